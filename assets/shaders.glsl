@@ -43,6 +43,51 @@ void main()
 }
 @end
 
+// Same as cubemap_fs for Radiance RGBE inputs, uploaded as RGBA8 texels. The shared exponent can't
+// be filtered by the sampler, so the four texels are decoded first and filtered here.
+@fs cubemap_rgbe_fs
+out vec4 fragColor;
+
+in vec3 localPos;
+
+uniform sampler2D tex;
+
+const vec2 invAtan = vec2(0.1591, 0.3183);
+vec2 SampleSphericalMap(vec3 v)
+{
+    vec2 uv = vec2(atan(v.z, v.x), asin(v.y));
+    uv *= invAtan;
+    uv += 0.5;
+    return uv;
+}
+
+// Same as stbi_loadf: rgb * 2^(e - 136), nothing for e = 0
+vec3 DecodeRGBE(ivec2 p)
+{
+    vec4 rgbe = floor(texelFetch(tex, p, 0) * 255.0 + 0.5);
+    return rgbe.a > 0.0 ? rgbe.rgb * exp2(rgbe.a - 136.0) : vec3(0.0);
+}
+
+void main()
+{
+    vec2 uv    = SampleSphericalMap(normalize(localPos));
+    ivec2 size = textureSize(tex, 0);
+    vec2 st    = uv * vec2(size) - 0.5;
+    vec2 f     = fract(st);
+
+    // Wraps around horizontally, like the repeating sampler of cubemap_fs
+    ivec2 p0 = ivec2(floor(st));
+    int x0   = (p0.x % size.x + size.x) % size.x;
+    int x1   = (x0 + 1) % size.x;
+    int y0   = clamp(p0.y, 0, size.y - 1);
+    int y1   = clamp(p0.y + 1, 0, size.y - 1);
+
+    vec3 top    = mix(DecodeRGBE(ivec2(x0, y0)), DecodeRGBE(ivec2(x1, y0)), f.x);
+    vec3 bottom = mix(DecodeRGBE(ivec2(x0, y1)), DecodeRGBE(ivec2(x1, y1)), f.x);
+    fragColor   = vec4(mix(top, bottom, f.y), 1.0);
+}
+@end
+
 ///////////////////////////////
 // Diffuse irradiance generation
 ///////////////////////////////
@@ -52,6 +97,11 @@ out vec4 fragColor;
 
 in vec3 localPos;
 
+uniform diffuse_irradiance_uniforms
+{
+    uniform float sample_delta;
+};
+
 uniform samplerCube env_map;
 
 #define PI 3.14159265359
@@ -66,11 +116,10 @@ vec3 CalculateIrradiance()
     vec3 right = normalize(cross(up, N));
     up         = normalize(cross(N, right));
 
-    float sampleDelta = 0.025;
     float nrSamples = 0.0;
-    for(float phi = 0.0; phi < 2.0 * PI; phi += sampleDelta)
+    for(float phi = 0.0; phi < 2.0 * PI; phi += sample_delta)
     {
-        for(float theta = 0.0; theta < 0.5 * PI; theta += sampleDelta)
+        for(float theta = 0.0; theta < 0.5 * PI; theta += sample_delta)
         {
             // spherical to cartesian (in tangent space)
             vec3 tangentSample = vec3(sin(theta) * cos(phi),  sin(theta) * sin(phi), cos(theta));
@@ -121,6 +170,8 @@ in vec3 v_localPos;
 uniform prefilter_uniforms
 {
     uniform float roughness;
+    uniform float sample_count;
+    uniform float source_resolution; // size of the environment cubemap faces
 };
 
 uniform samplerCube tex_cube;
@@ -189,7 +240,7 @@ void main()
     vec3 R = N;
     vec3 V = R;
 
-    const uint SAMPLE_COUNT = 2048u;// 1024u;
+    uint SAMPLE_COUNT = uint(sample_count);
     vec3 prefilteredColor = vec3(0.0);
     float totalWeight = 0.0;
 
@@ -209,9 +260,7 @@ void main()
             float HdotV = max(dot(H, V), 0.0);
             float pdf = D * NdotH / (4.0 * HdotV) + 0.0001;
 
-            // FIXE: This should be variable!!
-            float resolution = 2048.0; // resolution of source cubemap (per face)
-            float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
+            float saTexel  = 4.0 * PI / (6.0 * source_resolution * source_resolution);
             float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
 
             float mipLevel = roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel);
@@ -293,6 +342,11 @@ out vec4 fragColor;
 
 in vec2 v_texcoord;
 
+uniform brdf_lut_uniforms
+{
+    uniform float sample_count;
+};
+
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
 // http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
@@ -373,7 +427,7 @@ vec2 IntegrateBRDF(float NdotV, float roughness)
 
     vec3 N = vec3(0.0, 0.0, 1.0);
 
-    const uint SAMPLE_COUNT = 1024u;
+    uint SAMPLE_COUNT = uint(sample_count);
     for(uint i = 0u; i < SAMPLE_COUNT; ++i)
     {
         // generates a sample vector that's biased towards the
@@ -409,6 +463,7 @@ void main()
 @end
 
 @program pbr_shader             cubemap_vs   cubemap_fs
+@program pbr_shader_rgbe        cubemap_vs   cubemap_rgbe_fs
 @program pbr_diffuse_irradiance cubemap_vs   diffuse_irradiance_fs
 @program pbr_display            display_vs   display_fs
 @program pbr_brdf_lut           brdf_lut_vs  brdf_lut_fs
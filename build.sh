@@ -84,7 +84,17 @@ fi
 
 ${SOKOL_SDHC_CMD} --input assets/shaders.glsl --output src/shaders.glsl.h --slang glsl330
 
-./${GENIE_CMD} --file=premake.lua gmake
+GENIE_OPTIONS=""
+
+# EMBED_BRDF_LUT=1 ./build.sh bakes the BRDF LUT once at build time and embeds it in pbr-utils
+if [ "${EMBED_BRDF_LUT}" == "1" ]; then
+    ./${GENIE_CMD} --file=premake.lua gmake
+    (cd build && make brdf-lut-gen)
+    ./${BUILD_FOLDER}/brdf-lut-gen${PLATFORM_EXT} ${BUILD_FOLDER}/brdf_lut_embedded.h
+    GENIE_OPTIONS="--embed-brdf-lut"
+fi
+
+./${GENIE_CMD} ${GENIE_OPTIONS} --file=premake.lua gmake
 
 cd build
 make all
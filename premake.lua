@@ -47,6 +47,7 @@ function get_platform_config()
             links = function()
                 links {
                     "GL",
+                    "EGL",
                     "X11",
                     "Xi",
                     "Xcursor"
@@ -59,6 +60,11 @@ end
 
 local platform = get_platform_config()
 
+newoption {
+    trigger     = "embed-brdf-lut",
+    description = "Embed the BRDF LUT generated by brdf-lut-gen (build/brdf_lut_embedded.h) in pbr-utils"
+}
+
 
 solution "pbr-utils"
     language       ( "C++" )
@@ -79,13 +85,80 @@ solution "pbr-utils"
         defines { "NDEBUG" }
         flags   { "Optimize" }
 
+-- Generation core (image loading, CPU engines, conversion and writers), see src/pbr_utils.h
+project "pbrutils"
+    objdir      ( path.join(PATH_BUILD, "pbrutils") )
+    kind        ( "StaticLib" )
+    targetname  ( "pbrutils" )
+    targetdir   ( PATH_BUILD )
+    files       { path.join(PATH_SRC, "**.cpp"), path.join(PATH_SRC, "**.c") }
+    excludes    { path.join(PATH_SRC, "main.cpp") }
+    includedirs { PATH_SRC, PATH_BUILD }
+
 project "pbr-utils"
     objdir      ( PATH_BUILD )
     kind        ( "ConsoleApp" )
     targetname  ( "pbr-utils" )
     targetdir   ( PATH_BUILD )
-    files       { path.join(PATH_SRC, "**.cpp") }
+    files       { path.join(PATH_SRC, "main.cpp") }
     includedirs { PATH_SRC, PATH_BUILD }
+    links       { "pbrutils" }
+
+    if _OPTIONS["embed-brdf-lut"] then
+        defines { "PBR_UTILS_EMBED_BRDF_LUT" }
+    end
 
     platform.linkoptions()
     platform.links()
+
+-- Generates build/brdf_lut_embedded.h, see build.sh
+project "brdf-lut-gen"
+    objdir      ( path.join(PATH_BUILD, "brdf-lut-gen") )
+    kind        ( "ConsoleApp" )
+    targetname  ( "brdf-lut-gen" )
+    targetdir   ( PATH_BUILD )
+    files       { path.join(PATH_ROOT, "tools", "brdf_lut_gen.cpp") }
+    includedirs { PATH_SRC }
+    links       { "pbrutils" }
+
+    platform.linkoptions()
+
+-- Benchmarks the CPU engines on procedural environments, results are written as JSON
+project "pbr-bench"
+    objdir      ( path.join(PATH_BUILD, "pbr-bench") )
+    kind        ( "ConsoleApp" )
+    targetname  ( "pbr-bench" )
+    targetdir   ( PATH_BUILD )
+    files       { path.join(PATH_ROOT, "tools", "pbr_bench.cpp") }
+    includedirs { PATH_SRC }
+    links       { "pbrutils" }
+
+    if os.get() == "windows" then
+        links { "psapi" }
+    end
+
+    platform.linkoptions()
+
+-- Checks the SIMD half float conversions against the scalar ones, exits non-zero on a mismatch
+project "half-float-test"
+    objdir      ( path.join(PATH_BUILD, "half-float-test") )
+    kind        ( "ConsoleApp" )
+    targetname  ( "half-float-test" )
+    targetdir   ( PATH_BUILD )
+    files       { path.join(PATH_ROOT, "tools", "half_float_test.cpp") }
+    includedirs { PATH_SRC }
+    links       { "pbrutils" }
+
+    platform.linkoptions()
+
+-- Checks the parallel and streamed RGBE decodes against the sequential one, exits non-zero on a mismatch
+project "radiance-hdr-test"
+    objdir      ( path.join(PATH_BUILD, "radiance-hdr-test") )
+    kind        ( "ConsoleApp" )
+    targetname  ( "radiance-hdr-test" )
+    targetdir   ( PATH_BUILD )
+    files       { path.join(PATH_ROOT, "tools", "radiance_hdr_test.cpp") }
+    includedirs { PATH_SRC }
+    links       { "pbrutils" }
+
+    platform.linkoptions()
@@ -0,0 +1,126 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "area_filter.h"
+
+// Weights of one axis, output texel i covers [i * scale, (i+1) * scale) of the input
+typedef struct
+{
+    int*   m_First;
+    int*   m_Count;
+    float* m_Weights; // m_MaxTaps per output texel
+    int    m_MaxTaps;
+} filter_axis;
+
+struct area_filter
+{
+    filter_axis m_X;
+    filter_axis m_Y;
+    int         m_WidthOut;
+};
+
+static void filter_axis_create(filter_axis* axis, int size, int size_out)
+{
+    double scale    = (double) size / (double) size_out;
+    axis->m_MaxTaps = (int) ceil(scale) + 1;
+    axis->m_First   = (int*) malloc(size_out * sizeof(int));
+    axis->m_Count   = (int*) malloc(size_out * sizeof(int));
+    axis->m_Weights = (float*) calloc((size_t) size_out * axis->m_MaxTaps, sizeof(float));
+
+    for (int i = 0; i < size_out; ++i)
+    {
+        double begin = i * scale;
+        double end   = i == size_out - 1 ? (double) size : (i + 1) * scale;
+        int first    = (int) floor(begin);
+        int last     = (int) ceil(end) - 1;
+        if (last >= size)
+        {
+            last = size - 1;
+        }
+
+        axis->m_First[i] = first;
+        axis->m_Count[i] = last - first + 1;
+
+        float* weights = axis->m_Weights + (size_t) i * axis->m_MaxTaps;
+        for (int j = first; j <= last; ++j)
+        {
+            double covered     = fmin((double) (j + 1), end) - fmax((double) j, begin);
+            weights[j - first] = (float) (covered / (end - begin));
+        }
+    }
+}
+
+static void filter_axis_destroy(filter_axis* axis)
+{
+    free(axis->m_First);
+    free(axis->m_Count);
+    free(axis->m_Weights);
+}
+
+area_filter* area_filter_create(int width, int height, int width_out, int height_out)
+{
+    area_filter* filter = (area_filter*) malloc(sizeof(area_filter));
+    filter_axis_create(&filter->m_X, width, width_out);
+    filter_axis_create(&filter->m_Y, height, height_out);
+    filter->m_WidthOut = width_out;
+    return filter;
+}
+
+void area_filter_destroy(area_filter* filter)
+{
+    if (filter)
+    {
+        filter_axis_destroy(&filter->m_X);
+        filter_axis_destroy(&filter->m_Y);
+        free(filter);
+    }
+}
+
+void area_filter_input_rows(const area_filter* filter, int y, int* row_begin_out, int* row_count_out)
+{
+    *row_begin_out = filter->m_Y.m_First[y];
+    *row_count_out = filter->m_Y.m_Count[y];
+}
+
+int area_filter_max_input_rows(const area_filter* filter)
+{
+    return filter->m_Y.m_MaxTaps;
+}
+
+static void filter_row_horizontal(const filter_axis* axis, int width_out, const float* row, float* rgba_out)
+{
+    for (int x = 0; x < width_out; ++x)
+    {
+        const float* in      = row + (size_t) axis->m_First[x] * 4;
+        const float* weights = axis->m_Weights + (size_t) x * axis->m_MaxTaps;
+        float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+        for (int i = 0; i < axis->m_Count[x]; ++i)
+        {
+            r += in[i * 4 + 0] * weights[i];
+            g += in[i * 4 + 1] * weights[i];
+            b += in[i * 4 + 2] * weights[i];
+            a += in[i * 4 + 3] * weights[i];
+        }
+        rgba_out[x * 4 + 0] = r;
+        rgba_out[x * 4 + 1] = g;
+        rgba_out[x * 4 + 2] = b;
+        rgba_out[x * 4 + 3] = a;
+    }
+}
+
+void area_filter_row(const area_filter* filter, int y, const float* const* rows, float* scratch, float* rgba_out)
+{
+    int width_out        = filter->m_WidthOut;
+    const float* weights = filter->m_Y.m_Weights + (size_t) y * filter->m_Y.m_MaxTaps;
+    memset(rgba_out, 0, (size_t) width_out * 4 * sizeof(float));
+
+    for (int i = 0; i < filter->m_Y.m_Count[y]; ++i)
+    {
+        filter_row_horizontal(&filter->m_X, width_out, rows[i], scratch);
+        for (int x = 0; x < width_out * 4; ++x)
+        {
+            rgba_out[x] += scratch[x] * weights[i];
+        }
+    }
+}
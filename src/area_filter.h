@@ -0,0 +1,19 @@
+#pragma once
+
+// Area (box) downsampling, every output texel is the average of the input texels it covers, weighted
+// by how much of each one it covers. Separable: each input row is filtered horizontally and the
+// results are weighted into the output row, so only the rows of one output row are needed at a time.
+typedef struct area_filter area_filter;
+
+// Output sizes must be between 1 and the input size
+area_filter* area_filter_create(int width, int height, int width_out, int height_out);
+void         area_filter_destroy(area_filter* filter);
+
+// Range of input rows output row y covers
+void         area_filter_input_rows(const area_filter* filter, int y, int* row_begin_out, int* row_count_out);
+
+// Largest row_count of area_filter_input_rows
+int          area_filter_max_input_rows(const area_filter* filter);
+
+// Filters output row y, rows[i] is input row row_begin + i as RGBA32F. scratch must hold width_out * 4 floats.
+void         area_filter_row(const area_filter* filter, int y, const float* const* rows, float* scratch, float* rgba_out);
@@ -0,0 +1,107 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "brdf_lut.h"
+#include "job_system.h"
+
+static const float BRDF_LUT_PI = 3.14159265359f;
+
+typedef struct
+{
+    int    m_Size;
+    int    m_SampleCount;
+    float* m_Pixels;
+} brdf_lut_context;
+
+static float radical_inverse_vdc(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return (float) bits * 2.3283064365386963e-10f;
+}
+
+static float geometry_schlick_ggx(float n_dot_v, float roughness)
+{
+    float k = (roughness * roughness) / 2.0f;
+    return n_dot_v / (n_dot_v * (1.0f - k) + k);
+}
+
+// One job per row, every texel in a row shares the roughness and therefore the H samples
+static void brdf_lut_row_job(void* context, uint32_t job_index)
+{
+    brdf_lut_context* ctx = (brdf_lut_context*) context;
+    int size              = ctx->m_Size;
+    int sample_count      = ctx->m_SampleCount;
+    float roughness       = ((float) job_index + 0.5f) / (float) size;
+    float a               = roughness * roughness;
+
+    float* h = (float*) malloc(sample_count * 3 * sizeof(float));
+    for (int i = 0; i < sample_count; ++i)
+    {
+        float xi_x      = (float) i / (float) sample_count;
+        float xi_y      = radical_inverse_vdc((uint32_t) i);
+        float phi       = 2.0f * BRDF_LUT_PI * xi_x;
+        float cos_theta = sqrtf((1.0f - xi_y) / (1.0f + (a * a - 1.0f) * xi_y));
+        float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+
+        // N = (0,0,1) gives tangent = (0,-1,0) and bitangent = (1,0,0) in ImportanceSampleGGX
+        h[i * 3 + 0] = sinf(phi) * sin_theta;
+        h[i * 3 + 1] = -cosf(phi) * sin_theta;
+        h[i * 3 + 2] = cos_theta;
+    }
+
+    float* row = ctx->m_Pixels + (size_t) job_index * size * 4;
+
+    for (int x = 0; x < size; ++x)
+    {
+        float n_dot_v = ((float) x + 0.5f) / (float) size;
+        float v[3]    = { sqrtf(1.0f - n_dot_v * n_dot_v), 0.0f, n_dot_v };
+        float ggx_v   = geometry_schlick_ggx(n_dot_v, roughness);
+
+        float sum_a = 0.0f;
+        float sum_b = 0.0f;
+
+        for (int i = 0; i < sample_count; ++i)
+        {
+            const float* hi = h + i * 3;
+            float v_dot_h   = v[0] * hi[0] + v[2] * hi[2];
+
+            // L = normalize(2 * dot(V, H) * H - V), only z is needed
+            float l[3]  = { 2.0f * v_dot_h * hi[0] - v[0], 2.0f * v_dot_h * hi[1], 2.0f * v_dot_h * hi[2] - v[2] };
+            float l_len = sqrtf(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+            float n_dot_l = l[2] / l_len;
+
+            if (n_dot_l > 0.0f)
+            {
+                float n_dot_h = hi[2] > 0.0f ? hi[2] : 0.0f;
+                v_dot_h       = v_dot_h > 0.0f ? v_dot_h : 0.0f;
+
+                float g     = geometry_schlick_ggx(n_dot_l, roughness) * ggx_v;
+                float g_vis = (g * v_dot_h) / (n_dot_h * n_dot_v);
+                float fc    = powf(1.0f - v_dot_h, 5.0f);
+
+                sum_a += (1.0f - fc) * g_vis;
+                sum_b += fc * g_vis;
+            }
+        }
+
+        row[x * 4 + 0] = sum_a / (float) sample_count;
+        row[x * 4 + 1] = sum_b / (float) sample_count;
+        row[x * 4 + 2] = 0.0f;
+        row[x * 4 + 3] = 1.0f;
+    }
+
+    free(h);
+}
+
+void brdf_lut_integrate(job_system* jobs, int size, int sample_count, float* rgba_out)
+{
+    brdf_lut_context ctx;
+    ctx.m_Size        = size;
+    ctx.m_SampleCount = sample_count;
+    ctx.m_Pixels      = rgba_out;
+    job_system_run(jobs, brdf_lut_row_job, &ctx, size);
+}
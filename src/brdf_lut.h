@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct job_system job_system;
+
+// Bump when the integration changes so cached LUTs are invalidated
+static const int BRDF_LUT_VERSION = 1;
+
+// CPU implementation of brdf_lut_fs. Writes size*size RGBA32F texels (scale, bias, 0, 1),
+// rows are in GL readback order, i.e the first row is roughness = 0.5 / size.
+void brdf_lut_integrate(job_system* jobs, int size, int sample_count, float* rgba_out);
@@ -0,0 +1,226 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __has_include(<charconv>)
+    #include <charconv>
+#endif
+
+#include "buffer_writer.h"
+#include "output_file.h"
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    #define BUFFER_WRITER_HAS_TO_CHARS
+#endif
+
+static const uint32_t BUFFER_WRITER_CHUNK_SIZE = 64 * 1024;
+
+// Longest entry is a float like "-1.17549435e-38,"
+static const uint32_t BUFFER_WRITER_MAX_ENTRY_SIZE = 32;
+
+typedef struct
+{
+    char    m_Digits[256][4];
+    uint8_t m_Length[256];
+    char    m_DigitPairs[100][2];
+} digit_table;
+
+static digit_table make_digit_table()
+{
+    digit_table table;
+    for (int i = 0; i < 256; ++i)
+    {
+        table.m_Length[i] = (uint8_t) sprintf(table.m_Digits[i], "%d", i);
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        table.m_DigitPairs[i][0] = '0' + i / 10;
+        table.m_DigitPairs[i][1] = '0' + i % 10;
+    }
+    return table;
+}
+
+static const digit_table* get_digit_table()
+{
+    static const digit_table table = make_digit_table();
+    return &table;
+}
+
+typedef struct
+{
+    output_file* m_File;
+    char         m_Chunk[BUFFER_WRITER_CHUNK_SIZE];
+    uint32_t     m_ChunkSize;
+} chunk_writer;
+
+static void chunk_writer_flush(chunk_writer* writer)
+{
+    if (writer->m_ChunkSize > 0)
+    {
+        output_file_write(writer->m_File, writer->m_Chunk, writer->m_ChunkSize);
+    }
+    writer->m_ChunkSize = 0;
+}
+
+static void chunk_writer_write(chunk_writer* writer, const char* str, uint32_t str_len)
+{
+    if (writer->m_ChunkSize + str_len > BUFFER_WRITER_CHUNK_SIZE)
+    {
+        chunk_writer_flush(writer);
+    }
+    memcpy(writer->m_Chunk + writer->m_ChunkSize, str, str_len);
+    writer->m_ChunkSize += str_len;
+}
+
+// Makes room for one more entry and returns where to write it
+static inline char* chunk_writer_reserve(chunk_writer* writer)
+{
+    if (writer->m_ChunkSize + BUFFER_WRITER_MAX_ENTRY_SIZE > BUFFER_WRITER_CHUNK_SIZE)
+    {
+        chunk_writer_flush(writer);
+    }
+    return writer->m_Chunk + writer->m_ChunkSize;
+}
+
+static inline uint32_t format_uint8(const digit_table* table, uint8_t value, char* write_ptr)
+{
+    // Always copy the full table entry, the length decides how much of it is kept
+    memcpy(write_ptr, table->m_Digits[value], 4);
+    return table->m_Length[value];
+}
+
+static inline uint32_t format_uint16(const digit_table* table, uint16_t value, char* write_ptr)
+{
+    if (value < 256)
+    {
+        return format_uint8(table, (uint8_t) value, write_ptr);
+    }
+
+    // Two digits at a time, right to left
+    char digits[5];
+    char* digits_end = digits + sizeof(digits);
+    char* p          = digits_end;
+    uint32_t v       = value;
+
+    while (v >= 100)
+    {
+        p -= 2;
+        memcpy(p, table->m_DigitPairs[v % 100], 2);
+        v /= 100;
+    }
+
+    if (v >= 10)
+    {
+        p -= 2;
+        memcpy(p, table->m_DigitPairs[v], 2);
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+
+    uint32_t length = digits_end - p;
+    memcpy(write_ptr, p, length);
+    return length;
+}
+
+static inline uint32_t format_float32(float value, char* write_ptr)
+{
+    // JSON has no representation for these
+    if (isnan(value))
+    {
+        value = 0.0f;
+    }
+    else if (isinf(value))
+    {
+        value = value > 0.0f ? FLT_MAX : -FLT_MAX;
+    }
+
+#if defined(BUFFER_WRITER_HAS_TO_CHARS)
+    // Shortest representation that parses back to the same float
+    std::to_chars_result res = std::to_chars(write_ptr, write_ptr + BUFFER_WRITER_MAX_ENTRY_SIZE - 1, value);
+    return res.ptr - write_ptr;
+#else
+    // %.9g always round-trips, it's just not the shortest form
+    return sprintf(write_ptr, "%.9g", value);
+#endif
+}
+
+const char* buffer_format_to_str(int format)
+{
+    if (format == BUFFER_FORMAT_UINT16)
+    {
+        return "uint16";
+    }
+    else if (format == BUFFER_FORMAT_FLOAT32)
+    {
+        return "float32";
+    }
+    return "uint8";
+}
+
+int buffer_format_stream_count(int format)
+{
+    return format == BUFFER_FORMAT_UINT8 ? 1 : 4;
+}
+
+bool write_buffer_to_file(const char* output_path, int format, const void* data, uint32_t data_size)
+{
+    const char* data_header_template =
+        "[\n"
+        "    {\n"
+        "        \"name\": \"data\",\n"
+        "        \"type\": \"%s\",\n"
+        "        \"count\": %d,\n"
+        "        \"data\": [";
+
+    const char* data_footer =
+        "]\n"
+        "    }\n"
+        "]\n";
+
+    char data_header[256];
+    int data_header_size = sprintf(data_header, data_header_template, buffer_format_to_str(format), buffer_format_stream_count(format));
+
+    chunk_writer* writer = (chunk_writer*) malloc(sizeof(chunk_writer));
+    writer->m_File       = output_file_open(output_path);
+    writer->m_ChunkSize  = 0;
+
+    const digit_table* table = get_digit_table();
+
+    chunk_writer_write(writer, data_header, data_header_size);
+
+    uint32_t value_size  = format == BUFFER_FORMAT_UINT8 ? 1 : (format == BUFFER_FORMAT_UINT16 ? 2 : 4);
+    uint32_t value_count = data_size / value_size;
+
+    for (uint32_t i = 0; i < value_count; ++i)
+    {
+        char* write_ptr = chunk_writer_reserve(writer);
+        uint32_t length;
+
+        if (format == BUFFER_FORMAT_UINT8)
+        {
+            length = format_uint8(table, ((const uint8_t*) data)[i], write_ptr);
+        }
+        else if (format == BUFFER_FORMAT_UINT16)
+        {
+            length = format_uint16(table, ((const uint16_t*) data)[i], write_ptr);
+        }
+        else
+        {
+            length = format_float32(((const float*) data)[i], write_ptr);
+        }
+
+        write_ptr[length]    = ',';
+        writer->m_ChunkSize += length + (i + 1 < value_count ? 1 : 0);
+    }
+
+    chunk_writer_write(writer, data_footer, strlen(data_footer));
+    chunk_writer_flush(writer);
+
+    bool result = output_file_close(writer->m_File, 0);
+    free(writer);
+    return result;
+}
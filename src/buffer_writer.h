@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Stream types of the "data" stream in the written .buffer files
+static const int BUFFER_FORMAT_UINT8   = 0; // raw bytes, count 1 (float16 texels are split into bytes)
+static const int BUFFER_FORMAT_UINT16  = 1; // one number per float16 value, count 4 (RGBA)
+static const int BUFFER_FORMAT_FLOAT32 = 2; // one number per float32 value, count 4 (RGBA)
+
+const char* buffer_format_to_str(int format);
+int         buffer_format_stream_count(int format);
+
+// Writes data as a Defold .buffer resource (JSON) with a single "data" stream. data_size is in bytes,
+// data is read as uint8, uint16 or float values depending on the format.
+// The JSON is formatted straight into a fixed size chunk that is flushed as it fills up,
+// so memory use doesn't depend on the payload size. The file is only replaced if the contents change (see output_file.h).
+bool write_buffer_to_file(const char* output_path, int format, const void* data, uint32_t data_size);
@@ -0,0 +1,437 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cubemap.h"
+#include "job_system.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    #include <immintrin.h>
+    #define CUBEMAP_SIMD_X86
+#endif
+
+static const float CUBEMAP_PI = 3.14159265359f;
+
+void cubemap_texel_direction(int side, int x, int y, int size, float* dir_out)
+{
+    // GL cubemap face coordinates, rows are flipped on readback so the first output row is t = 1
+    float sc = 2.0f * ((float) x + 0.5f) / (float) size - 1.0f;
+    float tc = 1.0f - 2.0f * ((float) y + 0.5f) / (float) size;
+
+    switch(side)
+    {
+        case 0: dir_out[0] =  1.0f; dir_out[1] = -tc;   dir_out[2] = -sc;   break; // +X
+        case 1: dir_out[0] = -1.0f; dir_out[1] = -tc;   dir_out[2] =  sc;   break; // -X
+        case 2: dir_out[0] =  sc;   dir_out[1] = -1.0f; dir_out[2] = -tc;   break; // -Y
+        case 3: dir_out[0] =  sc;   dir_out[1] =  1.0f; dir_out[2] =  tc;   break; // +Y
+        case 4: dir_out[0] =  sc;   dir_out[1] = -tc;   dir_out[2] =  1.0f; break; // +Z
+        case 5: dir_out[0] = -sc;   dir_out[1] = -tc;   dir_out[2] = -1.0f; break; // -Z
+    }
+}
+
+void equirect_direction_to_uv(const float* dir, float* u_out, float* v_out)
+{
+    float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    float y   = fminf(fmaxf(dir[1] / len, -1.0f), 1.0f);
+    *u_out    = atan2f(dir[2], dir[0]) * (0.5f / CUBEMAP_PI) + 0.5f;
+    *v_out    = asinf(y) * (1.0f / CUBEMAP_PI) + 0.5f;
+}
+
+void equirect_uv_to_direction(float u, float v, float* dir_out)
+{
+    float phi       = (u - 0.5f) * 2.0f * CUBEMAP_PI;
+    float theta     = (v - 0.5f) * CUBEMAP_PI;
+    float cos_theta = cosf(theta);
+    dir_out[0]      = cos_theta * cosf(phi);
+    dir_out[1]      = sinf(theta);
+    dir_out[2]      = cos_theta * sinf(phi);
+}
+
+void cubemap_create(cubemap* cube, int size)
+{
+    memset(cube, 0, sizeof(cubemap));
+    cube->m_Size        = size;
+    cube->m_MipmapCount = 1 + (int) floor(log2((double) size));
+
+    for (int mip = 0; mip < cube->m_MipmapCount; ++mip)
+    {
+        int mip_size = size >> mip;
+        for (int face = 0; face < CUBEMAP_SIDE_COUNT; ++face)
+        {
+            cube->m_Faces[mip][face] = (float*) malloc((size_t) mip_size * mip_size * 4 * sizeof(float));
+        }
+    }
+}
+
+void cubemap_destroy(cubemap* cube)
+{
+    for (int mip = 0; mip < cube->m_MipmapCount; ++mip)
+    {
+        for (int face = 0; face < CUBEMAP_SIDE_COUNT; ++face)
+        {
+            free(cube->m_Faces[mip][face]);
+        }
+    }
+    memset(cube, 0, sizeof(cubemap));
+}
+
+// GL cubemap face direction for texture coordinates (s,t)
+static void cubemap_face_direction(int face, float s, float t, float* dir_out)
+{
+    float sc = 2.0f * s - 1.0f;
+    float tc = 2.0f * t - 1.0f;
+
+    switch(face)
+    {
+        case 0: dir_out[0] =  1.0f; dir_out[1] = -tc;   dir_out[2] = -sc;   break;
+        case 1: dir_out[0] = -1.0f; dir_out[1] = -tc;   dir_out[2] =  sc;   break;
+        case 2: dir_out[0] =  sc;   dir_out[1] =  1.0f; dir_out[2] =  tc;   break;
+        case 3: dir_out[0] =  sc;   dir_out[1] = -1.0f; dir_out[2] = -tc;   break;
+        case 4: dir_out[0] =  sc;   dir_out[1] = -tc;   dir_out[2] =  1.0f; break;
+        case 5: dir_out[0] = -sc;   dir_out[1] = -tc;   dir_out[2] = -1.0f; break;
+        default:
+            assert(0 && "Invalid cubemap face");
+            dir_out[0] = dir_out[1] = dir_out[2] = 0.0f;
+            break;
+    }
+}
+
+typedef struct
+{
+    cubemap*     m_Cube;
+    const float* m_Pixels;
+    const float* m_RowWeights; // solid angle of an equirect texel in each row, relative to the equator
+    int          m_Width;
+    int          m_Height;
+    int          m_RowsPerJob;
+} equirect_job_context;
+
+#if defined(CUBEMAP_SIMD_X86)
+// Max error 2e-6 radians (under a hundredth of a texel at 16k), quadrant fixup like atan2f
+static inline __m128 atan2_sse(__m128 y, __m128 x)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 ax   = _mm_andnot_ps(sign, x);
+    __m128 ay   = _mm_andnot_ps(sign, y);
+    __m128 swap = _mm_cmpgt_ps(ay, ax);
+    __m128 a    = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+    __m128 s    = _mm_mul_ps(a, a);
+
+    __m128 p = _mm_set1_ps(-0.01172120f);
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.05265332f));
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(-0.11643287f));
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.19354346f));
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(-0.33262347f));
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.99997726f));
+    __m128 r = _mm_mul_ps(p, a);
+
+    __m128 r_swap = _mm_sub_ps(_mm_set1_ps(0.5f * CUBEMAP_PI), r);
+    r = _mm_or_ps(_mm_and_ps(swap, r_swap), _mm_andnot_ps(swap, r));
+    __m128 x_neg  = _mm_cmplt_ps(x, _mm_setzero_ps());
+    __m128 r_neg  = _mm_sub_ps(_mm_set1_ps(CUBEMAP_PI), r);
+    r = _mm_or_ps(_mm_and_ps(x_neg, r_neg), _mm_andnot_ps(x_neg, r));
+    return _mm_or_ps(r, _mm_and_ps(y, sign));
+}
+#endif
+
+// Equirect (u,v) of count directions, same mapping as equirect_direction_to_uv. The latitude
+// asin(y / |dir|) is computed as atan2(y, |dir.xz|) so both angles share one approximation.
+static void equirect_directions_to_uv(const float* x, const float* y, const float* z, int count, float* u_out, float* v_out)
+{
+    int i = 0;
+#if defined(CUBEMAP_SIMD_X86)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 dx  = _mm_loadu_ps(x + i);
+        __m128 dy  = _mm_loadu_ps(y + i);
+        __m128 dz  = _mm_loadu_ps(z + i);
+        __m128 dxz = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)));
+        __m128 u   = _mm_add_ps(_mm_mul_ps(atan2_sse(dz, dx), _mm_set1_ps(0.5f / CUBEMAP_PI)), _mm_set1_ps(0.5f));
+        __m128 v   = _mm_add_ps(_mm_mul_ps(atan2_sse(dy, dxz), _mm_set1_ps(1.0f / CUBEMAP_PI)), _mm_set1_ps(0.5f));
+        _mm_storeu_ps(u_out + i, u);
+        _mm_storeu_ps(v_out + i, v);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float dir[3] = { x[i], y[i], z[i] };
+        equirect_direction_to_uv(dir, u_out + i, v_out + i);
+    }
+}
+
+// Adds the columns [begin,end) of a row to sum, wrapping around at the end of the row
+static void equirect_add_columns(const float* row, int width, int begin, int end, float* sum)
+{
+    int column = (begin % width + width) % width;
+    int count  = end - begin;
+    while (count > 0)
+    {
+        int run        = count < width - column ? count : width - column;
+        const float* p = row + (size_t) column * 4;
+#if defined(CUBEMAP_SIMD_X86)
+        __m128 s = _mm_loadu_ps(sum);
+        for (int i = 0; i < run; ++i)
+        {
+            s = _mm_add_ps(s, _mm_loadu_ps(p + i * 4));
+        }
+        _mm_storeu_ps(sum, s);
+#else
+        for (int i = 0; i < run * 4; ++i)
+        {
+            sum[i & 3] += p[i];
+        }
+#endif
+        count -= run;
+        column = 0;
+    }
+}
+
+// Box filters [x0,x1) x [y0,y1) (in texels) of the equirect, every texel weighted by the part of it
+// that is covered and by its solid angle. Wraps around horizontally, the rows are clamped at the poles.
+static void equirect_filter_area(const equirect_job_context* ctx, float x0, float x1, float y0, float y1, float* rgba_out)
+{
+    int width  = ctx->m_Width;
+    int height = ctx->m_Height;
+
+    // At least one texel wide, where the box over the texels becomes bilinear filtering
+    if (x1 - x0 < 1.0f)
+    {
+        float center = 0.5f * (x0 + x1);
+        x0 = center - 0.5f;
+        x1 = center + 0.5f;
+    }
+    if (y1 - y0 < 1.0f)
+    {
+        float center = 0.5f * (y0 + y1);
+        y0 = center - 0.5f;
+        y1 = center + 0.5f;
+    }
+    x1 = x1 - x0 > (float) width ? x0 + (float) width : x1;
+    y0 = fminf(fmaxf(y0, 0.0f), (float) height - 0.5f);
+    y1 = fminf(fmaxf(y1, y0 + 0.5f), (float) height);
+
+    // Only the first and last column are partially covered
+    int first       = (int) floorf(x0);
+    int last        = (int) ceilf(x1) - 1;
+    int first_wrap  = (first % width + width) % width;
+    int last_wrap   = (last % width + width) % width;
+    float w_first   = first == last ? x1 - x0 : (float) (first + 1) - x0;
+    float w_last    = first == last ? 0.0f : x1 - (float) last;
+
+    float sum[4] = {};
+    float total  = 0.0f;
+    for (int j = (int) floorf(y0); j < (int) ceilf(y1); ++j)
+    {
+        float wy = (fminf((float) (j + 1), y1) - fmaxf((float) j, y0)) * ctx->m_RowWeights[j];
+        if (wy <= 0.0f)
+        {
+            continue;
+        }
+
+        const float* row = ctx->m_Pixels + (size_t) j * width * 4;
+        float row_sum[4] = {};
+        equirect_add_columns(row, width, first + 1, last, row_sum);
+        for (int c = 0; c < 4; ++c)
+        {
+            row_sum[c] += row[first_wrap * 4 + c] * w_first + row[last_wrap * 4 + c] * w_last;
+            sum[c]     += row_sum[c] * wy;
+        }
+        total += (x1 - x0) * wy;
+    }
+
+    for (int c = 0; c < 4; ++c)
+    {
+        rgba_out[c] = sum[c] / total;
+    }
+}
+
+// Each job maps the texel corners of its rows to the equirect, the footprint of a texel is the
+// (u,v) bounds of its four corners. Corners on a pole have no longitude, the texel they belong to
+// covers the longitudes of its other corners up to the pole.
+static void equirect_job(void* context, uint32_t job_index)
+{
+    equirect_job_context* ctx = (equirect_job_context*) context;
+    int size                  = ctx->m_Cube->m_Size;
+    int jobs_per_face         = (size + ctx->m_RowsPerJob - 1) / ctx->m_RowsPerJob;
+    int face                  = job_index / jobs_per_face;
+    int row_begin             = (job_index % jobs_per_face) * ctx->m_RowsPerJob;
+    int row_end               = row_begin + ctx->m_RowsPerJob < size ? row_begin + ctx->m_RowsPerJob : size;
+
+    float* face_data  = ctx->m_Cube->m_Faces[0][face];
+    int corners       = size + 1;
+    int corner_rows   = row_end - row_begin + 1;
+    float* corner_x   = (float*) malloc((size_t) corners * 3 * sizeof(float) + (size_t) corners * corner_rows * 2 * sizeof(float));
+    float* corner_y   = corner_x + corners;
+    float* corner_z   = corner_y + corners;
+    float* corner_u   = corner_z + corners;
+    float* corner_v   = corner_u + (size_t) corners * corner_rows;
+
+    for (int row = 0; row < corner_rows; ++row)
+    {
+        float t = (float) (row_begin + row) / size;
+        for (int k = 0; k < corners; ++k)
+        {
+            float dir[3];
+            cubemap_face_direction(face, (float) k / size, t, dir);
+            corner_x[k] = dir[0];
+            corner_y[k] = dir[1];
+            corner_z[k] = dir[2];
+        }
+
+        float* u = corner_u + (size_t) row * corners;
+        float* v = corner_v + (size_t) row * corners;
+        equirect_directions_to_uv(corner_x, corner_y, corner_z, corners, u, v);
+
+        for (int k = 0; k < corners; ++k)
+        {
+            if (corner_x[k] == 0.0f && corner_z[k] == 0.0f)
+            {
+                u[k] = -1.0f;
+            }
+        }
+    }
+
+    // Only the +Y and -Y faces contain a pole, at their center
+    bool pole_face = face == 2 || face == 3;
+    float pole_v   = face == 2 ? 1.0f : 0.0f;
+
+    for (int y = row_begin; y < row_end; ++y)
+    {
+        const float* u0 = corner_u + (size_t) (y - row_begin) * corners;
+        const float* v0 = corner_v + (size_t) (y - row_begin) * corners;
+        const float* u1 = u0 + corners;
+        const float* v1 = v0 + corners;
+
+        for (int x = 0; x < size; ++x)
+        {
+            float u[4] = { u0[x], u0[x + 1], u1[x], u1[x + 1] };
+            float v[4] = { v0[x], v0[x + 1], v1[x], v1[x + 1] };
+
+            float u_min = 2.0f, u_max = -1.0f, v_min = 1.0f, v_max = 0.0f;
+            for (int i = 0; i < 4; ++i)
+            {
+                v_min = fminf(v_min, v[i]);
+                v_max = fmaxf(v_max, v[i]);
+                if (u[i] >= 0.0f)
+                {
+                    u_min = fminf(u_min, u[i]);
+                    u_max = fmaxf(u_max, u[i]);
+                }
+            }
+
+            // Across the seam, the corners on the left side continue past u = 1
+            if (u_max - u_min > 0.5f)
+            {
+                float seam_min = 2.0f, seam_max = -1.0f;
+                for (int i = 0; i < 4; ++i)
+                {
+                    if (u[i] >= 0.0f)
+                    {
+                        float seam_u = u[i] < 0.5f ? u[i] + 1.0f : u[i];
+                        seam_min     = fminf(seam_min, seam_u);
+                        seam_max     = fmaxf(seam_max, seam_u);
+                    }
+                }
+                u_min = seam_min;
+                u_max = seam_max;
+            }
+
+            // An odd sized face has the pole inside its center texel, which covers every longitude
+            if (pole_face && 2 * x + 1 == size && 2 * y + 1 == size)
+            {
+                u_min = 0.0f;
+                u_max = 1.0f;
+                v_min = fminf(v_min, pole_v);
+                v_max = fmaxf(v_max, pole_v);
+            }
+
+            float* texel = face_data + ((size_t) y * size + x) * 4;
+            equirect_filter_area(ctx, u_min * ctx->m_Width, u_max * ctx->m_Width, v_min * ctx->m_Height, v_max * ctx->m_Height, texel);
+        }
+    }
+
+    free(corner_x);
+}
+
+void cubemap_from_equirect(job_system* jobs, cubemap* cube, const float* pixels, int width, int height)
+{
+    float* row_weights = (float*) malloc(height * sizeof(float));
+    for (int j = 0; j < height; ++j)
+    {
+        row_weights[j] = sinf(CUBEMAP_PI * ((float) j + 0.5f) / (float) height);
+    }
+
+    equirect_job_context ctx;
+    ctx.m_Cube       = cube;
+    ctx.m_Pixels     = pixels;
+    ctx.m_RowWeights = row_weights;
+    ctx.m_Width      = width;
+    ctx.m_Height     = height;
+    ctx.m_RowsPerJob = 16;
+
+    int jobs_per_face = (cube->m_Size + ctx.m_RowsPerJob - 1) / ctx.m_RowsPerJob;
+    job_system_run(jobs, equirect_job, &ctx, jobs_per_face * CUBEMAP_SIDE_COUNT);
+
+    free(row_weights);
+}
+
+typedef struct
+{
+    cubemap* m_Cube;
+    int      m_Mip;
+} mipmap_job_context;
+
+static void mipmap_job(void* context, uint32_t job_index)
+{
+    mipmap_job_context* ctx = (mipmap_job_context*) context;
+    int dst_size            = ctx->m_Cube->m_Size >> ctx->m_Mip;
+    int src_size            = dst_size * 2;
+    const float* src        = ctx->m_Cube->m_Faces[ctx->m_Mip - 1][job_index];
+    float* dst              = ctx->m_Cube->m_Faces[ctx->m_Mip][job_index];
+
+    for (int y = 0; y < dst_size; ++y)
+    {
+        const float* row0 = src + (2 * y) * src_size * 4;
+        const float* row1 = row0 + src_size * 4;
+
+        for (int x = 0; x < dst_size; ++x)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                dst[(y * dst_size + x) * 4 + c] = 0.25f * (row0[(2 * x) * 4 + c] + row0[(2 * x + 1) * 4 + c] + row1[(2 * x) * 4 + c] + row1[(2 * x + 1) * 4 + c]);
+            }
+        }
+    }
+}
+
+void cubemap_generate_mipmaps(job_system* jobs, cubemap* cube)
+{
+    for (int mip = 1; mip < cube->m_MipmapCount; ++mip)
+    {
+        mipmap_job_context ctx = { cube, mip };
+        job_system_run(jobs, mipmap_job, &ctx, CUBEMAP_SIDE_COUNT);
+    }
+}
+
+void cubemap_sample_lod(const cubemap* cube, const float* dir, float lod, float* rgba_out)
+{
+    float s, t;
+    int face = cubemap_direction_to_face(dir[0], dir[1], dir[2], &s, &t);
+
+    float max_lod = (float) (cube->m_MipmapCount - 1);
+    lod           = lod < 0.0f ? 0.0f : (lod > max_lod ? max_lod : lod);
+
+    int   mip0 = (int) lod;
+    int   mip1 = mip0 + 1 < cube->m_MipmapCount ? mip0 + 1 : mip0;
+    float w    = lod - mip0;
+
+    float c0[4], c1[4];
+    cubemap_fetch_bilinear(cube, mip0, face, s, t, c0);
+    cubemap_fetch_bilinear(cube, mip1, face, s, t, c1);
+
+    for (int c = 0; c < 4; ++c)
+    {
+        rgba_out[c] = c0[c] + (c1[c] - c0[c]) * w;
+    }
+}
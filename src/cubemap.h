@@ -0,0 +1,117 @@
+#pragma once
+
+// Sides are in the output (Defold) order used by the buffer writers:
+// +X, -X, -Y, +Y, +Z, -Z. Rows are in output order, i.e top row first.
+enum
+{
+    CUBEMAP_SIDE_COUNT = 6
+};
+
+// Returns the (unnormalized) direction through the center of texel (x,y) of a cubemap side,
+// using the same orientation as the GPU passes after readback.
+void cubemap_texel_direction(int side, int x, int y, int size, float* dir_out);
+
+// Maps a direction to (u,v) in an equirectangular image, same as SampleSphericalMap in cubemap_fs
+// (v = 0 is the first row in memory).
+void equirect_direction_to_uv(const float* dir, float* u_out, float* v_out);
+
+// Inverse of equirect_direction_to_uv, returns a unit direction
+void equirect_uv_to_direction(float u, float v, float* dir_out);
+
+typedef struct job_system job_system;
+
+enum
+{
+    CUBEMAP_MAX_MIPMAPS = 16
+};
+
+// CPU side cubemap with a full mip chain. Unlike the output layout above, faces are stored in GL order
+// (+X, -X, +Y, -Y, +Z, -Z) with GL texture coordinates, i.e the first row in memory is t = 0.
+typedef struct
+{
+    int    m_Size;
+    int    m_MipmapCount;
+    float* m_Faces[CUBEMAP_MAX_MIPMAPS][CUBEMAP_SIDE_COUNT]; // RGBA32F
+} cubemap;
+
+void cubemap_create(cubemap* cube, int size);
+void cubemap_destroy(cubemap* cube);
+
+// Resamples an RGBA32F equirectangular image into mip 0 with the same orientation as cubemap_fs. Every texel
+// is the solid angle weighted average of the equirect area its footprint on the sphere covers, at least one
+// texel wide so that it filters like cubemap_fs (bilinear) where the input is smaller than the cube and doesn't
+// alias where it is larger. Faces x row blocks run on the job system, directions are mapped with SSE when available.
+void cubemap_from_equirect(job_system* jobs, cubemap* cube, const float* pixels, int width, int height);
+
+// 2x2 box filter down the mip chain, like glGenerateMipmap
+void cubemap_generate_mipmaps(job_system* jobs, cubemap* cube);
+
+// Trilinear lookup, rgba_out receives 4 floats
+void cubemap_sample_lod(const cubemap* cube, const float* dir, float lod, float* rgba_out);
+
+// Picks the GL face for a direction and returns its (s,t) texture coordinates in [0,1]
+static inline int cubemap_direction_to_face(float x, float y, float z, float* s_out, float* t_out)
+{
+    float ax = x < 0.0f ? -x : x;
+    float ay = y < 0.0f ? -y : y;
+    float az = z < 0.0f ? -z : z;
+    float sc, tc, ma;
+    int face;
+
+    if (ax >= ay && ax >= az)
+    {
+        face = x >= 0.0f ? 0 : 1;
+        sc   = x >= 0.0f ? -z : z;
+        tc   = -y;
+        ma   = ax;
+    }
+    else if (ay >= az)
+    {
+        face = y >= 0.0f ? 2 : 3;
+        sc   = x;
+        tc   = y >= 0.0f ? z : -z;
+        ma   = ay;
+    }
+    else
+    {
+        face = z >= 0.0f ? 4 : 5;
+        sc   = z >= 0.0f ? x : -x;
+        tc   = -y;
+        ma   = az;
+    }
+
+    *s_out = 0.5f * (sc / ma + 1.0f);
+    *t_out = 0.5f * (tc / ma + 1.0f);
+    return face;
+}
+
+// Bilinear lookup in a single face, clamped to the face edges
+static inline void cubemap_fetch_bilinear(const cubemap* cube, int mip, int face, float s, float t, float* rgba_out)
+{
+    int size     = cube->m_Size >> mip;
+    const float* data = cube->m_Faces[mip][face];
+
+    float fx = s * size - 0.5f;
+    float fy = t * size - 0.5f;
+    fx = fx < 0.0f ? 0.0f : (fx > size - 1 ? size - 1 : fx);
+    fy = fy < 0.0f ? 0.0f : (fy > size - 1 ? size - 1 : fy);
+
+    int x0 = (int) fx;
+    int y0 = (int) fy;
+    int x1 = x0 + 1 < size ? x0 + 1 : x0;
+    int y1 = y0 + 1 < size ? y0 + 1 : y0;
+    float wx = fx - x0;
+    float wy = fy - y0;
+
+    const float* p00 = data + (y0 * size + x0) * 4;
+    const float* p10 = data + (y0 * size + x1) * 4;
+    const float* p01 = data + (y1 * size + x0) * 4;
+    const float* p11 = data + (y1 * size + x1) * 4;
+
+    for (int c = 0; c < 4; ++c)
+    {
+        float top    = p00[c] + (p10[c] - p00[c]) * wx;
+        float bottom = p01[c] + (p11[c] - p01[c]) * wx;
+        rgba_out[c]  = top + (bottom - top) * wy;
+    }
+}
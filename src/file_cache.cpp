@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+    #include <direct.h>
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "file_cache.h"
+#include "output_file.h"
+
+uint64_t hash_fnv1a_64(const void* data, uint32_t data_size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint64_t hash        = seed;
+    for (uint32_t i = 0; i < data_size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static const uint32_t HASH_FILE_CHUNK_SIZE = 1024 * 1024;
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc  = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// Reads little endian values, like every platform we build for
+uint64_t hash_xxh64(const void* data, uint32_t data_size, uint64_t seed)
+{
+    const uint8_t* p   = (const uint8_t*) data;
+    const uint8_t* end = p + data_size;
+    uint64_t hash;
+
+    if (data_size >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        const uint8_t* limit = end - 32;
+        do
+        {
+            v1 = xxh_round(v1, xxh_read64(p));      p += 8;
+            v2 = xxh_round(v2, xxh_read64(p));      p += 8;
+            v3 = xxh_round(v3, xxh_read64(p));      p += 8;
+            v4 = xxh_round(v4, xxh_read64(p));      p += 8;
+        } while (p <= limit);
+
+        hash = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+        hash = xxh_merge_round(hash, v1);
+        hash = xxh_merge_round(hash, v2);
+        hash = xxh_merge_round(hash, v3);
+        hash = xxh_merge_round(hash, v4);
+    }
+    else
+    {
+        hash = seed + XXH_PRIME64_5;
+    }
+
+    hash += (uint64_t) data_size;
+
+    while (p + 8 <= end)
+    {
+        hash ^= xxh_round(0, xxh_read64(p));
+        hash  = xxh_rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        hash ^= (uint64_t) xxh_read32(p) * XXH_PRIME64_1;
+        hash  = xxh_rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        hash ^= (*p) * XXH_PRIME64_5;
+        hash  = xxh_rotl64(hash, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool hash_file(const char* path, uint64_t seed, uint64_t* hash_out)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+
+    uint8_t* buffer = (uint8_t*) malloc(HASH_FILE_CHUNK_SIZE);
+    uint64_t hash   = seed;
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, HASH_FILE_CHUNK_SIZE, f)) > 0)
+    {
+        hash = hash_xxh64(buffer, (uint32_t) bytes_read, hash);
+    }
+
+    bool result = ferror(f) == 0;
+    free(buffer);
+    fclose(f);
+
+    *hash_out = hash;
+    return result;
+}
+
+bool file_cache_init(const char* cache_dir)
+{
+#if defined(_WIN32)
+    int res = _mkdir(cache_dir);
+#else
+    int res = mkdir(cache_dir, 0755);
+#endif
+    return res == 0 || errno == EEXIST;
+}
+
+void file_cache_entry_path(const char* cache_dir, const char* prefix, uint64_t key, const char* extension, char* path_out, uint32_t path_out_size)
+{
+    snprintf(path_out, path_out_size, "%s/%s_%016llx%s", cache_dir, prefix, (unsigned long long) key, extension);
+}
+
+bool file_cache_has_entry(const char* entry_path)
+{
+    struct stat st;
+    return stat(entry_path, &st) == 0;
+}
+
+static bool copy_file(const char* from_path, const char* to_path)
+{
+    FILE* f_in = fopen(from_path, "rb");
+    if (!f_in)
+    {
+        return false;
+    }
+
+    FILE* f_out = fopen(to_path, "wb");
+    if (!f_out)
+    {
+        fclose(f_in);
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t bytes_read;
+    bool result = true;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), f_in)) > 0)
+    {
+        if (fwrite(buffer, 1, bytes_read, f_out) != bytes_read)
+        {
+            result = false;
+            break;
+        }
+    }
+
+    fclose(f_in);
+    fclose(f_out);
+    return result;
+}
+
+bool file_cache_fetch(const char* entry_path, const char* output_path)
+{
+    // Outputs that are already up to date are left alone, so they keep their mtime
+    if (file_contents_equal(entry_path, output_path))
+    {
+        return true;
+    }
+
+    // Never write through an existing link into the cache
+    remove(output_path);
+
+#if !defined(_WIN32)
+    if (link(entry_path, output_path) == 0)
+    {
+        return true;
+    }
+#endif
+    return copy_file(entry_path, output_path);
+}
+
+bool file_cache_store(const char* entry_path, const char* source_path)
+{
+    char tmp_path[512 + 32];
+#if defined(_WIN32)
+    int tmp_path_length = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", entry_path, _getpid());
+#else
+    int tmp_path_length = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", entry_path, (int) getpid());
+#endif
+    // A truncated temp path could be the entry itself
+    if (tmp_path_length < 0 || tmp_path_length >= (int) sizeof(tmp_path))
+    {
+        return false;
+    }
+
+    if (!copy_file(source_path, tmp_path))
+    {
+        remove(tmp_path);
+        return false;
+    }
+
+#if defined(_WIN32)
+    // rename doesn't replace existing files on windows, another run may have stored it already
+    remove(entry_path);
+#endif
+    if (rename(tmp_path, entry_path) != 0)
+    {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
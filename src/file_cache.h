@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Small content-addressed file cache. Entries are plain files in a directory, named by
+// the caller from a hash of everything that affects the file contents.
+
+static const uint64_t FNV1A_64_SEED = 0xcbf29ce484222325ULL;
+
+uint64_t hash_fnv1a_64(const void* data, uint32_t data_size, uint64_t seed);
+
+// XXH64, a lot faster than FNV-1a for large inputs
+uint64_t hash_xxh64(const void* data, uint32_t data_size, uint64_t seed);
+
+// Hashes the contents of a file in chunks (not the same value as hashing it in one go)
+bool     hash_file(const char* path, uint64_t seed, uint64_t* hash_out);
+
+// Creates the cache directory if it doesn't exist
+bool file_cache_init(const char* cache_dir);
+
+// Fills path_out with <cache_dir>/<prefix>_<key as hex><extension>
+void file_cache_entry_path(const char* cache_dir, const char* prefix, uint64_t key, const char* extension, char* path_out, uint32_t path_out_size);
+
+bool file_cache_has_entry(const char* entry_path);
+
+// Hard-links the cache entry to output_path, or copies it when linking isn't possible. Nothing is done if output_path
+// already has the same contents.
+bool file_cache_fetch(const char* entry_path, const char* output_path);
+
+// Copies source_path into the cache. The entry is written to a temporary file first and
+// renamed into place, so concurrent runs never see a partial entry.
+bool file_cache_store(const char* entry_path, const char* source_path);
@@ -0,0 +1,163 @@
+#include <string.h>
+
+#include "half_float.h"
+
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__)) && defined(__GNUC__)
+    #include <immintrin.h>
+    #define HALF_FLOAT_SIMD_X86
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// From: https://stackoverflow.com/questions/1659440/32-bit-to-16-bit-floating-point-conversion
+typedef uint16_t ushort;
+typedef uint32_t uint;
+
+static uint as_uint(const float x) {
+    uint u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+static float as_float(const uint x) {
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+float half_to_float(const uint16_t x) { // IEEE-754 16-bit floating-point format (without infinity): 1-5-10, exp-15, +-131008.0, +-6.1035156E-5, +-5.9604645E-8, 3.311 digits
+    const uint e = (x&0x7C00)>>10; // exponent
+    const uint m = (x&0x03FF)<<13; // mantissa
+    const uint v = as_uint((float)m)>>23; // evil log2 bit hack to count leading zeros in denormalized format
+    return as_float((x&0x8000)<<16 | (e!=0)*((e+112)<<23|m) | ((e==0)&(m!=0))*((v-37)<<23|((m<<(150-v))&0x007FE000))); // sign : normalized : denormalized
+}
+uint16_t float_to_half(const float x) { // IEEE-754 16-bit floating-point format (without infinity): 1-5-10, exp-15, +-131008.0, +-6.1035156E-5, +-5.9604645E-8, 3.311 digits
+    const uint b = as_uint(x)+0x00001000; // round-to-nearest-even: add last bit after truncated mantissa
+    const uint e = (b&0x7F800000)>>23; // exponent
+    const uint m = b&0x007FFFFF; // mantissa; in line below: 0x007FF000 = 0x00800000-0x00001000 = decimal indicator flag - initial rounding
+    return (b&0x80000000)>>16 | (e>112)*((((e-112)<<10)&0x7C00)|m>>13) | ((e<113)&(e>101))*((((0x007FF000+m)>>(125-e))+1)>>1) | (e>143)*0x7FFF; // sign : normalized : denormalized : saturate
+}
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static void float32_to_float16_scalar(const float* floats_in, uint32_t num_floats_in, uint16_t* half_floats_out)
+{
+    for (uint32_t i = 0; i < num_floats_in; ++i)
+    {
+        half_floats_out[i] = float_to_half(floats_in[i]);
+    }
+}
+
+static void float16_to_float32_scalar(const uint16_t* half_floats_in, uint32_t num_half_floats_in, float* floats_out)
+{
+    for (uint32_t i = 0; i < num_half_floats_in; ++i)
+    {
+        floats_out[i] = half_to_float(half_floats_in[i]);
+    }
+}
+
+#if defined(HALF_FLOAT_SIMD_X86)
+// F16C rounds to nearest even and produces infinities, which the bit hack above doesn't,
+// so this is the same integer math as float_to_half eight lanes at a time.
+__attribute__((target("avx2")))
+static void float32_to_float16_avx2(const float* floats_in, uint32_t num_floats_in, uint16_t* half_floats_out)
+{
+    const __m256i c_112 = _mm256_set1_epi32(112);
+    const __m256i c_113 = _mm256_set1_epi32(113);
+    const __m256i c_101 = _mm256_set1_epi32(101);
+    const __m256i c_125 = _mm256_set1_epi32(125);
+    const __m256i c_143 = _mm256_set1_epi32(143);
+
+    uint32_t i = 0;
+    for (; i + 8 <= num_floats_in; i += 8)
+    {
+        __m256i b = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (floats_in + i)), _mm256_set1_epi32(0x00001000));
+        __m256i e = _mm256_and_si256(_mm256_srli_epi32(b, 23), _mm256_set1_epi32(0xFF));
+        __m256i m = _mm256_and_si256(b, _mm256_set1_epi32(0x007FFFFF));
+
+        __m256i sign = _mm256_srli_epi32(_mm256_and_si256(b, _mm256_set1_epi32((int) 0x80000000)), 16);
+
+        // (e>112)*((((e-112)<<10)&0x7C00)|m>>13)
+        __m256i normal = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(_mm256_sub_epi32(e, c_112), 10), _mm256_set1_epi32(0x7C00)), _mm256_srli_epi32(m, 13));
+        normal         = _mm256_and_si256(normal, _mm256_cmpgt_epi32(e, c_112));
+
+        // ((e<113)&(e>101))*((((0x007FF000+m)>>(125-e))+1)>>1), out of range shift counts give 0 and are masked anyway
+        __m256i denormal = _mm256_srlv_epi32(_mm256_add_epi32(m, _mm256_set1_epi32(0x007FF000)), _mm256_sub_epi32(c_125, e));
+        denormal         = _mm256_srli_epi32(_mm256_add_epi32(denormal, _mm256_set1_epi32(1)), 1);
+        denormal         = _mm256_and_si256(denormal, _mm256_and_si256(_mm256_cmpgt_epi32(c_113, e), _mm256_cmpgt_epi32(e, c_101)));
+
+        // (e>143)*0x7FFF
+        __m256i saturate = _mm256_and_si256(_mm256_cmpgt_epi32(e, c_143), _mm256_set1_epi32(0x7FFF));
+
+        __m256i result = _mm256_or_si256(_mm256_or_si256(sign, normal), _mm256_or_si256(denormal, saturate));
+
+        // Every lane fits in 16 bits, pack and move the two 64 bit halves together
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(result, result), 0x08);
+        _mm_storeu_si128((__m128i*) (half_floats_out + i), _mm256_castsi256_si128(packed));
+    }
+
+    float32_to_float16_scalar(floats_in + i, num_floats_in - i, half_floats_out + i);
+}
+
+// F16C matches half_to_float for everything but exponent 31, which the bit hack
+// treats as a regular exponent instead of inf/nan. Those lanes are patched up.
+__attribute__((target("avx2,f16c")))
+static void float16_to_float32_f16c(const uint16_t* half_floats_in, uint32_t num_half_floats_in, float* floats_out)
+{
+    const __m256i exponent_mask = _mm256_set1_epi32(0x7C00);
+
+    uint32_t i = 0;
+    for (; i + 8 <= num_half_floats_in; i += 8)
+    {
+        __m128i h   = _mm_loadu_si128((const __m128i*) (half_floats_in + i));
+        __m256 f    = _mm256_cvtph_ps(h);
+        __m256i h32 = _mm256_cvtepu16_epi32(h);
+
+        __m256i max_exponent = _mm256_cmpeq_epi32(_mm256_and_si256(h32, exponent_mask), exponent_mask);
+
+        // (x&0x8000)<<16 | (31+112)<<23 | (x&0x03FF)<<13
+        __m256i patched = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(h32, _mm256_set1_epi32(0x8000)), 16), _mm256_set1_epi32(143 << 23));
+        patched         = _mm256_or_si256(patched, _mm256_slli_epi32(_mm256_and_si256(h32, _mm256_set1_epi32(0x03FF)), 13));
+
+        f = _mm256_blendv_ps(f, _mm256_castsi256_ps(patched), _mm256_castsi256_ps(max_exponent));
+        _mm256_storeu_ps(floats_out + i, f);
+    }
+
+    float16_to_float32_scalar(half_floats_in + i, num_half_floats_in - i, floats_out + i);
+}
+#endif
+
+typedef void (*float32_to_float16_function)(const float*, uint32_t, uint16_t*);
+typedef void (*float16_to_float32_function)(const uint16_t*, uint32_t, float*);
+
+static float32_to_float16_function select_float32_to_float16()
+{
+#if defined(HALF_FLOAT_SIMD_X86)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return float32_to_float16_avx2;
+    }
+#endif
+    return float32_to_float16_scalar;
+}
+
+static float16_to_float32_function select_float16_to_float32()
+{
+#if defined(HALF_FLOAT_SIMD_X86)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+    {
+        return float16_to_float32_f16c;
+    }
+#endif
+    return float16_to_float32_scalar;
+}
+
+void float32_to_float16(const float* floats_in, uint32_t num_floats_in, uint16_t* half_floats_out)
+{
+    static const float32_to_float16_function function = select_float32_to_float16();
+    function(floats_in, num_floats_in, half_floats_out);
+}
+
+void float16_to_float32(const uint16_t* half_floats_in, uint32_t num_half_floats_in, float* floats_out)
+{
+    static const float16_to_float32_function function = select_float16_to_float32();
+    function(half_floats_in, num_half_floats_in, floats_out);
+}
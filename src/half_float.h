@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// IEEE-754 16-bit floating-point format (without infinity)
+float    half_to_float(const uint16_t x);
+uint16_t float_to_half(const float x);
+
+// Batch conversions, bit-identical to the scalar functions above.
+// Uses AVX2 (and F16C for float16 -> float32) when the CPU supports it, picked at runtime.
+void float32_to_float16(const float* floats_in, uint32_t num_floats_in, uint16_t* half_floats_out);
+void float16_to_float32(const uint16_t* half_floats_in, uint32_t num_half_floats_in, float* floats_out);
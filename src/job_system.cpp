@@ -0,0 +1,220 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "job_system.h"
+
+typedef struct
+{
+    job_function          m_Function;
+    void*                 m_Context;
+    std::atomic<uint32_t> m_Remaining;
+} job_batch;
+
+typedef struct
+{
+    job_batch* m_Batch;
+    uint32_t   m_Index;
+} job;
+
+typedef struct
+{
+    std::mutex      m_Mutex;
+    std::deque<job> m_Jobs;
+} job_queue;
+
+struct job_system
+{
+    job_queue*               m_Queues;
+    std::thread*             m_Threads;
+    uint32_t                 m_QueueCount;
+    uint32_t                 m_ThreadCount;
+
+    std::mutex               m_WakeMutex;
+    std::condition_variable  m_WakeCondition;
+    std::atomic<uint32_t>    m_Pending;
+    std::atomic<uint32_t>    m_NextQueue;
+    bool                     m_Shutdown;
+};
+
+static bool job_queue_pop_back(job_queue* queue, job* job_out)
+{
+    std::lock_guard<std::mutex> lock(queue->m_Mutex);
+    if (queue->m_Jobs.empty())
+    {
+        return false;
+    }
+    *job_out = queue->m_Jobs.back();
+    queue->m_Jobs.pop_back();
+    return true;
+}
+
+static bool job_queue_steal(job_queue* queue, job* job_out)
+{
+    std::lock_guard<std::mutex> lock(queue->m_Mutex);
+    if (queue->m_Jobs.empty())
+    {
+        return false;
+    }
+    *job_out = queue->m_Jobs.front();
+    queue->m_Jobs.pop_front();
+    return true;
+}
+
+static bool job_system_find_job(job_system* jobs, uint32_t own_queue, job* job_out)
+{
+    if (job_queue_pop_back(&jobs->m_Queues[own_queue], job_out))
+    {
+        return true;
+    }
+
+    for (uint32_t i = 1; i < jobs->m_QueueCount; ++i)
+    {
+        if (job_queue_steal(&jobs->m_Queues[(own_queue + i) % jobs->m_QueueCount], job_out))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void job_system_execute(job_system* jobs, job* j)
+{
+    jobs->m_Pending.fetch_sub(1);
+    j->m_Batch->m_Function(j->m_Batch->m_Context, j->m_Index);
+    j->m_Batch->m_Remaining.fetch_sub(1, std::memory_order_release);
+}
+
+static void job_system_worker(job_system* jobs, uint32_t queue_index)
+{
+    while (true)
+    {
+        job j;
+        if (job_system_find_job(jobs, queue_index, &j))
+        {
+            job_system_execute(jobs, &j);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(jobs->m_WakeMutex);
+        jobs->m_WakeCondition.wait(lock, [jobs] { return jobs->m_Shutdown || jobs->m_Pending.load() > 0; });
+
+        if (jobs->m_Shutdown)
+        {
+            return;
+        }
+    }
+}
+
+job_system* job_system_create(uint32_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::thread::hardware_concurrency();
+    }
+
+    if (thread_count == 0)
+    {
+        thread_count = 1;
+    }
+
+    job_system* jobs    = new job_system();
+    jobs->m_ThreadCount = thread_count;
+    // One queue per worker, plus one for the threads that submit work
+    jobs->m_QueueCount  = thread_count;
+    jobs->m_Queues      = new job_queue[jobs->m_QueueCount];
+    jobs->m_Threads     = new std::thread[thread_count - 1];
+    jobs->m_Pending     = 0;
+    jobs->m_NextQueue   = 0;
+    jobs->m_Shutdown    = false;
+
+    for (uint32_t i = 0; i < thread_count - 1; ++i)
+    {
+        jobs->m_Threads[i] = std::thread(job_system_worker, jobs, i + 1);
+    }
+
+    return jobs;
+}
+
+void job_system_destroy(job_system* jobs)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs->m_WakeMutex);
+        jobs->m_Shutdown = true;
+    }
+    jobs->m_WakeCondition.notify_all();
+
+    for (uint32_t i = 0; i < jobs->m_ThreadCount - 1; ++i)
+    {
+        jobs->m_Threads[i].join();
+    }
+
+    delete[] jobs->m_Threads;
+    delete[] jobs->m_Queues;
+    delete jobs;
+}
+
+uint32_t job_system_thread_count(const job_system* jobs)
+{
+    return jobs->m_ThreadCount;
+}
+
+void job_system_run(job_system* jobs, job_function function, void* context, uint32_t job_count)
+{
+    if (job_count == 0)
+    {
+        return;
+    }
+
+    job_batch batch;
+    batch.m_Function  = function;
+    batch.m_Context   = context;
+    batch.m_Remaining = job_count;
+
+    // Hand out contiguous ranges so neighbouring jobs (e.g adjacent tiles) tend to run on the same thread,
+    // starting at a rotating queue so concurrent batches spread out
+    uint32_t first_queue = jobs->m_NextQueue.fetch_add(1) % jobs->m_QueueCount;
+    uint32_t per_queue   = (job_count + jobs->m_QueueCount - 1) / jobs->m_QueueCount;
+
+    jobs->m_Pending.fetch_add(job_count);
+
+    for (uint32_t q = 0; q < jobs->m_QueueCount; ++q)
+    {
+        uint32_t begin = q * per_queue;
+        uint32_t end   = begin + per_queue < job_count ? begin + per_queue : job_count;
+        if (begin >= end)
+        {
+            break;
+        }
+
+        job_queue* queue = &jobs->m_Queues[(first_queue + q) % jobs->m_QueueCount];
+        std::lock_guard<std::mutex> lock(queue->m_Mutex);
+
+        // Owners pop from the back, so push in reverse to run each range front to back
+        for (uint32_t i = end; i > begin; --i)
+        {
+            queue->m_Jobs.push_back({ &batch, i - 1 });
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs->m_WakeMutex);
+    }
+    jobs->m_WakeCondition.notify_all();
+
+    // Help out until our batch is done, starting with the queue that got the first range
+    while (batch.m_Remaining.load(std::memory_order_acquire) > 0)
+    {
+        job j;
+        if (job_system_find_job(jobs, first_queue, &j))
+        {
+            job_system_execute(jobs, &j);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Small work-stealing thread pool. Every worker owns a deque of jobs, pops from its own
+// back and steals from the front of the other deques when it runs dry.
+typedef struct job_system job_system;
+
+typedef void (*job_function)(void* context, uint32_t job_index);
+
+// thread_count is the total number of threads including the calling thread, 0 means one per hardware thread
+job_system* job_system_create(uint32_t thread_count);
+void        job_system_destroy(job_system* jobs);
+uint32_t    job_system_thread_count(const job_system* jobs);
+
+// Runs function(context, i) for every i in [0, job_count) and blocks until all of them have finished.
+// The calling thread executes jobs too. Safe to call from several threads at the same time.
+void        job_system_run(job_system* jobs, job_function function, void* context, uint32_t job_count);
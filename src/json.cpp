@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+static const int JSON_MAX_DEPTH = 64;
+
+typedef struct
+{
+    const char* m_Cursor;
+    int         m_Depth;
+} json_parser;
+
+static bool json_parse_value(json_parser* parser, json_value* value);
+
+static void json_skip_whitespace(json_parser* parser)
+{
+    while (*parser->m_Cursor == ' ' || *parser->m_Cursor == '\t' || *parser->m_Cursor == '\n' || *parser->m_Cursor == '\r')
+    {
+        parser->m_Cursor++;
+    }
+}
+
+static bool json_match(json_parser* parser, const char* literal)
+{
+    size_t len = strlen(literal);
+    if (strncmp(parser->m_Cursor, literal, len) != 0)
+    {
+        return false;
+    }
+    parser->m_Cursor += len;
+    return true;
+}
+
+static int json_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool json_parse_hex4(json_parser* parser, uint32_t* code_out)
+{
+    uint32_t code = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        int digit = json_hex_digit(parser->m_Cursor[i]);
+        if (digit < 0)
+        {
+            return false;
+        }
+        code = code * 16 + digit;
+    }
+    parser->m_Cursor += 4;
+    *code_out = code;
+    return true;
+}
+
+static char* json_write_utf8(char* write_ptr, uint32_t code)
+{
+    if (code < 0x80)
+    {
+        *write_ptr++ = (char) code;
+    }
+    else if (code < 0x800)
+    {
+        *write_ptr++ = (char) (0xC0 | (code >> 6));
+        *write_ptr++ = (char) (0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        *write_ptr++ = (char) (0xE0 | (code >> 12));
+        *write_ptr++ = (char) (0x80 | ((code >> 6) & 0x3F));
+        *write_ptr++ = (char) (0x80 | (code & 0x3F));
+    }
+    else
+    {
+        *write_ptr++ = (char) (0xF0 | (code >> 18));
+        *write_ptr++ = (char) (0x80 | ((code >> 12) & 0x3F));
+        *write_ptr++ = (char) (0x80 | ((code >> 6) & 0x3F));
+        *write_ptr++ = (char) (0x80 | (code & 0x3F));
+    }
+    return write_ptr;
+}
+
+// Expects the cursor at the opening quote
+static char* json_parse_string(json_parser* parser)
+{
+    parser->m_Cursor++;
+
+    // Unescaping never makes the string longer, so the raw length is enough
+    const char* end = parser->m_Cursor;
+    while (*end && *end != '"')
+    {
+        end += (end[0] == '\\' && end[1]) ? 2 : 1;
+    }
+    if (*end != '"')
+    {
+        return 0;
+    }
+
+    char* str       = (char*) malloc(end - parser->m_Cursor + 1);
+    char* write_ptr = str;
+
+    while (parser->m_Cursor < end)
+    {
+        char c = *parser->m_Cursor++;
+        if ((unsigned char) c < 0x20)
+        {
+            free(str);
+            return 0;
+        }
+        else if (c != '\\')
+        {
+            *write_ptr++ = c;
+            continue;
+        }
+
+        c = *parser->m_Cursor++;
+        switch (c)
+        {
+            case '"':  *write_ptr++ = '"';  break;
+            case '\\': *write_ptr++ = '\\'; break;
+            case '/':  *write_ptr++ = '/';  break;
+            case 'b':  *write_ptr++ = '\b'; break;
+            case 'f':  *write_ptr++ = '\f'; break;
+            case 'n':  *write_ptr++ = '\n'; break;
+            case 'r':  *write_ptr++ = '\r'; break;
+            case 't':  *write_ptr++ = '\t'; break;
+            case 'u':
+            {
+                uint32_t code;
+                if (!json_parse_hex4(parser, &code))
+                {
+                    free(str);
+                    return 0;
+                }
+
+                // Surrogate pair
+                uint32_t low;
+                if (code >= 0xD800 && code <= 0xDBFF && parser->m_Cursor[0] == '\\' && parser->m_Cursor[1] == 'u')
+                {
+                    parser->m_Cursor += 2;
+                    if (!json_parse_hex4(parser, &low) || low < 0xDC00 || low > 0xDFFF)
+                    {
+                        free(str);
+                        return 0;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                write_ptr = json_write_utf8(write_ptr, code);
+            } break;
+            default:
+                free(str);
+                return 0;
+        }
+    }
+
+    *write_ptr = 0;
+    parser->m_Cursor = end + 1;
+    return str;
+}
+
+static bool json_parse_number(json_parser* parser, json_value* value)
+{
+    const char* start = parser->m_Cursor;
+    if (*start != '-' && (*start < '0' || *start > '9'))
+    {
+        return false;
+    }
+
+    char* end;
+    value->m_Type   = JSON_NUMBER;
+    value->m_Number = strtod(start, &end);
+    if (end == start)
+    {
+        return false;
+    }
+    parser->m_Cursor = end;
+    return true;
+}
+
+static void json_push_child(json_value* value, uint32_t* capacity)
+{
+    if (value->m_Count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 4;
+        value->m_Children = (json_value*) realloc(value->m_Children, *capacity * sizeof(json_value));
+        if (value->m_Type == JSON_OBJECT)
+        {
+            value->m_Keys = (char**) realloc(value->m_Keys, *capacity * sizeof(char*));
+        }
+    }
+    memset(&value->m_Children[value->m_Count], 0, sizeof(json_value));
+    if (value->m_Type == JSON_OBJECT)
+    {
+        value->m_Keys[value->m_Count] = 0;
+    }
+    value->m_Count++;
+}
+
+// Children are added before they are parsed, so a partially parsed container can always be freed
+static bool json_parse_container(json_parser* parser, json_value* value, char close)
+{
+    if (++parser->m_Depth > JSON_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    parser->m_Cursor++;
+    json_skip_whitespace(parser);
+
+    uint32_t capacity = 0;
+    if (*parser->m_Cursor == close)
+    {
+        parser->m_Cursor++;
+        parser->m_Depth--;
+        return true;
+    }
+
+    while (true)
+    {
+        json_push_child(value, &capacity);
+
+        if (value->m_Type == JSON_OBJECT)
+        {
+            json_skip_whitespace(parser);
+            if (*parser->m_Cursor != '"')
+            {
+                return false;
+            }
+
+            value->m_Keys[value->m_Count - 1] = json_parse_string(parser);
+            if (!value->m_Keys[value->m_Count - 1])
+            {
+                return false;
+            }
+
+            json_skip_whitespace(parser);
+            if (*parser->m_Cursor++ != ':')
+            {
+                return false;
+            }
+        }
+
+        if (!json_parse_value(parser, &value->m_Children[value->m_Count - 1]))
+        {
+            return false;
+        }
+
+        json_skip_whitespace(parser);
+        char c = *parser->m_Cursor++;
+        if (c == close)
+        {
+            break;
+        }
+        else if (c != ',')
+        {
+            return false;
+        }
+    }
+
+    parser->m_Depth--;
+    return true;
+}
+
+static bool json_parse_value(json_parser* parser, json_value* value)
+{
+    json_skip_whitespace(parser);
+
+    switch (*parser->m_Cursor)
+    {
+        case '{':
+            value->m_Type = JSON_OBJECT;
+            return json_parse_container(parser, value, '}');
+        case '[':
+            value->m_Type = JSON_ARRAY;
+            return json_parse_container(parser, value, ']');
+        case '"':
+            value->m_Type   = JSON_STRING;
+            value->m_String = json_parse_string(parser);
+            return value->m_String != 0;
+        case 't':
+            value->m_Type = JSON_BOOL;
+            value->m_Bool = true;
+            return json_match(parser, "true");
+        case 'f':
+            value->m_Type = JSON_BOOL;
+            value->m_Bool = false;
+            return json_match(parser, "false");
+        case 'n':
+            value->m_Type = JSON_NULL;
+            return json_match(parser, "null");
+        default:
+            return json_parse_number(parser, value);
+    }
+}
+
+static void json_free_children(json_value* value)
+{
+    for (uint32_t i = 0; i < value->m_Count; ++i)
+    {
+        json_free_children(&value->m_Children[i]);
+        if (value->m_Keys)
+        {
+            free(value->m_Keys[i]);
+        }
+    }
+    free(value->m_String);
+    free(value->m_Children);
+    free(value->m_Keys);
+}
+
+json_value* json_parse(const char* text)
+{
+    json_parser parser = { text, 0 };
+    json_value* value  = (json_value*) calloc(1, sizeof(json_value));
+
+    bool result = json_parse_value(&parser, value);
+    if (result)
+    {
+        json_skip_whitespace(&parser);
+        result = *parser.m_Cursor == 0;
+    }
+
+    if (!result)
+    {
+        json_free(value);
+        return 0;
+    }
+    return value;
+}
+
+void json_free(json_value* value)
+{
+    if (value)
+    {
+        json_free_children(value);
+        free(value);
+    }
+}
+
+const json_value* json_object_get(const json_value* object, const char* key)
+{
+    if (!object || object->m_Type != JSON_OBJECT)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < object->m_Count; ++i)
+    {
+        if (strcmp(object->m_Keys[i], key) == 0)
+        {
+            return &object->m_Children[i];
+        }
+    }
+    return 0;
+}
+
+uint32_t json_write_string(const char* str, char* buffer, uint32_t buffer_size)
+{
+    uint32_t len = 0;
+    buffer[len++] = '"';
+
+    for (const char* read_ptr = str; *read_ptr; ++read_ptr)
+    {
+        unsigned char c = (unsigned char) *read_ptr;
+        char escaped[8];
+        if (c == '"' || c == '\\')
+        {
+            snprintf(escaped, sizeof(escaped), "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        }
+        else
+        {
+            escaped[0] = (char) c;
+            escaped[1] = 0;
+        }
+
+        // Escapes are written whole, with room left for the closing quote and the terminator
+        uint32_t escaped_len = (uint32_t) strlen(escaped);
+        if (len + escaped_len + 2 > buffer_size)
+        {
+            // Don't leave a partial UTF-8 sequence behind, escapes are all ASCII
+            if ((c & 0xC0) == 0x80)
+            {
+                while (len > 1 && ((unsigned char) buffer[len - 1] & 0xC0) == 0x80)
+                {
+                    len--;
+                }
+                if (len > 1 && (unsigned char) buffer[len - 1] >= 0xC0)
+                {
+                    len--;
+                }
+            }
+            break;
+        }
+        memcpy(buffer + len, escaped, escaped_len);
+        len += escaped_len;
+    }
+
+    buffer[len++] = '"';
+    buffer[len]   = 0;
+    return len;
+}
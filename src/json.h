@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Minimal JSON reader for small messages (e.g the --serve protocol). The whole document is parsed
+// into a tree of values that is released with json_free.
+static const int JSON_NULL   = 0;
+static const int JSON_BOOL   = 1;
+static const int JSON_NUMBER = 2;
+static const int JSON_STRING = 3;
+static const int JSON_ARRAY  = 4;
+static const int JSON_OBJECT = 5;
+
+typedef struct json_value json_value;
+
+struct json_value
+{
+    int         m_Type;
+    bool        m_Bool;
+    double      m_Number;
+    char*       m_String;   // JSON_STRING, unescaped and null terminated
+    json_value* m_Children; // JSON_ARRAY and JSON_OBJECT
+    char**      m_Keys;     // JSON_OBJECT, one per child
+    uint32_t    m_Count;
+};
+
+// Returns 0 if the text isn't a single valid JSON value
+json_value*       json_parse(const char* text);
+void              json_free(json_value* value);
+
+// Returns 0 if the value isn't an object or doesn't have the key
+const json_value* json_object_get(const json_value* object, const char* key);
+
+// Writes str as a quoted JSON string (always null terminated, truncated to fit without splitting
+// escapes or UTF-8 sequences). buffer_size must be at least 3. Returns the length.
+uint32_t          json_write_string(const char* str, char* buffer, uint32_t buffer_size);
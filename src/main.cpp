@@ -1,24 +1,57 @@
+#include <ctype.h>
 
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <dirent.h>
 #include <errno.h>
+#include <signal.h>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
 
 #include "linmath.h"
 
+#include "area_filter.h"
+#include "brdf_lut.h"
+#include "buffer_writer.h"
+#include "cubemap.h"
+#include "file_cache.h"
+#include "half_float.h"
+#include "json.h"
+#include "output_file.h"
+#include "profiler.h"
+#include "pbr_utils.h"
+#include "radiance_hdr.h"
+#include "spherical_harmonics.h"
+#include "task_queue.h"
+
 #define SOKOL_GLCORE33
 #define SOKOL_IMPL
+#define SOKOL_NO_ENTRY
 #include "sokol_app.h"
 #include "sokol_gfx.h"
 #include "sokol_glue.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+// Headless generation creates its own GL context through EGL,
+// sokol_app is only used for the preview window
+#if defined(__linux__)
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+    #define PBR_UTILS_HEADLESS
+#endif
+
 #if defined(SOKOL_METAL)
     #include "shaders.metal.h"
 #elif defined(SOKOL_GLCORE33)
@@ -27,6 +60,11 @@
     #error "Unsupported platform"
 #endif
 
+// Generated at build time by brdf-lut-gen, see build.sh
+#if defined(PBR_UTILS_EMBED_BRDF_LUT)
+    #include "brdf_lut_embedded.h"
+#endif
+
 // Logging
 #define LOG_VERBOSE(...) if (g_app.m_Params.m_Verbose) printf("[VERBOSE]: "); printf(__VA_ARGS__);
 #define LOG_INFO(...)                                  printf("[INFO]: ");    printf(__VA_ARGS__);
@@ -38,6 +76,18 @@
     typedef void (WINAPI * PFN_GLGETTEXIMAGEPROC)    (GLenum, GLint, GLenum, GLenum, void*);
     typedef void (WINAPI * PFN_GLGENERATEMIPMAPPROC) (GLenum);
 
+    typedef struct __GLsync* GLsync;
+    typedef void*     (WINAPI * PFN_GLMAPBUFFERRANGEPROC) (GLenum, GLintptr, GLsizeiptr, GLbitfield);
+    typedef GLboolean (WINAPI * PFN_GLUNMAPBUFFERPROC)    (GLenum);
+    typedef GLsync    (WINAPI * PFN_GLFENCESYNCPROC)      (GLenum, GLbitfield);
+    typedef GLenum    (WINAPI * PFN_GLCLIENTWAITSYNCPROC) (GLsync, GLbitfield, GLuint64);
+    typedef void      (WINAPI * PFN_GLDELETESYNCPROC)     (GLsync);
+    typedef void      (WINAPI * PFN_GLGENQUERIESPROC)     (GLsizei, GLuint*);
+    typedef void      (WINAPI * PFN_GLDELETEQUERIESPROC)  (GLsizei, const GLuint*);
+    typedef void      (WINAPI * PFN_GLBEGINQUERYPROC)     (GLenum, GLuint);
+    typedef void      (WINAPI * PFN_GLENDQUERYPROC)       (GLenum);
+    typedef void      (WINAPI * PFN_GLGETQUERYOBJECTUI64VPROC) (GLuint, GLenum, GLuint64*);
+
     // OpenGL DLL functions
     static HINSTANCE g_opengl32_dll                      = 0;
     static PFN_WGLGETPROCADDRESSPROC g_wglGetProcAddress = 0;
@@ -45,9 +95,29 @@
     // OpenGL Function ptrs
     static PFN_GLGETTEXIMAGEPROC    glGetTexImage    = NULL;
     static PFN_GLGENERATEMIPMAPPROC glGenerateMipmap = NULL;
+    static PFN_GLMAPBUFFERRANGEPROC glMapBufferRange = NULL;
+    static PFN_GLUNMAPBUFFERPROC    glUnmapBuffer    = NULL;
+    static PFN_GLFENCESYNCPROC      glFenceSync      = NULL;
+    static PFN_GLCLIENTWAITSYNCPROC glClientWaitSync = NULL;
+    static PFN_GLDELETESYNCPROC     glDeleteSync     = NULL;
+    static PFN_GLGENQUERIESPROC     glGenQueries     = NULL;
+    static PFN_GLDELETEQUERIESPROC  glDeleteQueries  = NULL;
+    static PFN_GLBEGINQUERYPROC     glBeginQuery     = NULL;
+    static PFN_GLENDQUERYPROC       glEndQuery       = NULL;
+    static PFN_GLGETQUERYOBJECTUI64VPROC glGetQueryObjectui64v = NULL;
 
     // OpenGL Defines
-    #define GL_TEXTURE_CUBE_MAP_SEAMLESS 0x884F
+    #define GL_TEXTURE_CUBE_MAP_SEAMLESS    0x884F
+    #define GL_PIXEL_PACK_BUFFER            0x88EB
+    #define GL_STREAM_READ                  0x88E1
+    #define GL_MAP_READ_BIT                 0x0001
+    #define GL_SYNC_GPU_COMMANDS_COMPLETE   0x9117
+    #define GL_SYNC_FLUSH_COMMANDS_BIT      0x00000001
+    #define GL_ALREADY_SIGNALED             0x911A
+    #define GL_CONDITION_SATISFIED          0x911C
+    #define GL_TIMEOUT_IGNORED              0xFFFFFFFFFFFFFFFFull
+    #define GL_TIME_ELAPSED                 0x88BF
+    #define GL_QUERY_RESULT                 0x8866
 #endif
 
 // Error message numbers
@@ -56,6 +126,7 @@ static const int PARAMS_RESULT_INCORRECT_INPUT            = -1;
 static const int PARAMS_RESULT_INCORRECT_OUTPUT_DIRECTORY = -2;
 static const int PARAMS_RESULT_SHOW_HELP                  = -3;
 static const int PARAMS_RESULT_INVALID_GENERATION_MASK    = -4;
+static const int PARAMS_RESULT_INVALID_VALUE              = -5;
 
 static const int GENERATE_NONE                     = 0;
 static const int GENERATE_BRDF_LUT                 = 1;
@@ -63,6 +134,43 @@ static const int GENERATE_DIFFUSE_IRRADIANCE       = 2;
 static const int GENERATE_PREFILTERED_ENVIRONMENT  = 4;
 static const int GENERATE_ALL                      = GENERATE_BRDF_LUT | GENERATE_DIFFUSE_IRRADIANCE | GENERATE_PREFILTERED_ENVIRONMENT;
 
+static const int ENGINE_GPU                        = 0;
+static const int ENGINE_CPU                        = 1;
+
+static const int IRRADIANCE_OUTPUT_BUFFER          = 0;
+static const int IRRADIANCE_OUTPUT_SH              = 1;
+
+static const int BRDF_LUT_SOURCE_GPU               = 0;
+static const int BRDF_LUT_SOURCE_CPU               = 1;
+static const int BRDF_LUT_SOURCE_CACHE             = 2;
+static const int BRDF_LUT_SOURCE_EMBEDDED          = 3;
+
+static const int HDR_FORMAT_RGBE                   = 0;
+static const int HDR_FORMAT_FLOAT                  = 1;
+
+static const int SERVE_NONE                        = 0;
+static const int SERVE_STDIO                       = 1;
+static const int SERVE_SOCKET                      = 2;
+
+// JSON-RPC 2.0 error codes
+static const int RPC_ERROR_PARSE                   = -32700;
+static const int RPC_ERROR_INVALID_REQUEST         = -32600;
+static const int RPC_ERROR_METHOD_NOT_FOUND        = -32601;
+static const int RPC_ERROR_INVALID_PARAMS          = -32602;
+static const int RPC_ERROR_BAKE_FAILED             = -32000;
+
+// Bump when anything that is written changes, so older bake cache entries are never used
+static const int BAKE_CACHE_VERSION                = 4;
+static const int MAX_OUTPUT_FILES                  = CUBEMAP_MAX_MIPMAPS + 4;
+// An output directory (see output_set::m_PathDirectory) plus a file name
+static const int MAX_OUTPUT_PATH                   = 512 + 64;
+
+// Largest size accepted for any pass, the prefilter mip chain must fit in CUBEMAP_MAX_MIPMAPS
+static const int MAX_PASS_SIZE                     = 16384;
+static const int MAX_SAMPLE_COUNT                  = 65536;
+// One per PBR_QUALITY_* preset, see --quality
+static const int MAX_QUALITY_PROFILES              = 3;
+
 typedef struct
 {
     sg_buffer vbuf;
@@ -75,11 +183,137 @@ typedef struct
     float pos[3];
 } vertex_t;
 
+// A .buffer file that is written by the output writer once all of its pixels are available.
+// m_Data is in the final buffer format (halves or floats) and lives in the output arena.
+typedef struct
+{
+    char     m_Path[MAX_OUTPUT_PATH];
+    uint8_t* m_Data;
+    uint32_t m_DataSize;
+    float*   m_SourcePixels; // CPU engine results, converted into m_Data by the writer
+    int      m_PendingReadbacks;
+    bool     m_Failed;       // not written, or its pixels are missing
+} output_buffer;
+
+// GPU -> CPU copy of one face / mip in flight
+typedef struct
+{
+    GLuint         m_PBO;
+    GLsync         m_Fence;
+    output_buffer* m_Output;
+    uint8_t*       m_Destination;
+    int            m_Size;
+    bool           m_FlipY;
+} pending_readback;
+
+// GL_TIME_ELAPSED query of one pass / face, see gpu_timer_begin
+typedef struct
+{
+    GLuint   m_Query;
+    uint64_t m_Issued; // CPU time the commands were issued
+    char     m_Name[64];
+    char     m_Detail[32];
+} gpu_timer;
+
+static const int MAX_GPU_TIMERS        = 256;
+
+static const int MAX_PENDING_READBACKS = 128;
+static const int MAX_OUTPUT_SET_TASKS  = CUBEMAP_MAX_MIPMAPS + 3;
+// Writers can still be busy with one environment while the next one renders
+static const int OUTPUT_SET_COUNT      = 2;
+static const int OUTPUT_WRITER_THREADS = 2;
+
+// Everything written for one environment, the arena holds all of its buffers
+typedef struct
+{
+    output_buffer   m_Irradiance;
+    output_buffer   m_Prefilter[CUBEMAP_MAX_MIPMAPS];
+    output_buffer   m_BRDFLut;
+    uint8_t*        m_Arena;
+    uint32_t        m_ArenaSize;
+    uint32_t        m_ArenaOffset;
+    uint64_t        m_Tasks[MAX_OUTPUT_SET_TASKS];
+    int             m_TaskCount;
+    int             m_BufferTaskCount;
+    // Used by the meta data, which is written after all buffers. The writers run while the
+    // next quality profile is generated, so nothing is read from the passes.
+    const char*     m_PathInput;
+    char            m_PathDirectory[512];
+    int             m_IrradianceSize;
+    int             m_PrefilterSize;
+    int             m_PrefilterMipmapCount;
+    int             m_BRDFLutSize;
+    sh_coefficients m_SH;
+    bool            m_StoreBRDFLut;
+    char            m_BRDFLutCachePath[MAX_OUTPUT_PATH];
+    uint64_t        m_CacheKey; // bake cache key, 0 if the outputs aren't stored
+    bool            m_Failed;   // a file wasn't written, complete once the set has been waited for
+} output_set;
+
+typedef struct
+{
+    uint8_t* m_Pixels;
+    int      m_PixelFormat; // PBR_PIXEL_FORMAT_*
+    size_t   m_PixelDataSize;
+    int      m_Width;
+    int      m_Height;
+} decoded_image;
+
+// Decoder threads keep at most this many upcoming batch entries decoded
+static const int BATCH_DECODE_THREADS = 2;
+static const int BATCH_PREFETCH_COUNT = 2;
+
+// Bytes of RGBE scanlines decoded at a time when the input is streamed, see stream_environment_image
+static const int ENVIRONMENT_STREAM_BAND_SIZE = 4 * 1024 * 1024;
+static const int ENVIRONMENT_STREAM_THREADS   = 4;
+
+typedef struct
+{
+    const char*   m_PathInput;
+    const char*   m_PathDirectory;
+    decoded_image m_Image;
+    bool          m_Decoded;
+    uint64_t      m_DecodeTask;
+    uint64_t      m_InputHash;
+} batch_entry;
+
+// One quality tier of the outputs. With several profiles every one of them is written to a
+// subdirectory of the output directory named after its preset.
+typedef struct
+{
+    int         m_Quality;
+    int         m_BRDFLutSource;
+    char        m_BRDFLutCachePath[MAX_OUTPUT_PATH];
+    pbr_outputs m_CPUOutputs; // CPU engine results of the current environment
+} quality_profile;
+
 typedef struct
 {
     const char* m_PathInput;
     const char* m_PathDirectory;
+    const char* m_PathCacheDirectory;
+    const char* m_PathManifest;
+    const char* m_PathServeSocket;
+    const char* m_PathProfile;
+    int         m_Serve;
     int         m_GenerateMask;
+    int         m_IrradianceEngine;
+    int         m_IrradianceOutput;
+    int         m_PrefilterEngine;
+    int         m_SHBands;
+    int         m_ThreadCount;
+    int         m_BufferFormat;
+    int         m_HDRFormat;
+    int         m_Qualities[MAX_QUALITY_PROFILES];
+    int         m_QualityCount;
+    // Overrides of the quality preset, 0 uses the value from the preset
+    int         m_EnvironmentSize;
+    int         m_IrradianceSize;
+    float       m_IrradianceSampleDelta;
+    int         m_PrefilterSize;
+    int         m_PrefilterSampleCount;
+    int         m_BRDFLutSize;
+    int         m_BRDFLutSampleCount;
     bool        m_GenerateMetaData;
     bool        m_Verbose;
     bool        m_Preview;
@@ -92,9 +326,12 @@ struct app
         sg_pass_action m_PassAction;
         sg_pass        m_Pass[6];
         sg_pipeline    m_Pipeline;
+        sg_pipeline    m_PipelineRGBE; // decodes RGBE inputs, see cubemap_rgbe_fs
         sg_image       m_Image;
+        sg_image       m_DepthImage;
         sg_bindings    m_Bindings;
         int            m_Size;
+        int            m_TargetSize;
     } m_EnvironmentPass;
 
     struct
@@ -104,7 +341,17 @@ struct app
         sg_pipeline    m_Pipeline;
         sg_image       m_Image;
         sg_bindings    m_Bindings;
+        sg_image       m_DepthImage;
         int            m_Size;
+        int            m_TargetSize;
+        float          m_SampleDelta;
+        // What m_Image holds for the current environment, smaller profiles are downsampled from it
+        int            m_RenderedSize;
+        float          m_RenderedSampleDelta;
+        bool           m_RenderedMipmaps;
+        // CPU engine results
+        sh_coefficients m_SH;
+        float*          m_Pixels;
     } m_DiffuseIrradiancePass;
 
     struct
@@ -113,9 +360,14 @@ struct app
         sg_pass*       m_Pass;
         sg_pipeline    m_Pipeline;
         sg_image       m_Image;
+        sg_image       m_DepthImages[CUBEMAP_MAX_MIPMAPS];
         sg_bindings    m_Bindings;
         int            m_Size;
+        int            m_TargetSize;
         int            m_MipmapCount;
+        int            m_SampleCount;
+        // CPU engine results, one buffer per mipmap
+        float**        m_Pixels;
     } m_PrefilterPass;
 
     struct
@@ -124,8 +376,18 @@ struct app
         sg_pass        m_Pass;
         sg_pipeline    m_Pipeline;
         sg_image       m_Image;
+        sg_image       m_DepthImage;
         sg_bindings    m_Bindings;
         int            m_Size;
+        int            m_TargetSize;
+        int            m_SampleCount;
+        // What m_Image holds, the LUT doesn't depend on the environment
+        int            m_RenderedSize;
+        int            m_RenderedSampleCount;
+        bool           m_RenderedMipmaps;
+        bool           m_Downsampled; // the last LUT was taken from a larger or better sampled one
+        // CPU engine result
+        float*         m_Pixels;
     } m_BRDFLutPass;
 
     struct
@@ -140,13 +402,75 @@ struct app
 
     struct
     {
-        sg_image    m_Image;
-        int         m_Width;
-        int         m_Height;
-        int         m_MipmapCount;
+        sg_image        m_Image;
+        int             m_PixelFormat; // PBR_PIXEL_FORMAT_*
+        uint8_t*        m_Pixels;
+        size_t          m_PixelDataSize;
+        int             m_Width;
+        int             m_Height;
+        int             m_MipmapCount;
+        // Inputs that are only read by the GPU are decoded while they are uploaded instead of into m_Pixels
+        radiance_stream* m_Stream;
+        GLuint           m_StreamTexture; // owned by us, m_Image only wraps it
     } m_EnvironmentTexture;
 
-    app_params m_Params;
+#if defined(PBR_UTILS_HEADLESS)
+    struct
+    {
+        EGLDisplay m_Display;
+        EGLContext m_Context;
+        EGLSurface m_Surface;
+    } m_Headless;
+#endif
+
+    struct
+    {
+        output_set       m_Sets[OUTPUT_SET_COUNT];
+        output_set*      m_Current;
+        int              m_NextSet;
+        pending_readback m_Readbacks[MAX_PENDING_READBACKS];
+        int              m_ReadbackCount;
+        task_queue*      m_Writer;
+        uint64_t         m_InputHash; // of the environment that is generated next, 0 if it isn't cached
+    } m_Output;
+
+    struct
+    {
+        quality_profile m_Profiles[MAX_QUALITY_PROFILES]; // highest quality first
+        int             m_Count;
+        int             m_Current;
+        int             m_EnvironmentSize; // shared by all profiles
+        int             m_CPUBakeMask;     // stages the CPU engines have baked for the current environment
+    } m_Quality;
+
+    struct
+    {
+        batch_entry* m_Entries;
+        int          m_EntryCount;
+        char*        m_ManifestData; // entry paths point into this
+        task_queue*  m_Decoder;
+    } m_Batch;
+
+    struct
+    {
+        app_params m_BaseParams; // from the command line, every request starts from these
+        FILE*      m_Out;
+        char       m_RequestId[256]; // JSON text of the id, empty for notifications
+        char       m_PathInput[512]; // of the current request, m_Params points to these
+        char       m_PathDirectory[512];
+    } m_Serve;
+
+    struct
+    {
+        profiler*  m_Profiler; // only created with --profile
+        gpu_timer  m_GpuTimers[MAX_GPU_TIMERS];
+        int        m_GpuTimerCount;
+        bool       m_GpuTimerActive;
+        uint64_t   m_GpuCursor; // end of the last GPU event on the trace
+    } m_Profile;
+
+    app_params  m_Params;
+    pbr_context* m_Context;
 
     uint8_t m_IsDone : 1;
 } g_app = {};
@@ -181,13 +505,32 @@ static void sg_query_image_pixels(sg_image img_id, void* pixels, int target, int
     _sg_gl_cache_restore_texture_binding(0);
 }
 
+// Starts an asynchronous download into a new pixel buffer object, returns the PBO
+static GLuint sg_query_image_pixels_async(sg_image img_id, int target, int data_type, int mipmap, int data_size)
+{
+    GLuint pbo = 0;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, data_size, 0, GL_STREAM_READ);
+
+    _sg_image_t* img = _sg_lookup_image(&_sg.pools, img_id.id);
+    _sg_gl_cache_store_texture_binding(0);
+    _sg_gl_cache_bind_texture(0, img->gl.target, img->gl.tex[img->cmn.active_slot]);
+    glGetTexImage(target, mipmap, GL_RGBA, data_type, 0);
+    _SG_GL_CHECK_ERROR();
+    _sg_gl_cache_restore_texture_binding(0);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return pbo;
+}
+
 static void sg_generate_mipmaps(sg_image img_id)
 {
     _sg_image_t* img = _sg_lookup_image(&_sg.pools, img_id.id);
     _sg_gl_cache_store_texture_binding(0);
     _sg_gl_cache_bind_texture(0, img->gl.target, img->gl.tex[img->cmn.active_slot]);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glGenerateMipmap(img->gl.target);
 
     img->cmn.num_mipmaps = 1 + floor(log2(fmax(img->cmn.width, img->cmn.height)));
 
@@ -254,1035 +597,3122 @@ static void make_cube()
     g_app.m_Cube = cube;
 }
 
-static bool make_environment_image()
+// CPU timing for --profile, returns the start time to pass to profile_end
+static uint64_t profile_begin()
+{
+    return g_app.m_Profile.m_Profiler ? profiler_now(g_app.m_Profile.m_Profiler) : 0;
+}
+
+static void profile_end(const char* name, const char* detail, uint64_t start)
+{
+    if (g_app.m_Profile.m_Profiler)
+    {
+        profiler_end(g_app.m_Profile.m_Profiler, name, detail, start);
+    }
+}
+
+// Times the GL commands issued until gpu_timer_end. Only one timer can be active at a time,
+// the results are read back by gpu_timers_collect.
+static void gpu_timer_begin(const char* name, const char* detail)
+{
+    if (!g_app.m_Profile.m_Profiler || g_app.m_Profile.m_GpuTimerCount == MAX_GPU_TIMERS)
+    {
+        return;
+    }
+
+    gpu_timer& timer = g_app.m_Profile.m_GpuTimers[g_app.m_Profile.m_GpuTimerCount++];
+    timer.m_Issued   = profiler_now(g_app.m_Profile.m_Profiler);
+    snprintf(timer.m_Name, sizeof(timer.m_Name), "%s", name);
+    snprintf(timer.m_Detail, sizeof(timer.m_Detail), "%s", detail ? detail : "");
+
+    glGenQueries(1, &timer.m_Query);
+    glBeginQuery(GL_TIME_ELAPSED, timer.m_Query);
+    g_app.m_Profile.m_GpuTimerActive = true;
+}
+
+static void gpu_timer_end()
+{
+    if (g_app.m_Profile.m_GpuTimerActive)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        g_app.m_Profile.m_GpuTimerActive = false;
+    }
+}
+
+// GL_TIME_ELAPSED only gives durations, so every pass is placed on the GPU track when it was issued
+// or when the previous pass ended, whichever is later.
+static void gpu_timers_collect()
 {
-    /// Load image
-    sg_pixel_format pixel_format;
-    uint8_t* pixel_data;
-    int x,y,ch;
-    int pixel_size;
+    for (int i = 0; i < g_app.m_Profile.m_GpuTimerCount; ++i)
+    {
+        gpu_timer& timer = g_app.m_Profile.m_GpuTimers[i];
+
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(timer.m_Query, GL_QUERY_RESULT, &elapsed_ns);
+        glDeleteQueries(1, &timer.m_Query);
+
+        // Some drivers (llvmpipe) report bogus durations for the first query, a pass can't
+        // have taken longer than the time since it was issued
+        uint64_t duration = elapsed_ns / 1000;
+        if (timer.m_Issued + duration > profiler_now(g_app.m_Profile.m_Profiler))
+        {
+            LOG_VERBOSE("Ignoring invalid GPU timing for %s\n", timer.m_Name);
+            continue;
+        }
+
+        uint64_t start = timer.m_Issued > g_app.m_Profile.m_GpuCursor ? timer.m_Issued : g_app.m_Profile.m_GpuCursor;
+        profiler_add_event(g_app.m_Profile.m_Profiler, PROFILER_TRACK_GPU, timer.m_Name, timer.m_Detail, start, duration);
+        g_app.m_Profile.m_GpuCursor = start + duration;
+    }
+    g_app.m_Profile.m_GpuTimerCount = 0;
+}
 
-    const char* input_path = g_app.m_Params.m_PathInput;
+static void write_profile()
+{
+    if (!g_app.m_Profile.m_Profiler)
+    {
+        return;
+    }
 
-    if (stbi_is_hdr(g_app.m_Params.m_PathInput))
+    if (profiler_write_trace(g_app.m_Profile.m_Profiler, g_app.m_Params.m_PathProfile))
     {
-        pixel_data   = (uint8_t*) stbi_loadf(g_app.m_Params.m_PathInput, &x, &y, &ch, 4);
-        pixel_format = SG_PIXELFORMAT_RGBA32F;
-        pixel_size   = x * y * 4 * sizeof(float);
+        LOG_INFO("Wrote profile to %s\n", g_app.m_Params.m_PathProfile);
     }
     else
     {
-        pixel_data   = (uint8_t*) stbi_load(g_app.m_Params.m_PathInput, &x, &y, &ch, 4);
-        pixel_format = SG_PIXELFORMAT_RGBA8;
-        pixel_size   = x * y * 4 * sizeof(uint8_t);
+        LOG_ERROR("Unable to write profile to %s\n", g_app.m_Params.m_PathProfile);
     }
+    profiler_print_summary(g_app.m_Profile.m_Profiler);
+
+    profiler_destroy(g_app.m_Profile.m_Profiler);
+    g_app.m_Profile.m_Profiler = 0;
+}
+
+static pbr_context* get_context()
+{
+    if (!g_app.m_Context)
+    {
+        g_app.m_Context = pbr_context_create(g_app.m_Params.m_ThreadCount);
+        LOG_VERBOSE("Job system: %d threads\n", pbr_context_thread_count(g_app.m_Context));
+    }
+    return g_app.m_Context;
+}
+
+static bool decode_environment_image(const char* path, pbr_context* context, decoded_image* image)
+{
+    uint64_t profile_start = profile_begin();
 
-    if (pixel_data == 0)
+    // RGBE keeps HDR inputs at 4 bytes per pixel, on the CPU and on the GPU
+    pbr_image loaded;
+    bool loaded_ok = g_app.m_Params.m_HDRFormat == HDR_FORMAT_RGBE ? pbr_image_load_rgbe(context, path, &loaded) : pbr_image_load(path, &loaded);
+    if (!loaded_ok)
     {
-        printf("Unable to load image from %s\n", g_app.m_Params.m_PathInput);
+        printf("Unable to load image from %s\n", path);
         return false;
     }
 
-    if (pixel_format == SG_PIXELFORMAT_RGBA32F)
+    int x = loaded.m_Width;
+    int y = loaded.m_Height;
+
+    if (loaded.m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F)
     {
         LOG_VERBOSE("Input environment: HDR\n");
+        image->m_PixelDataSize = (size_t) x * y * 4 * sizeof(float);
+    }
+    else if (loaded.m_PixelFormat == PBR_PIXEL_FORMAT_RGBE8)
+    {
+        LOG_VERBOSE("Input environment: HDR (RGBE)\n");
+        image->m_PixelDataSize = (size_t) x * y * 4 * sizeof(uint8_t);
     }
     else
     {
         LOG_VERBOSE("Input environment: RGBA8\n");
+        image->m_PixelDataSize = (size_t) x * y * 4 * sizeof(uint8_t);
     }
 
-    sg_image_data img_data       = {};
-    img_data.subimage[0][0].ptr  = pixel_data;
-    img_data.subimage[0][0].size = pixel_size;
-
-    sg_image_desc img_desc = {
-        .width        = x,
-        .height       = y,
-        .pixel_format = pixel_format,
-        .mag_filter   = SG_FILTER_LINEAR,
-        .data         = img_data
-    };
-
-    g_app.m_EnvironmentTexture.m_Image       = sg_make_image(&img_desc);
-    g_app.m_EnvironmentTexture.m_Width       = x;
-    g_app.m_EnvironmentTexture.m_Height      = y;
-    g_app.m_EnvironmentTexture.m_MipmapCount = 1 + floor(log2(fmax(x, y)));
+    image->m_PixelFormat = loaded.m_PixelFormat;
+    image->m_Pixels      = (uint8_t*) loaded.m_Pixels;
+    image->m_Width  = x;
+    image->m_Height = y;
 
-    stbi_image_free(pixel_data);
+    profile_end("decode", path, profile_start);
     return true;
 }
 
-static void make_brdf_lut_pass()
+static void set_environment_image(const decoded_image* image)
 {
-    g_app.m_BRDFLutPass.m_Size  = 512;
+    g_app.m_EnvironmentTexture.m_Pixels        = image->m_Pixels;
+    g_app.m_EnvironmentTexture.m_PixelFormat   = image->m_PixelFormat;
+    g_app.m_EnvironmentTexture.m_PixelDataSize = image->m_PixelDataSize;
+    g_app.m_EnvironmentTexture.m_Width         = image->m_Width;
+    g_app.m_EnvironmentTexture.m_Height        = image->m_Height;
+    g_app.m_EnvironmentTexture.m_MipmapCount   = 1 + floor(log2(fmax(image->m_Width, image->m_Height)));
+}
 
-    sg_image_desc brdf_lut_pass_image_desc = {
-        .type          = SG_IMAGETYPE_2D,
-        .render_target = true,
-        .width         = g_app.m_BRDFLutPass.m_Size,
-        .height        = g_app.m_BRDFLutPass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
-        .min_filter    = SG_FILTER_LINEAR,
-        .mag_filter    = SG_FILTER_LINEAR,
-        .wrap_u        = SG_WRAP_CLAMP_TO_EDGE,
-        .wrap_v        = SG_WRAP_CLAMP_TO_EDGE,
-        .label         = "color-image"
-    };
+static void free_environment_image()
+{
+    if (g_app.m_EnvironmentTexture.m_Pixels)
+    {
+        pbr_image image = {};
+        image.m_Pixels  = g_app.m_EnvironmentTexture.m_Pixels;
+        pbr_image_free(&image);
+        g_app.m_EnvironmentTexture.m_Pixels = 0;
+    }
+    if (g_app.m_EnvironmentTexture.m_Stream)
+    {
+        radiance_stream_close(g_app.m_EnvironmentTexture.m_Stream);
+        g_app.m_EnvironmentTexture.m_Stream = 0;
+    }
+}
 
-    g_app.m_BRDFLutPass.m_Image = sg_make_image(&brdf_lut_pass_image_desc);
+// The environment cube has four faces around the equator, an equirect with more texels than that
+// can't be resolved by it. Larger inputs are area filtered down to this (and to the GL limit) for the upload.
+static void get_environment_upload_size(int* width_out, int* height_out)
+{
+    int width     = g_app.m_EnvironmentTexture.m_Width;
+    int height    = g_app.m_EnvironmentTexture.m_Height;
+    int max_size  = sg_query_limits().max_image_size_2d;
+    int max_width = 4 * g_app.m_Quality.m_EnvironmentSize;
+    max_width     = max_width < max_size ? max_width : max_size;
 
-    sg_image_desc depth_img_desc = {
-        .type          = SG_IMAGETYPE_2D,
-        .render_target = true,
-        .width         = g_app.m_BRDFLutPass.m_Size,
-        .height        = g_app.m_BRDFLutPass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_DEPTH,
-        .label         = "cubemap-depth-rt"
-    };
+    if (width > max_width)
+    {
+        height = (int) ((int64_t) height * max_width / width);
+        height = height > 0 ? height : 1;
+        width  = max_width;
+    }
+    if (height > max_size)
+    {
+        width  = (int) ((int64_t) width * max_size / height);
+        width  = width > 0 ? width : 1;
+        height = max_size;
+    }
 
-    sg_image depth_img = sg_make_image(&depth_img_desc);
+    *width_out  = width;
+    *height_out = height;
+}
 
-    sg_pass_desc brdf_lut_pass_desc = {
-        .label = "offscreen-pass"
-    };
+typedef struct
+{
+    radiance_stream*   m_Stream;
+    const area_filter* m_Filter;    // 0 when the input is uploaded at its own size
+    uint8_t*           m_Input;     // scanlines the rows are filtered from
+    float*             m_InputRows; // area_filter_max_input_rows scanlines as RGBA32F
+    const float**      m_RowPointers;
+    float*             m_Scratch;
+    uint8_t*           m_Pixels;
+    int                m_Row;       // of the texture
+    int                m_RowCount;
+    bool               m_Decoded;
+    uint64_t           m_Task;
+} stream_band;
+
+static bool filter_stream_band(stream_band* band)
+{
+    int width       = g_app.m_EnvironmentTexture.m_Width;
+    int input_first = 0, input_last = 0, count = 0;
+    area_filter_input_rows(band->m_Filter, band->m_Row, &input_first, &count);
+    area_filter_input_rows(band->m_Filter, band->m_Row + band->m_RowCount - 1, &input_last, &count);
+    input_last += count - 1;
 
-    brdf_lut_pass_desc.depth_stencil_attachment.image = depth_img;
-    brdf_lut_pass_desc.color_attachments[0].image = g_app.m_BRDFLutPass.m_Image;
-    brdf_lut_pass_desc.color_attachments[0].slice = 0;
+    if (!radiance_stream_read_rows(band->m_Stream, input_first, input_last - input_first + 1, band->m_Input))
+    {
+        return false;
+    }
 
-    g_app.m_BRDFLutPass.m_Pass = sg_make_pass(&brdf_lut_pass_desc);
+    int width_out = 0, height_out = 0;
+    get_environment_upload_size(&width_out, &height_out);
+    const float** rows = band->m_RowPointers;
 
-    //g_app.m_BRDFLutPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
-    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.r = 0.0f;
-    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.g = 0.0f;
-    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.b = 0.0f;
-    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+    for (int y = band->m_Row; y < band->m_Row + band->m_RowCount; ++y)
+    {
+        int first;
+        area_filter_input_rows(band->m_Filter, y, &first, &count);
+        for (int i = 0; i < count; ++i)
+        {
+            rows[i] = band->m_InputRows + (size_t) i * width * 4;
+            radiance_rgbe_to_float(band->m_Input + (size_t) (first + i - input_first) * width * 4, width, band->m_InputRows + (size_t) i * width * 4);
+        }
+        area_filter_row(band->m_Filter, y, rows, band->m_Scratch, band->m_Scratch + width_out * 4);
+        radiance_float_to_rgbe(band->m_Scratch + width_out * 4, width_out, band->m_Pixels + (size_t) (y - band->m_Row) * width_out * 4);
+    }
+    return true;
+}
 
-    float vertices[] = {
-        -1.0f, -1.0f, 0.0f, 0.0f,
-        -1.0f,  1.0f, 0.0f, 1.0f,
-         1.0f,  1.0f, 1.0f, 1.0f,
+static void decode_stream_band_task(void* context)
+{
+    stream_band* band = (stream_band*) context;
+    if (band->m_Filter)
+    {
+        band->m_Decoded = filter_stream_band(band);
+    }
+    else
+    {
+        band->m_Decoded = radiance_stream_read_rows(band->m_Stream, band->m_Row, band->m_RowCount, band->m_Pixels);
+    }
+}
 
-        -1.0f, -1.0f, 0.0f, 0.0f,
-         1.0f,  1.0f, 1.0f, 1.0f,
-         1.0f, -1.0f, 1.0f, 0.0f,
-    };
+static void push_stream_band(task_queue* decoder, stream_band* band, int band_index, int band_rows, int height)
+{
+    band->m_Row      = band_index * band_rows;
+    band->m_RowCount = height - band->m_Row < band_rows ? height - band->m_Row : band_rows;
+    band->m_Task     = task_queue_push(decoder, decode_stream_band_task, band);
+}
 
-    sg_buffer_desc brdf_lut_pass_buffer_desc = {
-        .data  = SG_RANGE(vertices),
-        .label = "triangle-vertices",
-    };
+// Decodes the streamed input a band of scanlines at a time into a GL texture. Once the scanlines are
+// indexed, the bands are decoded on several threads while the finished ones are uploaded in order,
+// so at most ENVIRONMENT_STREAM_THREADS + 1 bands are in memory. Inputs larger than the upload size
+// are area filtered band by band, each band then covers the input rows of its texture rows.
+static GLuint stream_environment_image(int width_out, int height_out)
+{
+    radiance_stream* stream = g_app.m_EnvironmentTexture.m_Stream;
+    if (!radiance_stream_build_index(stream))
+    {
+        return 0;
+    }
 
-    g_app.m_BRDFLutPass.m_Bindings.vertex_buffers[0] = sg_make_buffer(&brdf_lut_pass_buffer_desc);
+    int width  = g_app.m_EnvironmentTexture.m_Width;
+    int height = g_app.m_EnvironmentTexture.m_Height;
 
-    sg_pipeline_desc brdf_lut_pass_pipeline_desc = {
-        .shader = sg_make_shader(pbr_brdf_lut_shader_desc(sg_query_backend())),
-        .layout = {},
-        .depth = {
-            .pixel_format  = SG_PIXELFORMAT_DEPTH,
-            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = true,
-        },
-        .cull_mode = SG_CULLMODE_NONE,
-        .label     = "pipeline_fullscreen"
-    };
+    area_filter* filter = 0;
+    if (width_out != width || height_out != height)
+    {
+        filter = area_filter_create(width, height, width_out, height_out);
+    }
 
-    brdf_lut_pass_pipeline_desc.colors[0].pixel_format                         = SG_PIXELFORMAT_RGBA32F;
-    brdf_lut_pass_pipeline_desc.layout.attrs[ATTR_brdf_lut_vs_position].format = SG_VERTEXFORMAT_FLOAT2;
-    brdf_lut_pass_pipeline_desc.layout.attrs[ATTR_brdf_lut_vs_texcoord].format = SG_VERTEXFORMAT_FLOAT2;
+    int band_rows  = (int) ((int64_t) ENVIRONMENT_STREAM_BAND_SIZE / (width * 4) * height_out / height);
+    band_rows      = band_rows > 0 ? band_rows : 1;
+    int band_count = (height_out + band_rows - 1) / band_rows;
+    int input_rows = (int) (((int64_t) band_rows * height + height_out - 1) / height_out) + 2;
 
-    g_app.m_BRDFLutPass.m_Pipeline = sg_make_pipeline(&brdf_lut_pass_pipeline_desc);
-}
+    GLuint texture;
+    glGenTextures(1, &texture);
+    _sg_gl_cache_store_texture_binding(0);
+    _sg_gl_cache_bind_texture(0, GL_TEXTURE_2D, texture);
 
-static void make_prefilter_pass()
-{
-    g_app.m_PrefilterPass.m_Size        = 256;
-    g_app.m_PrefilterPass.m_MipmapCount = 1 + floor(log2(g_app.m_PrefilterPass.m_Size));
+    // Only read with texelFetch by cubemap_rgbe_fs
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width_out, height_out, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
 
-    //g_app.m_PrefilterPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
-    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.r = 0.0f;
-    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.g = 0.0f;
-    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.b = 0.0f;
-    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+    static const int slot_count = ENVIRONMENT_STREAM_THREADS + 1;
+    stream_band bands[slot_count];
+    task_queue* decoder = task_queue_create(ENVIRONMENT_STREAM_THREADS);
 
-    sg_image_desc prefilter_pass_img_desc = {
-        .type          = SG_IMAGETYPE_CUBE,
-        .render_target = true,
-        .width         = g_app.m_PrefilterPass.m_Size,
-        .height        = g_app.m_PrefilterPass.m_Size,
-        .num_mipmaps   = g_app.m_PrefilterPass.m_MipmapCount,
-        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
-        .min_filter    = SG_FILTER_LINEAR,
-        .mag_filter    = SG_FILTER_LINEAR,
-        .wrap_u        = SG_WRAP_REPEAT,
-        .wrap_v        = SG_WRAP_REPEAT,
-        .label         = "color-image"
-    };
+    int next_band = 0;
+    for (int i = 0; i < slot_count; ++i)
+    {
+        memset(&bands[i], 0, sizeof(stream_band));
+        bands[i].m_Stream = stream;
+        bands[i].m_Filter = filter;
+        bands[i].m_Pixels = (uint8_t*) malloc((size_t) band_rows * width_out * 4);
+        if (filter)
+        {
+            bands[i].m_Input       = (uint8_t*) malloc((size_t) input_rows * width * 4);
+            bands[i].m_InputRows   = (float*) malloc((size_t) area_filter_max_input_rows(filter) * width * 4 * sizeof(float));
+            bands[i].m_RowPointers = (const float**) malloc(area_filter_max_input_rows(filter) * sizeof(float*));
+            bands[i].m_Scratch     = (float*) malloc((size_t) width_out * 8 * sizeof(float));
+        }
+        if (next_band < band_count)
+        {
+            push_stream_band(decoder, &bands[i], next_band++, band_rows, height_out);
+        }
+    }
 
-    g_app.m_PrefilterPass.m_Image = sg_make_image(&prefilter_pass_img_desc);
+    bool result = true;
+    for (int i = 0; i < band_count; ++i)
+    {
+        stream_band* band = &bands[i % slot_count];
+        task_queue_wait_task(decoder, band->m_Task);
+        if (!band->m_Decoded)
+        {
+            result = false;
+            break;
+        }
 
-    g_app.m_PrefilterPass.m_Pass = (sg_pass*) malloc(sizeof(sg_pass) * g_app.m_PrefilterPass.m_MipmapCount * 6);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, band->m_Row, width_out, band->m_RowCount, GL_RGBA, GL_UNSIGNED_BYTE, band->m_Pixels);
 
-    int pass_index = 0;
-    for (int mipmap = 0; mipmap < g_app.m_PrefilterPass.m_MipmapCount; ++mipmap)
+        // glTexSubImage2D is done with the pixels when it returns, the slot can decode the next band
+        if (next_band < band_count)
+        {
+            push_stream_band(decoder, band, next_band++, band_rows, height_out);
+        }
+    }
+
+    task_queue_destroy(decoder);
+    for (int i = 0; i < slot_count; ++i)
     {
+        free(bands[i].m_Pixels);
+        free(bands[i].m_Input);
+        free(bands[i].m_InputRows);
+        free(bands[i].m_RowPointers);
+        free(bands[i].m_Scratch);
+    }
+    area_filter_destroy(filter);
 
-        sg_image_desc depth_img_desc = {
-            .type          = SG_IMAGETYPE_2D,
-            .render_target = true,
-            .width         = g_app.m_PrefilterPass.m_Size >> mipmap,
-            .height        = g_app.m_PrefilterPass.m_Size >> mipmap,
-            .pixel_format  = SG_PIXELFORMAT_DEPTH,
-            .label         = "cubemap-depth-rt"
+    _SG_GL_CHECK_ERROR();
+    _sg_gl_cache_restore_texture_binding(0);
+
+    if (!result)
+    {
+        glDeleteTextures(1, &texture);
+        return 0;
+    }
+    return texture;
+}
+
+static bool make_environment_image()
+{
+    int width, height;
+    get_environment_upload_size(&width, &height);
+    if (width != g_app.m_EnvironmentTexture.m_Width || height != g_app.m_EnvironmentTexture.m_Height)
+    {
+        LOG_VERBOSE("Environment upload: %dx%d, filtered down from %dx%d\n", width, height, g_app.m_EnvironmentTexture.m_Width, g_app.m_EnvironmentTexture.m_Height);
+    }
+
+    if (g_app.m_EnvironmentTexture.m_Stream)
+    {
+        uint64_t profile_start = profile_begin();
+        GLuint texture         = stream_environment_image(width, height);
+        profile_end("decode + upload", g_app.m_Params.m_PathInput, profile_start);
+
+        radiance_stream_close(g_app.m_EnvironmentTexture.m_Stream);
+        g_app.m_EnvironmentTexture.m_Stream = 0;
+
+        if (!texture)
+        {
+            LOG_ERROR("Unable to decode %s\n", g_app.m_Params.m_PathInput);
+            return false;
+        }
+
+        sg_image_desc img_desc = {
+            .width        = width,
+            .height       = height,
+            .pixel_format = SG_PIXELFORMAT_RGBA8,
         };
+        img_desc.gl_textures[0] = texture;
 
-        sg_image depth_img = sg_make_image(&depth_img_desc);
+        g_app.m_EnvironmentTexture.m_StreamTexture = texture;
+        g_app.m_EnvironmentTexture.m_Image         = sg_make_image(&img_desc);
+        return true;
+    }
 
-        for (int i = 0; i < 6; ++i)
+    pbr_image image     = {};
+    image.m_Pixels      = g_app.m_EnvironmentTexture.m_Pixels;
+    image.m_Width       = g_app.m_EnvironmentTexture.m_Width;
+    image.m_Height      = g_app.m_EnvironmentTexture.m_Height;
+    image.m_PixelFormat = g_app.m_EnvironmentTexture.m_PixelFormat;
+
+    // The CPU engines still read the full resolution pixels, the filtered ones only live until they are uploaded
+    pbr_image filtered = {};
+    if (width != image.m_Width || height != image.m_Height)
+    {
+        uint64_t profile_start = profile_begin();
+        bool result            = pbr_image_downsample(get_context(), &image, width, height, &filtered);
+        profile_end("downsample", 0, profile_start);
+        if (!result)
         {
-            sg_pass_desc prefilter_pass_desc = {
-                .label = "offscreen-pass"
-            };
-            prefilter_pass_desc.depth_stencil_attachment.image = depth_img;
-            prefilter_pass_desc.color_attachments[0].image     = g_app.m_PrefilterPass.m_Image,
-            prefilter_pass_desc.color_attachments[0].mip_level = mipmap,
-            prefilter_pass_desc.color_attachments[0].slice     = i,
+            LOG_ERROR("Unable to filter %s down to %dx%d\n", g_app.m_Params.m_PathInput, width, height);
+            return false;
+        }
+    }
+
+    const pbr_image* upload      = filtered.m_Pixels ? &filtered : &image;
+    uint32_t pixel_size          = upload->m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F ? 4 * sizeof(float) : 4;
+    sg_image_data img_data       = {};
+    img_data.subimage[0][0].ptr  = upload->m_Pixels;
+    img_data.subimage[0][0].size = (size_t) width * height * pixel_size;
+
+    // RGBE texels are uploaded as they are and decoded (and filtered) by cubemap_rgbe_fs
+    sg_image_desc img_desc = {
+        .width        = width,
+        .height       = height,
+        .pixel_format = upload->m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F ? SG_PIXELFORMAT_RGBA32F : SG_PIXELFORMAT_RGBA8,
+        .mag_filter   = SG_FILTER_LINEAR,
+        .data         = img_data
+    };
+
+    uint64_t profile_start = profile_begin();
+    g_app.m_EnvironmentTexture.m_Image = sg_make_image(&img_desc);
+    profile_end("upload", 0, profile_start);
+
+    if (filtered.m_Pixels)
+    {
+        pbr_image_free(&filtered);
+    }
+    return true;
+}
+
+static void destroy_environment_image()
+{
+    if (g_app.m_EnvironmentTexture.m_Image.id != SG_INVALID_ID)
+    {
+        sg_destroy_image(g_app.m_EnvironmentTexture.m_Image);
+        g_app.m_EnvironmentTexture.m_Image.id = SG_INVALID_ID;
+    }
+    if (g_app.m_EnvironmentTexture.m_StreamTexture)
+    {
+        glDeleteTextures(1, &g_app.m_EnvironmentTexture.m_StreamTexture);
+        g_app.m_EnvironmentTexture.m_StreamTexture = 0;
+    }
+}
+
+static void init_pass_sizes(int quality_preset)
+{
+    pbr_bake_params quality;
+    pbr_bake_params_preset(quality_preset, &quality);
+
+#define PARAM_OR_PRESET(name) (g_app.m_Params.name > 0 ? g_app.m_Params.name : quality.name)
+    g_app.m_EnvironmentPass.m_Size              = PARAM_OR_PRESET(m_EnvironmentSize);
+    g_app.m_DiffuseIrradiancePass.m_Size        = PARAM_OR_PRESET(m_IrradianceSize);
+    g_app.m_DiffuseIrradiancePass.m_SampleDelta = PARAM_OR_PRESET(m_IrradianceSampleDelta);
+    g_app.m_PrefilterPass.m_Size                = PARAM_OR_PRESET(m_PrefilterSize);
+    g_app.m_PrefilterPass.m_MipmapCount         = 1 + floor(log2(g_app.m_PrefilterPass.m_Size));
+    g_app.m_PrefilterPass.m_SampleCount         = PARAM_OR_PRESET(m_PrefilterSampleCount);
+    g_app.m_BRDFLutPass.m_Size                  = PARAM_OR_PRESET(m_BRDFLutSize);
+    g_app.m_BRDFLutPass.m_SampleCount           = PARAM_OR_PRESET(m_BRDFLutSampleCount);
+#undef PARAM_OR_PRESET
+}
+
+const char* quality_to_str(int quality)
+{
+    if (quality == PBR_QUALITY_MOBILE)
+    {
+        return "mobile";
+    }
+    else if (quality == PBR_QUALITY_REFERENCE)
+    {
+        return "reference";
+    }
+    return "desktop";
+}
+
+int str_case_cmp(const char *s1, const char *s2)
+{
+#ifdef _WIN32
+    return _stricmp(s1, s2);
+#else
+    return strcasecmp(s1, s2);
+#endif
+}
+
+static bool parse_positive_int(const char* str, int max_value, int* value_out)
+{
+    int value = atoi(str);
+    if (value <= 0 || value > max_value)
+    {
+        return false;
+    }
+    *value_out = value;
+    return true;
+}
+
+static bool parse_quality(const char* str, int* quality_out)
+{
+    for (int quality = PBR_QUALITY_MOBILE; quality <= PBR_QUALITY_REFERENCE; ++quality)
+    {
+        if (str_case_cmp(str, quality_to_str(quality)) == 0)
+        {
+            *quality_out = quality;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Comma separated list of presets, each one at most once
+static bool parse_qualities(const char* str, app_params* params)
+{
+    char qualities[64];
+    if ((size_t) snprintf(qualities, sizeof(qualities), "%s", str) >= sizeof(qualities))
+    {
+        return false;
+    }
+
+    params->m_QualityCount = 0;
+    for (char* name = strtok(qualities, ","); name; name = strtok(0, ","))
+    {
+        int quality;
+        if (!parse_quality(name, &quality) || params->m_QualityCount == MAX_QUALITY_PROFILES)
+        {
+            return false;
+        }
+
+        for (int j = 0; j < params->m_QualityCount; ++j)
+        {
+            if (params->m_Qualities[j] == quality)
+            {
+                return false;
+            }
+        }
+        params->m_Qualities[params->m_QualityCount++] = quality;
+    }
+    return params->m_QualityCount > 0;
+}
+
+static quality_profile* get_quality_profile()
+{
+    return &g_app.m_Quality.m_Profiles[g_app.m_Quality.m_Current];
+}
+
+// Sets the pass sizes of a profile, the environment cube is shared by all of them
+static void select_quality_profile(int index)
+{
+    g_app.m_Quality.m_Current = index;
+    init_pass_sizes(g_app.m_Quality.m_Profiles[index].m_Quality);
+    g_app.m_EnvironmentPass.m_Size = g_app.m_Quality.m_EnvironmentSize;
+}
+
+// Profiles are generated from the highest quality down, so every pass is at most as large as in the
+// profiles before it. The environment cube is made as large as the largest profile needs.
+static void init_quality_profiles()
+{
+    g_app.m_Quality.m_Count           = 0;
+    g_app.m_Quality.m_EnvironmentSize = 0;
+    for (int quality = PBR_QUALITY_REFERENCE; quality >= PBR_QUALITY_MOBILE; --quality)
+    {
+        for (int i = 0; i < g_app.m_Params.m_QualityCount; ++i)
+        {
+            if (g_app.m_Params.m_Qualities[i] == quality)
+            {
+                g_app.m_Quality.m_Profiles[g_app.m_Quality.m_Count++].m_Quality = quality;
+
+                init_pass_sizes(quality);
+                if (g_app.m_EnvironmentPass.m_Size > g_app.m_Quality.m_EnvironmentSize)
+                {
+                    g_app.m_Quality.m_EnvironmentSize = g_app.m_EnvironmentPass.m_Size;
+                }
+                break;
+            }
+        }
+    }
+    select_quality_profile(0);
+}
+
+// A single profile writes straight into the output directory. Fails with an empty path_out if the
+// directory doesn't fit, which get_output_path then refuses.
+static bool get_output_directory(const char* path_directory, int profile_index, char* path_out, uint32_t path_out_size)
+{
+    int length;
+    if (g_app.m_Quality.m_Count == 1)
+    {
+        length = snprintf(path_out, path_out_size, "%s", path_directory);
+    }
+    else
+    {
+        length = snprintf(path_out, path_out_size, "%s/%s", path_directory, quality_to_str(g_app.m_Quality.m_Profiles[profile_index].m_Quality));
+    }
+
+    if (length < 0 || (uint32_t) length >= path_out_size)
+    {
+        LOG_ERROR("Output directory %s is too long\n", path_directory);
+        path_out[0] = 0;
+        return false;
+    }
+
+    if (g_app.m_Quality.m_Count > 1 && !output_directory_create(path_out))
+    {
+        LOG_ERROR("Unable to create output directory %s\n", path_out);
+    }
+    return true;
+}
+
+// Returns false if the path of the file in the output directory doesn't fit into path_out, or if
+// the directory itself didn't fit (already logged by get_output_directory)
+static bool get_output_path(const char* path_directory, const char* file_name, char* path_out, uint32_t path_out_size)
+{
+    int length = path_directory[0] ? snprintf(path_out, path_out_size, "%s/%s", path_directory, file_name) : -1;
+    if (length < 0 || (uint32_t) length >= path_out_size)
+    {
+        if (length >= 0)
+        {
+            LOG_ERROR("Unable to write %s, the output directory %s is too long\n", file_name, path_directory);
+        }
+        path_out[0] = 0;
+        return false;
+    }
+    return true;
+}
+
+static bool generation_uses_gpu_irradiance()
+{
+    return (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE) && g_app.m_Params.m_IrradianceEngine == ENGINE_GPU;
+}
+
+static bool generation_uses_gpu_prefilter()
+{
+    return (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT) && g_app.m_Params.m_PrefilterEngine == ENGINE_GPU;
+}
+
+// The environment cube is only needed by the GPU filtering passes
+static bool generation_uses_environment_cube()
+{
+    return generation_uses_gpu_irradiance() || generation_uses_gpu_prefilter();
+}
+
+// Streamed inputs never exist decoded in memory, so nothing but the environment pass may read them
+static bool environment_image_can_stream()
+{
+    bool cpu_irradiance = (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE) && g_app.m_Params.m_IrradianceEngine == ENGINE_CPU;
+    bool cpu_prefilter  = (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT) && g_app.m_Params.m_PrefilterEngine == ENGINE_CPU;
+    return g_app.m_Params.m_HDRFormat == HDR_FORMAT_RGBE && (generation_uses_environment_cube() || g_app.m_Params.m_Preview) && !cpu_irradiance && !cpu_prefilter;
+}
+
+static bool load_environment_image()
+{
+    if (environment_image_can_stream())
+    {
+        radiance_header header;
+        radiance_stream* stream = radiance_stream_open(g_app.m_Params.m_PathInput, &header);
+        if (stream)
+        {
+            LOG_VERBOSE("Input environment: HDR (RGBE, streamed)\n");
+            decoded_image image = {};
+            image.m_PixelFormat = PBR_PIXEL_FORMAT_RGBE8;
+            image.m_Width       = header.m_Width;
+            image.m_Height      = header.m_Height;
+            set_environment_image(&image);
+            g_app.m_EnvironmentTexture.m_Stream = stream;
+            return true;
+        }
+    }
+
+    decoded_image image;
+    if (!decode_environment_image(g_app.m_Params.m_PathInput, get_context(), &image))
+    {
+        return false;
+    }
+    set_environment_image(&image);
+    return true;
+}
+
+// In any of the profiles
+static bool generation_uses_gpu_brdf_lut()
+{
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
+    {
+        if ((g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT) && g_app.m_Quality.m_Profiles[i].m_BRDFLutSource == BRDF_LUT_SOURCE_GPU)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool generation_requires_gpu()
+{
+    return g_app.m_Params.m_Serve != SERVE_NONE || g_app.m_Params.m_Preview || generation_uses_environment_cube() || generation_uses_gpu_brdf_lut();
+}
+
+// The LUT doesn't depend on the environment, so prefer (in order) a cached copy, the LUT
+// embedded at build time and only then integrate it. The GPU is only used when it's needed anyway.
+static void resolve_profile_brdf_lut_source(quality_profile* profile)
+{
+    if (g_app.m_Params.m_PathCacheDirectory)
+    {
+        // Everything that affects the contents of brdf_lut.buffer
+        int key_data[] = { BRDF_LUT_VERSION, g_app.m_BRDFLutPass.m_Size, g_app.m_BRDFLutPass.m_SampleCount, g_app.m_Params.m_BufferFormat };
+        uint64_t key   = hash_fnv1a_64(key_data, sizeof(key_data), FNV1A_64_SEED);
+
+        file_cache_entry_path(g_app.m_Params.m_PathCacheDirectory, "brdf_lut", key, ".buffer",
+            profile->m_BRDFLutCachePath, sizeof(profile->m_BRDFLutCachePath));
+
+        if (file_cache_has_entry(profile->m_BRDFLutCachePath))
+        {
+            profile->m_BRDFLutSource = BRDF_LUT_SOURCE_CACHE;
+            return;
+        }
+    }
+
+#if defined(PBR_UTILS_EMBED_BRDF_LUT)
+    if (g_app.m_Params.m_BufferFormat     != BUFFER_FORMAT_FLOAT32 &&
+        g_app.m_BRDFLutPass.m_Size        == BRDF_LUT_EMBEDDED_SIZE &&
+        g_app.m_BRDFLutPass.m_SampleCount == BRDF_LUT_EMBEDDED_SAMPLE_COUNT &&
+        BRDF_LUT_VERSION                  == BRDF_LUT_EMBEDDED_VERSION)
+    {
+        profile->m_BRDFLutSource = BRDF_LUT_SOURCE_EMBEDDED;
+        return;
+    }
+#endif
+
+    profile->m_BRDFLutSource = (g_app.m_Params.m_Preview || generation_uses_environment_cube()) ? BRDF_LUT_SOURCE_GPU : BRDF_LUT_SOURCE_CPU;
+}
+
+static void resolve_brdf_lut_source()
+{
+    if (!(g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT))
+    {
+        return;
+    }
+
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
+    {
+        select_quality_profile(i);
+        resolve_profile_brdf_lut_source(get_quality_profile());
+    }
+    select_quality_profile(0);
+}
+
+// Names of every file the current parameters write into the output directory
+static int get_output_file_names(int prefilter_mipmap_count, char file_names[][64])
+{
+    int count = 0;
+    if ((g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE) && g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_BUFFER)
+    {
+        sprintf(file_names[count++], "irradiance.buffer");
+    }
+    if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
+    {
+        for (int mip = 0; mip < prefilter_mipmap_count; ++mip)
+        {
+            sprintf(file_names[count++], "prefilter_mm_%d.buffer", mip);
+        }
+    }
+    if (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT)
+    {
+        sprintf(file_names[count++], "brdf_lut.buffer");
+    }
+    if (g_app.m_Params.m_GenerateMetaData)
+    {
+        sprintf(file_names[count++], "environment.go");
+        sprintf(file_names[count++], "environment.script");
+    }
+    return count;
+}
+
+// Hash of the input file contents and everything that affects the outputs of the current profile.
+// The GPU and CPU engines don't give bit-identical results, so they are part of the key too. So are
+// the other profiles, smaller ones are downsampled from the larger ones.
+static uint64_t bake_cache_key(uint64_t input_hash)
+{
+    int quality_mask = 0;
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
+    {
+        quality_mask |= 1 << g_app.m_Quality.m_Profiles[i].m_Quality;
+    }
+
+    int key_data[] = {
+        BAKE_CACHE_VERSION,
+        BRDF_LUT_VERSION,
+        g_app.m_Params.m_GenerateMask,
+        g_app.m_Params.m_GenerateMetaData,
+        g_app.m_Params.m_IrradianceEngine,
+        g_app.m_Params.m_IrradianceOutput,
+        g_app.m_Params.m_PrefilterEngine,
+        g_app.m_Params.m_SHBands,
+        g_app.m_Params.m_BufferFormat,
+        g_app.m_Params.m_HDRFormat,
+        g_app.m_EnvironmentPass.m_Size,
+        g_app.m_DiffuseIrradiancePass.m_Size,
+        g_app.m_PrefilterPass.m_Size,
+        g_app.m_PrefilterPass.m_MipmapCount,
+        g_app.m_PrefilterPass.m_SampleCount,
+        g_app.m_BRDFLutPass.m_Size,
+        g_app.m_BRDFLutPass.m_SampleCount,
+        quality_mask
+    };
+
+    uint64_t key = hash_fnv1a_64(key_data, sizeof(key_data), input_hash);
+    return hash_fnv1a_64(&g_app.m_DiffuseIrradiancePass.m_SampleDelta, sizeof(float), key);
+}
+
+// The meta data refers to the input and output paths, so it's only shared by bakes into the same directory
+static void bake_cache_entry_path(uint64_t key, const char* path_input, const char* path_directory, const char* file_name, char* path_out, uint32_t path_out_size)
+{
+    const char* extension = strrchr(file_name, '.');
+    if (strcmp(extension, ".buffer") != 0)
+    {
+        key = hash_fnv1a_64(path_input, strlen(path_input) + 1, key);
+        key = hash_fnv1a_64(path_directory, strlen(path_directory) + 1, key);
+    }
+
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "bake_%.*s", (int) (extension - file_name), file_name);
+    file_cache_entry_path(g_app.m_Params.m_PathCacheDirectory, prefix, key, extension, path_out, path_out_size);
+}
+
+// Links (or copies) every output from the cache, fails without touching the outputs if any entry is missing
+static bool bake_cache_fetch(uint64_t key, const char* path_input, const char* path_directory)
+{
+    char file_names[MAX_OUTPUT_FILES][64];
+    char entry_paths[MAX_OUTPUT_FILES][512];
+    int file_count = get_output_file_names(g_app.m_PrefilterPass.m_MipmapCount, file_names);
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        bake_cache_entry_path(key, path_input, path_directory, file_names[i], entry_paths[i], sizeof(entry_paths[i]));
+        if (!file_cache_has_entry(entry_paths[i]))
+        {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        char output_path[MAX_OUTPUT_PATH];
+        if (!get_output_path(path_directory, file_names[i], output_path, sizeof(output_path)) ||
+            !file_cache_fetch(entry_paths[i], output_path))
+        {
+            LOG_ERROR("Unable to copy cached %s from %s\n", output_path, entry_paths[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bake_cache_store(const output_set* set)
+{
+    char file_names[MAX_OUTPUT_FILES][64];
+    int file_count = get_output_file_names(set->m_PrefilterMipmapCount, file_names);
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        char entry_path[512];
+        char output_path[MAX_OUTPUT_PATH];
+        bake_cache_entry_path(set->m_CacheKey, set->m_PathInput, set->m_PathDirectory, file_names[i], entry_path, sizeof(entry_path));
+
+        if (get_output_path(set->m_PathDirectory, file_names[i], output_path, sizeof(output_path)) &&
+            !file_cache_store(entry_path, output_path))
+        {
+            LOG_ERROR("Unable to store %s in cache %s\n", output_path, entry_path);
+        }
+    }
+}
+
+// Returns true if the outputs of every profile were materialized from the bake cache. Otherwise
+// input_hash_out receives the hash the cache keys of the outputs are made from once they have been
+// written (0 when caching is disabled).
+static bool bake_cache_lookup(const char* path_input, const char* path_directory, uint64_t* input_hash_out)
+{
+    *input_hash_out = 0;
+
+    uint64_t input_hash;
+    uint64_t profile_start = profile_begin();
+    if (!g_app.m_Params.m_PathCacheDirectory || !hash_file(path_input, FNV1A_64_SEED, &input_hash))
+    {
+        return false;
+    }
+
+    bool hit = true;
+    for (int i = 0; i < g_app.m_Quality.m_Count && hit; ++i)
+    {
+        select_quality_profile(i);
+
+        char directory[512];
+        hit = get_output_directory(path_directory, i, directory, sizeof(directory)) &&
+              bake_cache_fetch(bake_cache_key(input_hash), path_input, directory);
+    }
+    select_quality_profile(0);
+    profile_end("cache lookup", path_input, profile_start);
+
+    if (hit)
+    {
+        LOG_INFO("Outputs of %s are up to date, copied from cache into %s\n", path_input, path_directory);
+        return true;
+    }
+
+    *input_hash_out = input_hash;
+    return false;
+}
+
+// Drops the batch entries whose outputs came from the bake cache, returns the number of entries left
+static int skip_cached_batch_entries()
+{
+    int entry_count = 0;
+    for (int i = 0; i < g_app.m_Batch.m_EntryCount; ++i)
+    {
+        batch_entry entry = g_app.m_Batch.m_Entries[i];
+        if (!bake_cache_lookup(entry.m_PathInput, entry.m_PathDirectory, &entry.m_InputHash))
+        {
+            g_app.m_Batch.m_Entries[entry_count++] = entry;
+        }
+    }
+    g_app.m_Batch.m_EntryCount = entry_count;
+    return entry_count;
+}
+
+static void make_brdf_lut_targets()
+{
+    sg_image_desc brdf_lut_pass_image_desc = {
+        .type          = SG_IMAGETYPE_2D,
+        .render_target = true,
+        .width         = g_app.m_BRDFLutPass.m_Size,
+        .height        = g_app.m_BRDFLutPass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
+        .min_filter    = SG_FILTER_LINEAR,
+        .mag_filter    = SG_FILTER_LINEAR,
+        .wrap_u        = SG_WRAP_CLAMP_TO_EDGE,
+        .wrap_v        = SG_WRAP_CLAMP_TO_EDGE,
+        .label         = "color-image"
+    };
+
+    g_app.m_BRDFLutPass.m_Image = sg_make_image(&brdf_lut_pass_image_desc);
+
+    sg_image_desc depth_img_desc = {
+        .type          = SG_IMAGETYPE_2D,
+        .render_target = true,
+        .width         = g_app.m_BRDFLutPass.m_Size,
+        .height        = g_app.m_BRDFLutPass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_DEPTH,
+        .label         = "cubemap-depth-rt"
+    };
+
+    g_app.m_BRDFLutPass.m_DepthImage = sg_make_image(&depth_img_desc);
+
+    sg_pass_desc brdf_lut_pass_desc = {
+        .label = "offscreen-pass"
+    };
+
+    brdf_lut_pass_desc.depth_stencil_attachment.image = g_app.m_BRDFLutPass.m_DepthImage;
+    brdf_lut_pass_desc.color_attachments[0].image = g_app.m_BRDFLutPass.m_Image;
+    brdf_lut_pass_desc.color_attachments[0].slice = 0;
+
+    g_app.m_BRDFLutPass.m_Pass         = sg_make_pass(&brdf_lut_pass_desc);
+    g_app.m_BRDFLutPass.m_TargetSize   = g_app.m_BRDFLutPass.m_Size;
+    g_app.m_BRDFLutPass.m_RenderedSize = 0;
+}
+
+// Render targets follow the size of the current quality profile
+static void update_brdf_lut_targets()
+{
+    if (g_app.m_BRDFLutPass.m_TargetSize == g_app.m_BRDFLutPass.m_Size)
+    {
+        return;
+    }
+
+    sg_destroy_pass(g_app.m_BRDFLutPass.m_Pass);
+    sg_destroy_image(g_app.m_BRDFLutPass.m_DepthImage);
+    sg_destroy_image(g_app.m_BRDFLutPass.m_Image);
+    make_brdf_lut_targets();
+}
+
+static void make_brdf_lut_pass()
+{
+    make_brdf_lut_targets();
+
+    //g_app.m_BRDFLutPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
+    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.r = 0.0f;
+    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.g = 0.0f;
+    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.b = 0.0f;
+    g_app.m_BRDFLutPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+
+    float vertices[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f,
+        -1.0f,  1.0f, 0.0f, 1.0f,
+         1.0f,  1.0f, 1.0f, 1.0f,
+
+        -1.0f, -1.0f, 0.0f, 0.0f,
+         1.0f,  1.0f, 1.0f, 1.0f,
+         1.0f, -1.0f, 1.0f, 0.0f,
+    };
+
+    sg_buffer_desc brdf_lut_pass_buffer_desc = {
+        .data  = SG_RANGE(vertices),
+        .label = "triangle-vertices",
+    };
+
+    g_app.m_BRDFLutPass.m_Bindings.vertex_buffers[0] = sg_make_buffer(&brdf_lut_pass_buffer_desc);
+
+    sg_pipeline_desc brdf_lut_pass_pipeline_desc = {
+        .shader = sg_make_shader(pbr_brdf_lut_shader_desc(sg_query_backend())),
+        .layout = {},
+        .depth = {
+            .pixel_format  = SG_PIXELFORMAT_DEPTH,
+            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = true,
+        },
+        .cull_mode = SG_CULLMODE_NONE,
+        .label     = "pipeline_fullscreen"
+    };
+
+    brdf_lut_pass_pipeline_desc.colors[0].pixel_format                         = SG_PIXELFORMAT_RGBA32F;
+    brdf_lut_pass_pipeline_desc.layout.attrs[ATTR_brdf_lut_vs_position].format = SG_VERTEXFORMAT_FLOAT2;
+    brdf_lut_pass_pipeline_desc.layout.attrs[ATTR_brdf_lut_vs_texcoord].format = SG_VERTEXFORMAT_FLOAT2;
+
+    g_app.m_BRDFLutPass.m_Pipeline = sg_make_pipeline(&brdf_lut_pass_pipeline_desc);
+}
+
+static void make_prefilter_targets()
+{
+    sg_image_desc prefilter_pass_img_desc = {
+        .type          = SG_IMAGETYPE_CUBE,
+        .render_target = true,
+        .width         = g_app.m_PrefilterPass.m_Size,
+        .height        = g_app.m_PrefilterPass.m_Size,
+        .num_mipmaps   = g_app.m_PrefilterPass.m_MipmapCount,
+        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
+        .min_filter    = SG_FILTER_LINEAR,
+        .mag_filter    = SG_FILTER_LINEAR,
+        .wrap_u        = SG_WRAP_REPEAT,
+        .wrap_v        = SG_WRAP_REPEAT,
+        .label         = "color-image"
+    };
+
+    g_app.m_PrefilterPass.m_Image = sg_make_image(&prefilter_pass_img_desc);
+
+    g_app.m_PrefilterPass.m_Pass = (sg_pass*) malloc(sizeof(sg_pass) * g_app.m_PrefilterPass.m_MipmapCount * 6);
+
+    int pass_index = 0;
+    for (int mipmap = 0; mipmap < g_app.m_PrefilterPass.m_MipmapCount; ++mipmap)
+    {
+
+        sg_image_desc depth_img_desc = {
+            .type          = SG_IMAGETYPE_2D,
+            .render_target = true,
+            .width         = g_app.m_PrefilterPass.m_Size >> mipmap,
+            .height        = g_app.m_PrefilterPass.m_Size >> mipmap,
+            .pixel_format  = SG_PIXELFORMAT_DEPTH,
+            .label         = "cubemap-depth-rt"
+        };
+
+        g_app.m_PrefilterPass.m_DepthImages[mipmap] = sg_make_image(&depth_img_desc);
+
+        for (int i = 0; i < 6; ++i)
+        {
+            sg_pass_desc prefilter_pass_desc = {
+                .label = "offscreen-pass"
+            };
+            prefilter_pass_desc.depth_stencil_attachment.image = g_app.m_PrefilterPass.m_DepthImages[mipmap];
+            prefilter_pass_desc.color_attachments[0].image     = g_app.m_PrefilterPass.m_Image,
+            prefilter_pass_desc.color_attachments[0].mip_level = mipmap,
+            prefilter_pass_desc.color_attachments[0].slice     = i,
+
+            g_app.m_PrefilterPass.m_Pass[pass_index] = sg_make_pass(&prefilter_pass_desc);
+
+            pass_index++;
+        }
+    }
+
+    g_app.m_PrefilterPass.m_TargetSize = g_app.m_PrefilterPass.m_Size;
+}
+
+static void update_prefilter_targets()
+{
+    if (g_app.m_PrefilterPass.m_TargetSize == g_app.m_PrefilterPass.m_Size)
+    {
+        return;
+    }
+
+    int mipmap_count = 1 + floor(log2(g_app.m_PrefilterPass.m_TargetSize));
+    for (int mipmap = 0; mipmap < mipmap_count; ++mipmap)
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            sg_destroy_pass(g_app.m_PrefilterPass.m_Pass[mipmap * 6 + i]);
+        }
+        sg_destroy_image(g_app.m_PrefilterPass.m_DepthImages[mipmap]);
+    }
+    sg_destroy_image(g_app.m_PrefilterPass.m_Image);
+    free(g_app.m_PrefilterPass.m_Pass);
+    make_prefilter_targets();
+}
+
+static void make_prefilter_pass()
+{
+    //g_app.m_PrefilterPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
+    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.r = 0.0f;
+    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.g = 0.0f;
+    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.b = 0.0f;
+    g_app.m_PrefilterPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+
+    make_prefilter_targets();
+
+    sg_pipeline_desc prefilter_pass_pipeline_desc = {
+        .shader = sg_make_shader(pbr_prefilter_shader_desc(sg_query_backend())),
+        .layout = {
+        },
+        .depth = {
+            .pixel_format  = SG_PIXELFORMAT_DEPTH,
+            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = true,
+        },
+        .cull_mode              = SG_CULLMODE_NONE,
+        .label                  = "pipeline_fullscreen"
+    };
+
+    prefilter_pass_pipeline_desc.colors[0].pixel_format                         = SG_PIXELFORMAT_RGBA32F;
+    prefilter_pass_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
+
+    g_app.m_PrefilterPass.m_Pipeline = sg_make_pipeline(&prefilter_pass_pipeline_desc);
+
+    g_app.m_PrefilterPass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
+}
+
+static void make_diffuse_irradiance_targets()
+{
+    sg_image_desc diffuse_irridance_img_desc = {
+        .type          = SG_IMAGETYPE_CUBE,
+        .render_target = true,
+        .width         = g_app.m_DiffuseIrradiancePass.m_Size,
+        .height        = g_app.m_DiffuseIrradiancePass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
+        .min_filter    = SG_FILTER_LINEAR,
+        .mag_filter    = SG_FILTER_LINEAR,
+        .wrap_u        = SG_WRAP_REPEAT,
+        .wrap_v        = SG_WRAP_REPEAT,
+        .label         = "color-image"
+    };
+
+    g_app.m_DiffuseIrradiancePass.m_Image = sg_make_image(&diffuse_irridance_img_desc);
+
+    sg_image_desc diffuse_irridance_depth_img_desc = {
+        .type          = SG_IMAGETYPE_2D,
+        .render_target = true,
+        .width         = g_app.m_DiffuseIrradiancePass.m_Size,
+        .height        = g_app.m_DiffuseIrradiancePass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_DEPTH,
+        .label         = "cubemap-depth-rt"
+    };
+
+    g_app.m_DiffuseIrradiancePass.m_DepthImage = sg_make_image(&diffuse_irridance_depth_img_desc);
+
+    for (int i = 0; i < 6; ++i)
+    {
+
+        sg_pass_desc diffuse_irradiance_pass_desc = {
+            .label = "offscreen-pass"
+        };
+
+        diffuse_irradiance_pass_desc.depth_stencil_attachment.image = g_app.m_DiffuseIrradiancePass.m_DepthImage;
+        diffuse_irradiance_pass_desc.color_attachments[0].image = g_app.m_DiffuseIrradiancePass.m_Image;
+        diffuse_irradiance_pass_desc.color_attachments[0].slice = i;
+
+        g_app.m_DiffuseIrradiancePass.m_Pass[i] = sg_make_pass(&diffuse_irradiance_pass_desc);
+    }
+
+    g_app.m_DiffuseIrradiancePass.m_TargetSize   = g_app.m_DiffuseIrradiancePass.m_Size;
+    g_app.m_DiffuseIrradiancePass.m_RenderedSize = 0;
+}
+
+static void update_diffuse_irradiance_targets()
+{
+    if (g_app.m_DiffuseIrradiancePass.m_TargetSize == g_app.m_DiffuseIrradiancePass.m_Size)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        sg_destroy_pass(g_app.m_DiffuseIrradiancePass.m_Pass[i]);
+    }
+    sg_destroy_image(g_app.m_DiffuseIrradiancePass.m_DepthImage);
+    sg_destroy_image(g_app.m_DiffuseIrradiancePass.m_Image);
+    make_diffuse_irradiance_targets();
+}
+
+static void make_diffuse_irradiance_pass()
+{
+    //g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
+    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.r = 0.25f;
+    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.g = 0.25f;
+    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.b = 0.25f;
+    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.a = 1.0f;
+
+    make_diffuse_irradiance_targets();
+
+    sg_pipeline_desc diffuse_irradiance_pipeline_desc = {
+        .shader = sg_make_shader(pbr_diffuse_irradiance_shader_desc(sg_query_backend())),
+        .layout = {},
+        .depth = {
+            .pixel_format  = SG_PIXELFORMAT_DEPTH,
+            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = true,
+        },
+        .cull_mode              = SG_CULLMODE_NONE,
+        .label                  = "pipeline_fullscreen"
+    };
+
+    diffuse_irradiance_pipeline_desc.colors[0].pixel_format                        = SG_PIXELFORMAT_RGBA32F;
+    diffuse_irradiance_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
+
+    g_app.m_DiffuseIrradiancePass.m_Pipeline = sg_make_pipeline(&diffuse_irradiance_pipeline_desc);
+
+    g_app.m_DiffuseIrradiancePass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
+}
+
+static void make_environment_targets()
+{
+    sg_image_desc environment_pass_image_desc = {
+        .type          = SG_IMAGETYPE_CUBE,
+        .render_target = true,
+        .width         = g_app.m_EnvironmentPass.m_Size,
+        .height        = g_app.m_EnvironmentPass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
+        .sample_count  = 1,
+        .min_filter    = SG_FILTER_LINEAR_MIPMAP_LINEAR,
+        .mag_filter    = SG_FILTER_LINEAR,
+        .wrap_u        = SG_WRAP_REPEAT,
+        .wrap_v        = SG_WRAP_REPEAT,
+        .label         = "color-image"
+    };
+
+    g_app.m_EnvironmentPass.m_Image = sg_make_image(&environment_pass_image_desc);
+
+    sg_image_desc depth_img_desc = {
+        .type          = SG_IMAGETYPE_2D,
+        .render_target = true,
+        .width         = g_app.m_EnvironmentPass.m_Size,
+        .height        = g_app.m_EnvironmentPass.m_Size,
+        .pixel_format  = SG_PIXELFORMAT_DEPTH,
+        .sample_count  = 1,
+        .label         = "cubemap-depth-rt"
+    };
+
+    g_app.m_EnvironmentPass.m_DepthImage = sg_make_image(&depth_img_desc);
+
+    for (int i = 0; i < 6; ++i)
+    {
+        sg_pass_desc environment_pass_desc = {
+            .label = "offscreen-pass"
+        };
+
+        environment_pass_desc.depth_stencil_attachment.image = g_app.m_EnvironmentPass.m_DepthImage;
+        environment_pass_desc.color_attachments[0].image = g_app.m_EnvironmentPass.m_Image;
+        environment_pass_desc.color_attachments[0].slice = i;
+
+        g_app.m_EnvironmentPass.m_Pass[i] = sg_make_pass(&environment_pass_desc);
+    }
+
+    g_app.m_EnvironmentPass.m_TargetSize = g_app.m_EnvironmentPass.m_Size;
+}
+
+// The server can change the size between requests
+static void update_environment_targets()
+{
+    if (g_app.m_EnvironmentPass.m_TargetSize == g_app.m_EnvironmentPass.m_Size)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        sg_destroy_pass(g_app.m_EnvironmentPass.m_Pass[i]);
+    }
+    sg_destroy_image(g_app.m_EnvironmentPass.m_DepthImage);
+    sg_destroy_image(g_app.m_EnvironmentPass.m_Image);
+    make_environment_targets();
+}
+
+static void make_environment_pass()
+{
+    //g_app.m_EnvironmentPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
+    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.r = 0.25f;
+    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.g = 0.25f;
+    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.b = 0.25f;
+    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+
+    make_environment_targets();
+
+    sg_pipeline_desc environment_pass_pipeline_desc = {
+        .shader = sg_make_shader(pbr_shader_shader_desc(sg_query_backend())),
+        .depth = {
+            .pixel_format  = SG_PIXELFORMAT_DEPTH,
+            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = true,
+        },
+        .cull_mode              = SG_CULLMODE_NONE,
+        .sample_count           = 1,
+        .label                  = "pipeline_fullscreen"
+    };
+
+    environment_pass_pipeline_desc.colors[0].pixel_format                        = SG_PIXELFORMAT_RGBA32F;
+    environment_pass_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
+
+    g_app.m_EnvironmentPass.m_Pipeline                   = sg_make_pipeline(&environment_pass_pipeline_desc);
+    g_app.m_EnvironmentPass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
+
+    environment_pass_pipeline_desc.shader  = sg_make_shader(pbr_shader_rgbe_shader_desc(sg_query_backend()));
+    environment_pass_pipeline_desc.label   = "pipeline_fullscreen_rgbe";
+    g_app.m_EnvironmentPass.m_PipelineRGBE = sg_make_pipeline(&environment_pass_pipeline_desc);
+}
+
+static void make_display_pass(void)
+{
+    g_app.m_DisplayPass.m_PassAction.colors[0].load_action = SG_LOADACTION_CLEAR;
+    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.r = 0.0f;
+    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.g = 0.0f;
+    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.b = 0.0f;
+    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+
+    float vertices[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f,
+        -1.0f,  1.0f, 0.0f, 1.0f,
+         1.0f,  1.0f, 1.0f, 1.0f,
+
+        -1.0f, -1.0f, 0.0f, 0.0f,
+         1.0f,  1.0f, 1.0f, 1.0f,
+         1.0f, -1.0f, 1.0f, 0.0f,
+    };
+
+    sg_buffer_desc triangle_buffer_desc = {
+        .data  = SG_RANGE(vertices),
+        .label = "triangle-vertices",
+    };
+
+    g_app.m_DisplayPass.m_Bindings.vertex_buffers[0] = sg_make_buffer(&triangle_buffer_desc);
+
+    sg_pipeline_desc display_pass_pipeline_desc = {
+        .shader    = sg_make_shader(pbr_display_shader_desc(sg_query_backend())),
+        .cull_mode = SG_CULLMODE_NONE,
+        .label     = "pbr_pipeline"
+    };
+
+    display_pass_pipeline_desc.layout.attrs[ATTR_display_vs_position].format = SG_VERTEXFORMAT_FLOAT2;
+    display_pass_pipeline_desc.layout.attrs[ATTR_display_vs_texcoord].format = SG_VERTEXFORMAT_FLOAT2;
+
+    g_app.m_DisplayPass.m_Pipeline = sg_make_pipeline(&display_pass_pipeline_desc);
+}
+
+static void make_uniforms()
+{
+    vec3 eye, center, up;
+    #define SET_VIEW_MATRIX(ix, cx, cy, cz, ux, uy, uz) \
+        eye[0]    = 0.0f; eye[1]    = 0.0f; eye[2]    = 0.0f; \
+        center[0] = cx;   center[1] = cy;   center[2] = cz; \
+        up[0]     = ux;   up[1]     = uy;   up[2]     = uz; \
+        mat4x4_look_at(g_app.m_CubeViewMatrices[ix], eye, center, up);
+
+    SET_VIEW_MATRIX(0,  1.0f,  0.0f,  0.0f, 0.0f, -1.0f,  0.0f);
+    SET_VIEW_MATRIX(1, -1.0f,  0.0f,  0.0f, 0.0f, -1.0f,  0.0f);
+    SET_VIEW_MATRIX(2,  0.0f,  1.0f,  0.0f, 0.0f,  0.0f,  1.0f);
+    SET_VIEW_MATRIX(3,  0.0f, -1.0f,  0.0f, 0.0f,  0.0f, -1.0f);
+    SET_VIEW_MATRIX(4,  0.0f,  0.0f,  1.0f, 0.0f, -1.0f,  0.0f);
+    SET_VIEW_MATRIX(5,  0.0f,  0.0f, -1.0f, 0.0f, -1.0f,  0.0f);
+
+    #undef SET_VIEW_MATRIX
+}
+
+static void flip_image_y(void* pixels, int rows, int pitch)
+{
+    uint8_t* tmp_row = (uint8_t*) malloc(pitch * rows);
+    memcpy(tmp_row, pixels, pitch * rows);
+    for (int i = 0; i < rows; ++i)
+    {
+        uint8_t* write_ptr = (uint8_t*) pixels + pitch * i;
+        memcpy(write_ptr, tmp_row + (rows-i-1) * pitch, pitch);
+    }
+    free(tmp_row);
+}
+
+void write_prefilter(int side, int mipmap)
+{
+    uint32_t size        = g_app.m_PrefilterPass.m_Size >> mipmap;
+    uint32_t pixel_count = size * size * 4;
+    uint8_t* pixels      = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+
+    sg_query_image_pixels(g_app.m_PrefilterPass.m_Image, pixels, GL_TEXTURE_CUBE_MAP_POSITIVE_X + side, GL_UNSIGNED_BYTE, mipmap);
+
+    flip_image_y(pixels, size, size * 4);
+
+    char path_buffer[128];
+    sprintf(path_buffer, "build/debug_prefilter_mm%d_side%d.png", mipmap, side);
+
+    if (!stbi_write_png(path_buffer, size, size, 4, pixels, size * 4))
+    {
+        printf("Failed to write debug texture\n");
+    }
+    free(pixels);
+}
+
+void write_side(int side)
+{
+    uint32_t size        = g_app.m_DiffuseIrradiancePass.m_Size;
+    uint32_t pixel_count = size * size * 4;
+    uint8_t* pixels = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+
+    sg_query_image_pixels(g_app.m_DiffuseIrradiancePass.m_Image, pixels, GL_TEXTURE_CUBE_MAP_POSITIVE_X + side, GL_UNSIGNED_BYTE, 0);
+
+    char path_buffer[128];
+
+    sprintf(path_buffer, "debug_%d.png", side);
+
+    if (!stbi_write_png(path_buffer, size, size, 4, pixels, size * 4))
+    {
+        printf("Failed to write debug texture\n");
+    }
+    free(pixels);
+}
+
+void write_brdf_lut()
+{
+    uint32_t size        = g_app.m_BRDFLutPass.m_Size;
+    uint32_t pixel_count = size * size * 4;
+    uint8_t* pixels = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+
+    sg_query_image_pixels(g_app.m_BRDFLutPass.m_Image, pixels, GL_TEXTURE_2D, GL_UNSIGNED_BYTE, 0);
+
+    if (!stbi_write_png("brdf_lut.png", size, size, 4, pixels, size * 4))
+    {
+        printf("Failed to write debug texture\n");
+    }
+    free(pixels);
+}
+
+static bool write_bytes_to_file(const char* output_path, const void* data, uint32_t data_size)
+{
+    bool changed;
+    if (!output_file_write_all(output_path, data, data_size, &changed))
+    {
+        LOG_ERROR("Unable to write %s\n", output_path);
+        return false;
+    }
+    else if (!changed)
+    {
+        LOG_VERBOSE("%s is up to date\n", output_path);
+    }
+    return true;
+}
+
+bool directory_exists(const char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir)
+    {
+        closedir(dir);
+        return true;
+    }
+    return false;
+}
+
+static void ensure_unix_path(const char* file_path, char* buf)
+{
+    size_t path_len = strlen(file_path);
+
+    int read  = 0;
+    int write = 0;
+
+    if (file_path[1] == ':')
+    {
+        buf[0] = file_path[0];
+        read = 2;
+        write = 1;
+    }
+
+    for (; read < path_len; ++read, ++write)
+    {
+        if (file_path[read] == '\\')
+        {
+            buf[write] = '/';
+        }
+        else
+        {
+            buf[write] = file_path[read];
+        }
+    }
+}
+
+static void fill_base_name(const char* file_path, char* buf)
+{
+    size_t path_len = strlen(file_path);
+    uint32_t last_slash = 0;
+
+    for (int i = path_len; i >= 0; --i)
+    {
+        if (file_path[i] == '/' || file_path[i] == '\\')
+        {
+            last_slash = i;
+            break;
+        }
+    }
+
+    const char* ptr = file_path + last_slash + 1;
+    memcpy(buf, ptr, path_len - last_slash);
+    buf[path_len] = 0;
+}
+
+static void fill_base_directory(const char* directory_path, char* buf)
+{
+    uint32_t start_copy = 0;
+    size_t path_len = strlen(directory_path);
+
+    if (directory_path[0] == '/')
+    {
+        start_copy++;
+    }
+
+    buf[0]        = '/';
+    buf[path_len] = 0;
+
+    memcpy(buf + 1, directory_path + start_copy, path_len - start_copy);
+}
+
+#define ZERO_STR(the_path) memset(the_path, 0, sizeof(the_path))
+
+static bool write_meta_data_go(const char* path, const char* path_directory)
+{
+    const char* data_template =
+        "components {\n"
+        "  id: \"environment\"\n"
+        "  component: \"%s/environment.script\"\n"
+        "  position {\n"
+        "    x: 0.0\n"
+        "    y: 0.0\n"
+        "    z: 0.0\n"
+        "  }\n"
+        "  rotation {\n"
+        "    x: 0.0\n"
+        "    y: 0.0\n"
+        "    z: 0.0\n"
+        "    w: 1.0\n"
+        "  }\n"
+        "}\n";
+
+    char tmp_buffer[MAX_OUTPUT_PATH];
+    ZERO_STR(tmp_buffer);
+
+    char path_buffer[MAX_OUTPUT_PATH];
+    ZERO_STR(path_buffer);
+
+    ensure_unix_path(path_directory, tmp_buffer);
+    fill_base_directory(tmp_buffer, path_buffer);
+
+    char data_buffer[1024 + MAX_OUTPUT_PATH];
+    ZERO_STR(data_buffer);
+    snprintf(data_buffer, sizeof(data_buffer), data_template, path_buffer);
+
+    return write_bytes_to_file(path, data_buffer, strlen(data_buffer));
+}
+
+static bool write_meta_data_script(const char* path, const output_set* set)
+{
+    const char* script_template =
+        "go.property(\"irradiance_size\", %d)\n"
+        "go.property(\"prefilter_size\", %d)\n"
+        "go.property(\"prefilter_count\", %d)\n"
+        "go.property(\"brdf_lut_size\", %d)\n"
+        // layout of the \"data\" stream in all buffers
+        "go.property(\"buffer_stream_type\", hash(\"%s\"))\n"
+        "go.property(\"buffer_stream_count\", %d)\n"
+        // irradiance buffer resource or SH coefficients
+        "%s"
+        // add prefilter buffers as properties
+        "%s\n"
+        "local PBR = require(\"defold-pbr/core\")\n"
+        "function init(self)\n"
+        "    PBR.add_environment(\"%s\", go.get_id())\n"
+        "end\n"
+        "function on_message(self, message_id, message)\n"
+        "    if message_id == PBR.MESSAGES.LOAD_ENVIRONMENT then\n"
+        "        require(\"defold-pbr/scripts/helpers\").load_environment(PBR.context(), self)\n"
+        "    end\n"
+        "end\n";
+
+    char irradiance_project_path[MAX_OUTPUT_PATH];
+    ZERO_STR(irradiance_project_path);
+    snprintf(irradiance_project_path, sizeof(irradiance_project_path), "%s/irradiance.buffer", set->m_PathDirectory);
+
+    char tmp_buffer[MAX_OUTPUT_PATH];
+    ZERO_STR(tmp_buffer);
+
+    ensure_unix_path(irradiance_project_path, tmp_buffer);
+    fill_base_directory(tmp_buffer, irradiance_project_path);
+
+    char irradiance_properties[1024 * 4];
+    ZERO_STR(irradiance_properties);
+
+    if (g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_SH)
+    {
+        const sh_coefficients& sh = set->m_SH;
+        int coefficient_count     = sh.m_Bands * sh.m_Bands;
+
+        // Coefficients are already convolved with the cosine lobe (and divided by PI), the irradiance
+        // for a cubemap lookup direction n is sum(irradiance_sh_i.xyz * Y_i(n)) with the real SH basis
+        // ordered by band: Y00, Y1-1 (y), Y10 (z), Y11 (x), Y2-2 (xy), Y2-1 (yz), Y20 (3z^2-1), Y21 (xz), Y22 (x^2-y^2), ...
+        char* write_ptr = irradiance_properties;
+        write_ptr += sprintf(write_ptr, "go.property(\"irradiance_sh_count\", %d)\n", coefficient_count);
+
+        for (int i = 0; i < coefficient_count; ++i)
+        {
+            write_ptr += sprintf(write_ptr, "go.property(\"irradiance_sh_%d\", vmath.vector4(%.8g, %.8g, %.8g, 0))\n",
+                i, sh.m_Coefficients[i][0], sh.m_Coefficients[i][1], sh.m_Coefficients[i][2]);
+        }
+    }
+    else
+    {
+        snprintf(irradiance_properties, sizeof(irradiance_properties), "go.property(\"irradiance\", resource.buffer(\"%s\"))\n", irradiance_project_path);
+    }
+
+    char prefilter_property_buffers[CUBEMAP_MAX_MIPMAPS * (64 + MAX_OUTPUT_PATH)];
+    ZERO_STR(prefilter_property_buffers);
+
+    char* prefilter_property_write_ptr = prefilter_property_buffers;
+
+    for (int mip = 0; mip < set->m_PrefilterMipmapCount; ++mip)
+    {
+        char resource_buffer_project_path[MAX_OUTPUT_PATH];
+        ZERO_STR(resource_buffer_project_path);
+        ZERO_STR(tmp_buffer);
+
+        snprintf(resource_buffer_project_path, sizeof(resource_buffer_project_path), "%s/prefilter_mm_%d.buffer", set->m_PathDirectory, mip);
+
+        ensure_unix_path(resource_buffer_project_path, tmp_buffer);
+        fill_base_directory(tmp_buffer, resource_buffer_project_path);
+
+        int written = sprintf(prefilter_property_write_ptr, "go.property(\"prefilter_mm_%d\", resource.buffer(\"%s\"))\n", mip, resource_buffer_project_path);
+        prefilter_property_write_ptr += written;
+    }
+
+    char base_name[MAX_OUTPUT_PATH];
+    ZERO_STR(base_name);
+    fill_base_name(set->m_PathInput, base_name);
+
+    char data_buffer[1024 * 32];
+    ZERO_STR(data_buffer);
+    int data_size = snprintf(data_buffer, sizeof(data_buffer), script_template,
+        g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_SH ? 0 : set->m_IrradianceSize,
+        set->m_PrefilterSize,
+        set->m_PrefilterMipmapCount,
+        set->m_BRDFLutSize,
+        buffer_format_to_str(g_app.m_Params.m_BufferFormat),
+        buffer_format_stream_count(g_app.m_Params.m_BufferFormat),
+        irradiance_properties,
+        prefilter_property_buffers,
+        base_name);
+
+    if (data_size < 0 || data_size >= (int) sizeof(data_buffer))
+    {
+        LOG_ERROR("Unable to write %s, the script doesn't fit\n", path);
+        return false;
+    }
+    return write_bytes_to_file(path, data_buffer, data_size);
+}
+
+#undef ZERO_STR
+
+// Returns false if either file couldn't be written
+static bool write_meta_data(const output_set* set)
+{
+    char output_path_go[MAX_OUTPUT_PATH];
+    char output_path_script[MAX_OUTPUT_PATH];
+    if (!get_output_path(set->m_PathDirectory, "environment.go", output_path_go, sizeof(output_path_go)) ||
+        !get_output_path(set->m_PathDirectory, "environment.script", output_path_script, sizeof(output_path_script)))
+    {
+        return false;
+    }
+
+    bool result = write_meta_data_go(output_path_go, set->m_PathDirectory);
+    return write_meta_data_script(output_path_script, set) && result;
+}
+
+// Sends a single line message to the --serve client
+static void serve_send(const char* message)
+{
+    fputs(message, g_app.m_Serve.m_Out);
+    fputc('\n', g_app.m_Serve.m_Out);
+    fflush(g_app.m_Serve.m_Out);
+}
+
+static void serve_send_error(const char* id, int code, const char* message)
+{
+    char message_str[512];
+    json_write_string(message, message_str, sizeof(message_str));
+
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "{\"jsonrpc\":\"2.0\",\"id\":%s,\"error\":{\"code\":%d,\"message\":%s}}", id, code, message_str);
+    serve_send(buffer);
+}
+
+// Sent as notifications while a --serve request is running, no-op otherwise
+static void report_progress(const char* stage)
+{
+    if (!g_app.m_Serve.m_Out || !g_app.m_Serve.m_RequestId[0])
+    {
+        return;
+    }
+
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "{\"jsonrpc\":\"2.0\",\"method\":\"progress\",\"params\":{\"id\":%s,\"stage\":\"%s\"}}", g_app.m_Serve.m_RequestId, stage);
+    serve_send(buffer);
+}
+
+static uint32_t output_element_size()
+{
+    return g_app.m_Params.m_BufferFormat == BUFFER_FORMAT_FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+// Converts floats into the output buffer format
+static void convert_pixels(const float* pixels, uint32_t num_floats, uint8_t* data_out)
+{
+    if (g_app.m_Params.m_BufferFormat == BUFFER_FORMAT_FLOAT32)
+    {
+        memcpy(data_out, pixels, num_floats * sizeof(float));
+    }
+    else
+    {
+        float32_to_float16(pixels, num_floats, (uint16_t*) data_out);
+    }
+}
+
+static task_queue* get_output_writer()
+{
+    if (!g_app.m_Output.m_Writer)
+    {
+        g_app.m_Output.m_Writer = task_queue_create(OUTPUT_WRITER_THREADS);
+    }
+    return g_app.m_Output.m_Writer;
+}
+
+static void output_set_push_task(output_set* set, task_function function, void* context)
+{
+    assert(set->m_TaskCount < MAX_OUTPUT_SET_TASKS);
+    set->m_Tasks[set->m_TaskCount++] = task_queue_push(get_output_writer(), function, context);
+}
+
+static void output_set_wait(output_set* set)
+{
+    for (int i = 0; i < set->m_TaskCount; ++i)
+    {
+        task_queue_wait_task(g_app.m_Output.m_Writer, set->m_Tasks[i]);
+    }
+    set->m_TaskCount = 0;
+}
+
+// Picks the output set for the current profile of the next environment, waiting for the writers if
+// it's still in use. All outputs of a profile are in flight at the same time, so the arena holds every
+// buffer that one profile produces. Arenas are allocated once and reused by later generate() calls.
+static void output_set_begin()
+{
+    output_set* set         = &g_app.m_Output.m_Sets[g_app.m_Output.m_NextSet];
+    g_app.m_Output.m_NextSet = (g_app.m_Output.m_NextSet + 1) % OUTPUT_SET_COUNT;
+
+    output_set_wait(set);
+
+    uint32_t num_floats = 0;
+    if (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE)
+    {
+        num_floats += g_app.m_DiffuseIrradiancePass.m_Size * g_app.m_DiffuseIrradiancePass.m_Size * 4 * 6;
+    }
+    if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
+    {
+        for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+        {
+            int mipmap_size = g_app.m_PrefilterPass.m_Size >> mip;
+            num_floats += mipmap_size * mipmap_size * 4 * 6;
+        }
+    }
+    if (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT)
+    {
+        num_floats += g_app.m_BRDFLutPass.m_Size * g_app.m_BRDFLutPass.m_Size * 4;
+    }
+
+    uint32_t arena_size = num_floats * output_element_size();
+    if (arena_size > set->m_ArenaSize)
+    {
+        free(set->m_Arena);
+        set->m_Arena     = (uint8_t*) malloc(arena_size);
+        set->m_ArenaSize = arena_size;
+    }
+    set->m_ArenaOffset          = 0;
+    set->m_PathInput            = g_app.m_Params.m_PathInput;
+    set->m_IrradianceSize       = g_app.m_DiffuseIrradiancePass.m_Size;
+    set->m_PrefilterSize        = g_app.m_PrefilterPass.m_Size;
+    set->m_PrefilterMipmapCount = g_app.m_PrefilterPass.m_MipmapCount;
+    set->m_BRDFLutSize          = g_app.m_BRDFLutPass.m_Size;
+    set->m_StoreBRDFLut         = false;
+    set->m_CacheKey             = g_app.m_Output.m_InputHash ? bake_cache_key(g_app.m_Output.m_InputHash) : 0;
+    set->m_Failed               = !get_output_directory(g_app.m_Params.m_PathDirectory, g_app.m_Quality.m_Current, set->m_PathDirectory, sizeof(set->m_PathDirectory));
+
+    // Every buffer is checked once the set is written, not only the ones this profile uses
+    set->m_Irradiance.m_Failed = false;
+    set->m_BRDFLut.m_Failed    = false;
+    for (int mip = 0; mip < CUBEMAP_MAX_MIPMAPS; ++mip)
+    {
+        set->m_Prefilter[mip].m_Failed = false;
+    }
+
+    g_app.m_Output.m_Current = set;
+}
+
+// Cube pass slices are in GL order
+static const char* gl_side_names[] = { "+X", "-X", "+Y", "-Y", "+Z", "-Z" };
+
+static const int gl_to_defold_side_mapping[] = {
+    GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+    GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
+    GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+    GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+};
+
+// The output is written once all readbacks into it have finished. Takes ownership of source_pixels if set.
+static void output_buffer_init(output_buffer* output, const char* file_name, uint32_t num_floats, float* source_pixels)
+{
+    output_set* set    = g_app.m_Output.m_Current;
+    uint32_t data_size = num_floats * output_element_size();
+    assert(set->m_ArenaOffset + data_size <= set->m_ArenaSize);
+
+    if (!get_output_path(set->m_PathDirectory, file_name, output->m_Path, sizeof(output->m_Path)))
+    {
+        output->m_Failed = true;
+    }
+    output->m_Data             = set->m_Arena + set->m_ArenaOffset;
+    output->m_DataSize         = data_size;
+    output->m_SourcePixels     = source_pixels;
+    output->m_PendingReadbacks = 0;
+
+    set->m_ArenaOffset += data_size;
+}
+
+static void write_output_buffer_task(void* context)
+{
+    output_buffer* output = (output_buffer*) context;
+    if (output->m_SourcePixels)
+    {
+        uint64_t profile_start = profile_begin();
+        convert_pixels(output->m_SourcePixels, output->m_DataSize / output_element_size(), output->m_Data);
+        free(output->m_SourcePixels);
+        output->m_SourcePixels = 0;
+        profile_end("convert", output->m_Path, profile_start);
+    }
+
+    // Already failed if the path didn't fit or a readback into it was lost
+    uint64_t profile_start = profile_begin();
+    if (!output->m_Failed && !write_buffer_to_file(output->m_Path, g_app.m_Params.m_BufferFormat, output->m_Data, output->m_DataSize))
+    {
+        LOG_ERROR("Unable to write %s\n", output->m_Path);
+        output->m_Failed = true;
+    }
+    profile_end("serialize", output->m_Path, profile_start);
+}
+
+// Conversion and serialization run on a writer thread so they overlap with the remaining passes
+static void output_buffer_submit(output_buffer* output)
+{
+    output_set_push_task(g_app.m_Output.m_Current, write_output_buffer_task, output);
+}
+
+// Runs after the buffers of the set have been written
+static void write_output_set_task(void* context)
+{
+    output_set* set = (output_set*) context;
+
+    // Tasks are started in order, so the buffer tasks are either done or running on other threads
+    for (int i = 0; i < set->m_BufferTaskCount; ++i)
+    {
+        task_queue_wait_task(g_app.m_Output.m_Writer, set->m_Tasks[i]);
+    }
+
+    set->m_Failed = set->m_Failed || set->m_Irradiance.m_Failed || set->m_BRDFLut.m_Failed;
+    for (int mip = 0; mip < CUBEMAP_MAX_MIPMAPS; ++mip)
+    {
+        set->m_Failed = set->m_Failed || set->m_Prefilter[mip].m_Failed;
+    }
+
+    // A failed write leaves the previous file in place, which must not be cached for these parameters
+    if (set->m_StoreBRDFLut && !set->m_Failed)
+    {
+        char output_path_brdf_lut[MAX_OUTPUT_PATH];
+        if (get_output_path(set->m_PathDirectory, "brdf_lut.buffer", output_path_brdf_lut, sizeof(output_path_brdf_lut)) &&
+            !file_cache_store(set->m_BRDFLutCachePath, output_path_brdf_lut))
+        {
+            LOG_ERROR("Unable to store BRDF Lut in cache %s\n", set->m_BRDFLutCachePath);
+        }
+    }
+
+    uint64_t profile_start = profile_begin();
+    if (g_app.m_Params.m_GenerateMetaData)
+    {
+        set->m_Failed = !write_meta_data(set) || set->m_Failed;
+        profile_end("meta data", set->m_PathDirectory, profile_start);
+    }
+
+    if (set->m_CacheKey && set->m_Failed)
+    {
+        LOG_ERROR("Outputs in %s are incomplete, they are not stored in the cache\n", set->m_PathDirectory);
+    }
+    else if (set->m_CacheKey)
+    {
+        profile_start = profile_begin();
+        bake_cache_store(set);
+        profile_end("cache store", set->m_PathDirectory, profile_start);
+    }
+
+    LOG_VERBOSE("Writing complete!\n");
+}
+
+// Queues a download of a face / mip that has finished rendering, it's copied into the output
+// (at destination) once the fence has passed, see readback_poll.
+static void readback_queue(sg_image img_id, int target, int mipmap, int size, bool flip_y, output_buffer* output, uint8_t* destination)
+{
+    if (g_app.m_Output.m_ReadbackCount == MAX_PENDING_READBACKS)
+    {
+        LOG_ERROR("Too many pending readbacks\n");
+        exit(-1);
+    }
+
+    pending_readback& readback = g_app.m_Output.m_Readbacks[g_app.m_Output.m_ReadbackCount++];
+    readback.m_PBO         = sg_query_image_pixels_async(img_id, target, GL_FLOAT, mipmap, size * size * 4 * sizeof(float));
+    readback.m_Fence       = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.m_Output      = output;
+    readback.m_Destination = destination;
+    readback.m_Size        = size;
+    readback.m_FlipY       = flip_y;
+
+    output->m_PendingReadbacks++;
+}
+
+// Queues all six faces of a cubemap mip into a new output buffer in output layout
+static void readback_queue_cubemap(sg_image img_id, int mipmap, int size, output_buffer* output, const char* file_name)
+{
+    uint32_t num_floats_side = size * size * 4;
+    output_buffer_init(output, file_name, num_floats_side * 6, 0);
+
+    for (int side = 0; side < 6; ++side)
+    {
+        readback_queue(img_id, gl_to_defold_side_mapping[side], mipmap, size, true, output, output->m_Data + side * num_floats_side * output_element_size());
+    }
+}
+
+static void readback_consume(pending_readback* readback)
+{
+    uint64_t profile_start = profile_begin();
+
+    uint32_t row_floats = readback->m_Size * 4;
+    uint32_t pitch      = row_floats * sizeof(float);
+    uint32_t data_size  = pitch * readback->m_Size;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->m_PBO);
+    const uint8_t* mapped = (const uint8_t*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, data_size, GL_MAP_READ_BIT);
+
+    if (mapped)
+    {
+        // GL rows are bottom to top, flip and convert straight from the mapped buffer into the output
+        uint32_t dst_pitch = row_floats * output_element_size();
+        for (int row = 0; row < readback->m_Size; ++row)
+        {
+            int src_row = readback->m_FlipY ? readback->m_Size - 1 - row : row;
+            convert_pixels((const float*) (mapped + src_row * pitch), row_floats, readback->m_Destination + row * dst_pitch);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        LOG_ERROR("Unable to map readback buffer\n");
+        readback->m_Output->m_Failed = true;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteBuffers(1, &readback->m_PBO);
+    glDeleteSync(readback->m_Fence);
+
+    profile_end("readback", readback->m_Output->m_Path, profile_start);
+
+    if (--readback->m_Output->m_PendingReadbacks == 0)
+    {
+        output_buffer_submit(readback->m_Output);
+    }
+}
+
+// Hands finished downloads to the writer, when wait_all is set this blocks until every readback is done
+static void readback_poll(bool wait_all)
+{
+    // Make sure the queued commands and fences actually reach the GPU
+    glFlush();
+
+    int count = 0;
+    for (int i = 0; i < g_app.m_Output.m_ReadbackCount; ++i)
+    {
+        pending_readback* readback = &g_app.m_Output.m_Readbacks[i];
+        GLenum res = glClientWaitSync(readback->m_Fence, wait_all ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait_all ? GL_TIMEOUT_IGNORED : 0);
+
+        if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED)
+        {
+            readback_consume(readback);
+        }
+        else
+        {
+            g_app.m_Output.m_Readbacks[count++] = *readback;
+        }
+    }
+    g_app.m_Output.m_ReadbackCount = count;
+}
+
+void write_output_data()
+{
+    report_progress("write");
+
+    output_set* set          = g_app.m_Output.m_Current;
+    quality_profile* profile = get_quality_profile();
+
+    // Generate diffuse irradiance buffers
+    if ((g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE) && g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_BUFFER)
+    {
+        LOG_INFO("Writing irradiance images to %s/irradiance.buffer with type (%s)\n", set->m_PathDirectory, buffer_format_to_str(g_app.m_Params.m_BufferFormat));
+
+        // The CPU engine produces the cubemap in output layout, GPU readbacks were queued by generate()
+        if (g_app.m_DiffuseIrradiancePass.m_Pixels)
+        {
+            int size = g_app.m_DiffuseIrradiancePass.m_Size;
+            output_buffer_init(&set->m_Irradiance, "irradiance.buffer", size * size * 4 * 6, g_app.m_DiffuseIrradiancePass.m_Pixels);
+            output_buffer_submit(&set->m_Irradiance);
+            g_app.m_DiffuseIrradiancePass.m_Pixels = 0;
+        }
+    }
+
+    // Generate prefilter buffers
+    if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
+    {
+        LOG_INFO("Writing prefilter images to %s/prefilter*\n", set->m_PathDirectory);
+
+        // Same as for irradiance, only the CPU engine results are left to submit
+        if (g_app.m_PrefilterPass.m_Pixels)
+        {
+            for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+            {
+                int mipmap_size = g_app.m_PrefilterPass.m_Size >> mip;
+
+                char file_name[64];
+                sprintf(file_name, "prefilter_mm_%d.buffer", mip);
+                output_buffer_init(&set->m_Prefilter[mip], file_name, mipmap_size * mipmap_size * 4 * 6, g_app.m_PrefilterPass.m_Pixels[mip]);
+                output_buffer_submit(&set->m_Prefilter[mip]);
+            }
+            free(g_app.m_PrefilterPass.m_Pixels);
+            g_app.m_PrefilterPass.m_Pixels = 0;
+        }
+    }
+
+    // Generate BRDF buffer
+    if (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT)
+    {
+        char output_path_brdf_lut[MAX_OUTPUT_PATH];
+        bool has_path = get_output_path(set->m_PathDirectory, "brdf_lut.buffer", output_path_brdf_lut, sizeof(output_path_brdf_lut));
+        set->m_Failed = set->m_Failed || !has_path;
+
+        if (profile->m_BRDFLutSource == BRDF_LUT_SOURCE_CACHE)
+        {
+            LOG_INFO("Writing BRDF Lut to %s (cached)\n", output_path_brdf_lut);
+            if (has_path && strcmp(profile->m_BRDFLutCachePath, output_path_brdf_lut) != 0 &&
+                !file_cache_fetch(profile->m_BRDFLutCachePath, output_path_brdf_lut))
+            {
+                LOG_ERROR("Unable to copy cached BRDF Lut from %s\n", profile->m_BRDFLutCachePath);
+                set->m_Failed = true;
+            }
+        }
+        else
+        {
+            LOG_INFO("Writing BRDF Lut to %s\n", output_path_brdf_lut);
+
+            uint32_t pixel_count = g_app.m_BRDFLutPass.m_Size * g_app.m_BRDFLutPass.m_Size * 4;
+
+        #if defined(PBR_UTILS_EMBED_BRDF_LUT)
+            if (profile->m_BRDFLutSource == BRDF_LUT_SOURCE_EMBEDDED && has_path)
+            {
+                // Only used for the float16 formats, see resolve_brdf_lut_source
+                uint32_t half_float_buffer_data_size = pixel_count * sizeof(uint16_t);
+                uint16_t* half_float_buffer          = (uint16_t*) malloc(half_float_buffer_data_size);
 
-            g_app.m_PrefilterPass.m_Pass[pass_index] = sg_make_pass(&prefilter_pass_desc);
+                for (int i = 0; i < pixel_count / 4; ++i)
+                {
+                    half_float_buffer[i * 4 + 0] = BRDF_LUT_EMBEDDED_DATA[i * 2 + 0];
+                    half_float_buffer[i * 4 + 1] = BRDF_LUT_EMBEDDED_DATA[i * 2 + 1];
+                    half_float_buffer[i * 4 + 2] = 0x0000; // 0.0
+                    half_float_buffer[i * 4 + 3] = 0x3C00; // 1.0
+                }
 
-            pass_index++;
+                if (!write_buffer_to_file(output_path_brdf_lut, g_app.m_Params.m_BufferFormat, half_float_buffer, half_float_buffer_data_size))
+                {
+                    LOG_ERROR("Unable to write %s\n", output_path_brdf_lut);
+                    set->m_Failed = true;
+                }
+                free(half_float_buffer);
+            }
+            else
+        #endif
+            if (g_app.m_BRDFLutPass.m_Pixels)
+            {
+                output_buffer_init(&set->m_BRDFLut, "brdf_lut.buffer", pixel_count, g_app.m_BRDFLutPass.m_Pixels);
+                output_buffer_submit(&set->m_BRDFLut);
+                g_app.m_BRDFLutPass.m_Pixels = 0;
+            }
         }
     }
 
-    sg_pipeline_desc prefilter_pass_pipeline_desc = {
-        .shader = sg_make_shader(pbr_prefilter_shader_desc(sg_query_backend())),
-        .layout = {
-        },
-        .depth = {
-            .pixel_format  = SG_PIXELFORMAT_DEPTH,
-            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = true,
-        },
-        .cull_mode              = SG_CULLMODE_NONE,
-        .label                  = "pipeline_fullscreen"
-    };
-
-    prefilter_pass_pipeline_desc.colors[0].pixel_format                         = SG_PIXELFORMAT_RGBA32F;
-    prefilter_pass_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
-
-    g_app.m_PrefilterPass.m_Pipeline = sg_make_pipeline(&prefilter_pass_pipeline_desc);
-
-    g_app.m_PrefilterPass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
+    // The render targets are reused by the next environment, so the GPU readbacks have to finish here.
+    // Everything else (buffers, cache and meta data) is left to the writers.
+    readback_poll(true);
+    gpu_timers_collect();
+
+    // LUTs downsampled from another profile don't match their cache key
+    set->m_SH            = g_app.m_DiffuseIrradiancePass.m_SH;
+    set->m_StoreBRDFLut  = (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT) && profile->m_BRDFLutSource != BRDF_LUT_SOURCE_CACHE &&
+                           !(profile->m_BRDFLutSource == BRDF_LUT_SOURCE_GPU && g_app.m_BRDFLutPass.m_Downsampled) && g_app.m_Params.m_PathCacheDirectory;
+    set->m_BufferTaskCount = set->m_TaskCount;
+    snprintf(set->m_BRDFLutCachePath, sizeof(set->m_BRDFLutCachePath), "%s", profile->m_BRDFLutCachePath);
+    output_set_push_task(set, write_output_set_task, set);
 }
 
-static void make_diffuse_irradiance_pass()
+// Runs a CPU stage for every quality profile at once through libpbrutils, so the profiles share the
+// SH projection and the environment cube. Results are kept as float32 in the profiles, the output
+// writer converts them.
+static void bake_cpu(int generate_mask)
 {
-    g_app.m_DiffuseIrradiancePass.m_Size = 64;
-    //g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
-    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.r = 0.25f;
-    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.g = 0.25f;
-    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.b = 0.25f;
-    g_app.m_DiffuseIrradiancePass.m_PassAction.colors[0].clear_value.a = 1.0f;
-
-    sg_image_desc diffuse_irridance_img_desc = {
-        .type          = SG_IMAGETYPE_CUBE,
-        .render_target = true,
-        .width         = g_app.m_DiffuseIrradiancePass.m_Size,
-        .height        = g_app.m_DiffuseIrradiancePass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
-        .min_filter    = SG_FILTER_LINEAR,
-        .mag_filter    = SG_FILTER_LINEAR,
-        .wrap_u        = SG_WRAP_REPEAT,
-        .wrap_v        = SG_WRAP_REPEAT,
-        .label         = "color-image"
-    };
+    pbr_image image    = {};
+    image.m_Pixels      = g_app.m_EnvironmentTexture.m_Pixels;
+    image.m_Width       = g_app.m_EnvironmentTexture.m_Width;
+    image.m_Height      = g_app.m_EnvironmentTexture.m_Height;
+    image.m_PixelFormat = g_app.m_EnvironmentTexture.m_PixelFormat;
 
-    g_app.m_DiffuseIrradiancePass.m_Image = sg_make_image(&diffuse_irridance_img_desc);
+    int current_profile = g_app.m_Quality.m_Current;
 
-    sg_image_desc diffuse_irridance_depth_img_desc = {
-        .type          = SG_IMAGETYPE_2D,
-        .render_target = true,
-        .width         = g_app.m_DiffuseIrradiancePass.m_Size,
-        .height        = g_app.m_DiffuseIrradiancePass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_DEPTH,
-        .label         = "cubemap-depth-rt"
-    };
+    pbr_bake_params params[MAX_QUALITY_PROFILES];
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
+    {
+        select_quality_profile(i);
+
+        pbr_bake_params_default(&params[i]);
+        params[i].m_GenerateMask         = generate_mask;
+        params[i].m_EnvironmentSize      = g_app.m_EnvironmentPass.m_Size;
+        params[i].m_IrradianceSize       = g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_BUFFER ? g_app.m_DiffuseIrradiancePass.m_Size : 0;
+        params[i].m_SHBands              = g_app.m_Params.m_SHBands;
+        params[i].m_PrefilterSize        = g_app.m_PrefilterPass.m_Size;
+        params[i].m_PrefilterSampleCount = g_app.m_PrefilterPass.m_SampleCount;
+        params[i].m_BRDFLutSize          = g_app.m_BRDFLutPass.m_Size;
+        params[i].m_BRDFLutSampleCount   = g_app.m_BRDFLutPass.m_SampleCount;
+        params[i].m_BufferFormat         = PBR_BUFFER_FORMAT_FLOAT32;
+
+        if (g_app.m_Quality.m_Profiles[i].m_BRDFLutSource != BRDF_LUT_SOURCE_CPU)
+        {
+            params[i].m_GenerateMask &= ~PBR_GENERATE_BRDF_LUT;
+        }
+    }
+    select_quality_profile(current_profile);
 
-    sg_image depth_img = sg_make_image(&diffuse_irridance_depth_img_desc);
+    pbr_outputs outputs[MAX_QUALITY_PROFILES];
+    pbr_bake_profiles(get_context(), &image, params, g_app.m_Quality.m_Count, outputs);
 
-    for (int i = 0; i < 6; ++i)
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
     {
+        pbr_outputs* profile_outputs = &g_app.m_Quality.m_Profiles[i].m_CPUOutputs;
+        if (generate_mask & PBR_GENERATE_DIFFUSE_IRRADIANCE)
+        {
+            profile_outputs->m_Irradiance   = outputs[i].m_Irradiance;
+            profile_outputs->m_IrradianceSH = outputs[i].m_IrradianceSH;
+        }
+        if (generate_mask & PBR_GENERATE_BRDF_LUT)
+        {
+            profile_outputs->m_BRDFLut = outputs[i].m_BRDFLut;
+        }
+        if (generate_mask & PBR_GENERATE_PREFILTERED_ENVIRONMENT)
+        {
+            memcpy(profile_outputs->m_Prefilter, outputs[i].m_Prefilter, sizeof(outputs[i].m_Prefilter));
+            profile_outputs->m_PrefilterMipmapCount = outputs[i].m_PrefilterMipmapCount;
+        }
+    }
 
-        sg_pass_desc diffuse_irradiance_pass_desc = {
-            .label = "offscreen-pass"
-        };
+    g_app.m_Quality.m_CPUBakeMask |= generate_mask;
+}
 
-        diffuse_irradiance_pass_desc.depth_stencil_attachment.image = depth_img;
-        diffuse_irradiance_pass_desc.color_attachments[0].image = g_app.m_DiffuseIrradiancePass.m_Image;
-        diffuse_irradiance_pass_desc.color_attachments[0].slice = i;
+static void generate_diffuse_irradiance_cpu()
+{
+    LOG_INFO("Generating diffuse irradiance (CPU, %d SH coefficients)\n", g_app.m_Params.m_SHBands * g_app.m_Params.m_SHBands);
+    report_progress("irradiance");
 
-        g_app.m_DiffuseIrradiancePass.m_Pass[i] = sg_make_pass(&diffuse_irradiance_pass_desc);
+    // Without a buffer the coefficients go straight into the meta-data script
+    if (!(g_app.m_Quality.m_CPUBakeMask & PBR_GENERATE_DIFFUSE_IRRADIANCE))
+    {
+        uint64_t profile_start = profile_begin();
+        bake_cpu(PBR_GENERATE_DIFFUSE_IRRADIANCE);
+        profile_end("irradiance (cpu)", 0, profile_start);
     }
 
-    sg_pipeline_desc diffuse_irradiance_pipeline_desc = {
-        .shader = sg_make_shader(pbr_diffuse_irradiance_shader_desc(sg_query_backend())),
-        .layout = {},
-        .depth = {
-            .pixel_format  = SG_PIXELFORMAT_DEPTH,
-            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = true,
-        },
-        .cull_mode              = SG_CULLMODE_NONE,
-        .label                  = "pipeline_fullscreen"
-    };
+    pbr_outputs* outputs = &get_quality_profile()->m_CPUOutputs;
+    g_app.m_DiffuseIrradiancePass.m_SH     = outputs->m_IrradianceSH;
+    g_app.m_DiffuseIrradiancePass.m_Pixels = (float*) outputs->m_Irradiance.m_Data;
+    outputs->m_Irradiance.m_Data           = 0;
+}
 
-    diffuse_irradiance_pipeline_desc.colors[0].pixel_format                        = SG_PIXELFORMAT_RGBA32F;
-    diffuse_irradiance_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
+static void generate_brdf_lut_cpu()
+{
+    LOG_INFO("Generating BRDF Lut (CPU, %d threads)\n", pbr_context_thread_count(get_context()));
+    report_progress("brdf_lut");
 
-    g_app.m_DiffuseIrradiancePass.m_Pipeline = sg_make_pipeline(&diffuse_irradiance_pipeline_desc);
+    if (!(g_app.m_Quality.m_CPUBakeMask & PBR_GENERATE_BRDF_LUT))
+    {
+        uint64_t profile_start = profile_begin();
+        bake_cpu(PBR_GENERATE_BRDF_LUT);
+        profile_end("brdf_lut (cpu)", 0, profile_start);
+    }
 
-    g_app.m_DiffuseIrradiancePass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
+    pbr_outputs* outputs = &get_quality_profile()->m_CPUOutputs;
+    g_app.m_BRDFLutPass.m_Pixels = (float*) outputs->m_BRDFLut.m_Data;
+    outputs->m_BRDFLut.m_Data    = 0;
 }
 
-static void make_environment_pass()
+static void generate_prefilter_cpu()
 {
-    g_app.m_EnvironmentPass.m_Size                         = 1024;
-    //g_app.m_EnvironmentPass.m_PassAction.colors[0].load_action  = SG_LOADACTION_CLEAR;
-    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.r = 0.25f;
-    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.g = 0.25f;
-    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.b = 0.25f;
-    g_app.m_EnvironmentPass.m_PassAction.colors[0].clear_value.a = 1.0f;
-
-    sg_image_desc environment_pass_image_desc = {
-        .type          = SG_IMAGETYPE_CUBE,
-        .render_target = true,
-        .width         = g_app.m_EnvironmentPass.m_Size,
-        .height        = g_app.m_EnvironmentPass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_RGBA32F,
-        .sample_count  = 1,
-        .min_filter    = SG_FILTER_LINEAR_MIPMAP_LINEAR,
-        .mag_filter    = SG_FILTER_LINEAR,
-        .wrap_u        = SG_WRAP_REPEAT,
-        .wrap_v        = SG_WRAP_REPEAT,
-        .label         = "color-image"
-    };
+    LOG_INFO("Generating prefiltered environment (CPU, %d threads)\n", pbr_context_thread_count(get_context()));
+    report_progress("prefilter");
 
-    g_app.m_EnvironmentPass.m_Image = sg_make_image(&environment_pass_image_desc);
+    if (!(g_app.m_Quality.m_CPUBakeMask & PBR_GENERATE_PREFILTERED_ENVIRONMENT))
+    {
+        uint64_t profile_start = profile_begin();
+        bake_cpu(PBR_GENERATE_PREFILTERED_ENVIRONMENT);
+        profile_end("prefilter (cpu)", 0, profile_start);
+    }
 
-    sg_image_desc depth_img_desc = {
-        .type          = SG_IMAGETYPE_2D,
-        .render_target = true,
-        .width         = g_app.m_EnvironmentPass.m_Size,
-        .height        = g_app.m_EnvironmentPass.m_Size,
-        .pixel_format  = SG_PIXELFORMAT_DEPTH,
-        .sample_count  = 1,
-        .label         = "cubemap-depth-rt"
-    };
+    pbr_outputs* outputs = &get_quality_profile()->m_CPUOutputs;
+    g_app.m_PrefilterPass.m_Pixels = (float**) malloc(outputs->m_PrefilterMipmapCount * sizeof(float*));
+    for (int mip = 0; mip < outputs->m_PrefilterMipmapCount; ++mip)
+    {
+        g_app.m_PrefilterPass.m_Pixels[mip] = (float*) outputs->m_Prefilter[mip].m_Data;
+        outputs->m_Prefilter[mip].m_Data    = 0;
+    }
+}
 
-    sg_image depth_img = sg_make_image(&depth_img_desc);
+static void init_cubemap_uniforms(cubemap_uniforms_t* cubemap_uniforms)
+{
+    mat4x4 projection;
+    mat4x4_perspective(projection, 90 * (3.14159265359/180.0), 1.0f, 0.1f, 10.0f);
+    memset(cubemap_uniforms, 0, sizeof(cubemap_uniforms_t));
+    memcpy(&cubemap_uniforms->projection, projection, sizeof(mat4x4));
+}
 
-    for (int i = 0; i < 6; ++i)
+// Mipmap of an image rendered at rendered_size that is exactly size large, -1 if there is none
+static int get_downsampled_mipmap(int rendered_size, int size)
+{
+    for (int mip = 0; rendered_size > 0 && (rendered_size >> mip) >= size; ++mip)
     {
-        sg_pass_desc environment_pass_desc = {
-            .label = "offscreen-pass"
-        };
-
-        environment_pass_desc.depth_stencil_attachment.image = depth_img;
-        environment_pass_desc.color_attachments[0].image = g_app.m_EnvironmentPass.m_Image;
-        environment_pass_desc.color_attachments[0].slice = i;
+        if ((rendered_size >> mip) == size && (size << mip) == rendered_size)
+        {
+            return mip;
+        }
+    }
+    return -1;
+}
 
-        g_app.m_EnvironmentPass.m_Pass[i] = sg_make_pass(&environment_pass_desc);
+// Everything that is written for the current quality profile
+static void generate_quality_profile()
+{
+    if (g_app.m_Quality.m_Count > 1)
+    {
+        LOG_INFO("Generating %s profile\n", quality_to_str(get_quality_profile()->m_Quality));
     }
 
-    sg_pipeline_desc environment_pass_pipeline_desc = {
-        .shader = sg_make_shader(pbr_shader_shader_desc(sg_query_backend())),
-        .depth = {
-            .pixel_format  = SG_PIXELFORMAT_DEPTH,
-            .compare       = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = true,
-        },
-        .cull_mode              = SG_CULLMODE_NONE,
-        .sample_count           = 1,
-        .label                  = "pipeline_fullscreen"
-    };
+    output_set_begin();
 
-    environment_pass_pipeline_desc.colors[0].pixel_format                        = SG_PIXELFORMAT_RGBA32F;
-    environment_pass_pipeline_desc.layout.attrs[ATTR_cubemap_vs_position].format = SG_VERTEXFORMAT_FLOAT3;
+    cubemap_uniforms_t cubemap_uniforms;
+    init_cubemap_uniforms(&cubemap_uniforms);
 
-    g_app.m_EnvironmentPass.m_Pipeline                   = sg_make_pipeline(&environment_pass_pipeline_desc);
-    g_app.m_EnvironmentPass.m_Bindings.vertex_buffers[0] = g_app.m_Cube.vbuf;
-}
+    //////////////////////////////////////////////////////////////////////
+    // Diffuse irradiance pass
+    //////////////////////////////////////////////////////////////////////
 
-static void make_display_pass(void)
-{
-    g_app.m_DisplayPass.m_PassAction.colors[0].load_action = SG_LOADACTION_CLEAR;
-    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.r = 0.0f;
-    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.g = 0.0f;
-    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.b = 0.0f;
-    g_app.m_DisplayPass.m_PassAction.colors[0].clear_value.a = 1.0f;
+    if (generation_uses_gpu_irradiance())
+    {
+        // A larger profile of this environment has rendered the irradiance with at least as many
+        // samples, the smaller map is a mip of it
+        int mipmap = get_downsampled_mipmap(g_app.m_DiffuseIrradiancePass.m_RenderedSize, g_app.m_DiffuseIrradiancePass.m_Size);
+        if (mipmap >= 0 && g_app.m_DiffuseIrradiancePass.m_RenderedSampleDelta <= g_app.m_DiffuseIrradiancePass.m_SampleDelta)
+        {
+            LOG_INFO("Generating diffuse irradiance (downsampled from %d)\n", g_app.m_DiffuseIrradiancePass.m_RenderedSize);
+            report_progress("irradiance");
 
-    float vertices[] = {
-        -1.0f, -1.0f, 0.0f, 0.0f,
-        -1.0f,  1.0f, 0.0f, 1.0f,
-         1.0f,  1.0f, 1.0f, 1.0f,
+            if (mipmap > 0 && !g_app.m_DiffuseIrradiancePass.m_RenderedMipmaps)
+            {
+                gpu_timer_begin("irradiance mipmaps", 0);
+                sg_generate_mipmaps(g_app.m_DiffuseIrradiancePass.m_Image);
+                gpu_timer_end();
+                g_app.m_DiffuseIrradiancePass.m_RenderedMipmaps = true;
+            }
+        }
+        else
+        {
+            LOG_INFO("Generating diffuse irradiance\n");
+            report_progress("irradiance");
+            update_diffuse_irradiance_targets();
 
-        -1.0f, -1.0f, 0.0f, 0.0f,
-         1.0f,  1.0f, 1.0f, 1.0f,
-         1.0f, -1.0f, 1.0f, 0.0f,
-    };
+            diffuse_irradiance_uniforms_t irradiance_uniforms = {};
+            irradiance_uniforms.sample_delta = g_app.m_DiffuseIrradiancePass.m_SampleDelta;
 
-    sg_buffer_desc triangle_buffer_desc = {
-        .data  = SG_RANGE(vertices),
-        .label = "triangle-vertices",
-    };
+            g_app.m_DiffuseIrradiancePass.m_Bindings.fs_images[SLOT_env_map] = g_app.m_EnvironmentPass.m_Image;
+            for (int i = 0; i < 6; ++i)
+            {
+                memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
 
-    g_app.m_DisplayPass.m_Bindings.vertex_buffers[0] = sg_make_buffer(&triangle_buffer_desc);
+                sg_range cubemap_uniform_data    = SG_RANGE(cubemap_uniforms);
+                sg_range irradiance_uniform_data = SG_RANGE(irradiance_uniforms);
 
-    sg_pipeline_desc display_pass_pipeline_desc = {
-        .shader    = sg_make_shader(pbr_display_shader_desc(sg_query_backend())),
-        .cull_mode = SG_CULLMODE_NONE,
-        .label     = "pbr_pipeline"
-    };
+                gpu_timer_begin("irradiance", gl_side_names[i]);
+                sg_begin_pass(g_app.m_DiffuseIrradiancePass.m_Pass[i], &g_app.m_DiffuseIrradiancePass.m_PassAction);
+                sg_apply_pipeline(g_app.m_DiffuseIrradiancePass.m_Pipeline);
+                sg_apply_bindings(&g_app.m_DiffuseIrradiancePass.m_Bindings);
+                sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms, &cubemap_uniform_data);
+                sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_diffuse_irradiance_uniforms, &irradiance_uniform_data);
 
-    display_pass_pipeline_desc.layout.attrs[ATTR_display_vs_position].format = SG_VERTEXFORMAT_FLOAT2;
-    display_pass_pipeline_desc.layout.attrs[ATTR_display_vs_texcoord].format = SG_VERTEXFORMAT_FLOAT2;
+                sg_draw(0, g_app.m_Cube.num_elements, 1);
+                sg_end_pass();
+                gpu_timer_end();
+            }
 
-    g_app.m_DisplayPass.m_Pipeline = sg_make_pipeline(&display_pass_pipeline_desc);
-}
+            g_app.m_DiffuseIrradiancePass.m_RenderedSize        = g_app.m_DiffuseIrradiancePass.m_Size;
+            g_app.m_DiffuseIrradiancePass.m_RenderedSampleDelta = g_app.m_DiffuseIrradiancePass.m_SampleDelta;
+            g_app.m_DiffuseIrradiancePass.m_RenderedMipmaps     = false;
+            mipmap = 0;
+        }
 
-static void make_uniforms()
-{
-    vec3 eye, center, up;
-    #define SET_VIEW_MATRIX(ix, cx, cy, cz, ux, uy, uz) \
-        eye[0]    = 0.0f; eye[1]    = 0.0f; eye[2]    = 0.0f; \
-        center[0] = cx;   center[1] = cy;   center[2] = cz; \
-        up[0]     = ux;   up[1]     = uy;   up[2]     = uz; \
-        mat4x4_look_at(g_app.m_CubeViewMatrices[ix], eye, center, up);
+        if (g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_BUFFER)
+        {
+            readback_queue_cubemap(g_app.m_DiffuseIrradiancePass.m_Image, mipmap, g_app.m_DiffuseIrradiancePass.m_Size, &g_app.m_Output.m_Current->m_Irradiance, "irradiance.buffer");
+            readback_poll(false);
+        }
+    }
+    else if (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE)
+    {
+        generate_diffuse_irradiance_cpu();
+    }
 
-    SET_VIEW_MATRIX(0,  1.0f,  0.0f,  0.0f, 0.0f, -1.0f,  0.0f);
-    SET_VIEW_MATRIX(1, -1.0f,  0.0f,  0.0f, 0.0f, -1.0f,  0.0f);
-    SET_VIEW_MATRIX(2,  0.0f,  1.0f,  0.0f, 0.0f,  0.0f,  1.0f);
-    SET_VIEW_MATRIX(3,  0.0f, -1.0f,  0.0f, 0.0f,  0.0f, -1.0f);
-    SET_VIEW_MATRIX(4,  0.0f,  0.0f,  1.0f, 0.0f, -1.0f,  0.0f);
-    SET_VIEW_MATRIX(5,  0.0f,  0.0f, -1.0f, 0.0f, -1.0f,  0.0f);
+    //////////////////////////////////////////////////////////////////////
+    // BRDF Lookup table pass
+    //////////////////////////////////////////////////////////////////////
+    int brdf_lut_source = get_quality_profile()->m_BRDFLutSource;
+    if ((g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT) && brdf_lut_source == BRDF_LUT_SOURCE_GPU)
+    {
+        // Same as for irradiance, the LUT of a larger profile (or an earlier environment) is reused
+        int mipmap = get_downsampled_mipmap(g_app.m_BRDFLutPass.m_RenderedSize, g_app.m_BRDFLutPass.m_Size);
+        if (mipmap >= 0 && g_app.m_BRDFLutPass.m_RenderedSampleCount >= g_app.m_BRDFLutPass.m_SampleCount)
+        {
+            LOG_INFO("Generating BRDF Lut (from the %d lut)\n", g_app.m_BRDFLutPass.m_RenderedSize);
+            report_progress("brdf_lut");
 
-    #undef SET_VIEW_MATRIX
-}
+            if (mipmap > 0 && !g_app.m_BRDFLutPass.m_RenderedMipmaps)
+            {
+                gpu_timer_begin("brdf_lut mipmaps", 0);
+                sg_generate_mipmaps(g_app.m_BRDFLutPass.m_Image);
+                gpu_timer_end();
+                g_app.m_BRDFLutPass.m_RenderedMipmaps = true;
+            }
+            g_app.m_BRDFLutPass.m_Downsampled = mipmap > 0 || g_app.m_BRDFLutPass.m_RenderedSampleCount != g_app.m_BRDFLutPass.m_SampleCount;
+        }
+        else
+        {
+            LOG_INFO("Generating BRDF Lut\n");
+            report_progress("brdf_lut");
+            update_brdf_lut_targets();
 
-static void flip_image_y(void* pixels, int rows, int pitch)
-{
-    uint8_t* tmp_row = (uint8_t*) malloc(pitch * rows);
-    memcpy(tmp_row, pixels, pitch * rows);
-    for (int i = 0; i < rows; ++i)
+            brdf_lut_uniforms_t brdf_lut_uniforms = {};
+            brdf_lut_uniforms.sample_count = (float) g_app.m_BRDFLutPass.m_SampleCount;
+            sg_range brdf_lut_uniform_data = SG_RANGE(brdf_lut_uniforms);
+
+            gpu_timer_begin("brdf_lut", 0);
+            sg_begin_pass(g_app.m_BRDFLutPass.m_Pass, &g_app.m_BRDFLutPass.m_PassAction);
+            sg_apply_pipeline(g_app.m_BRDFLutPass.m_Pipeline);
+            sg_apply_bindings(&g_app.m_BRDFLutPass.m_Bindings);
+            sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_brdf_lut_uniforms, &brdf_lut_uniform_data);
+            sg_draw(0, 6, 1);
+            sg_end_pass();
+            gpu_timer_end();
+
+            g_app.m_BRDFLutPass.m_RenderedSize        = g_app.m_BRDFLutPass.m_Size;
+            g_app.m_BRDFLutPass.m_RenderedSampleCount = g_app.m_BRDFLutPass.m_SampleCount;
+            g_app.m_BRDFLutPass.m_RenderedMipmaps     = false;
+            g_app.m_BRDFLutPass.m_Downsampled         = false;
+            mipmap = 0;
+        }
+
+        int size = g_app.m_BRDFLutPass.m_Size;
+        output_buffer_init(&g_app.m_Output.m_Current->m_BRDFLut, "brdf_lut.buffer", size * size * 4, 0);
+        readback_queue(g_app.m_BRDFLutPass.m_Image, GL_TEXTURE_2D, mipmap, size, false, &g_app.m_Output.m_Current->m_BRDFLut, g_app.m_Output.m_Current->m_BRDFLut.m_Data);
+        readback_poll(false);
+    }
+    else if ((g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT) && brdf_lut_source == BRDF_LUT_SOURCE_CPU)
     {
-        uint8_t* write_ptr = (uint8_t*) pixels + pitch * i;
-        memcpy(write_ptr, tmp_row + (rows-i-1) * pitch, pitch);
+        generate_brdf_lut_cpu();
     }
-    free(tmp_row);
-}
 
-void write_prefilter(int side, int mipmap)
-{
-    uint32_t size        = 256 >> mipmap;
-    uint32_t pixel_count = size * size * 4;
-    uint8_t* pixels      = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+    //////////////////////////////////////////////////////////////////////
+    // Light prefilter pass
+    //////////////////////////////////////////////////////////////////////
+    // Every mip has its own roughness, so smaller chains can't be downsampled from larger ones
+    if (generation_uses_gpu_prefilter())
+    {
+        LOG_INFO("Generating prefiltered environment\n");
+        report_progress("prefilter");
+        update_prefilter_targets();
 
-    sg_query_image_pixels(g_app.m_PrefilterPass.m_Image, pixels, GL_TEXTURE_CUBE_MAP_POSITIVE_X + side, GL_UNSIGNED_BYTE, mipmap);
+        prefilter_uniforms_t prefilter_uniforms = {};
+        prefilter_uniforms.sample_count      = (float) g_app.m_PrefilterPass.m_SampleCount;
+        prefilter_uniforms.source_resolution = (float) g_app.m_EnvironmentPass.m_Size;
+        g_app.m_PrefilterPass.m_Bindings.fs_images[SLOT_tex_cube] = g_app.m_EnvironmentPass.m_Image;
 
-    flip_image_y(pixels, size, size * 4);
+        int pass_index = 0;
+        int mipmap_size = g_app.m_PrefilterPass.m_Size;
+        for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+        {
+            prefilter_uniforms.roughness = (float) mip / (float) (g_app.m_PrefilterPass.m_MipmapCount-1);
 
-    char path_buffer[128];
-    sprintf(path_buffer, "build/debug_prefilter_mm%d_side%d.png", mipmap, side);
+            char timer_name[32];
+            sprintf(timer_name, "prefilter mip %d", mip);
 
-    if (!stbi_write_png(path_buffer, size, size, 4, pixels, size * 4))
-    {
-        printf("Failed to write debug texture\n");
-    }
-    free(pixels);
-}
+            for (int i = 0; i < 6; ++i)
+            {
+                memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
 
-void write_side(int side)
-{
-    uint32_t pixel_count = 64 * 64 * 4;
-    uint8_t* pixels = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+                sg_range cubemap_uniform_data   = SG_RANGE(cubemap_uniforms);
+                sg_range prefilter_uniform_data = SG_RANGE(prefilter_uniforms);
 
-    sg_query_image_pixels(g_app.m_DiffuseIrradiancePass.m_Image, pixels, GL_TEXTURE_CUBE_MAP_POSITIVE_X + side, GL_UNSIGNED_BYTE, 0);
+                gpu_timer_begin(timer_name, gl_side_names[i]);
+                sg_begin_pass(g_app.m_PrefilterPass.m_Pass[pass_index], &g_app.m_PrefilterPass.m_PassAction);
 
-    char path_buffer[128];
+                sg_apply_viewport(0, 0, mipmap_size, mipmap_size, false);
 
-    sprintf(path_buffer, "debug_%d.png", side);
+                sg_apply_pipeline(g_app.m_PrefilterPass.m_Pipeline);
+                sg_apply_bindings(&g_app.m_PrefilterPass.m_Bindings);
+                sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms,   &cubemap_uniform_data);
+                sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_prefilter_uniforms, &prefilter_uniform_data);
 
-    if (!stbi_write_png(path_buffer, 64, 64, 4, pixels, 64 * 4))
-    {
-        printf("Failed to write debug texture\n");
-    }
-    free(pixels);
-}
+                sg_draw(0, g_app.m_Cube.num_elements, 1);
+                sg_end_pass();
+                gpu_timer_end();
 
-void write_brdf_lut()
-{
-    uint32_t pixel_count = 512 * 512 * 4;
-    uint8_t* pixels = (uint8_t*) malloc(pixel_count * sizeof(uint8_t));
+                pass_index++;
+            }
 
-    sg_query_image_pixels(g_app.m_BRDFLutPass.m_Image, pixels, GL_TEXTURE_2D, GL_UNSIGNED_BYTE, 0);
+            // Download this mip while the GPU keeps working on the next one
+            char file_name[64];
+            sprintf(file_name, "prefilter_mm_%d.buffer", mip);
+            readback_queue_cubemap(g_app.m_PrefilterPass.m_Image, mip, mipmap_size, &g_app.m_Output.m_Current->m_Prefilter[mip], file_name);
+            readback_poll(false);
 
-    if (!stbi_write_png("brdf_lut.png", 512, 512, 4, pixels, 512 * 4))
+            mipmap_size /= 2;
+        }
+    }
+    else if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
     {
-        printf("Failed to write debug texture\n");
+        generate_prefilter_cpu();
     }
-    free(pixels);
-}
 
-static void write_bytes_to_file(const char* output_path, uint8_t* data, uint32_t data_size)
-{
-    FILE* f              = fopen(output_path, "wb");
-    size_t bytes_written = fwrite(data, data_size, 1, f);
-    fclose(f);
+    //////////////////////////////////////////////////////////////////////
+    // Finally, write output data from generation
+    //////////////////////////////////////////////////////////////////////
+    write_output_data();
 }
 
-static void write_buffer_to_file(const char* output_path, uint8_t* data, uint32_t data_size)
+static void generate(void)
 {
-    FILE* f = fopen(output_path, "wb");
-
-    const char* data_template =
-        "[\n"
-        "    {\n"
-        "        \"name\": \"data\",\n"
-        "        \"type\": \"uint8\",\n"
-        "        \"count\": 1,\n"
-        "        \"data\": [%s]\n"
-        "    }\n"
-        "]\n";
-
+    uint64_t profile_start = profile_begin();
 
-    const uint32_t data_str_size = data_size * 4;
+    // Nothing of the previous environment can be reused
+    g_app.m_DiffuseIrradiancePass.m_RenderedSize = 0;
+    g_app.m_Quality.m_CPUBakeMask                = 0;
 
-    char* data_str_buffer = (char*) malloc(data_str_size);
-    char* data_str_buffer_write = data_str_buffer;
-    memset(data_str_buffer, 0, data_str_size);
-
-    for (int i = 0; i < data_size; ++i)
+    //////////////////////////////////////////////////////////////////////
+    // Generate cubemap environment from environment map, shared by all profiles
+    //////////////////////////////////////////////////////////////////////
+    if (generation_uses_environment_cube() || g_app.m_Params.m_Preview)
     {
-        assert((data_str_buffer_write - data_str_buffer) < data_str_size);
+        cubemap_uniforms_t cubemap_uniforms;
+        init_cubemap_uniforms(&cubemap_uniforms);
 
-        int written = 0;
-        if (i == (data_size-1))
-        {
-            written = sprintf(data_str_buffer_write, "%hhu", data[i]);
-        }
-        else
-        {
-            written = sprintf(data_str_buffer_write, "%hhu,", data[i]);
-        }
-        data_str_buffer_write += written;
-    }
+        update_environment_targets();
 
-    uint32_t template_size = strlen(data_template);
-    char* data_buffer = (char*) malloc(data_str_size + template_size);
-    memset(data_buffer, 0, data_str_size);
+        sg_pipeline pipeline = g_app.m_EnvironmentTexture.m_PixelFormat == PBR_PIXEL_FORMAT_RGBE8 ? g_app.m_EnvironmentPass.m_PipelineRGBE : g_app.m_EnvironmentPass.m_Pipeline;
 
-    sprintf(data_buffer, data_template, data_str_buffer);
+        g_app.m_EnvironmentPass.m_Bindings.fs_images[SLOT_tex] = g_app.m_EnvironmentTexture.m_Image;
+        for (int i = 0; i < 6; ++i)
+        {
+            memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
 
-    fwrite(data_buffer, strlen(data_buffer), 1, f);
+            sg_range cubemap_uniform_data = SG_RANGE(cubemap_uniforms);
 
-    fclose(f);
+            gpu_timer_begin("environment", gl_side_names[i]);
+            sg_begin_pass(g_app.m_EnvironmentPass.m_Pass[i], &g_app.m_EnvironmentPass.m_PassAction);
+            sg_apply_pipeline(pipeline);
+            sg_apply_bindings(&g_app.m_EnvironmentPass.m_Bindings);
+            sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms, &cubemap_uniform_data);
 
-    free(data_buffer);
-    free(data_str_buffer);
-}
+            _sg_image_t* img_before = _sg_lookup_image(&_sg.pools, g_app.m_EnvironmentPass.m_Image.id);
 
+            sg_draw(0, g_app.m_Cube.num_elements, 1);
+            sg_end_pass();
+            gpu_timer_end();
 
-///////////////////////////////////////////////////////////////////////////////////////////////
-// From: https://stackoverflow.com/questions/1659440/32-bit-to-16-bit-floating-point-conversion
-typedef uint16_t ushort;
-typedef uint32_t uint;
+            _sg_image_t* img_after = _sg_lookup_image(&_sg.pools, g_app.m_EnvironmentPass.m_Image.id);
+        }
 
-uint as_uint(const float x) {
-    return *(uint*)&x;
-}
-float as_float(const uint x) {
-    return *(float*)&x;
-}
+        _SG_GL_CHECK_ERROR();
 
-float half_to_float(const ushort x) { // IEEE-754 16-bit floating-point format (without infinity): 1-5-10, exp-15, +-131008.0, +-6.1035156E-5, +-5.9604645E-8, 3.311 digits
-    const uint e = (x&0x7C00)>>10; // exponent
-    const uint m = (x&0x03FF)<<13; // mantissa
-    const uint v = as_uint((float)m)>>23; // evil log2 bit hack to count leading zeros in denormalized format
-    return as_float((x&0x8000)<<16 | (e!=0)*((e+112)<<23|m) | ((e==0)&(m!=0))*((v-37)<<23|((m<<(150-v))&0x007FE000))); // sign : normalized : denormalized
-}
-ushort float_to_half(const float x) { // IEEE-754 16-bit floating-point format (without infinity): 1-5-10, exp-15, +-131008.0, +-6.1035156E-5, +-5.9604645E-8, 3.311 digits
-    const uint b = as_uint(x)+0x00001000; // round-to-nearest-even: add last bit after truncated mantissa
-    const uint e = (b&0x7F800000)>>23; // exponent
-    const uint m = b&0x007FFFFF; // mantissa; in line below: 0x007FF000 = 0x00800000-0x00001000 = decimal indicator flag - initial rounding
-    return (b&0x80000000)>>16 | (e>112)*((((e-112)<<10)&0x7C00)|m>>13) | ((e<113)&(e>101))*((((0x007FF000+m)>>(125-e))+1)>>1) | (e>143)*0x7FFF; // sign : normalized : denormalized : saturate
-}
-///////////////////////////////////////////////////////////////////////////////////////////////
+        gpu_timer_begin("environment mipmaps", 0);
+        sg_generate_mipmaps(g_app.m_EnvironmentPass.m_Image);
+        gpu_timer_end();
+    }
 
-static void float32_to_float16(float* floats_in, uint32_t num_floats_in, uint16_t* half_floats_out)
-{
-    for (int i = 0; i < num_floats_in; ++i)
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
     {
-        half_floats_out[i] = float_to_half(floats_in[i]);
+        select_quality_profile(i);
+        generate_quality_profile();
     }
-}
+    select_quality_profile(0);
 
-static void ensure_unix_path(const char* file_path, char* buf)
-{
-    size_t path_len = strlen(file_path);
+    free_environment_image();
 
-    int read  = 0;
-    int write = 0;
+    profile_end("generate", g_app.m_Params.m_PathInput, profile_start);
 
-    if (file_path[1] == ':')
-    {
-        buf[0] = file_path[0];
-        read = 2;
-        write = 1;
-    }
+    LOG_INFO("Finished generating!\n");
 
-    for (; read < path_len; ++read, ++write)
+#if 0
+    for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
     {
-        if (file_path[read] == '\\')
-        {
-            buf[write] = '/';
-        }
-        else
+        for (int i = 0; i < 6; ++i)
         {
-            buf[write] = file_path[read];
+            write_prefilter(i, mip);
         }
     }
+
+    write_side(0);
+    write_side(1);
+    write_side(2);
+    write_side(3);
+    write_side(4);
+    write_side(5);
+    write_brdf_lut();
+#endif
 }
 
-static void fill_base_name(const char* file_path, char* buf)
+// Threads are kept alive between the entries of a batch
+static void release_generation_resources()
 {
-    size_t path_len = strlen(file_path);
-    uint32_t last_slash = 0;
-
-    for (int i = path_len; i >= 0; --i)
+    if (g_app.m_Batch.m_Decoder)
     {
-        if (file_path[i] == '/' || file_path[i] == '\\')
-        {
-            last_slash = i;
-            break;
-        }
+        task_queue_destroy(g_app.m_Batch.m_Decoder);
+        g_app.m_Batch.m_Decoder = 0;
     }
 
-    const char* ptr = file_path + last_slash + 1;
-    memcpy(buf, ptr, path_len - last_slash);
-    buf[path_len] = 0;
-}
-
-static void fill_base_directory(const char* directory_path, char* buf)
-{
-    uint32_t start_copy = 0;
-    size_t path_len = strlen(directory_path);
-
-    if (directory_path[0] == '/')
+    if (g_app.m_Context)
     {
-        start_copy++;
+        pbr_context_destroy(g_app.m_Context);
+        g_app.m_Context = 0;
     }
 
-    buf[0]        = '/';
-    buf[path_len] = 0;
-
-    memcpy(buf + 1, directory_path + start_copy, path_len - start_copy);
+    if (g_app.m_Output.m_Writer)
+    {
+        task_queue_destroy(g_app.m_Output.m_Writer);
+        g_app.m_Output.m_Writer = 0;
+    }
 }
 
-#define ZERO_STR(the_path) memset(the_path, 0, sizeof(the_path))
-
-static void write_meta_data_go(const char* path)
+static bool upload_environment_image()
 {
-    FILE* f = fopen(path, "wb");
-
-    const char* data_template =
-        "components {\n"
-        "  id: \"environment\"\n"
-        "  component: \"%s/environment.script\"\n"
-        "  position {\n"
-        "    x: 0.0\n"
-        "    y: 0.0\n"
-        "    z: 0.0\n"
-        "  }\n"
-        "  rotation {\n"
-        "    x: 0.0\n"
-        "    y: 0.0\n"
-        "    z: 0.0\n"
-        "    w: 1.0\n"
-        "  }\n"
-        "}\n";
-
-    char tmp_buffer[256];
-    ZERO_STR(tmp_buffer);
+    destroy_environment_image();
+    return make_environment_image();
+}
 
-    char path_buffer[256];
-    ZERO_STR(path_buffer);
+static void decode_batch_entry_task(void* context)
+{
+    batch_entry* entry = (batch_entry*) context;
+    entry->m_Decoded   = decode_environment_image(entry->m_PathInput, g_app.m_Context, &entry->m_Image);
+}
 
-    ensure_unix_path(g_app.m_Params.m_PathDirectory, tmp_buffer);
-    fill_base_directory(tmp_buffer, path_buffer);
+// Starts decoding an upcoming entry on the decoder threads
+static void prefetch_batch_entry(int index)
+{
+    if (index >= g_app.m_Batch.m_EntryCount)
+    {
+        return;
+    }
 
-    char data_buffer[512];
-    ZERO_STR(data_buffer);
-    sprintf(data_buffer, data_template, path_buffer);
+    if (!g_app.m_Batch.m_Decoder)
+    {
+        g_app.m_Batch.m_Decoder = task_queue_create(BATCH_DECODE_THREADS);
+    }
 
-    fwrite(data_buffer, strlen(data_buffer), 1, f);
+    // The decoders run their scanlines on the CPU engine threads, they can't create the context themselves
+    get_context();
 
-    fclose(f);
+    batch_entry* entry   = &g_app.m_Batch.m_Entries[index];
+    entry->m_DecodeTask = task_queue_push(g_app.m_Batch.m_Decoder, decode_batch_entry_task, entry);
 }
 
-static void write_meta_data_script(const char* path)
+// Switches to the next environment of a batch. Only the environment texture is recreated,
+// shaders, pipelines, passes and render targets are shared by all entries.
+static bool load_batch_entry(int index)
 {
-    FILE* f = fopen(path, "wb");
-
-    const char* script_template =
-        "go.property(\"irradiance_size\", %d)\n"
-        "go.property(\"prefilter_size\", %d)\n"
-        "go.property(\"prefilter_count\", %d)\n"
-        "go.property(\"brdf_lut_size\", %d)\n"
-        // irradiance buffer resource
-        "go.property(\"irradiance\", resource.buffer(\"%s\"))\n"
-        // add prefilter buffers as properties
-        "%s\n"
-        "local PBR = require(\"defold-pbr/core\")\n"
-        "function init(self)\n"
-        "    PBR.add_environment(\"%s\", go.get_id())\n"
-        "end\n"
-        "function on_message(self, message_id, message)\n"
-        "    if message_id == PBR.MESSAGES.LOAD_ENVIRONMENT then\n"
-        "        require(\"defold-pbr/scripts/helpers\").load_environment(PBR.context(), self)\n"
-        "    end\n"
-        "end\n";
-
-    char irradiance_project_path[256];
-    ZERO_STR(irradiance_project_path);
-    sprintf(irradiance_project_path, "%s/irradiance.buffer", g_app.m_Params.m_PathDirectory);
-
-    char tmp_buffer[256];
-    ZERO_STR(tmp_buffer);
+    batch_entry& entry             = g_app.m_Batch.m_Entries[index];
+    g_app.m_Params.m_PathInput     = entry.m_PathInput;
+    g_app.m_Params.m_PathDirectory = entry.m_PathDirectory;
+    g_app.m_Output.m_InputHash     = entry.m_InputHash;
 
-    ensure_unix_path(irradiance_project_path, tmp_buffer);
-    fill_base_directory(tmp_buffer, irradiance_project_path);
+    LOG_INFO("Batch entry %d/%d: %s -> %s\n", index + 1, g_app.m_Batch.m_EntryCount, entry.m_PathInput, entry.m_PathDirectory);
 
-    char prefilter_property_buffers[1024 * 2];
-    ZERO_STR(prefilter_property_buffers);
+    uint64_t profile_start = profile_begin();
+    task_queue_wait_task(g_app.m_Batch.m_Decoder, entry.m_DecodeTask);
+    profile_end("decode wait", entry.m_PathInput, profile_start);
 
-    char* prefilter_property_write_ptr = prefilter_property_buffers;
+    // Keep the decoders BATCH_PREFETCH_COUNT entries ahead
+    prefetch_batch_entry(index + BATCH_PREFETCH_COUNT);
 
-    for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+    if (!entry.m_Decoded)
     {
-        char resource_buffer_project_path[256];
-        ZERO_STR(resource_buffer_project_path);
-        ZERO_STR(tmp_buffer);
-
-        sprintf(resource_buffer_project_path, "%s/prefilter_mm_%d.buffer", g_app.m_Params.m_PathDirectory, mip);
-
-        ensure_unix_path(resource_buffer_project_path, tmp_buffer);
-        fill_base_directory(tmp_buffer, resource_buffer_project_path);
-
-        int written = sprintf(prefilter_property_write_ptr, "go.property(\"prefilter_mm_%d\", resource.buffer(\"%s\"))\n", mip, resource_buffer_project_path);
-        prefilter_property_write_ptr += written;
+        return false;
     }
+    set_environment_image(&entry.m_Image);
 
-    char base_name[256];
-    ZERO_STR(base_name);
-    fill_base_name(g_app.m_Params.m_PathInput, base_name);
+    // Only created when there is a GL context
+    if (g_app.m_EnvironmentTexture.m_Image.id != SG_INVALID_ID)
+    {
+        return upload_environment_image();
+    }
+    return true;
+}
 
-    char data_buffer[1024 * 16];
-    ZERO_STR(data_buffer);
-    sprintf(data_buffer, script_template,
-        g_app.m_DiffuseIrradiancePass.m_Size,
-        g_app.m_PrefilterPass.m_Size,
-        g_app.m_PrefilterPass.m_MipmapCount,
-        g_app.m_BRDFLutPass.m_Size,
-        irradiance_project_path,
-        prefilter_property_buffers,
-        base_name);
+static bool serve_read_line(FILE* f, char** line, uint32_t* capacity)
+{
+    uint32_t len = 0;
+    while (true)
+    {
+        if (len + 1 >= *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 1024;
+            *line     = (char*) realloc(*line, *capacity);
+        }
 
-    fwrite(data_buffer, strlen(data_buffer), 1, f);
+        if (!fgets(*line + len, *capacity - len, f))
+        {
+            (*line)[len] = 0;
+            return len > 0;
+        }
 
-    fclose(f);
+        len += strlen(*line + len);
+        if (len > 0 && (*line)[len - 1] == '\n')
+        {
+            (*line)[len - 1] = 0;
+            return true;
+        }
+    }
 }
 
-#undef ZERO_STR
-
-static void write_meta_data(const char* go_path, const char* script_path)
+static void serve_send_bake_result(const char* id)
 {
-    write_meta_data_go(go_path);
-    write_meta_data_script(script_path);
+    if (!id[0])
+    {
+        return;
+    }
+
+    char input_str[512];
+    char output_str[512];
+    json_write_string(g_app.m_Params.m_PathInput, input_str, sizeof(input_str));
+    json_write_string(g_app.m_Params.m_PathDirectory, output_str, sizeof(output_str));
+
+    char buffer[2048];
+    snprintf(buffer, sizeof(buffer), "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":{\"input\":%s,\"output\":%s}}", id, input_str, output_str);
+    serve_send(buffer);
 }
 
-void write_output_data()
+// params: { "input": <path>, "output": <directory>, "generate": ["brdf"|"irradiance"|"prefilter"|"all", ...],
+//           "meta_data": <bool>, "buffer_format": "uint8"|"uint16"|"float32", "quality": "mobile,desktop",
+//           "environment_size", "irradiance_size", "irradiance_sample_delta", "prefilter_size",
+//           "prefilter_samples", "brdf_lut_size", "brdf_lut_samples": <number> }
+// Everything but input and output is optional and defaults to the command line arguments.
+static void serve_bake(const char* id, const json_value* params)
 {
-    int gl_to_defold_side_mapping[] = {
-        GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-    };
-
-    // Generate diffuse irradiance buffers
-    if (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE)
+    const json_value* input  = json_object_get(params, "input");
+    const json_value* output = json_object_get(params, "output");
+    if (!input || input->m_Type != JSON_STRING || !output || output->m_Type != JSON_STRING)
     {
-        char output_path_irridance[256];
-        sprintf(output_path_irridance, "%s/irradiance.buffer", g_app.m_Params.m_PathDirectory);
+        serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'input' and 'output' are required strings");
+        return;
+    }
 
-        LOG_INFO("Writing irradiance images to %s* with type (float16)\n", output_path_irridance);
+    if (!directory_exists(output->m_String))
+    {
+        serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "Output directory doesn't exist");
+        return;
+    }
 
-        // TODO: Output type should be configurable by arguments
+    // The request is freed once it has been handled, the paths have to outlive it
+    if (strlen(input->m_String) >= sizeof(g_app.m_Serve.m_PathInput) || strlen(output->m_String) >= sizeof(g_app.m_Serve.m_PathDirectory))
+    {
+        serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'input' or 'output' is too long");
+        return;
+    }
+    strcpy(g_app.m_Serve.m_PathInput, input->m_String);
+    strcpy(g_app.m_Serve.m_PathDirectory, output->m_String);
 
-        // buffer for each individual side
-        uint32_t data_size_side = g_app.m_DiffuseIrradiancePass.m_Size * g_app.m_DiffuseIrradiancePass.m_Size * 4 * sizeof(float);
-        float* pixels_side      = (float*) malloc(data_size_side);
+    g_app.m_Params                 = g_app.m_Serve.m_BaseParams;
+    g_app.m_Params.m_PathInput     = g_app.m_Serve.m_PathInput;
+    g_app.m_Params.m_PathDirectory = g_app.m_Serve.m_PathDirectory;
 
-        // pixel buffer for entire cubemap
-        uint32_t data_size = data_size_side * 6;
-        float* pixels      = (float*) malloc(data_size);
+    const json_value* generate_list = json_object_get(params, "generate");
+    if (generate_list)
+    {
+        int generation_mask = GENERATE_NONE;
+        for (uint32_t i = 0; generate_list->m_Type == JSON_ARRAY && i < generate_list->m_Count; ++i)
+        {
+            const char* value = generate_list->m_Children[i].m_Type == JSON_STRING ? generate_list->m_Children[i].m_String : "";
+            if (strcmp(value, "all") == 0)
+            {
+                generation_mask |= GENERATE_ALL;
+            }
+            else if (strcmp(value, "brdf") == 0)
+            {
+                generation_mask |= GENERATE_BRDF_LUT;
+            }
+            else if (strcmp(value, "irradiance") == 0)
+            {
+                generation_mask |= GENERATE_DIFFUSE_IRRADIANCE;
+            }
+            else if (strcmp(value, "prefilter") == 0)
+            {
+                generation_mask |= GENERATE_PREFILTERED_ENVIRONMENT;
+            }
+            else
+            {
+                generation_mask = GENERATE_NONE;
+                break;
+            }
+        }
 
-        for (int side = 0; side < 6; ++side)
+        if (generation_mask == GENERATE_NONE)
         {
-            sg_query_image_pixels(g_app.m_DiffuseIrradiancePass.m_Image, pixels_side, gl_to_defold_side_mapping[side], GL_FLOAT, 0);
-            flip_image_y(pixels_side, g_app.m_DiffuseIrradiancePass.m_Size, g_app.m_DiffuseIrradiancePass.m_Size * 4 * sizeof(float));
-
-            uint8_t* write_ptr = ((uint8_t*) pixels) + side * data_size_side;
-            memcpy(write_ptr, pixels_side, data_size_side);
+            serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'generate' must be a non-empty list of brdf, irradiance, prefilter or all");
+            return;
         }
-
-        uint32_t half_float_buffer_data_size = data_size / 2;
-        uint16_t* half_float_buffer          = (uint16_t*) malloc(data_size / 2);
-
-        float32_to_float16(pixels, data_size / sizeof(float), half_float_buffer);
-
-        write_buffer_to_file(output_path_irridance, (uint8_t*) half_float_buffer, half_float_buffer_data_size);
-
-        free(pixels_side);
-        free(pixels);
-        free(half_float_buffer);
+        g_app.m_Params.m_GenerateMask = generation_mask;
     }
 
-    // Generate prefilter buffers
-    if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
+    const json_value* meta_data = json_object_get(params, "meta_data");
+    if (meta_data && meta_data->m_Type == JSON_BOOL)
     {
-        char output_path_prefiter_base[256];
-        sprintf(output_path_prefiter_base, "%s/prefilter", g_app.m_Params.m_PathDirectory);
+        g_app.m_Params.m_GenerateMetaData = meta_data->m_Bool || g_app.m_Params.m_IrradianceOutput == IRRADIANCE_OUTPUT_SH;
+    }
 
-        LOG_INFO("Writing prefilter images to %s*\n", output_path_prefiter_base);
+    const json_value* buffer_format = json_object_get(params, "buffer_format");
+    if (buffer_format)
+    {
+        const char* value = buffer_format->m_Type == JSON_STRING ? buffer_format->m_String : "";
+        if (strcmp(value, "uint8") == 0)
+        {
+            g_app.m_Params.m_BufferFormat = BUFFER_FORMAT_UINT8;
+        }
+        else if (strcmp(value, "uint16") == 0)
+        {
+            g_app.m_Params.m_BufferFormat = BUFFER_FORMAT_UINT16;
+        }
+        else if (strcmp(value, "float32") == 0)
+        {
+            g_app.m_Params.m_BufferFormat = BUFFER_FORMAT_FLOAT32;
+        }
+        else
+        {
+            serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'buffer_format' must be uint8, uint16 or float32");
+            return;
+        }
+    }
 
-        // buffer for each individual side
-        uint32_t data_size_side = g_app.m_PrefilterPass.m_Size * g_app.m_PrefilterPass.m_Size * 4 * sizeof(float);
-        float* pixels_side      = (float*) malloc(data_size_side);
+    const json_value* quality = json_object_get(params, "quality");
+    if (quality && (quality->m_Type != JSON_STRING || !parse_qualities(quality->m_String, &g_app.m_Params)))
+    {
+        serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'quality' must be a comma separated list of mobile, desktop or reference");
+        return;
+    }
 
-        uint32_t data_size = data_size_side * 6;
-        float* pixels      = (float*) malloc(data_size);
+    // Same limits as the command line arguments
+    struct
+    {
+        const char* m_Key;
+        int         m_MaxValue;
+        int*        m_Value;
+    } overrides[] = {
+        { "environment_size",  MAX_PASS_SIZE,    &g_app.m_Params.m_EnvironmentSize },
+        { "irradiance_size",   MAX_PASS_SIZE,    &g_app.m_Params.m_IrradianceSize },
+        { "prefilter_size",    MAX_PASS_SIZE,    &g_app.m_Params.m_PrefilterSize },
+        { "prefilter_samples", MAX_SAMPLE_COUNT, &g_app.m_Params.m_PrefilterSampleCount },
+        { "brdf_lut_size",     MAX_PASS_SIZE,    &g_app.m_Params.m_BRDFLutSize },
+        { "brdf_lut_samples",  MAX_SAMPLE_COUNT, &g_app.m_Params.m_BRDFLutSampleCount },
+    };
 
-        for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+    for (uint32_t i = 0; i < sizeof(overrides) / sizeof(overrides[0]); ++i)
+    {
+        const json_value* value = json_object_get(params, overrides[i].m_Key);
+        if (!value)
         {
-            uint32_t mipmap_size           = g_app.m_PrefilterPass.m_Size >> mip;
-            uint32_t mipmap_data_size_side = mipmap_size * mipmap_size * 4 * sizeof(float);
-            uint32_t mipmap_data_size      = mipmap_data_size_side * 6;
-
-            for (int side = 0; side < 6; ++side)
-            {
-                sg_query_image_pixels(g_app.m_PrefilterPass.m_Image, pixels_side, gl_to_defold_side_mapping[side], GL_FLOAT, mip);
-                flip_image_y(pixels_side, mipmap_size, mipmap_size * 4 * sizeof(float));
+            continue;
+        }
 
-                uint8_t* write_ptr = ((uint8_t*) pixels) + side * mipmap_data_size_side;
-                memcpy(write_ptr, pixels_side, mipmap_data_size_side);
-            }
+        if (value->m_Type != JSON_NUMBER || value->m_Number != floor(value->m_Number) || value->m_Number <= 0 || value->m_Number > overrides[i].m_MaxValue)
+        {
+            char message[128];
+            snprintf(message, sizeof(message), "'%s' must be an integer between 1 and %d", overrides[i].m_Key, overrides[i].m_MaxValue);
+            serve_send_error(id, RPC_ERROR_INVALID_PARAMS, message);
+            return;
+        }
+        *overrides[i].m_Value = (int) value->m_Number;
+    }
 
-            char output_path_prefite_slice[128];
-            sprintf(output_path_prefite_slice, "%s_mm_%d.buffer", output_path_prefiter_base, mip);
+    const json_value* sample_delta = json_object_get(params, "irradiance_sample_delta");
+    if (sample_delta)
+    {
+        if (sample_delta->m_Type != JSON_NUMBER || sample_delta->m_Number <= 0.0 || sample_delta->m_Number > 1.0)
+        {
+            serve_send_error(id, RPC_ERROR_INVALID_PARAMS, "'irradiance_sample_delta' must be a number in (0, 1]");
+            return;
+        }
+        g_app.m_Params.m_IrradianceSampleDelta = (float) sample_delta->m_Number;
+    }
 
-            uint32_t half_float_buffer_data_size = mipmap_data_size / 2;
-            uint16_t* half_float_buffer          = (uint16_t*) malloc(mipmap_data_size / 2);
+    // Profiles and pass sizes follow the request, the passes resize their targets when they run
+    init_quality_profiles();
 
-            float32_to_float16(pixels, mipmap_data_size / sizeof(float), half_float_buffer);
+    LOG_INFO("Bake request: %s -> %s\n", g_app.m_Params.m_PathInput, g_app.m_Params.m_PathDirectory);
 
-            write_buffer_to_file(output_path_prefite_slice, (uint8_t*) half_float_buffer, half_float_buffer_data_size);
+    if (bake_cache_lookup(g_app.m_Params.m_PathInput, g_app.m_Params.m_PathDirectory, &g_app.m_Output.m_InputHash))
+    {
+        serve_send_bake_result(id);
+        return;
+    }
 
-            free(half_float_buffer);
-        }
+    resolve_brdf_lut_source();
 
-        free(pixels);
-        free(pixels_side);
+    if (!load_environment_image() || (generation_uses_environment_cube() && !upload_environment_image()))
+    {
+        free_environment_image();
+        serve_send_error(id, RPC_ERROR_BAKE_FAILED, "Unable to load input image");
+        return;
     }
 
-    // Generate BRDF buffer
-    if (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT)
+    // The sets are idle since the previous request waited for them. Those this bake doesn't use
+    // must not report the failures of an earlier one.
+    for (int i = 0; i < OUTPUT_SET_COUNT; ++i)
     {
-        char output_path_brdf_lut[256];
-        sprintf(output_path_brdf_lut, "%s/brdf_lut.buffer", g_app.m_Params.m_PathDirectory);
-        LOG_INFO("Writing BRDF Lut to %s\n", output_path_brdf_lut);
-
-        uint32_t pixel_count    = g_app.m_BRDFLutPass.m_Size * g_app.m_BRDFLutPass.m_Size * 4;
-        uint32_t data_size      = pixel_count * sizeof(float);
-        float* pixels           = (float*) malloc(data_size);
-        sg_query_image_pixels(g_app.m_BRDFLutPass.m_Image, pixels, GL_TEXTURE_2D, GL_FLOAT, 0);
-
-        uint32_t half_float_buffer_data_size = data_size / 2;
-        uint16_t* half_float_buffer          = (uint16_t*) malloc(half_float_buffer_data_size);
+        g_app.m_Output.m_Sets[i].m_Failed = false;
+    }
 
-        float32_to_float16(pixels, pixel_count, half_float_buffer);
-        write_buffer_to_file(output_path_brdf_lut, (uint8_t*) half_float_buffer, half_float_buffer_data_size);
+    generate();
 
-        free(half_float_buffer);
-        free(pixels);
+    // The client is told once every file is on disk
+    bool failed = false;
+    for (int i = 0; i < OUTPUT_SET_COUNT; ++i)
+    {
+        output_set_wait(&g_app.m_Output.m_Sets[i]);
+        failed = failed || g_app.m_Output.m_Sets[i].m_Failed;
     }
 
-    // Generate meta data
-    if (g_app.m_Params.m_GenerateMetaData)
+    if (failed)
     {
-        char output_path_go[256];
-        sprintf(output_path_go, "%s/environment.go", g_app.m_Params.m_PathDirectory);
-
-        char output_path_script[256];
-        sprintf(output_path_script, "%s/environment.script", g_app.m_Params.m_PathDirectory);
-        write_meta_data(output_path_go, output_path_script);
+        serve_send_error(id, RPC_ERROR_BAKE_FAILED, "Unable to write the outputs");
+        return;
     }
-
-    LOG_VERBOSE("Writing complete!\n");
+    serve_send_bake_result(id);
 }
 
-void frame(void)
+// Handles line delimited JSON-RPC requests until the input ends, returns true if the client asked for a shutdown
+static bool serve_connection(FILE* in, FILE* out)
 {
-    mat4x4 projection;
-    mat4x4_perspective(projection, 90 * (3.14159265359/180.0), 1.0f, 0.1f, 10.0f);
-    cubemap_uniforms_t cubemap_uniforms = {};
-    memcpy(&cubemap_uniforms.projection, projection, sizeof(mat4x4));
+    g_app.m_Serve.m_Out = out;
 
-    if (!g_app.m_IsDone)
+    char* line        = 0;
+    uint32_t capacity = 0;
+    bool shutdown     = false;
+
+    while (!shutdown && serve_read_line(in, &line, &capacity))
     {
-        //////////////////////////////////////////////////////////////////////
-        // Generate cubemap environment from environment map
-        //////////////////////////////////////////////////////////////////////
-        g_app.m_EnvironmentPass.m_Bindings.fs_images[SLOT_tex] = g_app.m_EnvironmentTexture.m_Image;
-        for (int i = 0; i < 6; ++i)
+        const char* read_ptr = line;
+        while (isspace((unsigned char) *read_ptr))
         {
-            memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
-
-            sg_range cubemap_uniform_data = SG_RANGE(cubemap_uniforms);
+            read_ptr++;
+        }
+        if (*read_ptr == 0)
+        {
+            continue;
+        }
 
-            sg_begin_pass(g_app.m_EnvironmentPass.m_Pass[i], &g_app.m_EnvironmentPass.m_PassAction);
-            sg_apply_pipeline(g_app.m_EnvironmentPass.m_Pipeline);
-            sg_apply_bindings(&g_app.m_EnvironmentPass.m_Bindings);
-            sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms, &cubemap_uniform_data);
+        json_value* request = json_parse(line);
+        if (!request || request->m_Type != JSON_OBJECT)
+        {
+            serve_send_error("null", RPC_ERROR_PARSE, "Parse error");
+            json_free(request);
+            continue;
+        }
 
-            _sg_image_t* img_before = _sg_lookup_image(&_sg.pools, g_app.m_EnvironmentPass.m_Image.id);
+        // Requests without an id are notifications and don't get any replies
+        const json_value* id_value = json_object_get(request, "id");
+        char* id = g_app.m_Serve.m_RequestId;
+        id[0]    = 0;
+        if (id_value && id_value->m_Type == JSON_NUMBER)
+        {
+            snprintf(id, sizeof(g_app.m_Serve.m_RequestId), "%.17g", id_value->m_Number);
+        }
+        else if (id_value && id_value->m_Type == JSON_STRING)
+        {
+            json_write_string(id_value->m_String, id, sizeof(g_app.m_Serve.m_RequestId));
+        }
 
-            sg_draw(0, g_app.m_Cube.num_elements, 1);
-            sg_end_pass();
+        const json_value* method = json_object_get(request, "method");
+        const json_value* params = json_object_get(request, "params");
 
-            _sg_image_t* img_after = _sg_lookup_image(&_sg.pools, g_app.m_EnvironmentPass.m_Image.id);
+        if (!method || method->m_Type != JSON_STRING)
+        {
+            serve_send_error(id[0] ? id : "null", RPC_ERROR_INVALID_REQUEST, "Invalid request");
+        }
+        else if (strcmp(method->m_String, "bake") == 0)
+        {
+            serve_bake(id, params);
+        }
+        else if (strcmp(method->m_String, "shutdown") == 0)
+        {
+            if (id[0])
+            {
+                char buffer[512];
+                snprintf(buffer, sizeof(buffer), "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":null}", id);
+                serve_send(buffer);
+            }
+            shutdown = true;
+        }
+        else if (id[0])
+        {
+            serve_send_error(id, RPC_ERROR_METHOD_NOT_FOUND, "Method not found");
         }
 
-        _SG_GL_CHECK_ERROR();
+        id[0] = 0;
+        json_free(request);
+    }
 
-        sg_generate_mipmaps(g_app.m_EnvironmentPass.m_Image);
+    free(line);
+    g_app.m_Serve.m_Out = 0;
+    return shutdown;
+}
 
-        //////////////////////////////////////////////////////////////////////
-        // Diffuse irradiance pass
-        //////////////////////////////////////////////////////////////////////
+#if !defined(_WIN32)
+static int serve_socket(const char* path)
+{
+    struct sockaddr_un address = {};
+    address.sun_family         = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        LOG_ERROR("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
 
-        if (g_app.m_Params.m_GenerateMask & GENERATE_DIFFUSE_IRRADIANCE)
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (server_fd < 0 || bind(server_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(server_fd, 4) != 0)
+    {
+        LOG_ERROR("Unable to listen on %s (%s)\n", path, strerror(errno));
+        if (server_fd >= 0)
         {
-            LOG_INFO("Generating diffuse irradiance\n");
-            g_app.m_DiffuseIrradiancePass.m_Bindings.fs_images[SLOT_env_map] = g_app.m_EnvironmentPass.m_Image;
-            for (int i = 0; i < 6; ++i)
-            {
-                memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
-
-                sg_range cubemap_uniform_data = SG_RANGE(cubemap_uniforms);
+            close(server_fd);
+        }
+        return -1;
+    }
 
-                sg_begin_pass(g_app.m_DiffuseIrradiancePass.m_Pass[i], &g_app.m_DiffuseIrradiancePass.m_PassAction);
-                sg_apply_pipeline(g_app.m_DiffuseIrradiancePass.m_Pipeline);
-                sg_apply_bindings(&g_app.m_DiffuseIrradiancePass.m_Bindings);
-                sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms, &cubemap_uniform_data);
+    // A client that disconnects early shouldn't take the server down
+    signal(SIGPIPE, SIG_IGN);
 
-                sg_draw(0, g_app.m_Cube.num_elements, 1);
-                sg_end_pass();
-            }
-        }
+    LOG_INFO("Listening on %s\n", path);
 
-        //////////////////////////////////////////////////////////////////////
-        // BRDF Lookup table pass
-        //////////////////////////////////////////////////////////////////////
-        if (g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT)
+    bool shutdown = false;
+    while (!shutdown)
+    {
+        int client_fd = accept(server_fd, 0, 0);
+        if (client_fd < 0)
         {
-            LOG_INFO("Generating BRDF Lut\n");
-            sg_begin_pass(g_app.m_BRDFLutPass.m_Pass, &g_app.m_BRDFLutPass.m_PassAction);
-            sg_apply_pipeline(g_app.m_BRDFLutPass.m_Pipeline);
-            sg_apply_bindings(&g_app.m_BRDFLutPass.m_Bindings);
-            sg_draw(0, 6, 1);
-            sg_end_pass();
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR("Unable to accept connection (%s)\n", strerror(errno));
+            break;
         }
 
-        //////////////////////////////////////////////////////////////////////
-        // Light prefilter pass
-        //////////////////////////////////////////////////////////////////////
-        if (g_app.m_Params.m_GenerateMask & GENERATE_PREFILTERED_ENVIRONMENT)
-        {
-            LOG_INFO("Generating prefiltered environment\n");
+        FILE* in  = fdopen(client_fd, "r");
+        FILE* out = fdopen(dup(client_fd), "w");
+        shutdown  = serve_connection(in, out);
+        fclose(out);
+        fclose(in);
+    }
 
-            prefilter_uniforms_t prefilter_uniforms = {};
-            g_app.m_PrefilterPass.m_Bindings.fs_images[SLOT_tex_cube] = g_app.m_EnvironmentPass.m_Image;
+    close(server_fd);
+    unlink(path);
+    return shutdown ? 0 : -1;
+}
+#endif
 
-            int pass_index = 0;
-            int mipmap_size = g_app.m_PrefilterPass.m_Size;
-            for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
-            {
-                prefilter_uniforms.roughness = (float) mip / (float) (g_app.m_PrefilterPass.m_MipmapCount-1);
+// Keeps the GL context and every pass alive and bakes environments on request
+static int run_server()
+{
+    g_app.m_Serve.m_BaseParams = g_app.m_Params;
 
-                for (int i = 0; i < 6; ++i)
-                {
-                    memcpy(&cubemap_uniforms.view, g_app.m_CubeViewMatrices[i], sizeof(mat4x4));
+#if !defined(_WIN32)
+    if (g_app.m_Params.m_Serve == SERVE_SOCKET)
+    {
+        return serve_socket(g_app.m_Params.m_PathServeSocket);
+    }
+#endif
 
-                    sg_range cubemap_uniform_data   = SG_RANGE(cubemap_uniforms);
-                    sg_range prefilter_uniform_data = SG_RANGE(prefilter_uniforms);
+    // stdout was taken over by main()
+    FILE* out = g_app.m_Serve.m_Out;
+    serve_connection(stdin, out);
+    fclose(out);
+    return 0;
+}
 
-                    sg_begin_pass(g_app.m_PrefilterPass.m_Pass[pass_index], &g_app.m_PrefilterPass.m_PassAction);
+// Generates the current environment, and every other entry of the batch (if any).
+// The first entry has already been loaded by main(). A batch runs as a pipeline: decoder threads
+// load the upcoming inputs and writer threads serialize the previous outputs while the GPU
+// filters the current environment.
+static int run_generation()
+{
+    if (g_app.m_Params.m_Serve != SERVE_NONE)
+    {
+        int result = run_server();
+        release_generation_resources();
+        write_profile();
+        return result;
+    }
 
-                    sg_apply_viewport(0, 0, mipmap_size, mipmap_size, false);
+    for (int i = 1; i <= BATCH_PREFETCH_COUNT; ++i)
+    {
+        prefetch_batch_entry(i);
+    }
 
-                    sg_apply_pipeline(g_app.m_PrefilterPass.m_Pipeline);
-                    sg_apply_bindings(&g_app.m_PrefilterPass.m_Bindings);
-                    sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_cubemap_uniforms,   &cubemap_uniform_data);
-                    sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_prefilter_uniforms, &prefilter_uniform_data);
+    int result = 0;
+    generate();
 
-                    sg_draw(0, g_app.m_Cube.num_elements, 1);
-                    sg_end_pass();
+    for (int i = 1; i < g_app.m_Batch.m_EntryCount; ++i)
+    {
+        // The BRDF LUT doesn't depend on the environment, reuse the ones written for the first entry
+        if ((g_app.m_Params.m_GenerateMask & GENERATE_BRDF_LUT) && i == 1)
+        {
+            for (int set = 0; set < OUTPUT_SET_COUNT; ++set)
+            {
+                output_set_wait(&g_app.m_Output.m_Sets[set]);
+            }
 
-                    pass_index++;
+            for (int p = 0; p < g_app.m_Quality.m_Count; ++p)
+            {
+                quality_profile* profile = &g_app.m_Quality.m_Profiles[p];
+                if (profile->m_BRDFLutSource != BRDF_LUT_SOURCE_CACHE)
+                {
+                    char directory[512];
+                    if (get_output_directory(g_app.m_Batch.m_Entries[0].m_PathDirectory, p, directory, sizeof(directory)) &&
+                        get_output_path(directory, "brdf_lut.buffer", profile->m_BRDFLutCachePath, sizeof(profile->m_BRDFLutCachePath)))
+                    {
+                        profile->m_BRDFLutSource = BRDF_LUT_SOURCE_CACHE;
+                    }
                 }
-
-                mipmap_size /= 2;
             }
         }
 
-        //////////////////////////////////////////////////////////////////////
-        // Finally, write output data from generation
-        //////////////////////////////////////////////////////////////////////
-        write_output_data();
-
-        LOG_INFO("Finished generating!\n");
-
-    #if 0
-        for (int mip = 0; mip < g_app.m_PrefilterPass.m_MipmapCount; ++mip)
+        if (!load_batch_entry(i))
         {
-            for (int i = 0; i < 6; ++i)
-            {
-                write_prefilter(i, mip);
-            }
+            result = -1;
+            continue;
         }
 
-        write_side(0);
-        write_side(1);
-        write_side(2);
-        write_side(3);
-        write_side(4);
-        write_side(5);
-        write_brdf_lut();
-    #endif
+        generate();
+    }
+
+    release_generation_resources();
+    write_profile();
+    return result;
+}
+
+void frame(void)
+{
+    if (!g_app.m_IsDone)
+    {
+        run_generation();
     }
 
     if (!g_app.m_Params.m_Preview)
@@ -1315,6 +3745,10 @@ void cleanup_platform()
 
 void cleanup(void)
 {
+    for (int i = 0; i < OUTPUT_SET_COUNT; ++i)
+    {
+        free(g_app.m_Output.m_Sets[i].m_Arena);
+    }
     cleanup_platform();
     sg_shutdown();
 }
@@ -1347,52 +3781,251 @@ bool init_platform()
 
     GET_PROC_ADDRESS(glGetTexImage,    "glGetTexImage",    PFN_GLGETTEXIMAGEPROC);
     GET_PROC_ADDRESS(glGenerateMipmap, "glGenerateMipmap", PFN_GLGENERATEMIPMAPPROC);
+    GET_PROC_ADDRESS(glMapBufferRange, "glMapBufferRange", PFN_GLMAPBUFFERRANGEPROC);
+    GET_PROC_ADDRESS(glUnmapBuffer,    "glUnmapBuffer",    PFN_GLUNMAPBUFFERPROC);
+    GET_PROC_ADDRESS(glFenceSync,      "glFenceSync",      PFN_GLFENCESYNCPROC);
+    GET_PROC_ADDRESS(glClientWaitSync, "glClientWaitSync", PFN_GLCLIENTWAITSYNCPROC);
+    GET_PROC_ADDRESS(glDeleteSync,     "glDeleteSync",     PFN_GLDELETESYNCPROC);
+    GET_PROC_ADDRESS(glGenQueries,     "glGenQueries",     PFN_GLGENQUERIESPROC);
+    GET_PROC_ADDRESS(glDeleteQueries,  "glDeleteQueries",  PFN_GLDELETEQUERIESPROC);
+    GET_PROC_ADDRESS(glBeginQuery,     "glBeginQuery",     PFN_GLBEGINQUERYPROC);
+    GET_PROC_ADDRESS(glEndQuery,       "glEndQuery",       PFN_GLENDQUERYPROC);
+    GET_PROC_ADDRESS(glGetQueryObjectui64v, "glGetQueryObjectui64v", PFN_GLGETQUERYOBJECTUI64VPROC);
     #undef GET_PROC_ADDRESS
 
-    return glGetTexImage != 0x0 && glGenerateMipmap != 0x0;
-#else
+    return glGetTexImage != 0x0 && glGenerateMipmap != 0x0 &&
+        glMapBufferRange != 0x0 && glUnmapBuffer != 0x0 &&
+        glFenceSync != 0x0 && glClientWaitSync != 0x0 && glDeleteSync != 0x0 &&
+        glGenQueries != 0x0 && glDeleteQueries != 0x0 && glBeginQuery != 0x0 &&
+        glEndQuery != 0x0 && glGetQueryObjectui64v != 0x0;
+#else
+    return true;
+#endif
+}
+
+static bool init_generation(sg_context_desc context_desc)
+{
+    sg_desc app_desc = {
+        .pass_pool_size = 1024,
+        .context        = context_desc,
+    };
+
+    sg_setup(&app_desc);
+
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    if (!init_platform())
+    {
+        printf("Unable to initialize, check console for errors!\n");
+        return false;
+    }
+
+    if (g_app.m_Params.m_Preview)
+    {
+        make_display_pass();
+    }
+
+    // The server doesn't know what will be requested, so it creates every pass up front
+    bool serve = g_app.m_Params.m_Serve != SERVE_NONE;
+
+    make_cube();
+    if ((g_app.m_EnvironmentTexture.m_Pixels || g_app.m_EnvironmentTexture.m_Stream) && !make_environment_image())
+    {
+        return false;
+    }
+    make_environment_pass();
+    if (serve || generation_uses_gpu_irradiance())
+    {
+        make_diffuse_irradiance_pass();
+    }
+    if (serve || generation_uses_gpu_prefilter())
+    {
+        make_prefilter_pass();
+    }
+    if (serve || generation_uses_gpu_brdf_lut())
+    {
+        make_brdf_lut_pass();
+    }
+    make_uniforms();
+    return true;
+}
+
+void init(void)
+{
+    if (!init_generation(sapp_sgcontext()))
+    {
+        exit(-1);
+    }
+}
+
+#if defined(PBR_UTILS_HEADLESS)
+static bool headless_context_create()
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    // Prefer the surfaceless platform so we never need a display server (works with llvmpipe)
+#if defined(EGL_PLATFORM_SURFACELESS_MESA)
+    PFNEGLGETPLATFORMDISPLAYEXTPROC egl_get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (egl_get_platform_display)
+    {
+        display = egl_get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+#endif
+
+    if (display == EGL_NO_DISPLAY)
+    {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint egl_major, egl_minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &egl_major, &egl_minor))
+    {
+        LOG_ERROR("Unable to initialize EGL display (error 0x%x)\n", eglGetError());
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        LOG_ERROR("EGL display does not support desktop OpenGL (error 0x%x)\n", eglGetError());
+        eglTerminate(display);
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE,        8,
+        EGL_GREEN_SIZE,      8,
+        EGL_BLUE_SIZE,       8,
+        EGL_ALPHA_SIZE,      8,
+        EGL_NONE
+    };
+
+    EGLConfig config      = 0;
+    EGLint    num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+    {
+        // Surfaceless displays usually don't expose any configs, rely on EGL_KHR_no_config_context
+        config = (EGLConfig) 0;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,       3,
+        EGL_CONTEXT_MINOR_VERSION,       3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT)
+    {
+        LOG_ERROR("Unable to create a GL 3.3 core context (error 0x%x)\n", eglGetError());
+        eglTerminate(display);
+        return false;
+    }
+
+    // We only render to offscreen targets, so no surface is needed if EGL_KHR_surfaceless_context is available.
+    // Otherwise fall back to a dummy pbuffer surface.
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+
+        if (num_configs > 0)
+        {
+            surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+        }
+
+        if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context))
+        {
+            LOG_ERROR("Unable to make headless GL context current (error 0x%x)\n", eglGetError());
+            eglDestroyContext(display, context);
+            eglTerminate(display);
+            return false;
+        }
+    }
+
+    g_app.m_Headless.m_Display = display;
+    g_app.m_Headless.m_Context = context;
+    g_app.m_Headless.m_Surface = surface;
+
+    LOG_VERBOSE("Headless context: EGL %d.%d, %s (%s)\n", egl_major, egl_minor, glGetString(GL_RENDERER), glGetString(GL_VERSION));
     return true;
-#endif
 }
 
-void init(void)
+static void headless_context_destroy()
 {
-    sg_desc app_desc = {
-        .pass_pool_size = 1024,
-        .context        = sapp_sgcontext(),
-    };
+    eglMakeCurrent(g_app.m_Headless.m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (g_app.m_Headless.m_Surface != EGL_NO_SURFACE)
+    {
+        eglDestroySurface(g_app.m_Headless.m_Display, g_app.m_Headless.m_Surface);
+    }
+    eglDestroyContext(g_app.m_Headless.m_Display, g_app.m_Headless.m_Context);
+    eglTerminate(g_app.m_Headless.m_Display);
+}
 
-    sg_setup(&app_desc);
+static int run_headless()
+{
+    uint64_t profile_start = profile_begin();
+    if (!headless_context_create())
+    {
+        return -1;
+    }
 
-    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    sg_context_desc context_desc = {};
+    context_desc.color_format    = SG_PIXELFORMAT_RGBA8;
+    context_desc.depth_format    = SG_PIXELFORMAT_DEPTH_STENCIL;
+    context_desc.sample_count    = 1;
 
-    if (init_platform())
+    int result = 0;
+    if (init_generation(context_desc))
     {
-        make_display_pass();
-        make_cube();
-        if (!make_environment_image())
-        {
-            exit(-1);
-        }
-        make_environment_pass();
-        make_diffuse_irradiance_pass();
-        make_prefilter_pass();
-        make_brdf_lut_pass();
-        make_uniforms();
+        profile_end("gl init", 0, profile_start);
+        result = run_generation();
     }
     else
     {
-        printf("Unable to initialize, check console for errors!\n");
+        result = -1;
     }
+
+    cleanup();
+    headless_context_destroy();
+    return result;
 }
+#endif
 
 app_params get_default_app_params()
 {
     app_params params;
-    params.m_Verbose       = false;
-    params.m_PathInput     = NULL; // required
-    params.m_PathDirectory = NULL; // required
-    params.m_GenerateMask  = GENERATE_ALL;
+    params.m_Verbose            = false;
+    params.m_Preview            = false;
+    params.m_GenerateMetaData   = false;
+    params.m_PathInput          = NULL; // required
+    params.m_PathDirectory      = NULL; // required
+    params.m_PathCacheDirectory = NULL;
+    params.m_PathManifest       = NULL;
+    params.m_PathServeSocket    = NULL;
+    params.m_PathProfile        = NULL;
+    params.m_Serve              = SERVE_NONE;
+    params.m_GenerateMask       = GENERATE_ALL;
+    params.m_IrradianceEngine   = ENGINE_GPU;
+    params.m_IrradianceOutput   = IRRADIANCE_OUTPUT_BUFFER;
+    params.m_PrefilterEngine    = ENGINE_GPU;
+    params.m_SHBands            = SH_MIN_BANDS;
+    params.m_ThreadCount        = 0; // all hardware threads
+    params.m_BufferFormat       = BUFFER_FORMAT_UINT8;
+    params.m_HDRFormat          = HDR_FORMAT_RGBE;
+    params.m_Qualities[0]       = PBR_QUALITY_DESKTOP;
+    params.m_QualityCount       = 1;
+
+    // Taken from the quality preset
+    params.m_EnvironmentSize       = 0;
+    params.m_IrradianceSize        = 0;
+    params.m_IrradianceSampleDelta = 0.0f;
+    params.m_PrefilterSize         = 0;
+    params.m_PrefilterSampleCount  = 0;
+    params.m_BRDFLutSize           = 0;
+    params.m_BRDFLutSampleCount    = 0;
 
     return params;
 }
@@ -1442,11 +4075,50 @@ void print_app_params(app_params params)
 
 #define TRUE_FALSE_LABEL(cond) (cond?"TRUE":"FALSE")
     printf("----------- Configuration -----------\n");
-    printf("Input path         : %s\n", params.m_PathInput);
-    printf("Output directory   : %s\n", params.m_PathDirectory);
+    if (params.m_Serve != SERVE_NONE)
+    {
+        printf("Serve              : %s\n", params.m_Serve == SERVE_SOCKET ? params.m_PathServeSocket : "stdin/stdout");
+    }
+    else if (params.m_PathManifest)
+    {
+        printf("Batch manifest     : %s\n", params.m_PathManifest);
+    }
+    else
+    {
+        printf("Input path         : %s\n", params.m_PathInput);
+        printf("Output directory   : %s\n", params.m_PathDirectory);
+    }
+    printf("Cache directory    : %s\n", params.m_PathCacheDirectory ? params.m_PathCacheDirectory : "<none>");
     printf("Generate           : %s\n", mask_str);
+    printf("Irradiance engine  : %s\n", params.m_IrradianceEngine == ENGINE_CPU ? "cpu" : "gpu");
+    printf("Irradiance output  : %s\n", params.m_IrradianceOutput == IRRADIANCE_OUTPUT_SH ? "sh" : "buffer");
+    if (params.m_IrradianceEngine == ENGINE_CPU)
+    {
+        printf("SH bands           : %d\n", params.m_SHBands);
+    }
+    printf("Prefilter engine   : %s\n", params.m_PrefilterEngine == ENGINE_CPU ? "cpu" : "gpu");
+    if (params.m_ThreadCount > 0)
+    {
+        printf("Threads            : %d\n", params.m_ThreadCount);
+    }
+    printf("Buffer format      : %s\n", buffer_format_to_str(params.m_BufferFormat));
+    printf("HDR format         : %s\n", params.m_HDRFormat == HDR_FORMAT_FLOAT ? "float" : "rgbe");
+    printf("Environment size   : %d\n", g_app.m_Quality.m_EnvironmentSize);
+    for (int i = 0; i < g_app.m_Quality.m_Count; ++i)
+    {
+        select_quality_profile(i);
+        printf("Quality            : %s\n", quality_to_str(get_quality_profile()->m_Quality));
+        printf("  Irradiance       : %d (sample delta %g)\n", g_app.m_DiffuseIrradiancePass.m_Size, g_app.m_DiffuseIrradiancePass.m_SampleDelta);
+        printf("  Prefilter        : %d (%d samples)\n", g_app.m_PrefilterPass.m_Size, g_app.m_PrefilterPass.m_SampleCount);
+        printf("  BRDF Lut         : %d (%d samples)\n", g_app.m_BRDFLutPass.m_Size, g_app.m_BRDFLutPass.m_SampleCount);
+    }
+    select_quality_profile(0);
     printf("Generate meta-data : %s\n", TRUE_FALSE_LABEL(params.m_GenerateMetaData));
     printf("Preview            : %s\n", TRUE_FALSE_LABEL(params.m_Preview));
+    if (params.m_PathProfile)
+    {
+        printf("Profile            : %s\n", params.m_PathProfile);
+    }
     printf("-------------------------------------\n");
 #undef TRUE_FALSE_LABEL
 }
@@ -1455,47 +4127,76 @@ void show_usage()
 {
     printf("--------------- Help ---------------\n");
     printf("Usage: pbr-utils <input-file> <output-file> [options]\n");
+    printf("       pbr-utils --batch <manifest> [options]\n");
+    printf("       pbr-utils --serve [options]\n");
     printf("Options:\n");
     printf("  --generate <value> : What to generate (can be multiple), where value is:\n");
     printf("      all            : Generate BRDF lut, diffuse irradiance, prefiltered environment (default)\n");
     printf("      brdf           : Generate BRDF lut map\n");
     printf("      irradiance     : Generate diffuse irradiance map\n");
     printf("      prefilter      : Generate prefiltered environment map\n");
+    printf("  --irradiance-engine <value> : How to generate the diffuse irradiance map, where value is:\n");
+    printf("      gpu            : Integrate the hemisphere per texel on the GPU (default)\n");
+    printf("      cpu            : Project the input into spherical harmonics on the CPU (no GPU needed)\n");
+    printf("  --sh-bands <3|4|5> : Number of SH bands used by the CPU irradiance engine (default 3, i.e 9 coefficients)\n");
+    printf("  --irradiance-output <value> : How the diffuse irradiance is stored, where value is:\n");
+    printf("      buffer         : Cubemap buffer resource (default)\n");
+    printf("      sh             : SH coefficients as properties in environment.script (implies cpu engine and meta-data)\n");
+    printf("  --prefilter-engine <value> : How to generate the prefiltered environment map, where value is:\n");
+    printf("      gpu            : Render the GGX prefilter passes on the GPU (default)\n");
+    printf("      cpu            : Run the same GGX prefilter on all CPU cores\n");
+    printf("  --threads <count>  : Number of threads used by the CPU engines (default: all hardware threads)\n");
+    printf("  --buffer-format <value> : Stream type used in the .buffer files, where value is:\n");
+    printf("      uint8          : float16 values split into bytes (default)\n");
+    printf("      uint16         : float16 values, one number per value\n");
+    printf("      float32        : float32 values, no conversion to float16\n");
+    printf("  --hdr-format <value> : How HDR inputs are kept in memory and uploaded, where value is:\n");
+    printf("      rgbe           : Radiance RGBE, 4 bytes per pixel, decoded when sampled (default)\n");
+    printf("      float          : Expanded to RGBA32F, 16 bytes per pixel\n");
+    printf("  --quality <value>  : Sizes and sample counts of all passes, where value is one or more (comma separated) of:\n");
+    printf("      mobile         : environment 512, irradiance 32, prefilter 128 (512 samples), BRDF lut 128 (512 samples)\n");
+    printf("      desktop        : environment 1024, irradiance 64, prefilter 256 (2048 samples), BRDF lut 512 (1024 samples) (default)\n");
+    printf("      reference      : environment 2048, irradiance 128, prefilter 512 (4096 samples), BRDF lut 512 (4096 samples)\n");
+    printf("                       Several presets (e.g mobile,desktop) are baked in one run into <output-directory>/<preset>. They share\n");
+    printf("                       the environment cube, smaller irradiance maps and BRDF luts are downsampled from the larger ones\n");
+    printf("  --environment-size <size>       : Override the size of the environment cubemap the prefilter samples from\n");
+    printf("  --irradiance-size <size>        : Override the size of the irradiance cubemap\n");
+    printf("  --irradiance-sample-delta <rad> : Override the hemisphere step of the GPU irradiance pass\n");
+    printf("  --prefilter-size <size>         : Override the size of the prefiltered mip 0\n");
+    printf("  --prefilter-samples <count>     : Override the number of GGX samples per prefiltered texel\n");
+    printf("  --brdf-lut-size <size>          : Override the size of the BRDF lut\n");
+    printf("  --brdf-lut-samples <count>      : Override the number of samples per BRDF lut texel\n");
+    printf("  --cache-dir <path> : Directory where results are cached between runs. Outputs of unchanged inputs (same contents\n");
+    printf("                       and arguments) are copied from the cache without baking, the BRDF lut is shared by all inputs\n");
+    printf("  --batch <manifest> : Generate several environments in one run. Every line of the manifest is\n");
+    printf("                       '<input-file> <output-directory>', empty lines and lines starting with # are skipped\n");
+    printf("  --serve            : Keep running and bake environments on request, JSON-RPC 2.0 messages (one per line)\n");
+    printf("                       on stdin/stdout. Methods: bake {input, output, generate, meta_data, buffer_format, quality,\n");
+    printf("                       environment_size, irradiance_size, ... (the size and sample options above)}, shutdown\n");
+    printf("  --serve-socket <path> : Same as --serve, but listen on a unix domain socket\n");
+    printf("  --profile <file>   : Record CPU and GPU timings of every stage, written as Chrome trace JSON (chrome://tracing)\n");
+    printf("                       with a summary table at exit\n");
     printf("  --meta-data        : Generate meta-data about generation (in lua format)\n");
     printf("  --verbose          : Enable verbose logging\n");
-    printf("  --preview          : Enable preview rendering\n");
+    printf("  --preview          : Enable preview rendering in a window (headless otherwise)\n");
     printf("  --help             : Show this help screen\n");
     printf("-------------------------------------\n");
 }
 
-int str_case_cmp(const char *s1, const char *s2)
-{
-#ifdef _WIN32
-    return _stricmp(s1, s2);
-#else
-    return strcasecmp(s1, s2);
-#endif
-}
-
 bool is_app_arg(const char* arg)
 {
     size_t str_len = strlen(arg);
     return str_len > 2 && arg[0] == '-' && arg[1] == '-';
 }
 
-bool directory_exists(const char* path)
+int validate_app_arguments(app_params* params)
 {
-    DIR* dir = opendir(path);
-    if (dir)
+    // Entries are validated when the manifest is loaded, server requests when they arrive
+    if (params->m_PathManifest || params->m_Serve != SERVE_NONE)
     {
-        closedir(dir);
-        return true;
+        return PARAMS_RESULT_OK;
     }
-    return false;
-}
 
-int validate_app_arguments(app_params* params)
-{
     if (!params->m_PathInput || is_app_arg(params->m_PathInput))
     {
         return PARAMS_RESULT_INCORRECT_INPUT;
@@ -1510,12 +4211,12 @@ int validate_app_arguments(app_params* params)
 
 int parse_arguments(int argc, char* argv[], app_params* params)
 {
-    params->m_PathInput     = argc > 1 ? argv[1] : 0;
-    params->m_PathDirectory = argc > 2 ? argv[2] : 0;
+    params->m_PathInput     = argc > 1 && !is_app_arg(argv[1]) ? argv[1] : 0;
+    params->m_PathDirectory = argc > 2 && !is_app_arg(argv[2]) ? argv[2] : 0;
 
     int generation_mask = GENERATE_NONE;
 
-    for (int i = 2; i < argc; ++i)
+    for (int i = 1; i < argc; ++i)
     {
         if (is_app_arg(argv[i]))
         {
@@ -1540,6 +4241,193 @@ int parse_arguments(int argc, char* argv[], app_params* params)
             {
                 params->m_GenerateMetaData = true;
             }
+            else if (CMP_ARG("serve"))
+            {
+                params->m_Serve = SERVE_STDIO;
+            }
+        #if !defined(_WIN32)
+            else if (CMP_ARG_1_OP("serve-socket"))
+            {
+                i++;
+                params->m_Serve           = SERVE_SOCKET;
+                params->m_PathServeSocket = argv[i];
+            }
+        #endif
+            else if (CMP_ARG_1_OP("irradiance-engine"))
+            {
+                i++;
+                if (CMP_VAL("gpu"))
+                {
+                    params->m_IrradianceEngine = ENGINE_GPU;
+                }
+                else if (CMP_VAL("cpu"))
+                {
+                    params->m_IrradianceEngine = ENGINE_CPU;
+                }
+                else
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("irradiance-output"))
+            {
+                i++;
+                if (CMP_VAL("buffer"))
+                {
+                    params->m_IrradianceOutput = IRRADIANCE_OUTPUT_BUFFER;
+                }
+                else if (CMP_VAL("sh"))
+                {
+                    params->m_IrradianceOutput = IRRADIANCE_OUTPUT_SH;
+                }
+                else
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("buffer-format"))
+            {
+                i++;
+                if (CMP_VAL("uint8"))
+                {
+                    params->m_BufferFormat = BUFFER_FORMAT_UINT8;
+                }
+                else if (CMP_VAL("uint16"))
+                {
+                    params->m_BufferFormat = BUFFER_FORMAT_UINT16;
+                }
+                else if (CMP_VAL("float32"))
+                {
+                    params->m_BufferFormat = BUFFER_FORMAT_FLOAT32;
+                }
+                else
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("hdr-format"))
+            {
+                i++;
+                if (CMP_VAL("rgbe"))
+                {
+                    params->m_HDRFormat = HDR_FORMAT_RGBE;
+                }
+                else if (CMP_VAL("float"))
+                {
+                    params->m_HDRFormat = HDR_FORMAT_FLOAT;
+                }
+                else
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("cache-dir"))
+            {
+                i++;
+                params->m_PathCacheDirectory = argv[i];
+            }
+            else if (CMP_ARG_1_OP("batch"))
+            {
+                i++;
+                params->m_PathManifest = argv[i];
+            }
+            else if (CMP_ARG_1_OP("profile"))
+            {
+                i++;
+                params->m_PathProfile = argv[i];
+            }
+            else if (CMP_ARG_1_OP("prefilter-engine"))
+            {
+                i++;
+                if (CMP_VAL("gpu"))
+                {
+                    params->m_PrefilterEngine = ENGINE_GPU;
+                }
+                else if (CMP_VAL("cpu"))
+                {
+                    params->m_PrefilterEngine = ENGINE_CPU;
+                }
+                else
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("threads"))
+            {
+                i++;
+                params->m_ThreadCount = atoi(argv[i]);
+                if (params->m_ThreadCount <= 0)
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("sh-bands"))
+            {
+                i++;
+                params->m_SHBands = atoi(argv[i]);
+                if (params->m_SHBands < SH_MIN_BANDS || params->m_SHBands > SH_MAX_BANDS)
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("quality"))
+            {
+                if (!parse_qualities(argv[++i], params))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("environment-size"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_PASS_SIZE, &params->m_EnvironmentSize))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("irradiance-size"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_PASS_SIZE, &params->m_IrradianceSize))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("irradiance-sample-delta"))
+            {
+                i++;
+                params->m_IrradianceSampleDelta = atof(argv[i]);
+                if (params->m_IrradianceSampleDelta <= 0.0f || params->m_IrradianceSampleDelta > 1.0f)
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("prefilter-size"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_PASS_SIZE, &params->m_PrefilterSize))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("prefilter-samples"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_SAMPLE_COUNT, &params->m_PrefilterSampleCount))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("brdf-lut-size"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_PASS_SIZE, &params->m_BRDFLutSize))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
+            else if (CMP_ARG_1_OP("brdf-lut-samples"))
+            {
+                if (!parse_positive_int(argv[++i], MAX_SAMPLE_COUNT, &params->m_BRDFLutSampleCount))
+                {
+                    return PARAMS_RESULT_INVALID_VALUE;
+                }
+            }
             else if (CMP_ARG_1_OP("generate"))
             {
                 i++;
@@ -1571,9 +4459,120 @@ int parse_arguments(int argc, char* argv[], app_params* params)
         params->m_GenerateMask = generation_mask;
     }
 
+    // SH coefficients only exist on the CPU and are stored in the meta-data script
+    if (params->m_IrradianceOutput == IRRADIANCE_OUTPUT_SH)
+    {
+        params->m_IrradianceEngine = ENGINE_CPU;
+        params->m_GenerateMetaData = true;
+    }
+
     return validate_app_arguments(params);
 }
 
+// Reads '<input-file> <output-directory>' pairs, the output directory is the last token on the line
+// so input paths may contain spaces.
+bool load_batch_manifest(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        LOG_ERROR("Unable to open batch manifest %s\n", path);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long data_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* data = (char*) malloc(data_size + 1);
+    data_size  = fread(data, 1, data_size, f);
+    data[data_size] = 0;
+    fclose(f);
+
+    int line_count = 1;
+    for (long i = 0; i < data_size; ++i)
+    {
+        line_count += data[i] == '\n';
+    }
+
+    batch_entry* entries = (batch_entry*) malloc(line_count * sizeof(batch_entry));
+    int entry_count      = 0;
+    bool result          = true;
+
+    char* line = data;
+    for (int line_number = 1; line; ++line_number)
+    {
+        char* next_line = strchr(line, '\n');
+        if (next_line)
+        {
+            *next_line++ = 0;
+        }
+
+        // Trim whitespace (and \r) on both ends
+        while (isspace((unsigned char) *line))
+        {
+            line++;
+        }
+        char* line_end = line + strlen(line);
+        while (line_end > line && isspace((unsigned char) line_end[-1]))
+        {
+            *--line_end = 0;
+        }
+
+        if (*line != 0 && *line != '#')
+        {
+            char* separator = line_end;
+            while (separator > line && !isspace((unsigned char) separator[-1]))
+            {
+                separator--;
+            }
+
+            char* input_end = separator;
+            while (input_end > line && isspace((unsigned char) input_end[-1]))
+            {
+                *--input_end = 0;
+            }
+
+            if (input_end == line)
+            {
+                LOG_ERROR("%s:%d: expected '<input-file> <output-directory>'\n", path, line_number);
+                result = false;
+            }
+            else if (!directory_exists(separator))
+            {
+                LOG_ERROR("%s:%d: output directory '%s' doesn't exist\n", path, line_number, separator);
+                result = false;
+            }
+            else
+            {
+                entries[entry_count].m_PathInput     = line;
+                entries[entry_count].m_PathDirectory = separator;
+                entry_count++;
+            }
+        }
+
+        line = next_line;
+    }
+
+    if (result && entry_count == 0)
+    {
+        LOG_ERROR("Batch manifest %s has no entries\n", path);
+        result = false;
+    }
+
+    if (!result)
+    {
+        free(entries);
+        free(data);
+        return false;
+    }
+
+    g_app.m_Batch.m_Entries      = entries;
+    g_app.m_Batch.m_EntryCount   = entry_count;
+    g_app.m_Batch.m_ManifestData = data;
+    return true;
+}
+
 void handle_parse_result(int res, app_params* params)
 {
 #define GET_STRING_OR_NULL(str) (str ? str : "<null>")
@@ -1592,6 +4591,10 @@ void handle_parse_result(int res, app_params* params)
     {
         printf("Incorrect directory passed (arg=2) '%s'\n", GET_STRING_OR_NULL(params->m_PathDirectory));
     }
+    else if (res == PARAMS_RESULT_INVALID_VALUE)
+    {
+        printf("Invalid argument value passed\n");
+    }
 
     show_usage();
 
@@ -1599,7 +4602,7 @@ void handle_parse_result(int res, app_params* params)
 #undef GET_STRING_OR_NULL
 }
 
-sapp_desc sokol_main(int argc, char* argv[])
+int main(int argc, char* argv[])
 {
     if (argc <= 1)
     {
@@ -1611,10 +4614,87 @@ sapp_desc sokol_main(int argc, char* argv[])
 
     handle_parse_result(parse_arguments(argc, argv, &g_app.m_Params), &g_app.m_Params);
 
+    // stdout is reserved for the --serve protocol, everything that is logged goes to stderr instead
+    if (g_app.m_Params.m_Serve == SERVE_STDIO)
+    {
+        fflush(stdout);
+    #if defined(_WIN32)
+        g_app.m_Serve.m_Out = _fdopen(_dup(_fileno(stdout)), "w");
+        _dup2(_fileno(stderr), _fileno(stdout));
+    #else
+        g_app.m_Serve.m_Out = fdopen(dup(fileno(stdout)), "w");
+        dup2(fileno(stderr), fileno(stdout));
+    #endif
+    }
+
+    if (g_app.m_Params.m_PathProfile)
+    {
+        g_app.m_Profile.m_Profiler = profiler_create();
+    }
+
+    if (g_app.m_Params.m_PathCacheDirectory && !file_cache_init(g_app.m_Params.m_PathCacheDirectory))
+    {
+        LOG_ERROR("Unable to create cache directory %s, caching disabled\n", g_app.m_Params.m_PathCacheDirectory);
+        g_app.m_Params.m_PathCacheDirectory = NULL;
+    }
+
+    init_quality_profiles();
+
+    // Unchanged environments are copied from the bake cache before anything is decoded or a GL context is created
+    if (g_app.m_Params.m_PathManifest)
+    {
+        if (!load_batch_manifest(g_app.m_Params.m_PathManifest))
+        {
+            exit(-1);
+        }
+
+        if (skip_cached_batch_entries() == 0)
+        {
+            write_profile();
+            return 0;
+        }
+
+        LOG_INFO("Batch entry 1/%d: %s -> %s\n", g_app.m_Batch.m_EntryCount, g_app.m_Batch.m_Entries[0].m_PathInput, g_app.m_Batch.m_Entries[0].m_PathDirectory);
+        g_app.m_Params.m_PathInput     = g_app.m_Batch.m_Entries[0].m_PathInput;
+        g_app.m_Params.m_PathDirectory = g_app.m_Batch.m_Entries[0].m_PathDirectory;
+        g_app.m_Output.m_InputHash     = g_app.m_Batch.m_Entries[0].m_InputHash;
+    }
+    else if (g_app.m_Params.m_Serve == SERVE_NONE)
+    {
+        if (bake_cache_lookup(g_app.m_Params.m_PathInput, g_app.m_Params.m_PathDirectory, &g_app.m_Output.m_InputHash))
+        {
+            write_profile();
+            return 0;
+        }
+    }
+
     print_app_params(g_app.m_Params);
 
-    return (sapp_desc)
+    // The server resolves these for every request
+    if (g_app.m_Params.m_Serve == SERVE_NONE)
+    {
+        resolve_brdf_lut_source();
+
+        if (!load_environment_image())
+        {
+            exit(-1);
+        }
+    }
+
+    // Everything requested can be generated on the CPU, no need for a GL context at all
+    if (!generation_requires_gpu())
     {
+        return run_generation();
+    }
+
+#if defined(PBR_UTILS_HEADLESS)
+    if (!g_app.m_Params.m_Preview)
+    {
+        return run_headless();
+    }
+#endif
+
+    sapp_desc app_desc = {
         .init_cb      = init,
         .frame_cb     = frame,
         .cleanup_cb   = cleanup,
@@ -1622,4 +4702,7 @@ sapp_desc sokol_main(int argc, char* argv[])
         .height       = 640,
         .window_title = "PBR Utils",
     };
+
+    sapp_run(&app_desc);
+    return 0;
 }
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+    #include <direct.h>
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "output_file.h"
+
+static const uint32_t OUTPUT_FILE_COMPARE_CHUNK_SIZE = 64 * 1024;
+
+struct output_file
+{
+    char     m_Path[512];
+    char     m_TmpPath[512 + 32]; // room for the ".<pid>.tmp" suffix
+    FILE*    m_Existing;     // open while everything written so far matches
+    FILE*    m_Tmp;          // open once the contents differ
+    uint64_t m_Offset;
+    bool     m_Error;
+    char     m_Compare[OUTPUT_FILE_COMPARE_CHUNK_SIZE];
+};
+
+// Starts the replacement, the part that matched so far is copied over from the existing file
+static void output_file_begin_replace(output_file* file)
+{
+#if defined(_WIN32)
+    int tmp_path_length = snprintf(file->m_TmpPath, sizeof(file->m_TmpPath), "%s.%d.tmp", file->m_Path, _getpid());
+#else
+    int tmp_path_length = snprintf(file->m_TmpPath, sizeof(file->m_TmpPath), "%s.%d.tmp", file->m_Path, (int) getpid());
+#endif
+    if (tmp_path_length < 0 || tmp_path_length >= (int) sizeof(file->m_TmpPath))
+    {
+        file->m_Error = true;
+        return;
+    }
+
+    file->m_Tmp = fopen(file->m_TmpPath, "wb");
+    if (!file->m_Tmp)
+    {
+        file->m_Error = true;
+        return;
+    }
+
+    if (file->m_Existing)
+    {
+        fseek(file->m_Existing, 0, SEEK_SET);
+
+        uint64_t bytes_left = file->m_Offset;
+        while (bytes_left > 0 && !file->m_Error)
+        {
+            size_t chunk_size = bytes_left < OUTPUT_FILE_COMPARE_CHUNK_SIZE ? (size_t) bytes_left : OUTPUT_FILE_COMPARE_CHUNK_SIZE;
+            if (fread(file->m_Compare, 1, chunk_size, file->m_Existing) != chunk_size ||
+                fwrite(file->m_Compare, 1, chunk_size, file->m_Tmp) != chunk_size)
+            {
+                file->m_Error = true;
+            }
+            bytes_left -= chunk_size;
+        }
+
+        fclose(file->m_Existing);
+        file->m_Existing = 0;
+    }
+}
+
+output_file* output_file_open(const char* path)
+{
+    output_file* file = (output_file*) malloc(sizeof(output_file));
+    file->m_TmpPath[0] = 0;
+    file->m_Existing   = 0;
+    file->m_Tmp        = 0;
+    file->m_Offset     = 0;
+    file->m_Error      = false;
+
+    // A truncated path would write somewhere else, fail on close instead
+    if ((size_t) snprintf(file->m_Path, sizeof(file->m_Path), "%s", path) >= sizeof(file->m_Path))
+    {
+        file->m_Error = true;
+        return file;
+    }
+
+    file->m_Existing = fopen(path, "rb");
+    if (!file->m_Existing)
+    {
+        output_file_begin_replace(file);
+    }
+    return file;
+}
+
+void output_file_write(output_file* file, const void* data, uint32_t data_size)
+{
+    if (file->m_Error)
+    {
+        return;
+    }
+
+    const char* read_ptr = (const char*) data;
+    uint32_t bytes_left  = data_size;
+
+    while (file->m_Existing && bytes_left > 0)
+    {
+        uint32_t chunk_size = bytes_left < OUTPUT_FILE_COMPARE_CHUNK_SIZE ? bytes_left : OUTPUT_FILE_COMPARE_CHUNK_SIZE;
+        size_t bytes_read   = fread(file->m_Compare, 1, chunk_size, file->m_Existing);
+        if (bytes_read != chunk_size || memcmp(file->m_Compare, read_ptr, chunk_size) != 0)
+        {
+            output_file_begin_replace(file);
+            break;
+        }
+
+        file->m_Offset += chunk_size;
+        read_ptr       += chunk_size;
+        bytes_left     -= chunk_size;
+    }
+
+    if (file->m_Tmp && bytes_left > 0 && fwrite(read_ptr, 1, bytes_left, file->m_Tmp) != bytes_left)
+    {
+        file->m_Error = true;
+    }
+}
+
+bool output_file_close(output_file* file, bool* changed_out)
+{
+    // Everything matched, but the existing file may be longer
+    if (file->m_Existing && !file->m_Error && fgetc(file->m_Existing) != EOF)
+    {
+        output_file_begin_replace(file);
+    }
+
+    bool changed = file->m_Tmp != 0;
+    bool result  = !file->m_Error;
+
+    if (file->m_Existing)
+    {
+        fclose(file->m_Existing);
+    }
+
+    if (file->m_Tmp)
+    {
+        result = fclose(file->m_Tmp) == 0 && result;
+
+    #if defined(_WIN32)
+        // rename doesn't replace existing files on windows
+        if (result)
+        {
+            remove(file->m_Path);
+        }
+    #endif
+
+        // Also replaces hard links (e.g into the cache) instead of writing through them
+        if (!result || rename(file->m_TmpPath, file->m_Path) != 0)
+        {
+            remove(file->m_TmpPath);
+            result = false;
+        }
+    }
+
+    if (changed_out)
+    {
+        *changed_out = changed && result;
+    }
+
+    free(file);
+    return result;
+}
+
+bool output_file_write_all(const char* path, const void* data, uint32_t data_size, bool* changed_out)
+{
+    output_file* file = output_file_open(path);
+    output_file_write(file, data, data_size);
+    return output_file_close(file, changed_out);
+}
+
+bool file_contents_equal(const char* path_a, const char* path_b)
+{
+    FILE* f_a = fopen(path_a, "rb");
+    FILE* f_b = f_a ? fopen(path_b, "rb") : 0;
+
+    bool result = f_a && f_b;
+    char* buffer_a = (char*) malloc(OUTPUT_FILE_COMPARE_CHUNK_SIZE * 2);
+    char* buffer_b = buffer_a + OUTPUT_FILE_COMPARE_CHUNK_SIZE;
+
+    while (result)
+    {
+        size_t bytes_read_a = fread(buffer_a, 1, OUTPUT_FILE_COMPARE_CHUNK_SIZE, f_a);
+        size_t bytes_read_b = fread(buffer_b, 1, OUTPUT_FILE_COMPARE_CHUNK_SIZE, f_b);
+        if (bytes_read_a != bytes_read_b || memcmp(buffer_a, buffer_b, bytes_read_a) != 0)
+        {
+            result = false;
+        }
+        else if (bytes_read_a < OUTPUT_FILE_COMPARE_CHUNK_SIZE)
+        {
+            result = !ferror(f_a) && !ferror(f_b);
+            break;
+        }
+    }
+
+    free(buffer_a);
+    if (f_a) fclose(f_a);
+    if (f_b) fclose(f_b);
+    return result;
+}
+
+bool output_directory_create(const char* path)
+{
+#if defined(_WIN32)
+    int res = _mkdir(path);
+#else
+    int res = mkdir(path, 0755);
+#endif
+    return res == 0 || errno == EEXIST;
+}
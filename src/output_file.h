@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// Output files that are only replaced when their contents change, so unchanged outputs keep their
+// mtime (and don't trigger rebuilds or hot-reloads downstream). Written data is compared with the
+// existing file as it streams in. Nothing is written until the first difference, from there on the
+// new contents go to a temporary file that is renamed over the target when the file is closed.
+typedef struct output_file output_file;
+
+output_file* output_file_open(const char* path);
+void         output_file_write(output_file* file, const void* data, uint32_t data_size);
+
+// Returns false if anything failed, the existing file is left as it was in that case.
+// changed_out (optional) is set if the file was created or replaced.
+bool         output_file_close(output_file* file, bool* changed_out);
+
+bool         output_file_write_all(const char* path, const void* data, uint32_t data_size, bool* changed_out);
+
+// Streaming comparison of two files
+bool         file_contents_equal(const char* path_a, const char* path_b);
+
+// Creates a directory (not its parents), succeeds if it already exists
+bool         output_directory_create(const char* path);
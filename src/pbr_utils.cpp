@@ -0,0 +1,553 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbr_utils.h"
+#include "area_filter.h"
+#include "brdf_lut.h"
+#include "buffer_writer.h"
+#include "half_float.h"
+#include "job_system.h"
+#include "prefilter.h"
+#include "radiance_hdr.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// Outputs are written with write_buffer_to_file by the callers
+static_assert(PBR_BUFFER_FORMAT_UINT8 == BUFFER_FORMAT_UINT8 && PBR_BUFFER_FORMAT_UINT16 == BUFFER_FORMAT_UINT16 && PBR_BUFFER_FORMAT_FLOAT32 == BUFFER_FORMAT_FLOAT32,
+    "PBR_BUFFER_FORMAT_* must match the .buffer stream types");
+
+struct pbr_context
+{
+    job_system* m_JobSystem;
+};
+
+void pbr_bake_params_default(pbr_bake_params* params)
+{
+    params->m_GenerateMask          = PBR_GENERATE_ALL;
+    params->m_EnvironmentSize       = 1024;
+    params->m_IrradianceSize        = 64;
+    params->m_IrradianceSampleDelta = 0.025f;
+    params->m_SHBands               = SH_MIN_BANDS;
+    params->m_PrefilterSize         = 256;
+    params->m_PrefilterSampleCount  = 2048;
+    params->m_BRDFLutSize           = 512;
+    params->m_BRDFLutSampleCount    = 1024;
+    params->m_BufferFormat          = PBR_BUFFER_FORMAT_UINT8;
+}
+
+bool pbr_bake_params_preset(int quality, pbr_bake_params* params)
+{
+    pbr_bake_params_default(params);
+
+    if (quality == PBR_QUALITY_MOBILE)
+    {
+        params->m_EnvironmentSize       = 512;
+        params->m_IrradianceSize        = 32;
+        params->m_IrradianceSampleDelta = 0.05f;
+        params->m_PrefilterSize         = 128;
+        params->m_PrefilterSampleCount  = 512;
+        params->m_BRDFLutSize           = 128;
+        params->m_BRDFLutSampleCount    = 512;
+    }
+    else if (quality == PBR_QUALITY_REFERENCE)
+    {
+        params->m_EnvironmentSize       = 2048;
+        params->m_IrradianceSize        = 128;
+        params->m_IrradianceSampleDelta = 0.01f;
+        params->m_PrefilterSize         = 512;
+        params->m_PrefilterSampleCount  = 4096;
+        params->m_BRDFLutSize           = 512;
+        params->m_BRDFLutSampleCount    = 4096;
+    }
+    else if (quality != PBR_QUALITY_DESKTOP)
+    {
+        return false;
+    }
+    return true;
+}
+
+pbr_context* pbr_context_create(uint32_t thread_count)
+{
+    pbr_context* context = (pbr_context*) malloc(sizeof(pbr_context));
+    context->m_JobSystem = job_system_create(thread_count);
+    return context;
+}
+
+void pbr_context_destroy(pbr_context* context)
+{
+    if (context)
+    {
+        job_system_destroy(context->m_JobSystem);
+        free(context);
+    }
+}
+
+uint32_t pbr_context_thread_count(const pbr_context* context)
+{
+    return job_system_thread_count(context->m_JobSystem);
+}
+
+static bool pbr_image_finish(void* pixels, int width, int height, int pixel_format, pbr_image* image_out)
+{
+    if (!pixels)
+    {
+        memset(image_out, 0, sizeof(pbr_image));
+        return false;
+    }
+
+    image_out->m_Pixels      = pixels;
+    image_out->m_Width       = width;
+    image_out->m_Height      = height;
+    image_out->m_PixelFormat = pixel_format;
+    return true;
+}
+
+bool pbr_image_load(const char* path, pbr_image* image_out)
+{
+    int x, y, ch;
+    if (stbi_is_hdr(path))
+    {
+        float* pixels = stbi_loadf(path, &x, &y, &ch, 4);
+        return pbr_image_finish(pixels, x, y, PBR_PIXEL_FORMAT_RGBA32F, image_out);
+    }
+
+    stbi_uc* pixels = stbi_load(path, &x, &y, &ch, 4);
+    return pbr_image_finish(pixels, x, y, PBR_PIXEL_FORMAT_RGBA8, image_out);
+}
+
+bool pbr_image_decode(const void* file_data, uint32_t file_data_size, pbr_image* image_out)
+{
+    int x, y, ch;
+    const stbi_uc* data = (const stbi_uc*) file_data;
+    if (stbi_is_hdr_from_memory(data, file_data_size))
+    {
+        float* pixels = stbi_loadf_from_memory(data, file_data_size, &x, &y, &ch, 4);
+        return pbr_image_finish(pixels, x, y, PBR_PIXEL_FORMAT_RGBA32F, image_out);
+    }
+
+    stbi_uc* pixels = stbi_load_from_memory(data, file_data_size, &x, &y, &ch, 4);
+    return pbr_image_finish(pixels, x, y, PBR_PIXEL_FORMAT_RGBA8, image_out);
+}
+
+bool pbr_image_load_rgbe(pbr_context* context, const char* path, pbr_image* image_out)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        memset(image_out, 0, sizeof(pbr_image));
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    void* file_data = file_size > 0 ? malloc(file_size) : 0;
+    bool result     = file_data && fread(file_data, 1, file_size, f) == (size_t) file_size;
+    fclose(f);
+
+    result = result && pbr_image_decode_rgbe(context, file_data, (uint32_t) file_size, image_out);
+    free(file_data);
+    return result;
+}
+
+bool pbr_image_decode_rgbe(pbr_context* context, const void* file_data, uint32_t file_data_size, pbr_image* image_out)
+{
+    radiance_header header;
+    if (!radiance_read_header(file_data, file_data_size, &header))
+    {
+        return pbr_image_decode(file_data, file_data_size, image_out);
+    }
+
+    // Released by pbr_image_free like the stb_image pixels
+    uint8_t* pixels = (uint8_t*) STBI_MALLOC((size_t) header.m_Width * header.m_Height * 4);
+    bool decoded    = false;
+    if (pixels && context)
+    {
+        decoded = radiance_decode_rgbe_parallel(context->m_JobSystem, file_data, file_data_size, &header, pixels);
+    }
+    else if (pixels)
+    {
+        decoded = radiance_decode_rgbe(file_data, file_data_size, &header, pixels);
+    }
+
+    if (!decoded)
+    {
+        STBI_FREE(pixels);
+        pixels = 0;
+    }
+    return pbr_image_finish(pixels, header.m_Width, header.m_Height, PBR_PIXEL_FORMAT_RGBE8, image_out);
+}
+
+void pbr_image_free(pbr_image* image)
+{
+    stbi_image_free(image->m_Pixels);
+    image->m_Pixels = 0;
+}
+
+static uint32_t get_pixel_size(int pixel_format)
+{
+    return pixel_format == PBR_PIXEL_FORMAT_RGBA32F ? 4 * sizeof(float) : 4;
+}
+
+static void image_row_to_float(const pbr_image* image, int row, float* rgba_out)
+{
+    const uint8_t* in = (const uint8_t*) image->m_Pixels + (size_t) row * image->m_Width * get_pixel_size(image->m_PixelFormat);
+    if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F)
+    {
+        memcpy(rgba_out, in, (size_t) image->m_Width * 4 * sizeof(float));
+    }
+    else if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBE8)
+    {
+        radiance_rgbe_to_float(in, image->m_Width, rgba_out);
+    }
+    else
+    {
+        for (int i = 0; i < image->m_Width * 4; ++i)
+        {
+            rgba_out[i] = in[i] / 255.0f;
+        }
+    }
+}
+
+static void float_to_image_row(const float* rgba, pbr_image* image, int row)
+{
+    uint8_t* out = (uint8_t*) image->m_Pixels + (size_t) row * image->m_Width * get_pixel_size(image->m_PixelFormat);
+    if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F)
+    {
+        memcpy(out, rgba, (size_t) image->m_Width * 4 * sizeof(float));
+    }
+    else if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBE8)
+    {
+        radiance_float_to_rgbe(rgba, image->m_Width, out);
+    }
+    else
+    {
+        for (int i = 0; i < image->m_Width * 4; ++i)
+        {
+            out[i] = (uint8_t) (fminf(fmaxf(rgba[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+typedef struct
+{
+    const area_filter* m_Filter;
+    const pbr_image*   m_Image;
+    pbr_image*         m_Output;
+    int                m_RowsPerJob;
+} downsample_job_context;
+
+// Input rows shared by two output rows are converted once for each of them
+static void downsample_job(void* context, uint32_t job_index)
+{
+    downsample_job_context* ctx = (downsample_job_context*) context;
+    int row_begin = job_index * ctx->m_RowsPerJob;
+    int row_end   = row_begin + ctx->m_RowsPerJob;
+    if (row_end > ctx->m_Output->m_Height)
+    {
+        row_end = ctx->m_Output->m_Height;
+    }
+
+    int max_rows       = area_filter_max_input_rows(ctx->m_Filter);
+    size_t row_size    = (size_t) ctx->m_Image->m_Width * 4;
+    size_t out_size    = (size_t) ctx->m_Output->m_Width * 4;
+    float* input       = (float*) malloc((row_size * max_rows + out_size * 2) * sizeof(float));
+    float* scratch     = input + row_size * max_rows;
+    float* rgba        = scratch + out_size;
+    const float** rows = (const float**) malloc(max_rows * sizeof(float*));
+
+    for (int y = row_begin; y < row_end; ++y)
+    {
+        int first, count;
+        area_filter_input_rows(ctx->m_Filter, y, &first, &count);
+        for (int i = 0; i < count; ++i)
+        {
+            rows[i] = input + row_size * i;
+            image_row_to_float(ctx->m_Image, first + i, input + row_size * i);
+        }
+        area_filter_row(ctx->m_Filter, y, rows, scratch, rgba);
+        float_to_image_row(rgba, ctx->m_Output, y);
+    }
+
+    free(rows);
+    free(input);
+}
+
+bool pbr_image_downsample(pbr_context* context, const pbr_image* image, int width, int height, pbr_image* image_out)
+{
+    if (width < 1 || height < 1 || width > image->m_Width || height > image->m_Height)
+    {
+        memset(image_out, 0, sizeof(pbr_image));
+        return false;
+    }
+
+    void* pixels = STBI_MALLOC((size_t) width * height * get_pixel_size(image->m_PixelFormat));
+    if (!pbr_image_finish(pixels, width, height, image->m_PixelFormat, image_out))
+    {
+        return false;
+    }
+
+    area_filter* filter = area_filter_create(image->m_Width, image->m_Height, width, height);
+
+    downsample_job_context ctx;
+    ctx.m_Filter     = filter;
+    ctx.m_Image      = image;
+    ctx.m_Output     = image_out;
+    ctx.m_RowsPerJob = 4;
+    job_system_run(context->m_JobSystem, downsample_job, &ctx, (height + ctx.m_RowsPerJob - 1) / ctx.m_RowsPerJob);
+
+    area_filter_destroy(filter);
+    return true;
+}
+
+// LDR inputs are sampled as normalized values by the GPU passes, do the same here. RGBE is expanded
+// for the duration of the bake.
+static float* get_image_pixels_float(const pbr_image* image)
+{
+    if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBA32F)
+    {
+        return (float*) image->m_Pixels;
+    }
+
+    size_t num_values = (size_t) image->m_Width * image->m_Height * 4;
+    float* pixels     = (float*) malloc(num_values * sizeof(float));
+    if (image->m_PixelFormat == PBR_PIXEL_FORMAT_RGBE8)
+    {
+        // RGBE images are at most 2^28 pixels (radiance_read_header)
+        radiance_rgbe_to_float((const uint8_t*) image->m_Pixels, (uint32_t) (num_values / 4), pixels);
+        return pixels;
+    }
+
+    const uint8_t* ldr = (const uint8_t*) image->m_Pixels;
+    for (size_t i = 0; i < num_values; ++i)
+    {
+        pixels[i] = ldr[i] / 255.0f;
+    }
+    return pixels;
+}
+
+static void release_image_pixels_float(const pbr_image* image, float* pixels)
+{
+    if (pixels != (float*) image->m_Pixels)
+    {
+        free(pixels);
+    }
+}
+
+static void output_alloc(pbr_output* output, int size, int side_count)
+{
+    output->m_Size     = size;
+    output->m_DataSize = size * size * 4 * sizeof(float) * side_count;
+    output->m_Data     = malloc(output->m_DataSize);
+}
+
+// Converts in place, the halves are written ahead of the floats they are read from
+static void output_finish(pbr_output* output, int buffer_format)
+{
+    if (buffer_format == PBR_BUFFER_FORMAT_FLOAT32 || !output->m_Data)
+    {
+        return;
+    }
+
+    uint32_t num_floats = output->m_DataSize / sizeof(float);
+    float* floats       = (float*) output->m_Data;
+    uint16_t* halves    = (uint16_t*) output->m_Data;
+    static const uint32_t chunk = 1024;
+    for (uint32_t i = 0; i < num_floats; i += chunk)
+    {
+        uint32_t count = num_floats - i < chunk ? num_floats - i : chunk;
+        uint16_t tmp[chunk];
+        float32_to_float16(floats + i, count, tmp);
+        memcpy(halves + i, tmp, count * sizeof(uint16_t));
+    }
+
+    output->m_DataSize = num_floats * sizeof(uint16_t);
+    output->m_Data     = realloc(output->m_Data, output->m_DataSize);
+}
+
+// Projects at the highest band count that is asked for, the bands are independent so fewer bands are a truncation
+static void project_irradiance_sh(const pbr_image* image, int bands, sh_coefficients* sh_out)
+{
+    float* pixels = get_image_pixels_float(image);
+
+    sh_project_equirect(pixels, image->m_Width, image->m_Height, bands, sh_out);
+    sh_convolve_irradiance(sh_out);
+
+    release_image_pixels_float(image, pixels);
+}
+
+static void bake_diffuse_irradiance(const sh_coefficients* sh, const pbr_bake_params* params, pbr_outputs* outputs)
+{
+    int coefficient_count = params->m_SHBands * params->m_SHBands;
+
+    memset(&outputs->m_IrradianceSH, 0, sizeof(sh_coefficients));
+    outputs->m_IrradianceSH.m_Bands = params->m_SHBands;
+    memcpy(outputs->m_IrradianceSH.m_Coefficients, sh->m_Coefficients, coefficient_count * sizeof(sh->m_Coefficients[0]));
+
+    if (params->m_IrradianceSize > 0)
+    {
+        output_alloc(&outputs->m_Irradiance, params->m_IrradianceSize, CUBEMAP_SIDE_COUNT);
+        sh_render_cubemap(&outputs->m_IrradianceSH, params->m_IrradianceSize, (float*) outputs->m_Irradiance.m_Data);
+    }
+}
+
+// Same steps as the GPU path: equirect -> environment cube -> mipmaps
+static void make_environment_cube(job_system* jobs, const pbr_image* image, int size, cubemap* environment)
+{
+    float* pixels = get_image_pixels_float(image);
+
+    cubemap_create(environment, size);
+    cubemap_from_equirect(jobs, environment, pixels, image->m_Width, image->m_Height);
+    cubemap_generate_mipmaps(jobs, environment);
+
+    release_image_pixels_float(image, pixels);
+}
+
+// -> GGX prefilter
+static void bake_prefilter(job_system* jobs, const cubemap* environment, const pbr_bake_params* params, pbr_outputs* outputs)
+{
+    prefilter_params prefilter;
+    prefilter.m_Size             = params->m_PrefilterSize;
+    prefilter.m_MipmapCount      = 1 + floor(log2(params->m_PrefilterSize));
+    prefilter.m_SampleCount      = params->m_PrefilterSampleCount;
+    prefilter.m_SourceResolution = (float) environment->m_Size;
+
+    float* mip_pixels[CUBEMAP_MAX_MIPMAPS];
+    for (int mip = 0; mip < prefilter.m_MipmapCount; ++mip)
+    {
+        output_alloc(&outputs->m_Prefilter[mip], params->m_PrefilterSize >> mip, CUBEMAP_SIDE_COUNT);
+        mip_pixels[mip] = (float*) outputs->m_Prefilter[mip].m_Data;
+    }
+    outputs->m_PrefilterMipmapCount = prefilter.m_MipmapCount;
+
+    prefilter_cubemap(jobs, environment, &prefilter, mip_pixels);
+}
+
+static bool bake_params_valid(const pbr_bake_params* params)
+{
+    return params->m_SHBands >= SH_MIN_BANDS && params->m_SHBands <= SH_MAX_BANDS &&
+        params->m_EnvironmentSize > 0 && params->m_IrradianceSize >= 0 && params->m_BRDFLutSize > 0 &&
+        params->m_PrefilterSampleCount > 0 && params->m_BRDFLutSampleCount > 0 &&
+        params->m_PrefilterSize > 0 && (1 + floor(log2(params->m_PrefilterSize))) <= CUBEMAP_MAX_MIPMAPS;
+}
+
+bool pbr_bake(pbr_context* context, const pbr_image* image, const pbr_bake_params* params, pbr_outputs* outputs_out)
+{
+    return pbr_bake_profiles(context, image, params, 1, outputs_out);
+}
+
+bool pbr_bake_profiles(pbr_context* context, const pbr_image* image, const pbr_bake_params* params, int profile_count, pbr_outputs* outputs_out)
+{
+    int generate_mask    = 0;
+    int sh_bands         = 0;
+    int environment_size = 0;
+    for (int i = 0; i < profile_count; ++i)
+    {
+        memset(&outputs_out[i], 0, sizeof(pbr_outputs));
+
+        if (!bake_params_valid(&params[i]))
+        {
+            return false;
+        }
+
+        generate_mask |= params[i].m_GenerateMask;
+        if (params[i].m_GenerateMask & PBR_GENERATE_DIFFUSE_IRRADIANCE)
+        {
+            sh_bands = params[i].m_SHBands > sh_bands ? params[i].m_SHBands : sh_bands;
+        }
+        if (params[i].m_GenerateMask & PBR_GENERATE_PREFILTERED_ENVIRONMENT)
+        {
+            environment_size = params[i].m_EnvironmentSize > environment_size ? params[i].m_EnvironmentSize : environment_size;
+        }
+    }
+
+    bool needs_image = (generate_mask & (PBR_GENERATE_DIFFUSE_IRRADIANCE | PBR_GENERATE_PREFILTERED_ENVIRONMENT)) != 0;
+    if (profile_count <= 0 || (needs_image && (!image || !image->m_Pixels || image->m_Width <= 0 || image->m_Height <= 0)))
+    {
+        return false;
+    }
+
+    // Everything that only depends on the input is done once for all profiles
+    sh_coefficients sh;
+    if (sh_bands > 0)
+    {
+        project_irradiance_sh(image, sh_bands, &sh);
+    }
+
+    cubemap environment = {};
+    if (environment_size > 0)
+    {
+        make_environment_cube(context->m_JobSystem, image, environment_size, &environment);
+    }
+
+    for (int i = 0; i < profile_count; ++i)
+    {
+        const pbr_bake_params* profile = &params[i];
+        pbr_outputs* outputs           = &outputs_out[i];
+
+        if (profile->m_GenerateMask & PBR_GENERATE_DIFFUSE_IRRADIANCE)
+        {
+            bake_diffuse_irradiance(&sh, profile, outputs);
+            output_finish(&outputs->m_Irradiance, profile->m_BufferFormat);
+        }
+
+        if (profile->m_GenerateMask & PBR_GENERATE_BRDF_LUT)
+        {
+            // The LUT doesn't depend on the input, profiles with the same settings get a copy
+            const pbr_outputs* same_lut = 0;
+            for (int j = 0; j < i && !same_lut; ++j)
+            {
+                if ((params[j].m_GenerateMask & PBR_GENERATE_BRDF_LUT) &&
+                    params[j].m_BRDFLutSize        == profile->m_BRDFLutSize &&
+                    params[j].m_BRDFLutSampleCount == profile->m_BRDFLutSampleCount &&
+                    params[j].m_BufferFormat       == profile->m_BufferFormat)
+                {
+                    same_lut = &outputs_out[j];
+                }
+            }
+
+            if (same_lut)
+            {
+                outputs->m_BRDFLut        = same_lut->m_BRDFLut;
+                outputs->m_BRDFLut.m_Data = malloc(same_lut->m_BRDFLut.m_DataSize);
+                memcpy(outputs->m_BRDFLut.m_Data, same_lut->m_BRDFLut.m_Data, same_lut->m_BRDFLut.m_DataSize);
+            }
+            else
+            {
+                output_alloc(&outputs->m_BRDFLut, profile->m_BRDFLutSize, 1);
+                brdf_lut_integrate(context->m_JobSystem, profile->m_BRDFLutSize, profile->m_BRDFLutSampleCount, (float*) outputs->m_BRDFLut.m_Data);
+                output_finish(&outputs->m_BRDFLut, profile->m_BufferFormat);
+            }
+        }
+
+        if (profile->m_GenerateMask & PBR_GENERATE_PREFILTERED_ENVIRONMENT)
+        {
+            bake_prefilter(context->m_JobSystem, &environment, profile, outputs);
+            for (int mip = 0; mip < outputs->m_PrefilterMipmapCount; ++mip)
+            {
+                output_finish(&outputs->m_Prefilter[mip], profile->m_BufferFormat);
+            }
+        }
+    }
+
+    if (environment_size > 0)
+    {
+        cubemap_destroy(&environment);
+    }
+    return true;
+}
+
+void pbr_outputs_free(pbr_outputs* outputs)
+{
+    free(outputs->m_Irradiance.m_Data);
+    free(outputs->m_BRDFLut.m_Data);
+    for (int mip = 0; mip < outputs->m_PrefilterMipmapCount; ++mip)
+    {
+        free(outputs->m_Prefilter[mip].m_Data);
+    }
+    memset(outputs, 0, sizeof(pbr_outputs));
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cubemap.h"
+#include "spherical_harmonics.h"
+
+// libpbrutils, the generation core behind pbr-utils as a C API. Everything works on in-memory
+// pixels, nothing is read from or written to disk unless asked for. A context owns the worker
+// threads, several contexts can bake at the same time (and a context can be shared between threads).
+//
+// The GL passes need a GL context and stay in the pbr-utils front-end, bakes through this API
+// always use the CPU engines (see prefilter.h, spherical_harmonics.h and brdf_lut.h).
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pbr_context pbr_context;
+
+// Constants are enums so that they are constant expressions in C as well
+enum
+{
+    PBR_GENERATE_BRDF_LUT                = 1,
+    PBR_GENERATE_DIFFUSE_IRRADIANCE      = 2,
+    PBR_GENERATE_PREFILTERED_ENVIRONMENT = 4,
+    PBR_GENERATE_ALL                     = 7
+};
+
+// Quality presets, see pbr_bake_params_preset
+enum
+{
+    PBR_QUALITY_MOBILE    = 0,
+    PBR_QUALITY_DESKTOP   = 1, // the defaults
+    PBR_QUALITY_REFERENCE = 2
+};
+
+enum
+{
+    PBR_PIXEL_FORMAT_RGBA8   = 0,
+    PBR_PIXEL_FORMAT_RGBA32F = 1,
+    PBR_PIXEL_FORMAT_RGBE8   = 2 // Radiance RGBE, 4 bytes per pixel
+};
+
+// Outputs are float16 unless PBR_BUFFER_FORMAT_FLOAT32, the values match the .buffer stream types
+enum
+{
+    PBR_BUFFER_FORMAT_UINT8   = 0,
+    PBR_BUFFER_FORMAT_UINT16  = 1,
+    PBR_BUFFER_FORMAT_FLOAT32 = 2
+};
+
+// Equirectangular environment, RGBA8 values are treated as normalized [0,1]
+typedef struct
+{
+    void* m_Pixels;
+    int   m_Width;
+    int   m_Height;
+    int   m_PixelFormat;
+} pbr_image;
+
+typedef struct
+{
+    int   m_GenerateMask;
+    int   m_EnvironmentSize;       // intermediate cubemap the prefilter samples from
+    int   m_IrradianceSize;        // 0 only computes the SH coefficients
+    float m_IrradianceSampleDelta; // hemisphere step (radians) of the GPU irradiance pass, the CPU engine uses SH
+    int   m_SHBands;
+    int   m_PrefilterSize;         // mip 0, the chain goes down to 1x1
+    int   m_PrefilterSampleCount;
+    int   m_BRDFLutSize;
+    int   m_BRDFLutSampleCount;
+    int   m_BufferFormat;          // PBR_BUFFER_FORMAT_*
+} pbr_bake_params;
+
+// RGBA texels, cubemaps have all six sides in output layout (see cubemap.h).
+// m_Data is allocated with malloc, ownership can be taken by clearing the pointer.
+typedef struct
+{
+    void*    m_Data;
+    uint32_t m_DataSize;
+    int      m_Size;
+} pbr_output;
+
+typedef struct
+{
+    pbr_output      m_Irradiance;
+    sh_coefficients m_IrradianceSH;
+    pbr_output      m_Prefilter[CUBEMAP_MAX_MIPMAPS];
+    int             m_PrefilterMipmapCount;
+    pbr_output      m_BRDFLut; // rows in GL readback order, like the GPU pass
+} pbr_outputs;
+
+// PBR_QUALITY_DESKTOP
+void         pbr_bake_params_default(pbr_bake_params* params);
+
+// Sizes and sample counts of a PBR_QUALITY_* preset, everything else is set to the defaults.
+// Returns false for unknown presets.
+bool         pbr_bake_params_preset(int quality, pbr_bake_params* params);
+
+// thread_count includes the calling thread, 0 means one per hardware thread
+pbr_context* pbr_context_create(uint32_t thread_count);
+void         pbr_context_destroy(pbr_context* context);
+uint32_t     pbr_context_thread_count(const pbr_context* context);
+
+// Decodes an image file (HDR as RGBA32F, everything else as RGBA8), release with pbr_image_free
+bool         pbr_image_load(const char* path, pbr_image* image_out);
+bool         pbr_image_decode(const void* file_data, uint32_t file_data_size, pbr_image* image_out);
+
+// Same as above, but Radiance HDR files are kept as PBR_PIXEL_FORMAT_RGBE8 (a quarter of the memory of RGBA32F).
+// With a context (optional) the scanlines are decoded on its threads.
+bool         pbr_image_load_rgbe(pbr_context* context, const char* path, pbr_image* image_out);
+bool         pbr_image_decode_rgbe(pbr_context* context, const void* file_data, uint32_t file_data_size, pbr_image* image_out);
+void         pbr_image_free(pbr_image* image);
+
+// Area filters the image down to width x height (each no larger than the input) on the context's threads,
+// every output pixel is the average of the input pixels it covers. The result has the same pixel format.
+bool         pbr_image_downsample(pbr_context* context, const pbr_image* image, int width, int height, pbr_image* image_out);
+
+// Bakes everything in params->m_GenerateMask, release the results with pbr_outputs_free
+bool         pbr_bake(pbr_context* context, const pbr_image* image, const pbr_bake_params* params, pbr_outputs* outputs_out);
+
+// Bakes several quality tiers of the same image, outputs_out[i] gets the results of params[i].
+// The SH projection and the environment cube (at the largest m_EnvironmentSize of the profiles that
+// prefilter) are only computed once, and profiles with the same BRDF LUT settings share the integration.
+bool         pbr_bake_profiles(pbr_context* context, const pbr_image* image, const pbr_bake_params* params, int profile_count, pbr_outputs* outputs_out);
+void         pbr_outputs_free(pbr_outputs* outputs);
+
+#ifdef __cplusplus
+}
+#endif
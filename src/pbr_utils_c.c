@@ -0,0 +1,2 @@
+// pbr_utils.h is a C API, compiling it as C keeps it that way
+#include "pbr_utils.h"
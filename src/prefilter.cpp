@@ -0,0 +1,466 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefilter.h"
+#include "job_system.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    #include <immintrin.h>
+    #define PREFILTER_SIMD_X86
+#endif
+
+static const float PREFILTER_PI       = 3.14159265359f;
+static const int   PREFILTER_TILE     = 32;
+static const int   PREFILTER_BATCH    = 8;
+
+// The sample pattern only depends on roughness, since V = R = N every sample can be expressed
+// in the tangent frame of the texel normal. Arrays are padded to a multiple of PREFILTER_BATCH.
+typedef struct
+{
+    float* m_LX;
+    float* m_LY;
+    float* m_LZ;
+    float* m_Weight;
+    int*   m_Mip0;
+    int*   m_Mip1;
+    float* m_MipBlend;
+    int    m_Count;
+    int    m_PaddedCount;
+    float  m_TotalWeight;
+} sample_table;
+
+typedef struct
+{
+    int m_Mip;
+    int m_Side;
+    int m_X;
+    int m_Y;
+    int m_Width;
+    int m_Height;
+} prefilter_tile;
+
+typedef void (*prefilter_texel_function)(const cubemap* env, const sample_table* table, const float* n, const float* t, const float* b, float* rgba_out);
+
+typedef struct
+{
+    const cubemap*           m_Environment;
+    const prefilter_params*  m_Params;
+    sample_table*            m_Tables;
+    prefilter_tile*          m_Tiles;
+    float**                  m_Pixels;
+    prefilter_texel_function m_TexelFunction;
+} prefilter_context;
+
+static float radical_inverse_vdc(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return (float) bits * 2.3283064365386963e-10f;
+}
+
+static void sample_table_create(sample_table* table, const prefilter_params* params, int max_mip, float roughness)
+{
+    int sample_count     = params->m_SampleCount;
+    table->m_PaddedCount = (sample_count + PREFILTER_BATCH - 1) / PREFILTER_BATCH * PREFILTER_BATCH;
+    table->m_LX          = (float*) calloc(table->m_PaddedCount, sizeof(float));
+    table->m_LY          = (float*) calloc(table->m_PaddedCount, sizeof(float));
+    table->m_LZ          = (float*) calloc(table->m_PaddedCount, sizeof(float));
+    table->m_Weight      = (float*) calloc(table->m_PaddedCount, sizeof(float));
+    table->m_Mip0        = (int*)   calloc(table->m_PaddedCount, sizeof(int));
+    table->m_Mip1        = (int*)   calloc(table->m_PaddedCount, sizeof(int));
+    table->m_MipBlend    = (float*) calloc(table->m_PaddedCount, sizeof(float));
+    table->m_Count       = 0;
+    table->m_TotalWeight = 0.0f;
+
+    float a        = roughness * roughness;
+    float a2       = a * a;
+    float sa_texel = 4.0f * PREFILTER_PI / (6.0f * params->m_SourceResolution * params->m_SourceResolution);
+
+    for (int i = 0; i < sample_count; ++i)
+    {
+        // Hammersley + ImportanceSampleGGX, in tangent space where N = V = (0,0,1)
+        float xi_x      = (float) i / (float) sample_count;
+        float xi_y      = radical_inverse_vdc((uint32_t) i);
+        float phi       = 2.0f * PREFILTER_PI * xi_x;
+        float cos_theta = sqrtf((1.0f - xi_y) / (1.0f + (a2 - 1.0f) * xi_y));
+        float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+
+        float hx = cosf(phi) * sin_theta;
+        float hy = sinf(phi) * sin_theta;
+        float hz = cos_theta;
+
+        // L = 2 * dot(V, H) * H - V
+        float lx = 2.0f * hz * hx;
+        float ly = 2.0f * hz * hy;
+        float lz = 2.0f * hz * hz - 1.0f;
+
+        float n_dot_l = lz;
+        if (n_dot_l <= 0.0f)
+        {
+            continue;
+        }
+
+        float mip_level = 0.0f;
+        if (roughness != 0.0f)
+        {
+            float n_dot_h2 = hz * hz;
+            float denom    = n_dot_h2 * (a2 - 1.0f) + 1.0f;
+            float d        = a2 / (PREFILTER_PI * denom * denom);
+            float pdf      = d * hz / (4.0f * hz) + 0.0001f;
+            float sa_sample = 1.0f / ((float) sample_count * pdf + 0.0001f);
+            mip_level      = 0.5f * log2f(sa_sample / sa_texel);
+        }
+
+        mip_level = mip_level < 0.0f ? 0.0f : (mip_level > (float) max_mip ? (float) max_mip : mip_level);
+
+        int c = table->m_Count++;
+        table->m_LX[c]       = lx;
+        table->m_LY[c]       = ly;
+        table->m_LZ[c]       = lz;
+        table->m_Weight[c]   = n_dot_l;
+        table->m_Mip0[c]     = (int) mip_level;
+        table->m_Mip1[c]     = table->m_Mip0[c] + 1 <= max_mip ? table->m_Mip0[c] + 1 : max_mip;
+        table->m_MipBlend[c] = mip_level - (float) table->m_Mip0[c];
+        table->m_TotalWeight += n_dot_l;
+    }
+
+    // With zero roughness every sample is L = N, a single lookup gives the same result
+    if (roughness == 0.0f && table->m_Count > 0)
+    {
+        table->m_Count       = 1;
+        table->m_TotalWeight = table->m_Weight[0];
+    }
+
+    // Padding samples have zero weight but must still point at a valid direction
+    for (int c = table->m_Count; c < table->m_PaddedCount; ++c)
+    {
+        table->m_LZ[c] = 1.0f;
+    }
+}
+
+static void sample_table_destroy(sample_table* table)
+{
+    free(table->m_LX);
+    free(table->m_LY);
+    free(table->m_LZ);
+    free(table->m_Weight);
+    free(table->m_Mip0);
+    free(table->m_Mip1);
+    free(table->m_MipBlend);
+}
+
+// Only used where there is no SSE
+#if !defined(PREFILTER_SIMD_X86)
+static void prefilter_texel_scalar(const cubemap* env, const sample_table* table, const float* n, const float* t, const float* b, float* rgba_out)
+{
+    float sum[4] = {};
+
+    for (int i = 0; i < table->m_Count; ++i)
+    {
+        float lx = t[0] * table->m_LX[i] + b[0] * table->m_LY[i] + n[0] * table->m_LZ[i];
+        float ly = t[1] * table->m_LX[i] + b[1] * table->m_LY[i] + n[1] * table->m_LZ[i];
+        float lz = t[2] * table->m_LX[i] + b[2] * table->m_LY[i] + n[2] * table->m_LZ[i];
+
+        float s, tc;
+        int face = cubemap_direction_to_face(lx, ly, lz, &s, &tc);
+
+        float c0[4], c1[4];
+        cubemap_fetch_bilinear(env, table->m_Mip0[i], face, s, tc, c0);
+        cubemap_fetch_bilinear(env, table->m_Mip1[i], face, s, tc, c1);
+
+        float w     = table->m_Weight[i];
+        float blend = table->m_MipBlend[i];
+        for (int c = 0; c < 4; ++c)
+        {
+            sum[c] += (c0[c] + (c1[c] - c0[c]) * blend) * w;
+        }
+    }
+
+    for (int c = 0; c < 4; ++c)
+    {
+        rgba_out[c] = sum[c] / table->m_TotalWeight;
+    }
+}
+#endif
+
+#if defined(PREFILTER_SIMD_X86)
+static inline __m128 fetch_bilinear_sse(const cubemap* env, int mip, int face, float s, float t)
+{
+    int size          = env->m_Size >> mip;
+    const float* data = env->m_Faces[mip][face];
+
+    float fx = s * size - 0.5f;
+    float fy = t * size - 0.5f;
+    fx = fx < 0.0f ? 0.0f : (fx > size - 1 ? size - 1 : fx);
+    fy = fy < 0.0f ? 0.0f : (fy > size - 1 ? size - 1 : fy);
+
+    int x0 = (int) fx;
+    int y0 = (int) fy;
+    int x1 = x0 + 1 < size ? x0 + 1 : x0;
+    int y1 = y0 + 1 < size ? y0 + 1 : y0;
+
+    __m128 wx  = _mm_set1_ps(fx - x0);
+    __m128 wy  = _mm_set1_ps(fy - y0);
+    __m128 p00 = _mm_loadu_ps(data + (y0 * size + x0) * 4);
+    __m128 p10 = _mm_loadu_ps(data + (y0 * size + x1) * 4);
+    __m128 p01 = _mm_loadu_ps(data + (y1 * size + x0) * 4);
+    __m128 p11 = _mm_loadu_ps(data + (y1 * size + x1) * 4);
+
+    __m128 top    = _mm_add_ps(p00, _mm_mul_ps(_mm_sub_ps(p10, p00), wx));
+    __m128 bottom = _mm_add_ps(p01, _mm_mul_ps(_mm_sub_ps(p11, p01), wx));
+    return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wy));
+}
+
+static inline __m128 select_sse(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Accumulates 'count' already projected samples
+static inline __m128 accumulate_samples_sse(const cubemap* env, const sample_table* table, int base, int count,
+    const float* faces, const float* s, const float* t, __m128 sum)
+{
+    for (int k = 0; k < count; ++k)
+    {
+        int i        = base + k;
+        int face     = (int) faces[k];
+        __m128 c0    = fetch_bilinear_sse(env, table->m_Mip0[i], face, s[k], t[k]);
+        __m128 c1    = fetch_bilinear_sse(env, table->m_Mip1[i], face, s[k], t[k]);
+        __m128 color = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), _mm_set1_ps(table->m_MipBlend[i])));
+        sum          = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(table->m_Weight[i])));
+    }
+    return sum;
+}
+
+static void prefilter_texel_sse(const cubemap* env, const sample_table* table, const float* n, const float* t, const float* b, float* rgba_out)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    __m128 sum = _mm_setzero_ps();
+
+    for (int base = 0; base < table->m_Count; base += 4)
+    {
+        __m128 tx = _mm_loadu_ps(table->m_LX + base);
+        __m128 ty = _mm_loadu_ps(table->m_LY + base);
+        __m128 tz = _mm_loadu_ps(table->m_LZ + base);
+
+        // Tangent space to world
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t[0]), tx), _mm_mul_ps(_mm_set1_ps(b[0]), ty)), _mm_mul_ps(_mm_set1_ps(n[0]), tz));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t[1]), tx), _mm_mul_ps(_mm_set1_ps(b[1]), ty)), _mm_mul_ps(_mm_set1_ps(n[1]), tz));
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t[2]), tx), _mm_mul_ps(_mm_set1_ps(b[2]), ty)), _mm_mul_ps(_mm_set1_ps(n[2]), tz));
+
+        // Face selection, same rules as cubemap_direction_to_face
+        __m128 ax = _mm_andnot_ps(sign, x);
+        __m128 ay = _mm_andnot_ps(sign, y);
+        __m128 az = _mm_andnot_ps(sign, z);
+
+        __m128 major_x = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+        __m128 major_y = _mm_andnot_ps(major_x, _mm_cmpge_ps(ay, az));
+        __m128 x_pos   = _mm_cmpge_ps(x, zero);
+        __m128 y_pos   = _mm_cmpge_ps(y, zero);
+        __m128 z_pos   = _mm_cmpge_ps(z, zero);
+        __m128 neg_x   = _mm_xor_ps(x, sign);
+        __m128 neg_y   = _mm_xor_ps(y, sign);
+        __m128 neg_z   = _mm_xor_ps(z, sign);
+
+        __m128 sc   = select_sse(major_x, select_sse(x_pos, neg_z, z), select_sse(major_y, x, select_sse(z_pos, x, neg_x)));
+        __m128 tc   = select_sse(major_y, select_sse(y_pos, z, neg_z), neg_y);
+        __m128 ma   = select_sse(major_x, ax, select_sse(major_y, ay, az));
+        __m128 face = select_sse(major_x, select_sse(x_pos, zero, one),
+                      select_sse(major_y, select_sse(y_pos, _mm_set1_ps(2.0f), _mm_set1_ps(3.0f)),
+                                          select_sse(z_pos, _mm_set1_ps(4.0f), _mm_set1_ps(5.0f))));
+
+        __m128 s_coord = _mm_mul_ps(half, _mm_add_ps(_mm_div_ps(sc, ma), one));
+        __m128 t_coord = _mm_mul_ps(half, _mm_add_ps(_mm_div_ps(tc, ma), one));
+
+        float faces[4], s[4], tt[4];
+        _mm_storeu_ps(faces, face);
+        _mm_storeu_ps(s, s_coord);
+        _mm_storeu_ps(tt, t_coord);
+
+        int count = table->m_Count - base < 4 ? table->m_Count - base : 4;
+        sum = accumulate_samples_sse(env, table, base, count, faces, s, tt, sum);
+    }
+
+    _mm_storeu_ps(rgba_out, _mm_div_ps(sum, _mm_set1_ps(table->m_TotalWeight)));
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+static void prefilter_texel_avx2(const cubemap* env, const sample_table* table, const float* n, const float* t, const float* b, float* rgba_out)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one  = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    const __m256 t0 = _mm256_set1_ps(t[0]), t1 = _mm256_set1_ps(t[1]), t2 = _mm256_set1_ps(t[2]);
+    const __m256 b0 = _mm256_set1_ps(b[0]), b1 = _mm256_set1_ps(b[1]), b2 = _mm256_set1_ps(b[2]);
+    const __m256 n0 = _mm256_set1_ps(n[0]), n1 = _mm256_set1_ps(n[1]), n2 = _mm256_set1_ps(n[2]);
+
+    __m128 sum = _mm_setzero_ps();
+
+    for (int base = 0; base < table->m_Count; base += 8)
+    {
+        __m256 tx = _mm256_loadu_ps(table->m_LX + base);
+        __m256 ty = _mm256_loadu_ps(table->m_LY + base);
+        __m256 tz = _mm256_loadu_ps(table->m_LZ + base);
+
+        __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t0, tx), _mm256_mul_ps(b0, ty)), _mm256_mul_ps(n0, tz));
+        __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t1, tx), _mm256_mul_ps(b1, ty)), _mm256_mul_ps(n1, tz));
+        __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t2, tx), _mm256_mul_ps(b2, ty)), _mm256_mul_ps(n2, tz));
+
+        __m256 ax = _mm256_andnot_ps(sign, x);
+        __m256 ay = _mm256_andnot_ps(sign, y);
+        __m256 az = _mm256_andnot_ps(sign, z);
+
+        __m256 major_x = _mm256_and_ps(_mm256_cmp_ps(ax, ay, _CMP_GE_OQ), _mm256_cmp_ps(ax, az, _CMP_GE_OQ));
+        __m256 major_y = _mm256_andnot_ps(major_x, _mm256_cmp_ps(ay, az, _CMP_GE_OQ));
+        __m256 x_pos   = _mm256_cmp_ps(x, zero, _CMP_GE_OQ);
+        __m256 y_pos   = _mm256_cmp_ps(y, zero, _CMP_GE_OQ);
+        __m256 z_pos   = _mm256_cmp_ps(z, zero, _CMP_GE_OQ);
+        __m256 neg_x   = _mm256_xor_ps(x, sign);
+        __m256 neg_y   = _mm256_xor_ps(y, sign);
+        __m256 neg_z   = _mm256_xor_ps(z, sign);
+
+        // blendv picks the second operand where the mask is set
+        __m256 sc   = _mm256_blendv_ps(_mm256_blendv_ps(_mm256_blendv_ps(neg_x, x, z_pos), x, major_y), _mm256_blendv_ps(z, neg_z, x_pos), major_x);
+        __m256 tc   = _mm256_blendv_ps(neg_y, _mm256_blendv_ps(neg_z, z, y_pos), major_y);
+        __m256 ma   = _mm256_blendv_ps(_mm256_blendv_ps(az, ay, major_y), ax, major_x);
+        __m256 face = _mm256_blendv_ps(
+            _mm256_blendv_ps(_mm256_blendv_ps(_mm256_set1_ps(5.0f), _mm256_set1_ps(4.0f), z_pos),
+                             _mm256_blendv_ps(_mm256_set1_ps(3.0f), _mm256_set1_ps(2.0f), y_pos), major_y),
+            _mm256_blendv_ps(one, zero, x_pos), major_x);
+
+        __m256 s_coord = _mm256_mul_ps(half, _mm256_add_ps(_mm256_div_ps(sc, ma), one));
+        __m256 t_coord = _mm256_mul_ps(half, _mm256_add_ps(_mm256_div_ps(tc, ma), one));
+
+        float faces[8], s[8], tt[8];
+        _mm256_storeu_ps(faces, face);
+        _mm256_storeu_ps(s, s_coord);
+        _mm256_storeu_ps(tt, t_coord);
+
+        int count = table->m_Count - base < 8 ? table->m_Count - base : 8;
+        sum = accumulate_samples_sse(env, table, base, count, faces, s, tt, sum);
+    }
+
+    _mm_storeu_ps(rgba_out, _mm_div_ps(sum, _mm_set1_ps(table->m_TotalWeight)));
+}
+#endif
+#endif
+
+static prefilter_texel_function select_texel_function()
+{
+#if defined(PREFILTER_SIMD_X86)
+    #if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return prefilter_texel_avx2;
+    }
+    #endif
+    return prefilter_texel_sse;
+#else
+    return prefilter_texel_scalar;
+#endif
+}
+
+static void prefilter_tile_job(void* context, uint32_t job_index)
+{
+    prefilter_context* ctx    = (prefilter_context*) context;
+    const prefilter_tile tile = ctx->m_Tiles[job_index];
+    const sample_table* table = &ctx->m_Tables[tile.m_Mip];
+    int size                  = ctx->m_Params->m_Size >> tile.m_Mip;
+    float* pixels             = ctx->m_Pixels[tile.m_Mip];
+
+    for (int y = tile.m_Y; y < tile.m_Y + tile.m_Height; ++y)
+    {
+        for (int x = tile.m_X; x < tile.m_X + tile.m_Width; ++x)
+        {
+            float n[3];
+            cubemap_texel_direction(tile.m_Side, x, y, size, n);
+
+            float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            n[0] /= len; n[1] /= len; n[2] /= len;
+
+            // Same tangent frame as ImportanceSampleGGX
+            float up[3] = { 0.0f, 0.0f, 1.0f };
+            if (fabsf(n[2]) >= 0.999f)
+            {
+                up[0] = 1.0f; up[2] = 0.0f;
+            }
+
+            float t[3] = { up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2], up[0] * n[1] - up[1] * n[0] };
+            float t_len = sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+            t[0] /= t_len; t[1] /= t_len; t[2] /= t_len;
+
+            float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+
+            float* texel = pixels + (((size_t) tile.m_Side * size + y) * size + x) * 4;
+            ctx->m_TexelFunction(ctx->m_Environment, table, n, t, b, texel);
+            texel[3] = 1.0f;
+        }
+    }
+}
+
+void prefilter_cubemap(job_system* jobs, const cubemap* environment, const prefilter_params* params, float** mip_pixels_out)
+{
+    prefilter_context ctx;
+    ctx.m_Environment   = environment;
+    ctx.m_Params        = params;
+    ctx.m_Pixels        = mip_pixels_out;
+    ctx.m_TexelFunction = select_texel_function();
+    ctx.m_Tables        = (sample_table*) malloc(params->m_MipmapCount * sizeof(sample_table));
+
+    int tile_count = 0;
+    for (int mip = 0; mip < params->m_MipmapCount; ++mip)
+    {
+        float roughness = params->m_MipmapCount > 1 ? (float) mip / (float) (params->m_MipmapCount - 1) : 0.0f;
+        sample_table_create(&ctx.m_Tables[mip], params, environment->m_MipmapCount - 1, roughness);
+
+        int tiles_per_row = ((params->m_Size >> mip) + PREFILTER_TILE - 1) / PREFILTER_TILE;
+        tile_count += tiles_per_row * tiles_per_row * CUBEMAP_SIDE_COUNT;
+    }
+
+    // Every texel costs the same regardless of mip, except mip 0 which only needs one sample.
+    // Bigger mips come first so the stealing evens out the tail.
+    ctx.m_Tiles    = (prefilter_tile*) malloc(tile_count * sizeof(prefilter_tile));
+    int tile_index = 0;
+
+    for (int mip = 0; mip < params->m_MipmapCount; ++mip)
+    {
+        int size = params->m_Size >> mip;
+        for (int side = 0; side < CUBEMAP_SIDE_COUNT; ++side)
+        {
+            for (int y = 0; y < size; y += PREFILTER_TILE)
+            {
+                for (int x = 0; x < size; x += PREFILTER_TILE)
+                {
+                    prefilter_tile& tile = ctx.m_Tiles[tile_index++];
+                    tile.m_Mip    = mip;
+                    tile.m_Side   = side;
+                    tile.m_X      = x;
+                    tile.m_Y      = y;
+                    tile.m_Width  = size - x < PREFILTER_TILE ? size - x : PREFILTER_TILE;
+                    tile.m_Height = size - y < PREFILTER_TILE ? size - y : PREFILTER_TILE;
+                }
+            }
+        }
+    }
+
+    job_system_run(jobs, prefilter_tile_job, &ctx, tile_count);
+
+    for (int mip = 0; mip < params->m_MipmapCount; ++mip)
+    {
+        sample_table_destroy(&ctx.m_Tables[mip]);
+    }
+
+    free(ctx.m_Tables);
+    free(ctx.m_Tiles);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "cubemap.h"
+
+// CPU implementation of prefilter_fs (GGX importance sampled specular prefilter).
+typedef struct
+{
+    int   m_Size;             // size of mip 0
+    int   m_MipmapCount;      // roughness = mip / (count-1), same as the GPU pass
+    int   m_SampleCount;      // samples per texel
+    float m_SourceResolution; // source resolution used for the sample lod, see prefilter_fs
+} prefilter_params;
+
+// Filters the environment into every mip, mip_pixels_out[mip] receives RGBA32F pixels for all six sides
+// in output layout and must hold (size >> mip)^2 * 6 texels.
+// Work is split into faces x mips x tiles on the job system, samples are evaluated with AVX2/SSE when available.
+void prefilter_cubemap(job_system* jobs, const cubemap* environment, const prefilter_params* params, float** mip_pixels_out);
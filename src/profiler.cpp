@@ -0,0 +1,172 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+#include "profiler.h"
+
+typedef struct
+{
+    char     m_Name[64];
+    char     m_Detail[128];
+    int      m_Track;
+    uint64_t m_Start;
+    uint64_t m_Duration;
+} profiler_event;
+
+struct profiler
+{
+    std::chrono::steady_clock::time_point m_Epoch;
+    std::mutex                            m_Mutex;
+    std::vector<profiler_event>           m_Events;
+};
+
+// CPU threads get tracks 1, 2, ... in the order they record their first event
+static int get_thread_track()
+{
+    static std::atomic<int> next_track(PROFILER_TRACK_GPU + 1);
+    static thread_local int track = 0;
+    if (track == 0)
+    {
+        track = next_track++;
+    }
+    return track;
+}
+
+profiler* profiler_create()
+{
+    profiler* prof = new profiler();
+    prof->m_Epoch  = std::chrono::steady_clock::now();
+    return prof;
+}
+
+void profiler_destroy(profiler* prof)
+{
+    delete prof;
+}
+
+uint64_t profiler_now(const profiler* prof)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - prof->m_Epoch).count();
+}
+
+void profiler_add_event(profiler* prof, int track, const char* name, const char* detail, uint64_t start_us, uint64_t duration_us)
+{
+    profiler_event event;
+    snprintf(event.m_Name, sizeof(event.m_Name), "%s", name);
+    snprintf(event.m_Detail, sizeof(event.m_Detail), "%s", detail ? detail : "");
+    event.m_Track    = track;
+    event.m_Start    = start_us;
+    event.m_Duration = duration_us;
+
+    std::lock_guard<std::mutex> lock(prof->m_Mutex);
+    prof->m_Events.push_back(event);
+}
+
+void profiler_end(profiler* prof, const char* name, const char* detail, uint64_t start_us)
+{
+    uint64_t now = profiler_now(prof);
+    profiler_add_event(prof, get_thread_track(), name, detail, start_us, now > start_us ? now - start_us : 0);
+}
+
+bool profiler_write_trace(const profiler* prof, const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(((profiler*) prof)->m_Mutex);
+
+    int max_track = PROFILER_TRACK_GPU;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < prof->m_Events.size(); ++i)
+    {
+        const profiler_event& event = prof->m_Events[i];
+        max_track = event.m_Track > max_track ? event.m_Track : max_track;
+
+        char name_str[160];
+        char detail_str[288];
+        json_write_string(event.m_Name, name_str, sizeof(name_str));
+        json_write_string(event.m_Detail, detail_str, sizeof(detail_str));
+
+        fprintf(f, "{\"name\":%s,\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"detail\":%s}},\n",
+            name_str, event.m_Track == PROFILER_TRACK_GPU ? "gpu" : "cpu", event.m_Track,
+            (unsigned long long) event.m_Start, (unsigned long long) event.m_Duration, detail_str);
+    }
+
+    for (int track = PROFILER_TRACK_GPU; track <= max_track; ++track)
+    {
+        char thread_name[32];
+        if (track == PROFILER_TRACK_GPU)
+        {
+            snprintf(thread_name, sizeof(thread_name), "GPU");
+        }
+        else
+        {
+            snprintf(thread_name, sizeof(thread_name), "CPU thread %d", track);
+        }
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}%s\n",
+            track, thread_name, track < max_track ? "," : "");
+    }
+    fprintf(f, "]}\n");
+
+    bool result = ferror(f) == 0;
+    fclose(f);
+    return result;
+}
+
+void profiler_print_summary(const profiler* prof)
+{
+    typedef struct
+    {
+        const char* m_Name;
+        bool        m_GPU;
+        int         m_Count;
+        uint64_t    m_Total;
+        uint64_t    m_Min;
+        uint64_t    m_Max;
+    } summary_row;
+
+    std::lock_guard<std::mutex> lock(((profiler*) prof)->m_Mutex);
+
+    std::vector<summary_row> rows;
+    for (size_t i = 0; i < prof->m_Events.size(); ++i)
+    {
+        const profiler_event& event = prof->m_Events[i];
+        bool gpu = event.m_Track == PROFILER_TRACK_GPU;
+
+        size_t row = 0;
+        while (row < rows.size() && (rows[row].m_GPU != gpu || strcmp(rows[row].m_Name, event.m_Name) != 0))
+        {
+            row++;
+        }
+
+        if (row == rows.size())
+        {
+            summary_row new_row = { event.m_Name, gpu, 0, 0, UINT64_MAX, 0 };
+            rows.push_back(new_row);
+        }
+
+        summary_row& r = rows[row];
+        r.m_Count++;
+        r.m_Total += event.m_Duration;
+        r.m_Min    = event.m_Duration < r.m_Min ? event.m_Duration : r.m_Min;
+        r.m_Max    = event.m_Duration > r.m_Max ? event.m_Duration : r.m_Max;
+    }
+
+    printf("-------------------------------------\n");
+    printf("%-32s %-4s %6s %12s %12s %12s %12s\n", "Stage", "", "Count", "Total (ms)", "Avg (ms)", "Min (ms)", "Max (ms)");
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        const summary_row& r = rows[i];
+        printf("%-32s %-4s %6d %12.3f %12.3f %12.3f %12.3f\n", r.m_Name, r.m_GPU ? "gpu" : "cpu", r.m_Count,
+            r.m_Total / 1000.0, r.m_Total / 1000.0 / r.m_Count, r.m_Min / 1000.0, r.m_Max / 1000.0);
+    }
+    printf("-------------------------------------\n");
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Collects timed events from any thread (see --profile). Events are exported as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev) and summarized per name.
+typedef struct profiler profiler;
+
+// Events on this track are drawn as a separate "GPU" thread in the trace
+static const int PROFILER_TRACK_GPU = 0;
+
+profiler* profiler_create();
+void      profiler_destroy(profiler* prof);
+
+// Microseconds since the profiler was created
+uint64_t  profiler_now(const profiler* prof);
+
+// Records an event on the calling thread that started at start_us (from profiler_now) and ends now.
+// detail is optional and shows up in the event arguments, e.g the file or face of a pass.
+void      profiler_end(profiler* prof, const char* name, const char* detail, uint64_t start_us);
+
+void      profiler_add_event(profiler* prof, int track, const char* name, const char* detail, uint64_t start_us, uint64_t duration_us);
+
+bool      profiler_write_trace(const profiler* prof, const char* path);
+
+// Count, total, average, min and max per event name, in order of first occurrence
+void      profiler_print_summary(const profiler* prof);
@@ -0,0 +1,622 @@
+#include <atomic>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "radiance_hdr.h"
+#include "job_system.h"
+
+static const int RADIANCE_MAX_LINE = 1024;
+
+// New style RLE is only used for widths in this range, other images are stored flat
+static const int RADIANCE_RLE_MIN_WIDTH = 8;
+static const int RADIANCE_RLE_MAX_WIDTH = 32767;
+
+// Scanlines decoded by one job of radiance_decode_rgbe_parallel
+static const int RADIANCE_ROWS_PER_JOB  = 16;
+
+static bool starts_with(const uint8_t* data, uint32_t data_size, const char* prefix)
+{
+    uint32_t prefix_len = strlen(prefix);
+    return data_size >= prefix_len && memcmp(data, prefix, prefix_len) == 0;
+}
+
+bool radiance_is_hdr(const void* data, uint32_t data_size)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    return starts_with(bytes, data_size, "#?RADIANCE\n") || starts_with(bytes, data_size, "#?RGBE\n");
+}
+
+// Copies the line at *offset without the newline and advances past it
+static bool read_line(const uint8_t* data, uint32_t data_size, uint32_t* offset, char* line_out)
+{
+    int len = 0;
+    while (*offset < data_size && data[*offset] != '\n')
+    {
+        if (len < RADIANCE_MAX_LINE - 1)
+        {
+            line_out[len++] = (char) data[*offset];
+        }
+        (*offset)++;
+    }
+    line_out[len] = 0;
+
+    if (*offset == data_size)
+    {
+        return false;
+    }
+    (*offset)++;
+    return true;
+}
+
+bool radiance_read_header(const void* data, uint32_t data_size, radiance_header* header_out)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    if (!radiance_is_hdr(bytes, data_size))
+    {
+        return false;
+    }
+
+    char line[RADIANCE_MAX_LINE];
+    uint32_t offset = 0;
+    bool valid      = false;
+
+    // Header variables end with an empty line
+    read_line(bytes, data_size, &offset, line);
+    for (;;)
+    {
+        if (!read_line(bytes, data_size, &offset, line))
+        {
+            return false;
+        }
+        if (line[0] == 0)
+        {
+            break;
+        }
+        if (strcmp(line, "FORMAT=32-bit_rle_rgbe") == 0)
+        {
+            valid = true;
+        }
+    }
+
+    if (!valid || !read_line(bytes, data_size, &offset, line) || strncmp(line, "-Y ", 3) != 0)
+    {
+        return false;
+    }
+
+    char* token = line + 3;
+    int height  = strtol(token, &token, 10);
+    while (*token == ' ')
+    {
+        token++;
+    }
+    if (strncmp(token, "+X ", 3) != 0)
+    {
+        return false;
+    }
+    int width = strtol(token + 3, NULL, 10);
+
+    // Keeps width * height * 4 (values or bytes) in 32 bits for callers
+    if (width <= 0 || height <= 0 || (uint64_t) width * height > (1u << 28))
+    {
+        return false;
+    }
+
+    header_out->m_Width      = width;
+    header_out->m_Height     = height;
+    header_out->m_DataOffset = offset;
+    return true;
+}
+
+static bool decode_scanline_rle(const uint8_t* data, uint32_t data_size, uint32_t* offset, int width, uint8_t* rgbe_out)
+{
+    uint32_t pos = *offset + 4;
+    for (int c = 0; c < 4; ++c)
+    {
+        int x = 0;
+        while (x < width)
+        {
+            if (pos >= data_size)
+            {
+                return false;
+            }
+
+            int count = data[pos++];
+            int left  = width - x;
+            if (count > 128)
+            {
+                count -= 128;
+                if (count > left || pos >= data_size)
+                {
+                    return false;
+                }
+
+                uint8_t value = data[pos++];
+                for (int i = 0; i < count; ++i)
+                {
+                    rgbe_out[(x++) * 4 + c] = value;
+                }
+            }
+            else
+            {
+                if (count == 0 || count > left || pos + count > data_size)
+                {
+                    return false;
+                }
+
+                for (int i = 0; i < count; ++i)
+                {
+                    rgbe_out[(x++) * 4 + c] = data[pos++];
+                }
+            }
+        }
+    }
+
+    *offset = pos;
+    return true;
+}
+
+// Same checks as decode_scanline_rle, without writing anything
+static bool skip_scanline_rle(const uint8_t* data, uint32_t data_size, uint32_t* offset, int width)
+{
+    uint32_t pos = *offset + 4;
+    for (int c = 0; c < 4; ++c)
+    {
+        int x = 0;
+        while (x < width)
+        {
+            if (pos >= data_size)
+            {
+                return false;
+            }
+
+            int count = data[pos++];
+            int left  = width - x;
+            if (count > 128)
+            {
+                count -= 128;
+                if (count > left || pos >= data_size)
+                {
+                    return false;
+                }
+                pos++;
+            }
+            else
+            {
+                if (count == 0 || count > left || pos + count > data_size)
+                {
+                    return false;
+                }
+                pos += count;
+            }
+            x += count;
+        }
+    }
+
+    *offset = pos;
+    return true;
+}
+
+static bool is_rle_scanline(const uint8_t* data, uint32_t data_size, const radiance_cursor* cursor)
+{
+    if (cursor->m_Flat || cursor->m_Offset + 4 > data_size)
+    {
+        return false;
+    }
+    const uint8_t* start = data + cursor->m_Offset;
+    return start[0] == 2 && start[1] == 2 && (start[2] & 0x80) == 0;
+}
+
+// Moves the cursor past one scanline, like radiance_decode_rows does
+static bool skip_scanline(const uint8_t* data, uint32_t data_size, int width, radiance_cursor* cursor)
+{
+    if (is_rle_scanline(data, data_size, cursor))
+    {
+        const uint8_t* start = data + cursor->m_Offset;
+        if (((start[2] << 8) | start[3]) != width || !skip_scanline_rle(data, data_size, &cursor->m_Offset, width))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        cursor->m_Flat = true;
+        if ((uint64_t) cursor->m_Offset + width * 4 > data_size)
+        {
+            return false;
+        }
+        cursor->m_Offset += width * 4;
+    }
+    cursor->m_Row++;
+    return true;
+}
+
+void radiance_cursor_init(const radiance_header* header, radiance_cursor* cursor_out)
+{
+    cursor_out->m_Offset = header->m_DataOffset;
+    cursor_out->m_Row    = 0;
+    cursor_out->m_Flat   = header->m_Width < RADIANCE_RLE_MIN_WIDTH || header->m_Width > RADIANCE_RLE_MAX_WIDTH;
+}
+
+bool radiance_decode_rows(const void* data, uint32_t data_size, const radiance_header* header, radiance_cursor* cursor, int row_count, uint8_t* rgbe_out)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    int width            = header->m_Width;
+    uint32_t row_size    = width * 4;
+
+    if (row_count > header->m_Height - cursor->m_Row)
+    {
+        return false;
+    }
+
+    for (int y = 0; y < row_count; ++y)
+    {
+        uint8_t* row = rgbe_out + (uint64_t) y * row_size;
+
+        // RLE scanlines start with 2, 2 and the width, a flat file never does (the first pixel
+        // isn't normalized). Files that aren't RLE are flat from here on.
+        if (is_rle_scanline(bytes, data_size, cursor))
+        {
+            const uint8_t* start = bytes + cursor->m_Offset;
+            if (((start[2] << 8) | start[3]) != width || !decode_scanline_rle(bytes, data_size, &cursor->m_Offset, width, row))
+            {
+                return false;
+            }
+            cursor->m_Row++;
+            continue;
+        }
+        cursor->m_Flat = true;
+
+        uint64_t rest = (uint64_t) (row_count - y) * row_size;
+        if (cursor->m_Offset + rest > data_size)
+        {
+            return false;
+        }
+        memcpy(row, bytes + cursor->m_Offset, rest);
+        cursor->m_Offset += rest;
+        cursor->m_Row    += row_count - y;
+        return true;
+    }
+    return true;
+}
+
+bool radiance_decode_rgbe(const void* data, uint32_t data_size, const radiance_header* header, uint8_t* rgbe_out)
+{
+    radiance_cursor cursor;
+    radiance_cursor_init(header, &cursor);
+    return radiance_decode_rows(data, data_size, header, &cursor, header->m_Height, rgbe_out);
+}
+
+bool radiance_index_scanlines(const void* data, uint32_t data_size, const radiance_header* header, uint32_t* offsets_out, int* flat_row_out)
+{
+    radiance_cursor cursor;
+    radiance_cursor_init(header, &cursor);
+
+    *flat_row_out = cursor.m_Flat ? 0 : header->m_Height;
+    for (int y = 0; y < header->m_Height; ++y)
+    {
+        offsets_out[y] = cursor.m_Offset;
+        if (!skip_scanline((const uint8_t*) data, data_size, header->m_Width, &cursor))
+        {
+            return false;
+        }
+        if (cursor.m_Flat && *flat_row_out > y)
+        {
+            *flat_row_out = y;
+        }
+    }
+    return true;
+}
+
+void radiance_cursor_from_index(const uint32_t* offsets, int flat_row, int row, radiance_cursor* cursor_out)
+{
+    cursor_out->m_Offset = offsets[row];
+    cursor_out->m_Row    = row;
+    cursor_out->m_Flat   = row >= flat_row;
+}
+
+typedef struct
+{
+    const uint8_t*         m_Data;
+    uint32_t               m_DataSize;
+    const radiance_header* m_Header;
+    const uint32_t*        m_Offsets;
+    int                    m_FlatRow;
+    uint8_t*               m_Pixels;
+    std::atomic<bool>      m_Failed;
+} decode_job_context;
+
+static void decode_rows_job(void* context, uint32_t job_index)
+{
+    decode_job_context* ctx = (decode_job_context*) context;
+    int row_begin           = job_index * RADIANCE_ROWS_PER_JOB;
+    int row_count           = ctx->m_Header->m_Height - row_begin < RADIANCE_ROWS_PER_JOB ? ctx->m_Header->m_Height - row_begin : RADIANCE_ROWS_PER_JOB;
+
+    radiance_cursor cursor;
+    radiance_cursor_from_index(ctx->m_Offsets, ctx->m_FlatRow, row_begin, &cursor);
+
+    uint8_t* rows = ctx->m_Pixels + (uint64_t) row_begin * ctx->m_Header->m_Width * 4;
+    if (!radiance_decode_rows(ctx->m_Data, ctx->m_DataSize, ctx->m_Header, &cursor, row_count, rows))
+    {
+        ctx->m_Failed = true;
+    }
+}
+
+bool radiance_decode_rgbe_parallel(job_system* jobs, const void* data, uint32_t data_size, const radiance_header* header, uint8_t* rgbe_out)
+{
+    decode_job_context ctx;
+    ctx.m_Data     = (const uint8_t*) data;
+    ctx.m_DataSize = data_size;
+    ctx.m_Header   = header;
+    ctx.m_Pixels   = rgbe_out;
+    ctx.m_Failed   = false;
+
+    uint32_t* offsets = (uint32_t*) malloc(header->m_Height * sizeof(uint32_t));
+    if (!radiance_index_scanlines(data, data_size, header, offsets, &ctx.m_FlatRow))
+    {
+        free(offsets);
+        return false;
+    }
+    ctx.m_Offsets = offsets;
+
+    job_system_run(jobs, decode_rows_job, &ctx, (header->m_Height + RADIANCE_ROWS_PER_JOB - 1) / RADIANCE_ROWS_PER_JOB);
+
+    free(offsets);
+    return !ctx.m_Failed;
+}
+
+void radiance_rgbe_to_float(const uint8_t* rgbe, uint32_t pixel_count, float* rgba_out)
+{
+    for (size_t i = 0; i < pixel_count; ++i)
+    {
+        const uint8_t* in = rgbe + i * 4;
+        float* out        = rgba_out + i * 4;
+        if (in[3] != 0)
+        {
+            float f = (float) ldexp(1.0f, in[3] - (int) (128 + 8));
+            out[0]  = in[0] * f;
+            out[1]  = in[1] * f;
+            out[2]  = in[2] * f;
+        }
+        else
+        {
+            out[0] = out[1] = out[2] = 0.0f;
+        }
+        out[3] = 1.0f;
+    }
+}
+
+void radiance_float_to_rgbe(const float* rgba, uint32_t pixel_count, uint8_t* rgbe_out)
+{
+    for (size_t i = 0; i < pixel_count; ++i)
+    {
+        const float* in = rgba + i * 4;
+        uint8_t* out    = rgbe_out + i * 4;
+        float m         = fmaxf(in[0], fmaxf(in[1], in[2]));
+        if (m < 1e-32f)
+        {
+            out[0] = out[1] = out[2] = out[3] = 0;
+        }
+        else
+        {
+            // Rounded to the nearest mantissa, the largest component can round up into the next exponent
+            int e;
+            frexpf(m, &e);
+            float f = ldexpf(1.0f, 8 - e);
+            if (m * f + 0.5f >= 256.0f)
+            {
+                e += 1;
+                f *= 0.5f;
+            }
+            out[0] = (uint8_t) (fmaxf(in[0], 0.0f) * f + 0.5f);
+            out[1] = (uint8_t) (fmaxf(in[1], 0.0f) * f + 0.5f);
+            out[2] = (uint8_t) (fmaxf(in[2], 0.0f) * f + 0.5f);
+            out[3] = (uint8_t) (e + 128);
+        }
+    }
+}
+
+struct radiance_stream
+{
+    const uint8_t*  m_Data;
+    uint32_t        m_DataSize;
+    uint32_t        m_ReleasedSize; // of the sequential reads
+    radiance_header m_Header;
+    radiance_cursor m_Cursor;
+    uint32_t*       m_Offsets;
+    int             m_FlatRow;
+#if defined(_WIN32)
+    HANDLE          m_File;
+    HANDLE          m_Mapping;
+#endif
+};
+
+static const uint8_t* map_file(radiance_stream* stream, const char* path)
+{
+#if defined(_WIN32)
+    stream->m_File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (stream->m_File == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(stream->m_File, &file_size) || file_size.QuadPart == 0 || file_size.QuadPart > UINT32_MAX)
+    {
+        CloseHandle(stream->m_File);
+        return 0;
+    }
+
+    stream->m_Mapping = CreateFileMappingA(stream->m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* data        = stream->m_Mapping ? MapViewOfFile(stream->m_Mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+    if (!data)
+    {
+        if (stream->m_Mapping)
+        {
+            CloseHandle(stream->m_Mapping);
+        }
+        CloseHandle(stream->m_File);
+        return 0;
+    }
+    stream->m_DataSize = (uint32_t) file_size.QuadPart;
+    return (const uint8_t*) data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t) st.st_size > UINT32_MAX)
+    {
+        close(fd);
+        return 0;
+    }
+
+    // The mapping keeps the file open
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return 0;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    stream->m_DataSize = (uint32_t) st.st_size;
+    return (const uint8_t*) data;
+#endif
+}
+
+static void unmap_file(radiance_stream* stream)
+{
+#if defined(_WIN32)
+    UnmapViewOfFile(stream->m_Data);
+    CloseHandle(stream->m_Mapping);
+    CloseHandle(stream->m_File);
+#else
+    munmap((void*) stream->m_Data, stream->m_DataSize);
+#endif
+}
+
+// Drops the pages that lie entirely in [begin, end), they are read from the file again if they are ever touched
+static void release_pages(radiance_stream* stream, uint32_t begin, uint32_t end)
+{
+#if !defined(_WIN32)
+    static const uint32_t page_size = (uint32_t) sysconf(_SC_PAGESIZE);
+    begin = (begin + page_size - 1) / page_size * page_size;
+    end   = end / page_size * page_size;
+    if (end > begin)
+    {
+        madvise((void*) (stream->m_Data + begin), end - begin, MADV_DONTNEED);
+    }
+#endif
+}
+
+radiance_stream* radiance_stream_open(const char* path, radiance_header* header_out)
+{
+    radiance_stream* stream = (radiance_stream*) calloc(1, sizeof(radiance_stream));
+    stream->m_Data          = map_file(stream, path);
+    if (!stream->m_Data)
+    {
+        free(stream);
+        return 0;
+    }
+
+    if (!radiance_read_header(stream->m_Data, stream->m_DataSize, &stream->m_Header))
+    {
+        radiance_stream_close(stream);
+        return 0;
+    }
+
+    radiance_cursor_init(&stream->m_Header, &stream->m_Cursor);
+    *header_out = stream->m_Header;
+    return stream;
+}
+
+void radiance_stream_close(radiance_stream* stream)
+{
+    unmap_file(stream);
+    free(stream->m_Offsets);
+    free(stream);
+}
+
+int radiance_stream_read(radiance_stream* stream, int row_count, uint8_t* rgbe_out)
+{
+    int rows_left = stream->m_Header.m_Height - stream->m_Cursor.m_Row;
+    row_count     = row_count < rows_left ? row_count : rows_left;
+    if (row_count == 0)
+    {
+        return 0;
+    }
+
+    if (!radiance_decode_rows(stream->m_Data, stream->m_DataSize, &stream->m_Header, &stream->m_Cursor, row_count, rgbe_out))
+    {
+        return -1;
+    }
+
+    release_pages(stream, stream->m_ReleasedSize, stream->m_Cursor.m_Offset);
+    stream->m_ReleasedSize = stream->m_Cursor.m_Offset;
+    return row_count;
+}
+
+bool radiance_stream_build_index(radiance_stream* stream)
+{
+    const radiance_header* header = &stream->m_Header;
+    stream->m_Offsets             = (uint32_t*) realloc(stream->m_Offsets, header->m_Height * sizeof(uint32_t));
+
+    // Same as radiance_index_scanlines, but pages are released as the index grows
+    radiance_cursor cursor;
+    radiance_cursor_init(header, &cursor);
+
+    uint32_t released = 0;
+    stream->m_FlatRow = cursor.m_Flat ? 0 : header->m_Height;
+    for (int y = 0; y < header->m_Height; ++y)
+    {
+        stream->m_Offsets[y] = cursor.m_Offset;
+        if (!skip_scanline(stream->m_Data, stream->m_DataSize, header->m_Width, &cursor))
+        {
+            free(stream->m_Offsets);
+            stream->m_Offsets = 0;
+            return false;
+        }
+        if (cursor.m_Flat && stream->m_FlatRow > y)
+        {
+            stream->m_FlatRow = y;
+        }
+        if ((y & 255) == 255)
+        {
+            release_pages(stream, released, cursor.m_Offset);
+            released = cursor.m_Offset;
+        }
+    }
+    release_pages(stream, released, stream->m_DataSize);
+    return true;
+}
+
+bool radiance_stream_read_rows(radiance_stream* stream, int row, int row_count, uint8_t* rgbe_out)
+{
+    if (!stream->m_Offsets || row < 0 || row_count <= 0 || row + row_count > stream->m_Header.m_Height)
+    {
+        return false;
+    }
+
+    radiance_cursor cursor;
+    radiance_cursor_from_index(stream->m_Offsets, stream->m_FlatRow, row, &cursor);
+    if (!radiance_decode_rows(stream->m_Data, stream->m_DataSize, &stream->m_Header, &cursor, row_count, rgbe_out))
+    {
+        return false;
+    }
+
+    release_pages(stream, stream->m_Offsets[row], cursor.m_Offset);
+    return true;
+}
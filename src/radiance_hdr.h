@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct job_system job_system;
+
+// Radiance .hdr decoding that keeps the native 4 byte RGBE pixels instead of expanding them to
+// 4 floats. Decodes the same files as stb_image (FORMAT=32-bit_rle_rgbe, -Y <height> +X <width>),
+// converting with radiance_rgbe_to_float gives the exact values stbi_loadf returns.
+typedef struct
+{
+    int      m_Width;
+    int      m_Height;
+    uint32_t m_DataOffset; // first scanline
+} radiance_header;
+
+bool radiance_is_hdr(const void* data, uint32_t data_size);
+
+// Fails on images over 2^28 pixels
+bool radiance_read_header(const void* data, uint32_t data_size, radiance_header* header_out);
+
+// Position of the next scanline in the file data
+typedef struct
+{
+    uint32_t m_Offset;
+    int      m_Row;
+    bool     m_Flat; // no more RLE scanlines
+} radiance_cursor;
+
+void radiance_cursor_init(const radiance_header* header, radiance_cursor* cursor_out);
+
+// Decodes the next row_count scanlines into rgbe_out (row_count * width * 4 bytes) and advances the cursor
+bool radiance_decode_rows(const void* data, uint32_t data_size, const radiance_header* header, radiance_cursor* cursor, int row_count, uint8_t* rgbe_out);
+
+// Decodes all scanlines, rgbe_out receives width * height * 4 bytes (top row first)
+bool radiance_decode_rgbe(const void* data, uint32_t data_size, const radiance_header* header, uint8_t* rgbe_out);
+
+// Finds the offset of every scanline (offsets_out has room for height entries) by skipping over the
+// RLE packets without decoding them. Scanlines from flat_row_out on are stored flat.
+bool radiance_index_scanlines(const void* data, uint32_t data_size, const radiance_header* header, uint32_t* offsets_out, int* flat_row_out);
+
+// Cursor at any row of an index, scanlines can be decoded from there independently of the rows before it
+void radiance_cursor_from_index(const uint32_t* offsets, int flat_row, int row, radiance_cursor* cursor_out);
+
+// Bit-identical to radiance_decode_rgbe, indexes the scanlines and decodes ranges of them on all threads
+bool radiance_decode_rgbe_parallel(job_system* jobs, const void* data, uint32_t data_size, const radiance_header* header, uint8_t* rgbe_out);
+
+// A memory mapped .hdr file that is decoded a band of scanlines at a time. Only the band and the
+// pages of the file it is decoded from are resident, pages behind the cursor are released again.
+typedef struct radiance_stream radiance_stream;
+
+// Returns 0 if the file can't be mapped or isn't a Radiance file
+radiance_stream* radiance_stream_open(const char* path, radiance_header* header_out);
+void             radiance_stream_close(radiance_stream* stream);
+
+// Decodes up to row_count scanlines into rgbe_out, returns the number of rows decoded (0 once all
+// rows are decoded) or -1 if the data is corrupt
+int              radiance_stream_read(radiance_stream* stream, int row_count, uint8_t* rgbe_out);
+
+// Indexes the scanlines, after which radiance_stream_read_rows can decode any range of rows. Several
+// threads can read different ranges at the same time.
+bool             radiance_stream_build_index(radiance_stream* stream);
+bool             radiance_stream_read_rows(radiance_stream* stream, int row, int row_count, uint8_t* rgbe_out);
+
+// RGBA32F with alpha 1, like stbi_loadf(..., 4)
+void radiance_rgbe_to_float(const uint8_t* rgbe, uint32_t pixel_count, float* rgba_out);
+
+// Encodes RGBA32F (alpha is dropped), each component rounded to the nearest value the shared exponent can hold
+void radiance_float_to_rgbe(const float* rgba, uint32_t pixel_count, uint8_t* rgbe_out);
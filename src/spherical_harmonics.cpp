@@ -0,0 +1,193 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spherical_harmonics.h"
+#include "cubemap.h"
+
+static const float SH_PI = 3.14159265359f;
+
+void sh_evaluate_basis(int bands, float x, float y, float z, float* basis_out)
+{
+    const float x2 = x * x;
+    const float y2 = y * y;
+    const float z2 = z * z;
+
+    // L0
+    basis_out[0] = 0.282094792f;
+
+    // L1
+    basis_out[1] = 0.488602512f * y;
+    basis_out[2] = 0.488602512f * z;
+    basis_out[3] = 0.488602512f * x;
+
+    // L2
+    basis_out[4] = 1.092548431f * x * y;
+    basis_out[5] = 1.092548431f * y * z;
+    basis_out[6] = 0.315391565f * (3.0f * z2 - 1.0f);
+    basis_out[7] = 1.092548431f * x * z;
+    basis_out[8] = 0.546274215f * (x2 - y2);
+
+    if (bands <= 3)
+    {
+        return;
+    }
+
+    // L3
+    basis_out[9]  = 0.590043589f * y * (3.0f * x2 - y2);
+    basis_out[10] = 2.890611442f * x * y * z;
+    basis_out[11] = 0.457045799f * y * (5.0f * z2 - 1.0f);
+    basis_out[12] = 0.373176333f * z * (5.0f * z2 - 3.0f);
+    basis_out[13] = 0.457045799f * x * (5.0f * z2 - 1.0f);
+    basis_out[14] = 1.445305721f * z * (x2 - y2);
+    basis_out[15] = 0.590043589f * x * (x2 - 3.0f * y2);
+
+    if (bands <= 4)
+    {
+        return;
+    }
+
+    // L4
+    basis_out[16] = 2.503342942f * x * y * (x2 - y2);
+    basis_out[17] = 1.770130837f * y * z * (3.0f * x2 - y2);
+    basis_out[18] = 0.946174696f * x * y * (7.0f * z2 - 1.0f);
+    basis_out[19] = 0.669046544f * y * z * (7.0f * z2 - 3.0f);
+    basis_out[20] = 0.105785547f * (35.0f * z2 * z2 - 30.0f * z2 + 3.0f);
+    basis_out[21] = 0.669046544f * x * z * (7.0f * z2 - 3.0f);
+    basis_out[22] = 0.473087348f * (x2 - y2) * (7.0f * z2 - 1.0f);
+    basis_out[23] = 1.770130837f * x * z * (x2 - 3.0f * y2);
+    basis_out[24] = 0.625835735f * (x2 * (x2 - 3.0f * y2) - y2 * (3.0f * x2 - y2));
+}
+
+void sh_project_equirect(const float* pixels, int width, int height, int bands, sh_coefficients* sh_out)
+{
+    const int coefficient_count = bands * bands;
+
+    // Accumulate in double, an 8k input sums up ~32M weighted samples per coefficient
+    double accum[SH_MAX_COEFFICIENTS][3] = {};
+    double total_weight                  = 0.0;
+
+    float* cos_phi = (float*) malloc(width * sizeof(float));
+    float* sin_phi = (float*) malloc(width * sizeof(float));
+
+    for (int i = 0; i < width; ++i)
+    {
+        float phi  = (((float) i + 0.5f) / (float) width - 0.5f) * 2.0f * SH_PI;
+        cos_phi[i] = cosf(phi);
+        sin_phi[i] = sinf(phi);
+    }
+
+    const float pixel_angle = (2.0f * SH_PI / (float) width) * (SH_PI / (float) height);
+
+    for (int j = 0; j < height; ++j)
+    {
+        float theta     = (((float) j + 0.5f) / (float) height - 0.5f) * SH_PI;
+        float cos_theta = cosf(theta);
+        float sin_theta = sinf(theta);
+        float weight    = cos_theta * pixel_angle;
+
+        double row_accum[SH_MAX_COEFFICIENTS][3] = {};
+
+        const float* row = pixels + (size_t) j * width * 4;
+        for (int i = 0; i < width; ++i)
+        {
+            float basis[SH_MAX_COEFFICIENTS];
+            sh_evaluate_basis(bands, cos_theta * cos_phi[i], sin_theta, cos_theta * sin_phi[i], basis);
+
+            const float* rgb = row + i * 4;
+            for (int c = 0; c < coefficient_count; ++c)
+            {
+                row_accum[c][0] += basis[c] * rgb[0];
+                row_accum[c][1] += basis[c] * rgb[1];
+                row_accum[c][2] += basis[c] * rgb[2];
+            }
+        }
+
+        for (int c = 0; c < coefficient_count; ++c)
+        {
+            accum[c][0] += row_accum[c][0] * weight;
+            accum[c][1] += row_accum[c][1] * weight;
+            accum[c][2] += row_accum[c][2] * weight;
+        }
+
+        total_weight += weight * width;
+    }
+
+    free(cos_phi);
+    free(sin_phi);
+
+    // Normalize so the discrete weights integrate to exactly 4*PI over the sphere
+    double normalization = (4.0 * SH_PI) / total_weight;
+
+    memset(sh_out, 0, sizeof(sh_coefficients));
+    sh_out->m_Bands = bands;
+
+    for (int c = 0; c < coefficient_count; ++c)
+    {
+        sh_out->m_Coefficients[c][0] = (float) (accum[c][0] * normalization);
+        sh_out->m_Coefficients[c][1] = (float) (accum[c][1] * normalization);
+        sh_out->m_Coefficients[c][2] = (float) (accum[c][2] * normalization);
+    }
+}
+
+void sh_convolve_irradiance(sh_coefficients* sh)
+{
+    // Clamped cosine lobe in SH (Ramamoorthi & Hanrahan), divided by PI
+    static const float band_factor[SH_MAX_BANDS] = {
+        1.0f,
+        2.0f / 3.0f,
+        1.0f / 4.0f,
+        0.0f,
+        -1.0f / 24.0f,
+    };
+
+    for (int l = 0; l < sh->m_Bands; ++l)
+    {
+        for (int m = -l; m <= l; ++m)
+        {
+            int c = l * l + l + m;
+            sh->m_Coefficients[c][0] *= band_factor[l];
+            sh->m_Coefficients[c][1] *= band_factor[l];
+            sh->m_Coefficients[c][2] *= band_factor[l];
+        }
+    }
+}
+
+void sh_evaluate(const sh_coefficients* sh, const float* dir, float* rgb_out)
+{
+    float basis[SH_MAX_COEFFICIENTS];
+    float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    sh_evaluate_basis(sh->m_Bands, dir[0] / len, dir[1] / len, dir[2] / len, basis);
+
+    rgb_out[0] = rgb_out[1] = rgb_out[2] = 0.0f;
+    for (int c = 0; c < sh->m_Bands * sh->m_Bands; ++c)
+    {
+        rgb_out[0] += sh->m_Coefficients[c][0] * basis[c];
+        rgb_out[1] += sh->m_Coefficients[c][1] * basis[c];
+        rgb_out[2] += sh->m_Coefficients[c][2] * basis[c];
+    }
+
+    // Ringing can push the reconstruction slightly negative for very high contrast inputs
+    rgb_out[0] = fmaxf(rgb_out[0], 0.0f);
+    rgb_out[1] = fmaxf(rgb_out[1], 0.0f);
+    rgb_out[2] = fmaxf(rgb_out[2], 0.0f);
+}
+
+void sh_render_cubemap(const sh_coefficients* sh, int size, float* pixels_out)
+{
+    for (int side = 0; side < CUBEMAP_SIDE_COUNT; ++side)
+    {
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                float dir[3];
+                cubemap_texel_direction(side, x, y, size, dir);
+
+                float* texel = pixels_out + (((size_t) side * size + y) * size + x) * 4;
+                sh_evaluate(sh, dir, texel);
+                texel[3] = 1.0f;
+            }
+        }
+    }
+}
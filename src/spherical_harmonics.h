@@ -0,0 +1,31 @@
+#pragma once
+
+// Real spherical harmonics up to band L4 (25 coefficients), used to compute
+// diffuse irradiance on the CPU instead of integrating the hemisphere per texel.
+enum
+{
+    SH_MIN_BANDS        = 3,
+    SH_MAX_BANDS        = 5,
+    SH_MAX_COEFFICIENTS = SH_MAX_BANDS * SH_MAX_BANDS
+};
+
+typedef struct
+{
+    int   m_Bands;
+    float m_Coefficients[SH_MAX_COEFFICIENTS][3];
+} sh_coefficients;
+
+// Evaluates the SH basis functions for a unit direction, basis_out must hold bands*bands floats
+void sh_evaluate_basis(int bands, float x, float y, float z, float* basis_out);
+
+// Projects an equirectangular RGBA32F image into SH radiance coefficients, weighting each pixel by its solid angle
+void sh_project_equirect(const float* pixels, int width, int height, int bands, sh_coefficients* sh_out);
+
+// Convolves radiance coefficients with the clamped cosine lobe. The result is scaled by 1/PI so that
+// evaluating it gives the same values as the brute-force diffuse_irradiance_fs pass.
+void sh_convolve_irradiance(sh_coefficients* sh);
+
+void sh_evaluate(const sh_coefficients* sh, const float* dir, float* rgb_out);
+
+// Evaluates the SH for every texel of a cubemap, output is RGBA32F for all sides in output order (see cubemap.h)
+void sh_render_cubemap(const sh_coefficients* sh, int size, float* pixels_out);
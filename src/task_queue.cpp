@@ -0,0 +1,110 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "task_queue.h"
+
+typedef struct
+{
+    task_function m_Function;
+    void*         m_Context;
+    uint64_t      m_Ticket;
+} task;
+
+struct task_queue
+{
+    std::thread*            m_Threads;
+    uint32_t                m_ThreadCount;
+
+    std::mutex              m_Mutex;
+    std::condition_variable m_TaskCondition;
+    std::condition_variable m_DoneCondition;
+    std::deque<task>        m_Tasks;
+    std::set<uint64_t>      m_Unfinished; // tickets of queued and running tasks
+    uint64_t                m_NextTicket;
+    bool                    m_Shutdown;
+};
+
+static void task_queue_worker(task_queue* queue)
+{
+    std::unique_lock<std::mutex> lock(queue->m_Mutex);
+
+    while (true)
+    {
+        queue->m_TaskCondition.wait(lock, [queue] { return queue->m_Shutdown || !queue->m_Tasks.empty(); });
+
+        if (queue->m_Tasks.empty())
+        {
+            return;
+        }
+
+        task t = queue->m_Tasks.front();
+        queue->m_Tasks.pop_front();
+
+        lock.unlock();
+        t.m_Function(t.m_Context);
+        lock.lock();
+
+        queue->m_Unfinished.erase(t.m_Ticket);
+        queue->m_DoneCondition.notify_all();
+    }
+}
+
+task_queue* task_queue_create(uint32_t thread_count)
+{
+    task_queue* queue    = new task_queue();
+    queue->m_ThreadCount = thread_count > 0 ? thread_count : 1;
+    queue->m_NextTicket  = 1;
+    queue->m_Shutdown    = false;
+    queue->m_Threads     = new std::thread[queue->m_ThreadCount];
+
+    for (uint32_t i = 0; i < queue->m_ThreadCount; ++i)
+    {
+        queue->m_Threads[i] = std::thread(task_queue_worker, queue);
+    }
+    return queue;
+}
+
+void task_queue_destroy(task_queue* queue)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue->m_Mutex);
+        queue->m_Shutdown = true;
+    }
+    queue->m_TaskCondition.notify_all();
+
+    for (uint32_t i = 0; i < queue->m_ThreadCount; ++i)
+    {
+        queue->m_Threads[i].join();
+    }
+
+    delete[] queue->m_Threads;
+    delete queue;
+}
+
+uint64_t task_queue_push(task_queue* queue, task_function function, void* context)
+{
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(queue->m_Mutex);
+        ticket = queue->m_NextTicket++;
+        queue->m_Tasks.push_back({ function, context, ticket });
+        queue->m_Unfinished.insert(ticket);
+    }
+    queue->m_TaskCondition.notify_one();
+    return ticket;
+}
+
+void task_queue_wait(task_queue* queue)
+{
+    std::unique_lock<std::mutex> lock(queue->m_Mutex);
+    queue->m_DoneCondition.wait(lock, [queue] { return queue->m_Unfinished.empty(); });
+}
+
+void task_queue_wait_task(task_queue* queue, uint64_t ticket)
+{
+    std::unique_lock<std::mutex> lock(queue->m_Mutex);
+    queue->m_DoneCondition.wait(lock, [queue, ticket] { return queue->m_Unfinished.count(ticket) == 0; });
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// FIFO of tasks executed asynchronously by a fixed set of worker threads. Unlike job_system_run,
+// pushing a task doesn't block the caller, which makes it suitable for background stages
+// (e.g writing outputs while the GPU keeps rendering).
+typedef struct task_queue task_queue;
+
+typedef void (*task_function)(void* context);
+
+task_queue* task_queue_create(uint32_t thread_count);
+// Waits for all pushed tasks before joining the threads
+void        task_queue_destroy(task_queue* queue);
+
+// Returns a ticket that identifies the task in task_queue_wait_task
+uint64_t    task_queue_push(task_queue* queue, task_function function, void* context);
+// Blocks until every task pushed so far has finished
+void        task_queue_wait(task_queue* queue);
+// Blocks until the task with the ticket has finished (returns immediately if it already has)
+void        task_queue_wait_task(task_queue* queue, uint64_t ticket);
@@ -0,0 +1,62 @@
+// Build time generator for the BRDF LUT that is embedded in pbr-utils (see PBR_UTILS_EMBED_BRDF_LUT).
+// Usage: brdf-lut-gen <output-header> [size] [sample-count]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "brdf_lut.h"
+#include "half_float.h"
+#include "job_system.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: brdf-lut-gen <output-header> [size] [sample-count]\n");
+        return -1;
+    }
+
+    int size         = argc > 2 ? atoi(argv[2]) : 512;
+    int sample_count = argc > 3 ? atoi(argv[3]) : 1024;
+
+    if (size <= 0 || sample_count <= 0)
+    {
+        printf("Invalid size or sample count\n");
+        return -1;
+    }
+
+    float* pixels    = (float*) malloc((size_t) size * size * 4 * sizeof(float));
+    job_system* jobs = job_system_create(0);
+    brdf_lut_integrate(jobs, size, sample_count, pixels);
+    job_system_destroy(jobs);
+
+    FILE* f = fopen(argv[1], "wb");
+    if (!f)
+    {
+        printf("Unable to open %s for writing\n", argv[1]);
+        free(pixels);
+        return -1;
+    }
+
+    // Only scale and bias are stored, blue and alpha are always 0 and 1
+    fprintf(f, "// Generated by brdf-lut-gen, do not edit\n");
+    fprintf(f, "#pragma once\n\n");
+    fprintf(f, "static const int BRDF_LUT_EMBEDDED_VERSION      = %d;\n", BRDF_LUT_VERSION);
+    fprintf(f, "static const int BRDF_LUT_EMBEDDED_SIZE         = %d;\n", size);
+    fprintf(f, "static const int BRDF_LUT_EMBEDDED_SAMPLE_COUNT = %d;\n\n", sample_count);
+    fprintf(f, "// float16 RG pairs, rows in GL readback order\n");
+    fprintf(f, "static const uint16_t BRDF_LUT_EMBEDDED_DATA[] = {\n");
+
+    uint32_t texel_count = size * size;
+    for (uint32_t i = 0; i < texel_count; ++i)
+    {
+        fprintf(f, "0x%04x,0x%04x,%s", float_to_half(pixels[i * 4 + 0]), float_to_half(pixels[i * 4 + 1]), (i % 8) == 7 ? "\n" : "");
+    }
+
+    fprintf(f, "};\n");
+    fclose(f);
+    free(pixels);
+
+    printf("Wrote %dx%d BRDF LUT (%d samples) to %s\n", size, size, sample_count, argv[1]);
+    return 0;
+}
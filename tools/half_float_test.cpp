@@ -0,0 +1,107 @@
+// Checks that the batch conversions in half_float.h (AVX2/F16C when the CPU has them) are bit-identical
+// to the scalar float_to_half/half_to_float, for every float bit pattern and every half.
+// Usage: half-float-test, exits with a non-zero code on the first mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "half_float.h"
+
+// Batches get odd lengths so the SIMD loops finish with every possible scalar tail
+static const uint32_t BATCH_SIZE = 1 << 16;
+
+static bool test_float32_to_float16()
+{
+    float* floats      = (float*) malloc(BATCH_SIZE * sizeof(float));
+    uint16_t* halves   = (uint16_t*) malloc(BATCH_SIZE * sizeof(uint16_t));
+    uint64_t bits      = 0;
+    uint32_t batch     = 0;
+
+    while (bits <= 0xFFFFFFFFull)
+    {
+        uint32_t count = BATCH_SIZE - (batch++ % 8);
+        if (bits + count > 0x100000000ull)
+        {
+            count = (uint32_t) (0x100000000ull - bits);
+        }
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t b = (uint32_t) (bits + i);
+            memcpy(&floats[i], &b, sizeof(b));
+        }
+
+        float32_to_float16(floats, count, halves);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint16_t expected = float_to_half(floats[i]);
+            if (halves[i] != expected)
+            {
+                printf("float32_to_float16 mismatch for 0x%08x: 0x%04x, expected 0x%04x\n", (uint32_t) (bits + i), halves[i], expected);
+                free(floats);
+                free(halves);
+                return false;
+            }
+        }
+        bits += count;
+    }
+
+    free(floats);
+    free(halves);
+    return true;
+}
+
+static bool test_float16_to_float32()
+{
+    static const uint32_t half_count = 1 << 16;
+    uint16_t* halves = (uint16_t*) malloc(half_count * sizeof(uint16_t));
+    float* floats    = (float*) malloc(half_count * sizeof(float));
+    for (uint32_t i = 0; i < half_count; ++i)
+    {
+        halves[i] = (uint16_t) i;
+    }
+
+    // Every tail length of the 8 wide loop, from every start offset
+    for (uint32_t offset = 0; offset < 8; ++offset)
+    {
+        uint32_t count = half_count - offset - (offset * 3) % 8;
+        float16_to_float32(halves + offset, count, floats);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            float expected = half_to_float(halves[offset + i]);
+            if (memcmp(&floats[i], &expected, sizeof(float)) != 0)
+            {
+                uint32_t got, want;
+                memcpy(&got, &floats[i], sizeof(got));
+                memcpy(&want, &expected, sizeof(want));
+                printf("float16_to_float32 mismatch for 0x%04x: 0x%08x, expected 0x%08x\n", halves[offset + i], got, want);
+                free(halves);
+                free(floats);
+                return false;
+            }
+        }
+    }
+
+    free(halves);
+    free(floats);
+    return true;
+}
+
+int main()
+{
+    if (!test_float16_to_float32())
+    {
+        return -1;
+    }
+    printf("float16_to_float32: all 65536 halves match\n");
+
+    if (!test_float32_to_float16())
+    {
+        return -1;
+    }
+    printf("float32_to_float16: all 2^32 floats match\n");
+    return 0;
+}
@@ -0,0 +1,667 @@
+// Benchmark of the CPU engines in libpbrutils on procedural environments, no assets or GPU needed.
+// Every stage is swept over sizes and sample counts and the results are written as JSON,
+// so they can be compared between releases.
+// Usage: pbr-bench [--output <file.json>] [--threads <n>] [--max-input-size <n>] [--repeat <n>] [--quick]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <psapi.h>
+    #include <process.h>
+#else
+    #include <sys/resource.h>
+    #include <unistd.h>
+#endif
+
+#include "brdf_lut.h"
+#include "buffer_writer.h"
+#include "cubemap.h"
+#include "half_float.h"
+#include "job_system.h"
+#include "pbr_utils.h"
+#include "prefilter.h"
+#include "spherical_harmonics.h"
+
+static const int BENCH_VERSION = 1;
+
+static const int INPUT_SKY     = 0; // analytic sky gradient with a very bright sun disk (HDR)
+static const int INPUT_NOISE   = 1; // fractal value noise
+static const int INPUT_CHECKER = 2; // high contrast checkerboard
+static const int INPUT_COUNT   = 3;
+
+static const char* INPUT_NAMES[] = { "sky", "noise", "checker" };
+
+// Equirect widths, the height is half of that
+static const int INPUT_SIZES[]         = { 1024, 2048, 4096, 8192, 16384 };
+static const int ENVIRONMENT_SIZES[]   = { 256, 512, 1024 };
+static const int IRRADIANCE_SIZES[]    = { 32, 64, 128 };
+static const int PREFILTER_SIZES[]     = { 64, 128, 256 };
+static const int PREFILTER_SAMPLES[]   = { 256, 1024, 2048 };
+static const int BRDF_LUT_SIZES[]      = { 128, 256, 512 };
+static const int BRDF_LUT_SAMPLES[]    = { 256, 1024 };
+
+// The prefilter sweep samples from an environment of this size, like the default bake
+static const int PREFILTER_ENVIRONMENT_SIZE = 1024;
+
+#define ARRAY_COUNT(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+static struct
+{
+    const char* m_PathOutput;
+    const char* m_PathScratch;
+    int         m_ThreadCount;
+    int         m_MaxInputSize;
+    int         m_Repeat;
+    bool        m_Quick;
+} g_params = { 0, 0, 0, 4096, 1, false };
+
+typedef struct
+{
+    const char* m_Stage;
+    const char* m_Input;
+    int         m_InputSize;
+    int         m_Size;
+    int         m_SampleCount;
+    double      m_Seconds;
+    uint64_t    m_Texels;
+    uint64_t    m_Samples;
+    uint64_t    m_Bytes;
+    double      m_PeakMemoryMB;
+} bench_result;
+
+static bench_result* g_results      = 0;
+static int           g_result_count = 0;
+
+static double time_now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////
+// Memory
+////////////////////////////////////////
+
+// Linux can reset the high water mark between stages, elsewhere the peak is for the whole run so far
+static void reset_peak_memory()
+{
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f)
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+static double get_peak_memory_mb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    return 0.0;
+#elif defined(__linux__)
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f)
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), f))
+        {
+            long kb;
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            {
+                fclose(f);
+                return kb / 1024.0;
+            }
+        }
+        fclose(f);
+    }
+    return 0.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / (1024.0 * 1024.0); // bytes on macOS
+#endif
+}
+
+////////////////////////////////////////
+// Procedural inputs
+////////////////////////////////////////
+
+static uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static float lattice_value(int x, int y, int period, uint32_t seed)
+{
+    x = ((x % period) + period) % period;
+    return (hash_u32(x * 73856093U ^ y * 19349663U ^ seed) & 0xffffff) / (float) 0xffffff;
+}
+
+// Tiles horizontally so the noise doesn't have a seam at u = 0
+static float value_noise(float x, float y, int period, uint32_t seed)
+{
+    int x0   = (int) floorf(x);
+    int y0   = (int) floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fy = fy * fy * (3.0f - 2.0f * fy);
+
+    float v00 = lattice_value(x0,     y0,     period, seed);
+    float v10 = lattice_value(x0 + 1, y0,     period, seed);
+    float v01 = lattice_value(x0,     y0 + 1, period, seed);
+    float v11 = lattice_value(x0 + 1, y0 + 1, period, seed);
+    float top    = v00 + (v10 - v00) * fx;
+    float bottom = v01 + (v11 - v01) * fx;
+    return top + (bottom - top) * fy;
+}
+
+static void sky_radiance(const float* dir, float* rgb_out)
+{
+    static const float sun_dir[3] = { 0.48f, 0.6f, 0.64f }; // normalized
+    float elevation = dir[1];
+
+    if (elevation < 0.0f)
+    {
+        rgb_out[0] = 0.12f;
+        rgb_out[1] = 0.1f;
+        rgb_out[2] = 0.08f;
+    }
+    else
+    {
+        float t = powf(1.0f - elevation, 4.0f);
+        rgb_out[0] = 0.25f + 0.75f * t;
+        rgb_out[1] = 0.45f + 0.5f * t;
+        rgb_out[2] = 1.0f;
+    }
+
+    float cos_sun = dir[0] * sun_dir[0] + dir[1] * sun_dir[1] + dir[2] * sun_dir[2];
+    if (cos_sun > 0.99996f) // ~0.5 degrees across
+    {
+        rgb_out[0] += 50000.0f;
+        rgb_out[1] += 48000.0f;
+        rgb_out[2] += 45000.0f;
+    }
+    else
+    {
+        float glow = powf(cos_sun > 0.0f ? cos_sun : 0.0f, 64.0f) * 8.0f;
+        rgb_out[0] += glow;
+        rgb_out[1] += glow * 0.9f;
+        rgb_out[2] += glow * 0.7f;
+    }
+}
+
+typedef struct
+{
+    int    m_Kind;
+    int    m_Width;
+    int    m_Height;
+    float* m_Pixels;
+} input_gen_context;
+
+static void generate_input_row(void* ctx, uint32_t y)
+{
+    input_gen_context* gen = (input_gen_context*) ctx;
+    float* row = gen->m_Pixels + (size_t) y * gen->m_Width * 4;
+
+    for (int x = 0; x < gen->m_Width; ++x)
+    {
+        float u = (x + 0.5f) / gen->m_Width;
+        float v = (y + 0.5f) / gen->m_Height;
+        float* rgba = row + x * 4;
+
+        if (gen->m_Kind == INPUT_SKY)
+        {
+            float dir[3];
+            equirect_uv_to_direction(u, v, dir);
+            sky_radiance(dir, rgba);
+        }
+        else if (gen->m_Kind == INPUT_NOISE)
+        {
+            // Same features regardless of resolution
+            float value = 0.0f;
+            float amplitude = 0.5f;
+            int period = 16;
+            for (int octave = 0; octave < 6; ++octave)
+            {
+                value     += amplitude * value_noise(u * period, v * period * 0.5f, period, octave);
+                amplitude *= 0.5f;
+                period    *= 2;
+            }
+            rgba[0] = value;
+            rgba[1] = value * value;
+            rgba[2] = 1.0f - value;
+        }
+        else
+        {
+            int checker = ((int) (u * 64.0f) + (int) (v * 32.0f)) & 1;
+            rgba[0] = checker ? 4.0f : 0.02f;
+            rgba[1] = checker ? 4.0f : 0.02f;
+            rgba[2] = checker ? 4.0f : 0.02f;
+        }
+        rgba[3] = 1.0f;
+    }
+}
+
+static float* generate_input(job_system* jobs, int kind, int width, int height)
+{
+    input_gen_context gen;
+    gen.m_Kind   = kind;
+    gen.m_Width  = width;
+    gen.m_Height = height;
+    gen.m_Pixels = (float*) malloc((size_t) width * height * 4 * sizeof(float));
+    if (gen.m_Pixels)
+    {
+        job_system_run(jobs, generate_input_row, &gen, height);
+    }
+    return gen.m_Pixels;
+}
+
+////////////////////////////////////////
+// Results
+////////////////////////////////////////
+
+static void add_result(const char* stage, const char* input, int input_size, int size, int sample_count,
+    double seconds, uint64_t texels, uint64_t samples, uint64_t bytes)
+{
+    g_results = (bench_result*) realloc(g_results, (g_result_count + 1) * sizeof(bench_result));
+    bench_result& r  = g_results[g_result_count++];
+    r.m_Stage        = stage;
+    r.m_Input        = input;
+    r.m_InputSize    = input_size;
+    r.m_Size         = size;
+    r.m_SampleCount  = sample_count;
+    r.m_Seconds      = seconds;
+    r.m_Texels       = texels;
+    r.m_Samples      = samples;
+    r.m_Bytes        = bytes;
+    r.m_PeakMemoryMB = get_peak_memory_mb();
+
+    fprintf(stderr, "%-12s %-8s input %5d size %5d samples %5d: %10.3f ms\n",
+        stage, input ? input : "-", input_size, size, sample_count, seconds * 1000.0);
+}
+
+static double per_second(double value, double seconds)
+{
+    return seconds > 0.0 ? value / seconds : 0.0;
+}
+
+static bool write_results(FILE* f, uint32_t thread_count)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"version\": %d,\n", BENCH_VERSION);
+    fprintf(f, "  \"threads\": %u,\n", thread_count);
+    fprintf(f, "  \"repeat\": %d,\n", g_params.m_Repeat);
+    fprintf(f, "  \"quick\": %s,\n", g_params.m_Quick ? "true" : "false");
+    fprintf(f, "  \"results\": [\n");
+
+    for (int i = 0; i < g_result_count; ++i)
+    {
+        const bench_result& r = g_results[i];
+        fprintf(f, "    {\"stage\": \"%s\", \"input\": \"%s\", \"input_size\": %d, \"size\": %d, \"sample_count\": %d, "
+            "\"time_ms\": %.3f, \"texels_per_s\": %.0f, \"samples_per_s\": %.0f, \"bytes\": %llu, \"mb_per_s\": %.2f, "
+            "\"peak_memory_mb\": %.1f}%s\n",
+            r.m_Stage, r.m_Input ? r.m_Input : "", r.m_InputSize, r.m_Size, r.m_SampleCount,
+            r.m_Seconds * 1000.0, per_second((double) r.m_Texels, r.m_Seconds), per_second((double) r.m_Samples, r.m_Seconds),
+            (unsigned long long) r.m_Bytes, per_second(r.m_Bytes / (1024.0 * 1024.0), r.m_Seconds),
+            r.m_PeakMemoryMB, i + 1 < g_result_count ? "," : "");
+    }
+
+    fprintf(f, "  ]\n}\n");
+    return ferror(f) == 0;
+}
+
+////////////////////////////////////////
+// Stages
+////////////////////////////////////////
+
+// Every case is run m_Repeat times and the fastest run is reported
+#define BENCH_BEGIN() \
+    double best_seconds = 0.0; \
+    reset_peak_memory(); \
+    for (int repeat = 0; repeat < g_params.m_Repeat; ++repeat) \
+    { \
+        double start = time_now();
+
+#define BENCH_END() \
+        double seconds = time_now() - start; \
+        best_seconds = (repeat == 0 || seconds < best_seconds) ? seconds : best_seconds; \
+    }
+
+static void bench_environment(job_system* jobs, const char* input, const float* pixels, int width, int height)
+{
+    int count = g_params.m_Quick ? 1 : ARRAY_COUNT(ENVIRONMENT_SIZES);
+    for (int i = 0; i < count; ++i)
+    {
+        int size = ENVIRONMENT_SIZES[i];
+        cubemap environment;
+        cubemap_create(&environment, size);
+
+        BENCH_BEGIN();
+        cubemap_from_equirect(jobs, &environment, pixels, width, height);
+        cubemap_generate_mipmaps(jobs, &environment);
+        BENCH_END();
+
+        uint64_t texels = (uint64_t) size * size * CUBEMAP_SIDE_COUNT;
+        add_result("environment", input, width, size, 0, best_seconds, texels, texels, texels * 4 * sizeof(float));
+        cubemap_destroy(&environment);
+    }
+}
+
+// The SH projection reads every input texel, the render writes the output cubemap
+static void bench_irradiance(const char* input, const float* pixels, int width, int height)
+{
+    int count = g_params.m_Quick ? 1 : ARRAY_COUNT(IRRADIANCE_SIZES);
+    for (int i = 0; i < count; ++i)
+    {
+        int size = IRRADIANCE_SIZES[i];
+        float* irradiance = (float*) malloc((size_t) size * size * 4 * sizeof(float) * CUBEMAP_SIDE_COUNT);
+
+        BENCH_BEGIN();
+        sh_coefficients sh;
+        sh_project_equirect(pixels, width, height, SH_MIN_BANDS, &sh);
+        sh_convolve_irradiance(&sh);
+        sh_render_cubemap(&sh, size, irradiance);
+        BENCH_END();
+
+        uint64_t texels = (uint64_t) size * size * CUBEMAP_SIDE_COUNT;
+        add_result("irradiance", input, width, size, 0, best_seconds, texels, (uint64_t) width * height,
+            texels * 4 * sizeof(float));
+        free(irradiance);
+    }
+}
+
+static void bench_prefilter(job_system* jobs, const char* input, const float* pixels, int width, int height)
+{
+    cubemap environment;
+    cubemap_create(&environment, PREFILTER_ENVIRONMENT_SIZE);
+    cubemap_from_equirect(jobs, &environment, pixels, width, height);
+    cubemap_generate_mipmaps(jobs, &environment);
+
+    int size_count   = g_params.m_Quick ? 1 : ARRAY_COUNT(PREFILTER_SIZES);
+    int sample_count = g_params.m_Quick ? 1 : ARRAY_COUNT(PREFILTER_SAMPLES);
+    for (int i = 0; i < size_count; ++i)
+    {
+        for (int j = 0; j < sample_count; ++j)
+        {
+            prefilter_params params;
+            params.m_Size             = PREFILTER_SIZES[i];
+            params.m_MipmapCount      = 1 + (int) floor(log2(params.m_Size));
+            params.m_SampleCount      = PREFILTER_SAMPLES[j];
+            params.m_SourceResolution = (float) PREFILTER_ENVIRONMENT_SIZE;
+
+            uint64_t texels = 0;
+            float* mip_pixels[CUBEMAP_MAX_MIPMAPS];
+            for (int mip = 0; mip < params.m_MipmapCount; ++mip)
+            {
+                int mip_size    = params.m_Size >> mip;
+                mip_pixels[mip] = (float*) malloc((size_t) mip_size * mip_size * 4 * sizeof(float) * CUBEMAP_SIDE_COUNT);
+                texels         += (uint64_t) mip_size * mip_size * CUBEMAP_SIDE_COUNT;
+            }
+
+            BENCH_BEGIN();
+            prefilter_cubemap(jobs, &environment, &params, mip_pixels);
+            BENCH_END();
+
+            add_result("prefilter", input, width, params.m_Size, params.m_SampleCount, best_seconds,
+                texels, texels * params.m_SampleCount, texels * 4 * sizeof(float));
+
+            for (int mip = 0; mip < params.m_MipmapCount; ++mip)
+            {
+                free(mip_pixels[mip]);
+            }
+        }
+    }
+
+    cubemap_destroy(&environment);
+}
+
+static void bench_brdf_lut(job_system* jobs)
+{
+    int size_count   = g_params.m_Quick ? 1 : ARRAY_COUNT(BRDF_LUT_SIZES);
+    int sample_count = g_params.m_Quick ? 1 : ARRAY_COUNT(BRDF_LUT_SAMPLES);
+    for (int i = 0; i < size_count; ++i)
+    {
+        for (int j = 0; j < sample_count; ++j)
+        {
+            int size    = BRDF_LUT_SIZES[i];
+            int samples = BRDF_LUT_SAMPLES[j];
+            float* lut  = (float*) malloc((size_t) size * size * 4 * sizeof(float));
+
+            BENCH_BEGIN();
+            brdf_lut_integrate(jobs, size, samples, lut);
+            BENCH_END();
+
+            uint64_t texels = (uint64_t) size * size;
+            add_result("brdf_lut", 0, 0, size, samples, best_seconds, texels, texels * samples, texels * 4 * sizeof(float));
+            free(lut);
+        }
+    }
+}
+
+// float16 conversion and .buffer serialization of a prefiltered cubemap mip of each size
+static void bench_output(const float* pixels, int width, int height)
+{
+    static const int sizes[] = { 64, 256, 1024 };
+    int count = g_params.m_Quick ? 1 : ARRAY_COUNT(sizes);
+
+    for (int i = 0; i < count; ++i)
+    {
+        int size            = sizes[i];
+        uint32_t num_floats = size * size * 4 * CUBEMAP_SIDE_COUNT;
+        float* floats       = (float*) malloc(num_floats * sizeof(float));
+        uint16_t* halves    = (uint16_t*) malloc(num_floats * sizeof(uint16_t));
+
+        // Real pixel values, the text size of the serialized numbers depends on them
+        size_t input_floats = (size_t) width * height * 4;
+        for (uint32_t f = 0; f < num_floats; ++f)
+        {
+            floats[f] = pixels[(f * 7919ULL) % input_floats];
+        }
+
+        BENCH_BEGIN();
+        float32_to_float16(floats, num_floats, halves);
+        BENCH_END();
+        add_result("convert", 0, 0, size, 0, best_seconds, num_floats / 4, 0, num_floats * sizeof(uint16_t));
+
+        static const int formats[] = { BUFFER_FORMAT_UINT8, BUFFER_FORMAT_UINT16, BUFFER_FORMAT_FLOAT32 };
+        static const char* stages[] = { "serialize_uint8", "serialize_uint16", "serialize_float32" };
+        for (int format = 0; format < ARRAY_COUNT(formats); ++format)
+        {
+            const void* data   = formats[format] == BUFFER_FORMAT_FLOAT32 ? (const void*) floats : (const void*) halves;
+            uint32_t data_size = formats[format] == BUFFER_FORMAT_FLOAT32 ? num_floats * sizeof(float) : num_floats * sizeof(uint16_t);
+            uint64_t file_size = 0;
+
+            BENCH_BEGIN();
+            // Unchanged files are only compared, remove it so every run writes
+            remove(g_params.m_PathScratch);
+            write_buffer_to_file(g_params.m_PathScratch, formats[format], data, data_size);
+            BENCH_END();
+
+            FILE* f = fopen(g_params.m_PathScratch, "rb");
+            if (f)
+            {
+                fseek(f, 0, SEEK_END);
+                file_size = ftell(f);
+                fclose(f);
+            }
+            remove(g_params.m_PathScratch);
+
+            add_result(stages[format], 0, 0, size, 0, best_seconds, num_floats / 4, 0, file_size);
+        }
+
+        free(floats);
+        free(halves);
+    }
+}
+
+// The whole pbr_bake with default parameters, i.e what a default pbr-utils run costs on the CPU engines
+static void bench_bake(const char* input, float* pixels, int width, int height)
+{
+    pbr_context* context = pbr_context_create(g_params.m_ThreadCount);
+
+    pbr_image image;
+    image.m_Pixels      = pixels;
+    image.m_Width       = width;
+    image.m_Height      = height;
+    image.m_PixelFormat = PBR_PIXEL_FORMAT_RGBA32F;
+
+    pbr_bake_params params;
+    pbr_bake_params_default(&params);
+
+    uint64_t bytes = 0;
+    BENCH_BEGIN();
+    pbr_outputs outputs;
+    pbr_bake(context, &image, &params, &outputs);
+    bytes = outputs.m_Irradiance.m_DataSize + outputs.m_BRDFLut.m_DataSize;
+    for (int mip = 0; mip < outputs.m_PrefilterMipmapCount; ++mip)
+    {
+        bytes += outputs.m_Prefilter[mip].m_DataSize;
+    }
+    pbr_outputs_free(&outputs);
+    BENCH_END();
+
+    add_result("bake", input, width, params.m_PrefilterSize, params.m_PrefilterSampleCount, best_seconds, 0, 0, bytes);
+    pbr_context_destroy(context);
+}
+
+static bool parse_arguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--output") == 0 && has_value)
+        {
+            g_params.m_PathOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+        {
+            g_params.m_ThreadCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-input-size") == 0 && has_value)
+        {
+            g_params.m_MaxInputSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && has_value)
+        {
+            g_params.m_Repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--quick") == 0)
+        {
+            g_params.m_Quick = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return g_params.m_ThreadCount >= 0 && g_params.m_Repeat > 0 && g_params.m_MaxInputSize >= INPUT_SIZES[0];
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parse_arguments(argc, argv))
+    {
+        printf("Usage: pbr-bench [--output <file.json>] [--threads <n>] [--max-input-size <n>] [--repeat <n>] [--quick]\n");
+        printf("  --output         : Write the results to a file instead of stdout\n");
+        printf("  --threads        : Number of threads including the main thread, 0 is one per hardware thread (default)\n");
+        printf("  --max-input-size : Largest procedural input width, %d to %d (default %d)\n",
+            INPUT_SIZES[0], INPUT_SIZES[ARRAY_COUNT(INPUT_SIZES) - 1], g_params.m_MaxInputSize);
+        printf("  --repeat         : Run every case n times and report the fastest (default 1)\n");
+        printf("  --quick          : Only the smallest size and sample count of every sweep\n");
+        return -1;
+    }
+
+    char scratch_path[256];
+#if defined(_WIN32)
+    snprintf(scratch_path, sizeof(scratch_path), "pbr_bench_%d.buffer", _getpid());
+#else
+    snprintf(scratch_path, sizeof(scratch_path), "pbr_bench_%d.buffer", (int) getpid());
+#endif
+    g_params.m_PathScratch = scratch_path;
+
+    job_system* jobs      = job_system_create(g_params.m_ThreadCount);
+    uint32_t thread_count = job_system_thread_count(jobs);
+    fprintf(stderr, "pbr-bench: %u threads\n", thread_count);
+
+    // The input independent stages run first, on the smallest sky
+    {
+        int width     = INPUT_SIZES[0];
+        float* pixels = generate_input(jobs, INPUT_SKY, width, width / 2);
+        bench_brdf_lut(jobs);
+        bench_output(pixels, width, width / 2);
+        free(pixels);
+    }
+
+    for (int kind = 0; kind < INPUT_COUNT; ++kind)
+    {
+        for (int i = 0; i < ARRAY_COUNT(INPUT_SIZES) && INPUT_SIZES[i] <= g_params.m_MaxInputSize; ++i)
+        {
+            int width  = INPUT_SIZES[i];
+            int height = width / 2;
+
+            reset_peak_memory();
+            double start  = time_now();
+            float* pixels = generate_input(jobs, kind, width, height);
+            if (!pixels)
+            {
+                fprintf(stderr, "Unable to allocate a %dx%d input\n", width, height);
+                break;
+            }
+            uint64_t texels = (uint64_t) width * height;
+            add_result("generate_input", INPUT_NAMES[kind], width, width, 0, time_now() - start, texels, texels, texels * 4 * sizeof(float));
+
+            bench_environment(jobs, INPUT_NAMES[kind], pixels, width, height);
+            bench_irradiance(INPUT_NAMES[kind], pixels, width, height);
+
+            // The prefilter only sees the environment cube, one input size is enough
+            if (i == 0)
+            {
+                bench_prefilter(jobs, INPUT_NAMES[kind], pixels, width, height);
+            }
+
+            if (i == 0 && kind == INPUT_SKY && !g_params.m_Quick)
+            {
+                bench_bake(INPUT_NAMES[kind], pixels, width, height);
+            }
+
+            free(pixels);
+        }
+    }
+
+    job_system_destroy(jobs);
+
+    bool result;
+    if (g_params.m_PathOutput)
+    {
+        FILE* f = fopen(g_params.m_PathOutput, "wb");
+        result  = f && write_results(f, thread_count);
+        if (f)
+        {
+            fclose(f);
+        }
+        fprintf(stderr, "%s %s\n", result ? "Wrote results to" : "Unable to write results to", g_params.m_PathOutput);
+    }
+    else
+    {
+        result = write_results(stdout, thread_count);
+    }
+
+    free(g_results);
+    return result ? 0 : -1;
+}
@@ -0,0 +1,304 @@
+// Checks that radiance_decode_rgbe_parallel and the indexed stream reads are bit-identical to the
+// sequential radiance_decode_rgbe, on procedural RGBE files with RLE scanlines, flat scanlines and
+// files that switch from RLE to flat part of the way down.
+// Usage: radiance-hdr-test, exits with a non-zero code on the first mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radiance_hdr.h"
+#include "job_system.h"
+
+static const char* TEST_FILE_PATH = "radiance_hdr_test.tmp.hdr";
+
+typedef struct
+{
+    const char* m_Name;
+    int         m_Width;
+    int         m_Height;
+    int         m_FlatRow; // scanlines from here on are written flat
+} test_case;
+
+static const test_case TEST_CASES[] = {
+    { "rle",              1000, 300, 300 },
+    { "rle, flat at 77",  1000, 300, 77 },
+    { "rle, flat at 32",  513,  100, 32 },  // on a job boundary
+    { "rle, flat at 299", 1000, 300, 299 },
+    { "flat",             640,  90,  0 },
+    { "narrow",           7,    50,  0 },   // too narrow for RLE
+    { "wide",             32768, 3,  0 },   // too wide for RLE
+    { "single row",       256,  1,   1 },
+};
+
+static uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// A bright sun on a sky gradient with noisy ground, plus black and flat bands so that the
+// RLE encoder emits both runs and literals
+static void generate_rgbe(int width, int height, uint8_t* rgbe_out)
+{
+    float* rgba = (float*) malloc((size_t) width * 4 * sizeof(float));
+    for (int y = 0; y < height; ++y)
+    {
+        float v = (y + 0.5f) / height;
+        for (int x = 0; x < width; ++x)
+        {
+            float u    = (x + 0.5f) / width;
+            float* out = rgba + x * 4;
+            if (v < 0.5f)
+            {
+                float du = u - 0.3f;
+                float dv = v - 0.2f;
+                float sun = du * du + dv * dv < 0.001f ? 20000.0f : 0.0f;
+                out[0] = 0.3f + v + sun;
+                out[1] = 0.5f + v + sun;
+                out[2] = 1.0f + sun;
+            }
+            else if ((x / 37) % 3 == 0)
+            {
+                out[0] = out[1] = out[2] = (y / 11) % 2 ? 0.0f : 0.25f;
+            }
+            else
+            {
+                uint32_t h = hash_u32(y * 65521 + x);
+                out[0] = (h & 0xFF) / 64.0f;
+                out[1] = ((h >> 8) & 0xFF) / 512.0f;
+                out[2] = ((h >> 16) & 0xFF) * 1e-4f;
+            }
+            out[3] = 1.0f;
+        }
+        radiance_float_to_rgbe(rgba, width, rgbe_out + (size_t) y * width * 4);
+    }
+    free(rgba);
+}
+
+static uint8_t* append(uint8_t* write_ptr, const void* data, uint32_t data_size)
+{
+    memcpy(write_ptr, data, data_size);
+    return write_ptr + data_size;
+}
+
+// Runs of 4 or more are packed, everything else goes into literals of at most 128 bytes
+static uint8_t* write_scanline_rle(uint8_t* write_ptr, const uint8_t* row, int width)
+{
+    uint8_t start[4] = { 2, 2, (uint8_t) (width >> 8), (uint8_t) (width & 0xFF) };
+    write_ptr = append(write_ptr, start, 4);
+
+    for (int c = 0; c < 4; ++c)
+    {
+        int x = 0;
+        while (x < width)
+        {
+            int run = 1;
+            while (x + run < width && run < 127 && row[(x + run) * 4 + c] == row[x * 4 + c])
+            {
+                run++;
+            }
+
+            if (run >= 4)
+            {
+                *write_ptr++ = (uint8_t) (128 + run);
+                *write_ptr++ = row[x * 4 + c];
+                x += run;
+                continue;
+            }
+
+            int literal = 0;
+            while (x + literal < width && literal < 128)
+            {
+                int next = x + literal;
+                if (next + 3 < width && row[next * 4 + c] == row[(next + 1) * 4 + c] &&
+                    row[next * 4 + c] == row[(next + 2) * 4 + c] && row[next * 4 + c] == row[(next + 3) * 4 + c])
+                {
+                    break;
+                }
+                literal++;
+            }
+
+            *write_ptr++ = (uint8_t) literal;
+            for (int i = 0; i < literal; ++i)
+            {
+                *write_ptr++ = row[(x + i) * 4 + c];
+            }
+            x += literal;
+        }
+    }
+    return write_ptr;
+}
+
+static uint8_t* write_file_data(const test_case* test, uint8_t* pixels, uint32_t* data_size_out)
+{
+    int width       = test->m_Width;
+    size_t row_size = (size_t) width * 4;
+
+    // Worst case of the RLE scanlines is a literal header for every 128 bytes
+    uint8_t* data      = (uint8_t*) malloc(256 + test->m_Height * (4 + row_size + row_size / 128 + 4));
+    uint8_t* write_ptr = data;
+
+    char header[256];
+    int header_size = snprintf(header, sizeof(header), "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", test->m_Height, width);
+    write_ptr       = append(write_ptr, header, header_size);
+
+    for (int y = 0; y < test->m_Height; ++y)
+    {
+        uint8_t* row = pixels + y * row_size;
+        if (y < test->m_FlatRow)
+        {
+            write_ptr = write_scanline_rle(write_ptr, row, width);
+            continue;
+        }
+
+        // A flat scanline that looks like the start of an RLE one would be read as RLE by any decoder
+        if (y == test->m_FlatRow && row[0] == 2 && row[1] == 2 && (row[2] & 0x80) == 0)
+        {
+            row[0] = 3;
+        }
+        write_ptr = append(write_ptr, row, (uint32_t) row_size);
+    }
+
+    *data_size_out = (uint32_t) (write_ptr - data);
+    return data;
+}
+
+static bool expect_equal(const test_case* test, const char* what, const uint8_t* result, const uint8_t* expected, size_t size)
+{
+    if (memcmp(result, expected, size) == 0)
+    {
+        return true;
+    }
+
+    size_t i = 0;
+    while (result[i] == expected[i])
+    {
+        i++;
+    }
+    printf("%s: %s differs from radiance_decode_rgbe at pixel %d,%d\n", test->m_Name, what,
+        (int) (i / 4 % test->m_Width), (int) (i / 4 / test->m_Width));
+    return false;
+}
+
+static bool test_stream(const test_case* test, const uint8_t* data, uint32_t data_size, const uint8_t* expected)
+{
+    FILE* f = fopen(TEST_FILE_PATH, "wb");
+    if (!f || fwrite(data, 1, data_size, f) != data_size)
+    {
+        printf("%s: unable to write %s\n", test->m_Name, TEST_FILE_PATH);
+        if (f) fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    size_t row_size  = (size_t) test->m_Width * 4;
+    uint8_t* pixels  = (uint8_t*) calloc(test->m_Height, row_size);
+    radiance_header header;
+    bool result      = true;
+
+    // Sequential bands of an odd size
+    radiance_stream* stream = radiance_stream_open(TEST_FILE_PATH, &header);
+    int row                 = 0;
+    int rows_read           = 0;
+    while (stream && (rows_read = radiance_stream_read(stream, 7, pixels + row * row_size)) > 0)
+    {
+        row += rows_read;
+    }
+    if (!stream || rows_read < 0 || row != test->m_Height)
+    {
+        printf("%s: radiance_stream_read failed\n", test->m_Name);
+        result = false;
+    }
+    result = result && expect_equal(test, "radiance_stream_read", pixels, expected, test->m_Height * row_size);
+    if (stream) radiance_stream_close(stream);
+
+    // Indexed ranges, back to front so nothing depends on the previous read
+    memset(pixels, 0, test->m_Height * row_size);
+    stream = radiance_stream_open(TEST_FILE_PATH, &header);
+    if (!stream || !radiance_stream_build_index(stream))
+    {
+        printf("%s: radiance_stream_build_index failed\n", test->m_Name);
+        result = false;
+    }
+    for (int end = test->m_Height; result && end > 0;)
+    {
+        int count = end < 13 ? end : 13;
+        if (!radiance_stream_read_rows(stream, end - count, count, pixels + (end - count) * row_size))
+        {
+            printf("%s: radiance_stream_read_rows failed at row %d\n", test->m_Name, end - count);
+            result = false;
+        }
+        end -= count;
+    }
+    result = result && expect_equal(test, "radiance_stream_read_rows", pixels, expected, test->m_Height * row_size);
+    if (stream) radiance_stream_close(stream);
+
+    free(pixels);
+    remove(TEST_FILE_PATH);
+    return result;
+}
+
+static bool run_test(job_system* jobs, const test_case* test)
+{
+    size_t pixels_size = (size_t) test->m_Width * test->m_Height * 4;
+    uint8_t* source    = (uint8_t*) malloc(pixels_size);
+    generate_rgbe(test->m_Width, test->m_Height, source);
+
+    uint32_t data_size = 0;
+    uint8_t* data      = write_file_data(test, source, &data_size);
+    uint8_t* expected  = (uint8_t*) malloc(pixels_size);
+    uint8_t* parallel  = (uint8_t*) calloc(1, pixels_size);
+
+    radiance_header header;
+    bool result = radiance_read_header(data, data_size, &header) && header.m_Width == test->m_Width && header.m_Height == test->m_Height;
+    if (!result)
+    {
+        printf("%s: radiance_read_header failed\n", test->m_Name);
+    }
+    else if (!radiance_decode_rgbe(data, data_size, &header, expected) || memcmp(expected, source, pixels_size) != 0)
+    {
+        printf("%s: radiance_decode_rgbe doesn't return the encoded pixels\n", test->m_Name);
+        result = false;
+    }
+    else if (!radiance_decode_rgbe_parallel(jobs, data, data_size, &header, parallel))
+    {
+        printf("%s: radiance_decode_rgbe_parallel failed\n", test->m_Name);
+        result = false;
+    }
+    else
+    {
+        result = expect_equal(test, "radiance_decode_rgbe_parallel", parallel, expected, pixels_size) &&
+                 test_stream(test, data, data_size, expected);
+    }
+
+    free(source);
+    free(data);
+    free(expected);
+    free(parallel);
+    return result;
+}
+
+int main()
+{
+    // More threads than jobs in some files, fewer in others
+    job_system* jobs = job_system_create(4);
+
+    int result = 0;
+    for (uint32_t i = 0; i < sizeof(TEST_CASES) / sizeof(TEST_CASES[0]); ++i)
+    {
+        if (!run_test(jobs, &TEST_CASES[i]))
+        {
+            result = -1;
+            break;
+        }
+        printf("%s (%dx%d): decodes match\n", TEST_CASES[i].m_Name, TEST_CASES[i].m_Width, TEST_CASES[i].m_Height);
+    }
+
+    job_system_destroy(jobs);
+    return result;
+}